@@ -0,0 +1,148 @@
+/**
+ * @file arena.hpp
+ * @brief Growable float buffer that does not move when it grows.
+ *
+ * An ArenaBuffer reserves a large range of virtual address space on first
+ * use and commits pages from the front of it as capacity is requested, so
+ * growth neither copies nor invalidates pointers into the buffer. Only
+ * address space is reserved up front; physical memory is used as pages
+ * are touched. The reservation defaults to 64 GiB per buffer and can be
+ * set with TFORMER_ARENA_RESERVE_GB. Outgrowing it, or running where
+ * address space cannot be reserved, falls back to reallocating and copying.
+ *
+ * An ArenaPolicy controls alignment, huge pages and NUMA placement. The
+ * default policy comes from the environment:
+ *   TFORMER_HUGE_PAGES = none | transparent | explicit
+ *   TFORMER_NUMA       = first-touch | interleave | <node id>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @enum HugePages
+ * @brief Page size an arena asks for.
+ */
+enum class HugePages {
+  None,         ///< Base pages
+  Transparent,  ///< madvise(MADV_HUGEPAGE): the kernel promotes to 2 MB
+  Explicit      ///< MAP_HUGETLB 2 MB pages from the hugetlb pool
+};
+
+/**
+ * @enum NumaPlacement
+ * @brief Which NUMA node an arena's pages come from.
+ */
+enum class NumaPlacement {
+  FirstTouch,  ///< Node of the thread that first writes each page
+  Bind,        ///< Always ArenaPolicy::numa_node
+  Interleave   ///< Round-robin over all nodes
+};
+
+/**
+ * @struct ArenaPolicy
+ * @brief How an ArenaBuffer allocates. Huge pages and NUMA placement are
+ * best effort: where the system refuses, the buffer falls back to base
+ * pages and first touch, and ArenaStats records what it got.
+ */
+struct ArenaPolicy {
+  size_t alignment = 64;  ///< Byte alignment of the start, a power of two
+  HugePages huge_pages = HugePages::None;          ///< Page size
+  NumaPlacement numa = NumaPlacement::FirstTouch;  ///< Node placement
+  int numa_node = 0;                               ///< Node for Bind
+
+  /**
+   * @brief Policy described by TFORMER_HUGE_PAGES and TFORMER_NUMA.
+   * @return Defaults for unset or unrecognized variables
+   */
+  static ArenaPolicy from_env();
+};
+
+/**
+ * @struct ArenaStats
+ * @brief What an ArenaBuffer has committed so far.
+ */
+struct ArenaStats {
+  size_t commit_calls = 0;      ///< Times more of the buffer was committed
+  size_t committed_bytes = 0;   ///< Usable bytes
+  size_t huge_page_bytes = 0;   ///< Bytes on explicit or advised huge pages
+  size_t numa_bound_bytes = 0;  ///< Bytes with a Bind/Interleave policy set
+  bool mapped = false;          ///< Grows in place (see ArenaBuffer::mapped)
+};
+
+/**
+ * @class ArenaBuffer
+ * @brief Float storage whose committed prefix grows in place.
+ */
+class ArenaBuffer {
+ public:
+  /// Buffer using ArenaPolicy::from_env().
+  ArenaBuffer();
+
+  /**
+   * @brief Buffer with an explicit policy.
+   * @param policy Alignment, page size and NUMA placement
+   */
+  explicit ArenaBuffer(const ArenaPolicy& policy);
+  ~ArenaBuffer();
+  ArenaBuffer(ArenaBuffer&& other) noexcept;
+  ArenaBuffer& operator=(ArenaBuffer&& other) noexcept;
+  ArenaBuffer(const ArenaBuffer&) = delete;
+  ArenaBuffer& operator=(const ArenaBuffer&) = delete;
+
+  /**
+   * @brief Make at least required elements usable.
+   *
+   * Commits more of the reservation when it fits; otherwise moves to a new,
+   * larger allocation and copies the first used elements across.
+   * @param required Minimum capacity in elements
+   * @param used Elements to preserve if the buffer has to move
+   * @return True if the buffer moved
+   */
+  bool grow(size_t required, size_t used);
+
+  /**
+   * @brief First element, or nullptr before the first grow().
+   * @return Buffer start, aligned to the policy's alignment
+   */
+  float* data() const { return data_; }
+
+  /**
+   * @brief Usable elements.
+   * @return Committed capacity
+   */
+  size_t capacity() const { return committed_; }
+
+  /**
+   * @brief Whether the buffer lives in a reserved address range, so growth
+   * up to the reservation keeps it in place.
+   * @return False on the reallocating fallback
+   */
+  bool mapped() const { return reserved_ != 0; }
+
+  /**
+   * @brief Policy the buffer was created with.
+   * @return Requested policy
+   */
+  const ArenaPolicy& policy() const { return policy_; }
+
+  /**
+   * @brief Commit counters and what the policy achieved.
+   * @return Current stats
+   */
+  const ArenaStats& stats() const { return stats_; }
+
+ private:
+  void release();
+  bool reserve(size_t count);
+  void commit(size_t from, size_t to);
+  size_t granule() const;
+
+  ArenaPolicy policy_;
+  HugePages pages_ = HugePages::None;  ///< Page size still being attempted
+  float* data_ = nullptr;
+  size_t committed_ = 0;  ///< Usable elements
+  size_t reserved_ = 0;   ///< Elements of address space, 0 if heap backed
+  ArenaStats stats_;
+};
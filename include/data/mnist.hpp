@@ -1,19 +1,21 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <utility>
 #include <vector>
 
-typedef std::vector<float> MNIST_IN;
-typedef float MNIST_OUT;
+// Raw 0..255 pixels and class labels, stored at their natural width.
+typedef std::vector<uint8_t> MNIST_IN;
+typedef int32_t MNIST_OUT;
 typedef std::vector<MNIST_IN> MNIST_INS;
 typedef std::vector<MNIST_OUT> MNIST_OUTS;
 typedef std::pair<MNIST_INS, MNIST_OUTS> MNIST_BATCH;
 struct MnistDataset {
-  std::vector<std::vector<float>> train_data;
-  std::vector<float> train_labels;
-  std::vector<std::vector<float>> test_data;
-  std::vector<float> test_labels;
+  MNIST_INS train_data;
+  MNIST_OUTS train_labels;
+  MNIST_INS test_data;
+  MNIST_OUTS test_labels;
 };
 
 struct MNIST {
@@ -5,6 +5,8 @@
 #include <utility>
 #include <vector>
 
+#include "tensor.hpp"
+
 using IntSequenceBatch = std::vector<std::vector<int>>;
 using FloatSequenceBatch = std::vector<std::vector<float>>;
 using Batch = std::pair<IntSequenceBatch, IntSequenceBatch>;
@@ -24,4 +26,21 @@ struct Sampler {
         val_data(val_data) {}
 
   void sample(Batch& batch, bool is_train = true);
+
+  /**
+   * @brief Write the same windows as sample(Batch&) into int32 tensors.
+   *
+   * Reuses the caller's tensors, so a training loop keeps token ids in the
+   * arena and can feed them straight to embedding() and
+   * softmax_cross_entropy() without building nested vectors.
+   * @param inputs Int32 tensor [batch_size, block_size]
+   * @param targets Int32 tensor [batch_size, block_size], inputs shifted by
+   * one token
+   * @param is_train Sample from train_data rather than val_data
+   * @throws std::invalid_argument on a wrong shape or dtype
+   */
+  void sample(Tensor& inputs, Tensor& targets, bool is_train = true);
+
+ private:
+  size_t window_start(const std::vector<int>& data, uint32_t i) const;
 };
@@ -0,0 +1,491 @@
+/**
+ * @file expr.hpp
+ * @brief Compile-time expression templates for fused elementwise math.
+ *
+ * Arithmetic on expr::ref() handles builds a typed expression tree instead
+ * of computing anything:
+ *
+ * @code
+ * const auto p = expr::ref(predicted), y = expr::ref(expected);
+ * Tensor loss = expr::mean((p - y) * (p - y), store);
+ * @endcode
+ *
+ * eval(), sum() and mean() then run the whole tree as one loop over the
+ * elements into a single output, with no intermediate tensors or tape
+ * records. The backward pass is derived from the same type: one more loop
+ * applies the chain rule through the tree at each element and accumulates
+ * into every input's gradient. The result is recorded as one OpType::Custom
+ * op with a forward callback, so captured graphs replay it too.
+ *
+ * Every tensor input must have the same shape; there is no broadcasting
+ * apart from float constants. An expression may read at most three distinct
+ * tensors (the a, b and c slots of its tape record), each any number of
+ * times.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+#include "tensor.hpp"
+
+namespace expr {
+
+/**
+ * @brief Pointers and constants an expression's loop reads.
+ *
+ * Leaf and constant nodes are numbered left to right; node L reads x[L]
+ * and accumulates into g[L] (nullptr if it takes no gradient).
+ */
+template <size_t Leaves, size_t Consts>
+struct Frame {
+  const float* x[Leaves];
+  float* g[Leaves];
+  float c[Consts > 0 ? Consts : 1];
+};
+
+/**
+ * @brief CRTP base of every expression node.
+ *
+ * Nodes are small values holding their operands; static value() and grad()
+ * evaluate element i given a Frame, with L and C the numbers of leaf and
+ * constant nodes to the node's left.
+ */
+template <typename E>
+struct Expr {
+  const E& self() const { return static_cast<const E&>(*this); }
+};
+
+/// A tensor input.
+struct Leaf : Expr<Leaf> {
+  static constexpr size_t kLeaves = 1;
+  static constexpr size_t kConsts = 0;
+
+  explicit Leaf(const Tensor& t) : tensor(t) {}
+
+  template <typename V>
+  void visit(V& visitor) const {
+    visitor.leaf(tensor);
+  }
+
+  template <size_t L, size_t C, typename F>
+  static float value(const F& f, size_t i) {
+    return f.x[L][i];
+  }
+
+  template <size_t L, size_t C, typename F>
+  static void grad(const F& f, size_t i, float g) {
+    if (f.g[L]) f.g[L][i] += g;
+  }
+
+  Tensor tensor;
+};
+
+/// A float constant, broadcast to every element.
+struct Const : Expr<Const> {
+  static constexpr size_t kLeaves = 0;
+  static constexpr size_t kConsts = 1;
+
+  explicit Const(float v) : v(v) {}
+
+  template <typename V>
+  void visit(V& visitor) const {
+    visitor.constant(v);
+  }
+
+  template <size_t L, size_t C, typename F>
+  static float value(const F& f, size_t) {
+    return f.c[C];
+  }
+
+  template <size_t L, size_t C, typename F>
+  static void grad(const F&, size_t, float) {}
+
+  float v;
+};
+
+/// Op(a) for a unary Op with apply(x) and derivative(x, y = apply(x)).
+template <typename Op, typename A>
+struct Unary : Expr<Unary<Op, A>> {
+  static constexpr size_t kLeaves = A::kLeaves;
+  static constexpr size_t kConsts = A::kConsts;
+
+  explicit Unary(const A& a) : a(a) {}
+
+  template <typename V>
+  void visit(V& visitor) const {
+    a.visit(visitor);
+  }
+
+  template <size_t L, size_t C, typename F>
+  static float value(const F& f, size_t i) {
+    return Op::apply(A::template value<L, C>(f, i));
+  }
+
+  template <size_t L, size_t C, typename F>
+  static void grad(const F& f, size_t i, float g) {
+    const float x = A::template value<L, C>(f, i);
+    A::template grad<L, C>(f, i, g * Op::derivative(x, Op::apply(x)));
+  }
+
+  A a;
+};
+
+/// Op(a, b) for a binary Op with apply(x, y), da(x, y) and db(x, y).
+template <typename Op, typename A, typename B>
+struct Binary : Expr<Binary<Op, A, B>> {
+  static constexpr size_t kLeaves = A::kLeaves + B::kLeaves;
+  static constexpr size_t kConsts = A::kConsts + B::kConsts;
+
+  Binary(const A& a, const B& b) : a(a), b(b) {}
+
+  template <typename V>
+  void visit(V& visitor) const {
+    a.visit(visitor);
+    b.visit(visitor);
+  }
+
+  template <size_t L, size_t C, typename F>
+  static float value(const F& f, size_t i) {
+    return Op::apply(A::template value<L, C>(f, i),
+                     B::template value<L + A::kLeaves, C + A::kConsts>(f, i));
+  }
+
+  template <size_t L, size_t C, typename F>
+  static void grad(const F& f, size_t i, float g) {
+    constexpr size_t LB = L + A::kLeaves, CB = C + A::kConsts;
+    const float x = A::template value<L, C>(f, i);
+    const float y = B::template value<LB, CB>(f, i);
+    A::template grad<L, C>(f, i, g * Op::da(x, y));
+    B::template grad<LB, CB>(f, i, g * Op::db(x, y));
+  }
+
+  A a;
+  B b;
+};
+
+/// Elementwise operations nodes apply.
+namespace ops {
+
+struct Add {
+  static float apply(float x, float y) { return x + y; }
+  static float da(float, float) { return 1.0f; }
+  static float db(float, float) { return 1.0f; }
+};
+
+struct Sub {
+  static float apply(float x, float y) { return x - y; }
+  static float da(float, float) { return 1.0f; }
+  static float db(float, float) { return -1.0f; }
+};
+
+struct Mul {
+  static float apply(float x, float y) { return x * y; }
+  static float da(float, float y) { return y; }
+  static float db(float x, float) { return x; }
+};
+
+struct Div {
+  static float apply(float x, float y) { return x / y; }
+  static float da(float, float y) { return 1.0f / y; }
+  static float db(float x, float y) { return -x / (y * y); }
+};
+
+struct Neg {
+  static float apply(float x) { return -x; }
+  static float derivative(float, float) { return -1.0f; }
+};
+
+struct Square {
+  static float apply(float x) { return x * x; }
+  static float derivative(float x, float) { return 2.0f * x; }
+};
+
+struct Relu {
+  static float apply(float x) { return x > 0.0f ? x : 0.0f; }
+  static float derivative(float x, float) { return x > 0.0f ? 1.0f : 0.0f; }
+};
+
+struct Tanh {
+  static float apply(float x) { return std::tanh(x); }
+  static float derivative(float, float y) { return 1.0f - y * y; }
+};
+
+struct Sigmoid {
+  static float apply(float x) { return 1.0f / (1.0f + std::exp(-x)); }
+  static float derivative(float, float y) { return y * (1.0f - y); }
+};
+
+struct Exp {
+  static float apply(float x) { return std::exp(x); }
+  static float derivative(float, float y) { return y; }
+};
+
+struct Log {
+  static float apply(float x) { return std::log(x); }
+  static float derivative(float x, float) { return 1.0f / x; }
+};
+
+}  // namespace ops
+
+/**
+ * @brief Wrap a tensor for use in an expression.
+ * @param t Input tensor; any layout, copied densely if strided
+ * @return Leaf node
+ */
+inline Leaf ref(const Tensor& t) { return Leaf(t); }
+
+/// @name Operators
+/// Operands may be expressions or floats.
+/// @{
+template <typename A, typename B>
+Binary<ops::Add, A, B> operator+(const Expr<A>& a, const Expr<B>& b) {
+  return {a.self(), b.self()};
+}
+template <typename A>
+Binary<ops::Add, A, Const> operator+(const Expr<A>& a, float b) {
+  return {a.self(), Const(b)};
+}
+template <typename B>
+Binary<ops::Add, Const, B> operator+(float a, const Expr<B>& b) {
+  return {Const(a), b.self()};
+}
+
+template <typename A, typename B>
+Binary<ops::Sub, A, B> operator-(const Expr<A>& a, const Expr<B>& b) {
+  return {a.self(), b.self()};
+}
+template <typename A>
+Binary<ops::Sub, A, Const> operator-(const Expr<A>& a, float b) {
+  return {a.self(), Const(b)};
+}
+template <typename B>
+Binary<ops::Sub, Const, B> operator-(float a, const Expr<B>& b) {
+  return {Const(a), b.self()};
+}
+
+template <typename A, typename B>
+Binary<ops::Mul, A, B> operator*(const Expr<A>& a, const Expr<B>& b) {
+  return {a.self(), b.self()};
+}
+template <typename A>
+Binary<ops::Mul, A, Const> operator*(const Expr<A>& a, float b) {
+  return {a.self(), Const(b)};
+}
+template <typename B>
+Binary<ops::Mul, Const, B> operator*(float a, const Expr<B>& b) {
+  return {Const(a), b.self()};
+}
+
+template <typename A, typename B>
+Binary<ops::Div, A, B> operator/(const Expr<A>& a, const Expr<B>& b) {
+  return {a.self(), b.self()};
+}
+template <typename A>
+Binary<ops::Div, A, Const> operator/(const Expr<A>& a, float b) {
+  return {a.self(), Const(b)};
+}
+template <typename B>
+Binary<ops::Div, Const, B> operator/(float a, const Expr<B>& b) {
+  return {Const(a), b.self()};
+}
+
+template <typename A>
+Unary<ops::Neg, A> operator-(const Expr<A>& a) {
+  return Unary<ops::Neg, A>(a.self());
+}
+/// @}
+
+/// @name Functions
+/// @{
+template <typename A>
+Unary<ops::Square, A> square(const Expr<A>& a) {
+  return Unary<ops::Square, A>(a.self());
+}
+template <typename A>
+Unary<ops::Relu, A> relu(const Expr<A>& a) {
+  return Unary<ops::Relu, A>(a.self());
+}
+template <typename A>
+Unary<ops::Tanh, A> tanh(const Expr<A>& a) {
+  return Unary<ops::Tanh, A>(a.self());
+}
+template <typename A>
+Unary<ops::Sigmoid, A> sigmoid(const Expr<A>& a) {
+  return Unary<ops::Sigmoid, A>(a.self());
+}
+template <typename A>
+Unary<ops::Exp, A> exp(const Expr<A>& a) {
+  return Unary<ops::Exp, A>(a.self());
+}
+template <typename A>
+Unary<ops::Log, A> log(const Expr<A>& a) {
+  return Unary<ops::Log, A>(a.self());
+}
+/// @}
+
+namespace detail {
+
+/// What an evaluated expression writes: every element, or one reduction.
+enum class Reduce { None, Sum, Mean };
+
+constexpr size_t kMaxInputs = 3;
+
+// The record keeps, right after op.out's data, which input slot each leaf
+// node reads and the value of each constant node, so the op can be rerun
+// from the record alone.
+template <typename E>
+constexpr size_t kParams = E::kLeaves + E::kConsts;
+
+// Collects leaf tensors and constants in node order.
+template <typename E>
+struct Collector {
+  const Tensor* leaves[E::kLeaves];
+  float consts[E::kConsts > 0 ? E::kConsts : 1];
+  size_t num_leaves = 0;
+  size_t num_consts = 0;
+
+  void leaf(const Tensor& t) { leaves[num_leaves++] = &t; }
+  void constant(float v) { consts[num_consts++] = v; }
+};
+
+template <typename E>
+Frame<E::kLeaves, E::kConsts> bind(const TapeOp& op) {
+  ParameterStore& store = *op.out.store;
+  const float* params = store.data_ptr(op.out.offset + op.out.numel);
+  const Tensor* inputs[kMaxInputs] = {&op.a, &op.b, &op.c};
+  Frame<E::kLeaves, E::kConsts> f;
+  for (size_t k = 0; k < E::kLeaves; ++k) {
+    const Tensor& t = *inputs[static_cast<size_t>(params[k])];
+    f.x[k] = store.data_ptr(t.offset);
+    f.g[k] = t.requires_grad() ? store.grad_ptr(t.grad_offset) : nullptr;
+  }
+  for (size_t k = 0; k < E::kConsts; ++k) f.c[k] = params[E::kLeaves + k];
+  return f;
+}
+
+template <typename E, Reduce R>
+void forward(void*, const TapeOp& op) {
+  const auto f = bind<E>(op);
+  float* out = op.out.store->data_ptr(op.out.offset);
+  if (R == Reduce::None) {
+    for (size_t i = 0; i < op.out.numel; ++i)
+      out[i] = E::template value<0, 0>(f, i);
+    return;
+  }
+  const size_t n = op.a.numel;
+  float total = 0.0f;
+  for (size_t i = 0; i < n; ++i) total += E::template value<0, 0>(f, i);
+  out[0] = R == Reduce::Mean ? total / static_cast<float>(n) : total;
+}
+
+template <typename E, Reduce R>
+void backward(void*, const TapeOp& op, ParameterStore& store) {
+  const auto f = bind<E>(op);
+  const float* g = store.grad_ptr(op.out.grad_offset);
+  if (R == Reduce::None) {
+    for (size_t i = 0; i < op.out.numel; ++i)
+      E::template grad<0, 0>(f, i, g[i]);
+    return;
+  }
+  const size_t n = op.a.numel;
+  const float gi = R == Reduce::Mean ? g[0] / static_cast<float>(n) : g[0];
+  for (size_t i = 0; i < n; ++i) E::template grad<0, 0>(f, i, gi);
+}
+
+template <Reduce R, typename E>
+Tensor run(const Expr<E>& e, ParameterStore& store) {
+  static_assert(E::kLeaves > 0, "expression reads no tensor");
+  Collector<E> found;
+  e.self().visit(found);
+
+  // Distinct inputs go to the record's slots; params name each leaf's slot.
+  const Tensor* distinct[kMaxInputs] = {};
+  Tensor inputs[kMaxInputs];
+  size_t num_inputs = 0;
+  float params[kParams<E>];
+  const Shape& shape = found.leaves[0]->shape;
+  for (size_t k = 0; k < E::kLeaves; ++k) {
+    const Tensor& t = *found.leaves[k];
+    if (t.store != &store)
+      throw std::invalid_argument("expr input belongs to different store");
+    if (t.shape != shape)
+      throw std::invalid_argument("expr inputs must have the same shape");
+    size_t slot = 0;
+    while (slot < num_inputs &&
+           !(distinct[slot]->offset == t.offset &&
+             distinct[slot]->dtype == t.dtype &&
+             distinct[slot]->strides == t.strides))
+      ++slot;
+    if (slot == num_inputs) {
+      if (num_inputs == kMaxInputs)
+        throw std::invalid_argument("expr reads more than 3 tensors");
+      distinct[slot] = &t;
+      // Kernels read float32: bfloat16 leaves are widened by a cast.
+      inputs[slot] = t.dtype != DType::Float32 ? cast(t, DType::Float32, store)
+                     : t.is_contiguous()       ? t
+                                               : contiguous(t, store);
+      ++num_inputs;
+    }
+    params[k] = static_cast<float>(slot);
+  }
+  for (size_t k = 0; k < E::kConsts; ++k)
+    params[E::kLeaves + k] = found.consts[k];
+
+  const bool grad = store.grad_enabled() &&
+                    (inputs[0].requires_grad() || inputs[1].requires_grad() ||
+                     inputs[2].requires_grad());
+  const Shape out_shape = R == Reduce::None ? shape : Shape{1};
+  const size_t numel = R == Reduce::None ? inputs[0].numel : 1;
+  const Tensor block = store.tensor({static_cast<int>(numel + kParams<E>)},
+                                    TensorInit::UninitializedData, grad);
+  TapeOp op{OpType::Custom, Tensor(&store, block.offset, out_shape, numel),
+            inputs[0], inputs[1], nullptr, inputs[2]};
+  op.out.grad_offset = block.grad_offset;
+  op.backward = &backward<E, R>;
+  op.forward = &forward<E, R>;
+  float* stored = store.data_ptr(block.offset + numel);
+  for (size_t k = 0; k < kParams<E>; ++k) stored[k] = params[k];
+  forward<E, R>(nullptr, op);
+  store.record(op);
+  return op.out;
+}
+
+}  // namespace detail
+
+/**
+ * @brief Evaluate an expression elementwise in one fused loop.
+ * @param e Expression over same-shape tensors
+ * @param store ParameterStore for the output
+ * @return Tensor of the inputs' shape
+ */
+template <typename E>
+Tensor eval(const Expr<E>& e, ParameterStore& store) {
+  return detail::run<detail::Reduce::None>(e, store);
+}
+
+/**
+ * @brief Sum an expression over all elements in one fused loop.
+ * @param e Expression over same-shape tensors
+ * @param store ParameterStore for the output
+ * @return Scalar tensor [1]
+ */
+template <typename E>
+Tensor sum(const Expr<E>& e, ParameterStore& store) {
+  return detail::run<detail::Reduce::Sum>(e, store);
+}
+
+/**
+ * @brief Average an expression over all elements in one fused loop.
+ * @param e Expression over same-shape tensors
+ * @param store ParameterStore for the output
+ * @return Scalar tensor [1]
+ */
+template <typename E>
+Tensor mean(const Expr<E>& e, ParameterStore& store) {
+  return detail::run<detail::Reduce::Mean>(e, store);
+}
+
+}  // namespace expr
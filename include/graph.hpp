@@ -0,0 +1,129 @@
+/**
+ * @file graph.hpp
+ * @brief Capture one fixed-shape training step and replay it.
+ *
+ * A Graph runs a step (forward and loss) once while recording every op it
+ * issues, backpropagates it, and freezes both passes into flat op lists.
+ * Each op keeps the arena offsets it was given during capture, so a replay
+ * only runs kernels: no shape checks, allocation or tape recording. New
+ * inputs are passed by writing into the same tensors, label arrays and
+ * index arrays the step read while it was captured.
+ *
+ * optimize() rewrites a captured plan: repeated subexpressions are computed
+ * once, and chains of same-size elementwise ops run as one loop over
+ * cache-sized tiles in both passes.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "tensor.hpp"
+
+/**
+ * @class Graph
+ * @brief Frozen forward + backward plan of one training step.
+ *
+ * The arena range the capture allocated belongs to the graph: do not
+ * reset() the store below the end of it while the graph is in use.
+ */
+class Graph {
+ public:
+  /**
+   * @brief Create an empty graph over a store.
+   * @param store ParameterStore the step runs on
+   */
+  explicit Graph(ParameterStore& store) : store_(store) {}
+  ~Graph();
+  Graph(const Graph&) = delete;
+  Graph& operator=(const Graph&) = delete;
+
+  /**
+   * @brief Run step once while recording it, then backpropagate its loss.
+   *
+   * Clears the store's tape first. Gradients accumulate into parameters as
+   * with store.backward(), so this is also the first training step.
+   * @param step Callable returning the loss tensor
+   * @return The loss; replay() rewrites its value in place
+   */
+  template <typename F>
+  Tensor capture(F&& step) {
+    begin_capture();
+    return end_capture(step());
+  }
+
+  /**
+   * @brief Re-run the captured step on the current input contents.
+   *
+   * Recomputes every forward op, resets the step's intermediate gradients
+   * and runs the backward ops that reach the loss. Parameter gradients
+   * accumulate, so zero them first as for an ordinary step.
+   */
+  void replay();
+
+  /**
+   * @brief Remove duplicate ops and fuse elementwise chains in the plan.
+   *
+   * A forward op that repeats an earlier one on the same inputs is dropped
+   * and its readers use the earlier output. Runs of consecutive elementwise
+   * ops of one size (add, sub, mul, activations, log, and sum's backward)
+   * then execute tile by tile, each tile passing through the whole run
+   * while it is in cache; tiles run in parallel. After a replay, tensors of
+   * the step other than the loss may no longer hold its values.
+   */
+  void optimize();
+
+  /**
+   * @brief Whether capture() has completed.
+   * @return True once the graph can be replayed
+   */
+  bool captured() const { return loss_.store != nullptr; }
+
+  /**
+   * @brief Number of ops the forward plan runs.
+   * @return Forward op count
+   */
+  size_t forward_ops() const { return forward_.size(); }
+
+  /**
+   * @brief Number of ops the backward plan runs.
+   * @return Backward op count
+   */
+  size_t backward_ops() const { return backward_.size(); }
+
+  /**
+   * @brief Number of loops the forward plan runs; fused runs count once.
+   * @return Forward group count
+   */
+  size_t forward_groups() const { return forward_groups_.size(); }
+
+  /**
+   * @brief Number of loops the backward plan runs; fused runs count once.
+   * @return Backward group count
+   */
+  size_t backward_groups() const { return backward_groups_.size(); }
+
+ private:
+  /// Ops [begin, end) of a plan; with numel set they run tile by tile.
+  struct Group {
+    size_t begin = 0;
+    size_t end = 0;
+    size_t numel = 0;  ///< Elementwise size of a fused run, else 0
+  };
+
+  void begin_capture();
+  Tensor end_capture(const Tensor& loss);
+  void eliminate_common_subexpressions();
+  void run_backward_plan();
+
+  ParameterStore& store_;
+  Tape recorded_;                 ///< Capture target for every op
+  std::vector<TapeOp> forward_;   ///< Forward ops in issue order
+  std::vector<TapeOp> backward_;  ///< Live backward ops, in run order
+  std::vector<Group> forward_groups_;   ///< Partition of forward_
+  std::vector<Group> backward_groups_;  ///< Partition of backward_
+  Tensor loss_;                   ///< Loss produced by the step
+  StoreMark begin_;               ///< Arena positions before the step
+  StoreMark end_;                 ///< Arena positions after the step
+};
@@ -0,0 +1,254 @@
+/**
+ * @file kernels.hpp
+ * @brief Runtime-dispatched CPU kernels backing the tensor operations.
+ *
+ * Every op in tensor.cpp funnels its inner loops through a KernelTable. Tables
+ * exist for a portable scalar backend and, when compiled in, for AVX2,
+ * AVX-512, NEON and Apple Accelerate. The active table is chosen once at
+ * startup from CPU feature detection and can be overridden with the
+ * TFORMER_KERNEL_BACKEND environment variable or set_backend().
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace kernels {
+
+/**
+ * @brief Activation applied by the fused bias/activation kernels.
+ */
+enum class Activation { None, Relu, Tanh, Sigmoid };
+
+/**
+ * @brief Element type of a KernelTable::gemm_mixed operand.
+ */
+enum class Operand : uint8_t {
+  F32,   ///< float
+  BF16,  ///< bfloat16 bits (uint16_t)
+  U8     ///< unsigned bytes, read as the integers 0..255
+};
+
+// Helpers defined in this header have internal linkage: backends compiled
+// with ISA flags include it, and a shared inline copy built with AVX
+// encodings could otherwise be the one the linker keeps for every caller.
+// The kernel headers follow the same rule (see lib/core/kernels/math.hpp).
+
+/**
+ * @brief Widen a bfloat16 (the top half of a float32) to float.
+ * @param h bfloat16 bits
+ * @return The same value as a float
+ */
+static inline float bf16_to_float(uint16_t h) {
+  const uint32_t bits = static_cast<uint32_t>(h) << 16;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+/**
+ * @brief Round a float to the nearest bfloat16, ties to even.
+ * @param f Value to round; NaN stays a quiet NaN
+ * @return bfloat16 bits
+ */
+static inline uint16_t float_to_bf16(float f) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  if ((bits & 0x7fffffffu) > 0x7f800000u)
+    return static_cast<uint16_t>((bits >> 16) | 0x40u);
+  bits += 0x7fffu + ((bits >> 16) & 1u);
+  return static_cast<uint16_t>(bits >> 16);
+}
+
+/// Column padding of int8 weights packed by pack_s8().
+constexpr int kS8Columns = 32;
+
+/// Number of four-value K groups in int8 weights packed by pack_s8().
+static constexpr int s8_groups(int K) { return (K + 3) / 4; }
+
+/// Padded column count of int8 weights packed by pack_s8().
+static constexpr int s8_ld(int N) {
+  return (N + kS8Columns - 1) / kS8Columns * kS8Columns;
+}
+
+/**
+ * @brief Pack int8 weights for KernelTable::gemm_s8.
+ *
+ * Groups four K values per column, the order dot-product instructions
+ * read: value k of channel n lands at byte ((k / 4) * s8_ld(N) + n) * 4 +
+ * k % 4. Padding past K and N is zero. The layout is the same for every
+ * backend.
+ * @param W Weights [N, K], one output channel per row
+ * @param N Output channels
+ * @param K Input features
+ * @param packed s8_groups(K) * s8_ld(N) * 4 bytes
+ * @param sums N column sums, sum over k of W[n, k]
+ */
+void pack_s8(const int8_t* W, int N, int K, int8_t* packed, int32_t* sums);
+
+/**
+ * @struct KernelTable
+ * @brief Function table for one kernel backend.
+ *
+ * All pointers operate on contiguous float buffers. In-place variants
+ * accumulate into their destination, matching how backward passes add into
+ * gradient buffers.
+ */
+struct KernelTable {
+  const char* name;  ///< Backend identifier (e.g. "avx2")
+
+  /// out = a + b
+  void (*add)(const float* a, const float* b, float* out, size_t n);
+  /// out = a - b
+  void (*sub)(const float* a, const float* b, float* out, size_t n);
+  /// out = a * b
+  void (*mul)(const float* a, const float* b, float* out, size_t n);
+  /// dst += src
+  void (*add_inplace)(float* dst, const float* src, size_t n);
+  /// dst -= src
+  void (*sub_inplace)(float* dst, const float* src, size_t n);
+  /// dst += a * b
+  void (*mul_add_inplace)(float* dst, const float* a, const float* b,
+                          size_t n);
+  /// dst += v
+  void (*add_scalar_inplace)(float* dst, float v, size_t n);
+  /// dst *= v
+  void (*scale_inplace)(float* dst, float v, size_t n);
+  /// dst += alpha * x
+  void (*axpy)(float* dst, float alpha, const float* x, size_t n);
+
+  /// out = max(x, 0)
+  void (*relu)(const float* x, float* out, size_t n);
+  /// out = tanh(x)
+  void (*tanh)(const float* x, float* out, size_t n);
+  /// out = 1 / (1 + exp(-x))
+  void (*sigmoid)(const float* x, float* out, size_t n);
+  /// out = log(x)
+  void (*log)(const float* x, float* out, size_t n);
+  /// Returns sum of x
+  float (*sum)(const float* x, size_t n);
+  /// Returns sum of a * b
+  float (*dot)(const float* a, const float* b, size_t n);
+
+  /// gx += g * (x > 0)
+  void (*relu_backward)(const float* g, const float* x, float* gx, size_t n);
+  /// gx += g * (1 - y^2), y = tanh(x)
+  void (*tanh_backward)(const float* g, const float* y, float* gx, size_t n);
+  /// gx += g * y * (1 - y), y = sigmoid(x)
+  void (*sigmoid_backward)(const float* g, const float* y, float* gx,
+                           size_t n);
+  /// gx += g / x
+  void (*log_backward)(const float* g, const float* x, float* gx, size_t n);
+
+  /// Returns sum of max(x, 0) - x * y + log(1 + exp(-|x|)), the stable
+  /// binary cross-entropy of logits x against targets y
+  float (*bce_with_logits)(const float* x, const float* y, size_t n);
+  /// gx += scale * (sigmoid(x) - y)
+  void (*bce_with_logits_backward)(const float* x, const float* y,
+                                   float scale, float* gx, size_t n);
+  /// p = softmax(x); returns log(sum(exp(x))), computed max-shifted
+  float (*softmax)(const float* x, float* p, size_t n);
+  /// x = act(x + bias); bias may be null
+  void (*bias_act)(float* x, const float* bias, Activation act, size_t n);
+  /// g *= act'(z), given the activation output y = act(z)
+  void (*act_backward)(float* g, const float* y, Activation act, size_t n);
+
+  /**
+   * Row-major SGEMM: C = alpha * op(A) * op(B) + beta * C, where op(A) is
+   * [M,K] and op(B) is [K,N]. When beta is zero C is not read. Native
+   * backends pack and cache-block large problems and spread them over the
+   * parallel:: thread pool.
+   */
+  void (*sgemm)(bool trans_a, bool trans_b, int M, int N, int K, float alpha,
+                const float* A, int lda, const float* B, int ldb, float beta,
+                float* C, int ldc);
+
+  /**
+   * Batched SGEMM: C_i = alpha * op(A_i) * op(B_i) + beta * C_i for i in
+   * [0, batch), where A_i starts at A + i * stride_a (likewise B and C). A
+   * stride of 0 shares one matrix across the batch; a C stride of 0 adds
+   * every product into one C in order. Small matrices run whole on separate
+   * pool threads instead of each splitting across the pool.
+   */
+  void (*sgemm_batched)(bool trans_a, bool trans_b, int M, int N, int K,
+                        float alpha, const float* A, int lda, size_t stride_a,
+                        const float* B, int ldb, size_t stride_b, float beta,
+                        float* C, int ldc, size_t stride_c, int batch);
+
+  /**
+   * Fused linear layer: C = act(op(A) * op(B) + bias), with bias [N]
+   * broadcast over rows (may be null). C is not read. Packed backends apply
+   * the bias and activation to each register tile as soon as its last K
+   * slice is accumulated, while the tile is still in cache.
+   */
+  void (*sgemm_bias_act)(bool trans_a, bool trans_b, int M, int N, int K,
+                         const float* A, int lda, const float* B, int ldb,
+                         const float* bias, Activation act, float* C,
+                         int ldc);
+
+  /// out = x rounded to bfloat16, ties to even
+  void (*f32_to_bf16)(const float* x, uint16_t* out, size_t n);
+  /// out = x widened from bfloat16
+  void (*bf16_to_f32)(const uint16_t* x, float* out, size_t n);
+
+  /**
+   * Mixed-precision GEMM: C = act(alpha * op(A) * op(B) + beta * C + bias),
+   * where A and B hold elements of type a_type and b_type. Products
+   * accumulate in float32 C. Packed backends widen narrow operands while
+   * packing panels, so they are read once at their own width. The epilogue
+   * runs only when bias is set or act is not None.
+   */
+  void (*gemm_mixed)(bool trans_a, bool trans_b, int M, int N, int K,
+                     float alpha, const void* A, Operand a_type, int lda,
+                     const void* B, Operand b_type, int ldb, float beta,
+                     const float* bias, Activation act, float* C, int ldc);
+
+  /// q = round(x / scale) with scale = max|x| / 127, so q is in
+  /// [-127, 127]; returns scale (0 when x is all zero)
+  float (*quantize_s8)(const float* x, int8_t* q, size_t n);
+
+  /**
+   * Int8 linear layer: C[m,n] = act(a_scale[m] * b_scale[n] *
+   * sum_k A[m,k] * W[n,k] + bias[n]) (bias may be null). A [M,K] is
+   * quantized per row with lda >= 4 * s8_groups(K); W is quantized per
+   * output channel and packed by pack_s8() into B and b_sum. Values must
+   * lie in [-127, 127]; products accumulate exactly in int32. C is not
+   * read. Backends use VNNI (vpdpbusd) or NEON sdot when the CPU has it.
+   */
+  void (*gemm_s8)(int M, int N, int K, const int8_t* A, int lda,
+                  const float* a_scale, const int8_t* B, const int32_t* b_sum,
+                  const float* b_scale, const float* bias, Activation act,
+                  float* C, int ldc);
+};
+
+/**
+ * @brief Get the kernel table selected for this process.
+ * @return Active kernel table
+ */
+const KernelTable& active();
+
+/**
+ * @brief Look up a backend table without activating it.
+ * @param name Backend name as listed by available_backends()
+ * @return The table, or nullptr if unavailable on this machine
+ */
+const KernelTable* find_backend(const std::string& name);
+
+/**
+ * @brief Switch the active backend.
+ * @param name Backend name as listed by available_backends()
+ * @return True if the backend is compiled in and supported by this CPU
+ */
+bool set_backend(const std::string& name);
+
+/**
+ * @brief Names of backends usable on this machine, best first.
+ * @return Backend names
+ */
+std::vector<std::string> available_backends();
+
+}  // namespace kernels
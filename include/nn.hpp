@@ -56,14 +56,18 @@ struct Module {
  * @class Linear
  * @brief Fully connected linear layer.
  *
- * Performs affine transformation: y = xW^T + b (if bias enabled).
+ * Performs affine transformation: y = xW + b (if bias enabled) as one fused
+ * tape op.
  */
 struct Linear : public Module {
   int in_features;   ///< Number of input features
   int out_features;  ///< Number of output features
   bool use_bias;     ///< Whether to include bias term
-  Tensor W;          ///< Weight matrix [out_features, in_features]
+  Tensor W;          ///< Weight matrix [in_features, out_features]
   Tensor b;          ///< Bias vector [out_features] (empty if no bias)
+  /// Factor applied to the input inside the GEMM, e.g. 1 / 255 for a first
+  /// layer fed uint8 pixels (see linear())
+  float input_scale = 1.0f;
 
   /**
    * @brief Construct a linear layer.
@@ -78,13 +82,23 @@ struct Linear : public Module {
          float init_scale = 0.5f, unsigned seed = 0);
 
   /**
-   * @brief Forward pass: y = xW^T + b
+   * @brief Forward pass: y = xW + b
    * @param x Input tensor [batch_size, in_features]
    * @param store ParameterStore for computation
    * @return Output tensor [batch_size, out_features]
    */
   Tensor forward(const Tensor& x, ParameterStore& store) override;
 
+  /**
+   * @brief Forward pass with a fused activation: y = act(xW + b)
+   * @param x Input tensor [batch_size, in_features]
+   * @param act Activation applied in the GEMM epilogue
+   * @param store ParameterStore for computation
+   * @return Output tensor [batch_size, out_features]
+   */
+  Tensor forward(const Tensor& x, kernels::Activation act,
+                 ParameterStore& store);
+
   /**
    * @brief Get learnable parameters.
    * @return Vector containing W and optionally b
@@ -92,6 +106,113 @@ struct Linear : public Module {
   std::vector<Tensor> params() override;
 };
 
+/**
+ * @class QuantizedLinear
+ * @brief Inference-only Linear with int8 per-channel weights.
+ *
+ * Produced from a trained Linear by quantize_dynamic(); activations are
+ * quantized per row on every forward (see linear_s8()). Has no learnable
+ * parameters.
+ */
+struct QuantizedLinear : public Module {
+  QuantizedMatrix W;  ///< Weights [out_features, in_features], int8
+  Tensor b;           ///< Float32 bias shared with the source layer
+  float input_scale;  ///< Copied from the source layer
+
+  /**
+   * @brief Quantize a trained linear layer.
+   * @param src Layer whose weights are quantized and whose bias is reused
+   */
+  explicit QuantizedLinear(const Linear& src);
+
+  /**
+   * @brief Forward pass: y = xW + b
+   * @param x Input tensor [batch_size, in_features]
+   * @param store ParameterStore for computation
+   * @return Output tensor [batch_size, out_features]
+   */
+  Tensor forward(const Tensor& x, ParameterStore& store) override;
+
+  /**
+   * @brief Forward pass with a fused activation: y = act(xW + b)
+   * @param x Input tensor [batch_size, in_features]
+   * @param act Activation applied in the GEMM epilogue
+   * @param store ParameterStore for computation
+   * @return Output tensor [batch_size, out_features]
+   */
+  Tensor forward(const Tensor& x, kernels::Activation act,
+                 ParameterStore& store);
+};
+
+/**
+ * @class Embedding
+ * @brief Learnable lookup table mapping token ids to dense vectors.
+ *
+ * Replaces a one-hot input followed by a Linear layer: only the looked-up
+ * rows are read in forward and written in backward. Not a Module, since
+ * its input is an integer index array or int32 Tensor rather than a float
+ * activation.
+ */
+struct Embedding {
+  int num_embeddings;  ///< Vocabulary size
+  int embedding_dim;   ///< Width of each embedding vector
+  Tensor W;            ///< Table [num_embeddings, embedding_dim]
+
+  /**
+   * @brief Construct an embedding table.
+   * @param num Number of embeddings (vocabulary size)
+   * @param dim Embedding dimension
+   * @param store ParameterStore for parameter allocation
+   * @param init_scale Weight initialization scale (default 0.5)
+   * @param seed Random seed for initialization
+   * @param sparse_grad Track the table's gradient as touched rows so
+   * optimizers and zero_grad() only visit looked-up rows (default false)
+   */
+  Embedding(int num, int dim, ParameterStore& store, float init_scale = 0.5f,
+            unsigned seed = 0, bool sparse_grad = false);
+
+  /**
+   * @brief Look up embeddings for an index array.
+   * @param indices Token ids in [0, num_embeddings); must outlive backward()
+   * @param shape Shape of the index array, e.g. [batch_size, context]
+   * @param store ParameterStore for computation
+   * @return Embeddings of shape shape + [embedding_dim]
+   */
+  Tensor forward(const int32_t* indices, const Shape& shape,
+                 ParameterStore& store);
+
+  /**
+   * @brief Function call operator for convenience.
+   * @param indices Token ids in [0, num_embeddings)
+   * @param shape Shape of the index array
+   * @param store ParameterStore for computation
+   * @return Embeddings of shape shape + [embedding_dim]
+   */
+  Tensor operator()(const int32_t* indices, const Shape& shape,
+                    ParameterStore& store) {
+    return forward(indices, shape, store);
+  }
+
+  /**
+   * @brief Look up embeddings for an int32 index tensor.
+   * @param indices Token ids in [0, num_embeddings), any shape
+   * @param store ParameterStore for computation
+   * @return Embeddings of shape indices.shape + [embedding_dim]
+   */
+  Tensor forward(const Tensor& indices, ParameterStore& store);
+
+  /// @copydoc forward(const Tensor&, ParameterStore&)
+  Tensor operator()(const Tensor& indices, ParameterStore& store) {
+    return forward(indices, store);
+  }
+
+  /**
+   * @brief Get learnable parameters.
+   * @return Vector containing W
+   */
+  std::vector<Tensor> params() { return {W}; }
+};
+
 /**
  * @class Tanh
  * @brief Hyperbolic tangent activation layer.
@@ -134,14 +255,36 @@ struct Sigmoid : public Module {
   Tensor forward(const Tensor& x, ParameterStore& store) override;
 };
 
+/**
+ * @struct CheckpointPolicy
+ * @brief How nn::Sequential splits its layers into recomputed segments.
+ *
+ * With `every` set, each segment spans that many layers (a fused Linear and
+ * activation pair is never split). Otherwise a segment grows until the
+ * activations inside it would exceed `budget_elements`. Both zero turns
+ * checkpointing off.
+ */
+struct CheckpointPolicy {
+  size_t every = 0;            ///< Layers per segment
+  size_t budget_elements = 0;  ///< Interior activation elements per segment
+};
+
 /**
  * @class Sequential
  * @brief Container for sequential layer composition.
  *
  * Chains multiple modules together, passing output of one as input to the next.
+ * A Linear layer directly followed by Relu, Tanh or Sigmoid runs as a single
+ * fused linear op.
+ *
+ * With a checkpoint policy set, training forwards run each segment without
+ * the tape and record a single op that keeps only the segment's input and
+ * output. Backward recomputes the segment's interior activations, at the
+ * cost of one extra forward per segment.
  */
 struct Sequential : public Module {
   std::vector<std::unique_ptr<Module>> layers;  ///< Sequence of layers
+  CheckpointPolicy checkpoint;  ///< Activation checkpointing, off by default
 
   Sequential() = default;
 
@@ -181,19 +324,69 @@ struct Sequential : public Module {
     layers.push_back(std::move(layer));
     return ref;
   }
+
+ private:
+  /// Layer range recomputed by one checkpoint op; addresses are stable.
+  struct Segment {
+    Sequential* seq = nullptr;  ///< Owner, refreshed on every forward
+    size_t begin = 0;           ///< First layer
+    size_t end = 0;             ///< One past the last layer
+    Tape tape;                  ///< Recompute tape, reused across steps
+  };
+
+  Tensor run(size_t& i, size_t end, const Tensor& x, ParameterStore& store,
+             const CheckpointPolicy* policy);
+  Segment* segment(size_t begin, size_t end);
+  static void backward_segment(void* ctx, const TapeOp& op,
+                               ParameterStore& store);
+
+  std::vector<std::unique_ptr<Segment>> segments_;
 };
 
+/**
+ * @brief Convert every Linear in a model to a QuantizedLinear, in place.
+ *
+ * Recurses into nested Sequentials. The model is inference-only afterwards:
+ * run it under a NoGradGuard. Activation fusion in Sequential carries over.
+ * @param model Trained model
+ * @return Number of layers converted
+ */
+size_t quantize_dynamic(Sequential& model);
+
 /**
  * @brief Binary Cross-Entropy loss with logits.
  *
- * Computes BCE loss between logits and targets, with numerical stability.
+ * Computes BCE loss between logits and targets as one fused tape op using
+ * the log-sum-exp form, so no probability clamping is needed.
  * @param logits Predicted logits [batch_size, num_classes]
  * @param targets Target labels [batch_size, num_classes] (0 or 1)
  * @param store ParameterStore for computation
- * @param eps Small epsilon for numerical stability (default 1e-6)
- * @return Mean loss scalar
+ * @param eps Unused; kept for source compatibility
+ * @return Loss summed over classes, averaged over the batch
  */
 Tensor bce_with_logits_loss(const Tensor& logits, const Tensor& targets,
                             ParameterStore& store, float eps = 1e-6f);
 
+/**
+ * @brief Softmax cross-entropy loss on integer class labels.
+ *
+ * Fused log-softmax + NLL; see softmax_cross_entropy().
+ * @param logits Predicted logits [batch_size, num_classes]
+ * @param labels batch_size class indices; must outlive store.backward()
+ * @param store ParameterStore for computation
+ * @return Negative log-likelihood averaged over the batch
+ */
+Tensor cross_entropy_loss(const Tensor& logits, const int32_t* labels,
+                          ParameterStore& store);
+
+/**
+ * @brief Softmax cross-entropy loss on an int32 label tensor.
+ * @param logits Predicted logits [batch_size, num_classes]
+ * @param labels Int32 class indices [batch_size]
+ * @param store ParameterStore for computation
+ * @return Negative log-likelihood averaged over the batch
+ */
+Tensor cross_entropy_loss(const Tensor& logits, const Tensor& labels,
+                          ParameterStore& store);
+
 }  // namespace nn
@@ -4,6 +4,13 @@
  *
  * Provides SGD, Adam, and AdamW optimizers with configurable learning rate
  * schedulers. Supports momentum, weight decay, and AMSGrad variants.
+ *
+ * Parameters registered with ParameterStore::enable_row_sparse_grad() are
+ * updated lazily: only rows touched since the last zero_grad() are visited.
+ * When a row is next touched, its skipped steps are caught up in closed
+ * form (momentum/moment decay and decoupled weight decay, using the current
+ * learning rate). Adam-family updates for skipped steps are not replayed,
+ * matching the usual lazy/sparse Adam behaviour.
  */
 
 #pragma once
@@ -75,6 +82,46 @@ class Optimizer {
   static bool valid_param(const Tensor& t) {
     return t.numel > 0 && t.data() != nullptr && t.grad() != nullptr;
   }
+
+  /**
+   * @brief Row-sparse gradient bookkeeping for a parameter, if enabled.
+   * @param t Parameter tensor
+   * @return Touched-row set, or nullptr for dense parameters
+   */
+  static RowSparseGrad* sparse_grad(const Tensor& t) {
+    return t.store ? t.store->row_sparse_grad(t) : nullptr;
+  }
+
+  /**
+   * @brief Visit the rows of a sparse parameter that need updating.
+   * @param sparse Touched-row set
+   * @param f Called with each row: every row if sparse.dense, else the
+   *          touched rows
+   */
+  template <typename F>
+  static void for_each_update_row(const RowSparseGrad& sparse, F&& f) {
+    if (sparse.dense) {
+      for (int32_t r = 0; r < sparse.rows; ++r) f(r);
+      return;
+    }
+    for (int32_t r : sparse.touched) f(r);
+  }
+
+  /**
+   * @brief Count the steps a sparse row sat out and mark it current.
+   * @param last_step Per-row step of the last update (resized on demand)
+   * @param rows Number of rows in the parameter
+   * @param row Row being updated at the current step
+   * @return Number of steps since the row was last updated
+   */
+  size_t skipped_steps(std::vector<size_t>& last_step, int rows, int32_t row) {
+    if (last_step.size() != static_cast<size_t>(rows)) {
+      last_step.assign(static_cast<size_t>(rows), 0);
+    }
+    const size_t skipped = step_count_ - 1 - last_step[row];
+    last_step[row] = step_count_;
+    return skipped;
+  }
 };
 
 /**
@@ -117,7 +164,8 @@ class SGD : public OptimizerWithScheduler<Scheduler> {
       float momentum_beta = 0.0f)
       : OptimizerWithScheduler<Scheduler>(std::move(params), scheduler),
         momentum_beta_(momentum_beta),
-        momentum_(this->params_.size()) {}
+        momentum_(this->params_.size()),
+        last_step_(this->params_.size()) {}
 
   /**
    * @brief Perform SGD update step.
@@ -129,27 +177,58 @@ class SGD : public OptimizerWithScheduler<Scheduler> {
     for (size_t idx = 0; idx < this->params_.size(); ++idx) {
       Tensor& param = this->params_[idx];
       if (!Optimizer::valid_param(param)) continue;
-      float* data = param.data();
-      const float* grad = param.grad();
-      const size_t n = param.numel;
       if (momentum_beta_ != 0.0f) {
-        Optimizer::ensure_state_size(momentum_[idx], n);
-        auto& momentum_vec = momentum_[idx];
-        for (size_t i = 0; i < n; ++i) {
-          momentum_vec[i] = momentum_beta_ * momentum_vec[i] + grad[i];
-          data[i] -= lr * momentum_vec[i];
-        }
-      } else {
-        for (size_t i = 0; i < n; ++i) {
-          data[i] -= lr * grad[i];
-        }
+        Optimizer::ensure_state_size(momentum_[idx], param.numel);
+      }
+      RowSparseGrad* sparse = Optimizer::sparse_grad(param);
+      if (!sparse) {
+        update_range(idx, param, 0, param.numel, lr);
+        continue;
       }
+      const size_t cols = static_cast<size_t>(sparse->cols);
+      Optimizer::for_each_update_row(*sparse, [&](int32_t r) {
+        const size_t begin = static_cast<size_t>(r) * cols;
+        const size_t skipped =
+            this->skipped_steps(last_step_[idx], sparse->rows, r);
+        if (momentum_beta_ != 0.0f && skipped > 0) {
+          // k zero-gradient steps: v_j = beta^j v, p -= lr * sum_j v_j.
+          const float decay =
+              std::pow(momentum_beta_, static_cast<float>(skipped));
+          const float drift =
+              lr * momentum_beta_ * (1.0f - decay) / (1.0f - momentum_beta_);
+          float* data = param.data();
+          auto& momentum_vec = momentum_[idx];
+          for (size_t i = begin; i < begin + cols; ++i) {
+            data[i] -= drift * momentum_vec[i];
+            momentum_vec[i] *= decay;
+          }
+        }
+        update_range(idx, param, begin, begin + cols, lr);
+      });
     }
   }
 
  private:
+  void update_range(size_t idx, Tensor& param, size_t begin, size_t end,
+                    float lr) {
+    float* data = param.data();
+    const float* grad = param.grad();
+    if (momentum_beta_ != 0.0f) {
+      auto& momentum_vec = momentum_[idx];
+      for (size_t i = begin; i < end; ++i) {
+        momentum_vec[i] = momentum_beta_ * momentum_vec[i] + grad[i];
+        data[i] -= lr * momentum_vec[i];
+      }
+    } else {
+      for (size_t i = begin; i < end; ++i) {
+        data[i] -= lr * grad[i];
+      }
+    }
+  }
+
   float momentum_beta_;
   std::vector<std::vector<float>> momentum_;
+  std::vector<std::vector<size_t>> last_step_;
 };
 
 /**
@@ -187,7 +266,8 @@ class Adam : public OptimizerWithScheduler<Scheduler> {
         epsilon_(epsilon),
         m1_(this->params_.size()),
         m2_(this->params_.size()),
-        vhat_(amsgrad ? this->params_.size() : 0) {}
+        vhat_(amsgrad ? this->params_.size() : 0),
+        last_step_(this->params_.size()) {}
 
   /**
    * @brief Perform Adam update step.
@@ -203,40 +283,64 @@ class Adam : public OptimizerWithScheduler<Scheduler> {
     for (size_t idx = 0; idx < this->params_.size(); ++idx) {
       Tensor& param = this->params_[idx];
       if (!Optimizer::valid_param(param)) continue;
-      float* data = param.data();
-      const float* grad_ptr = param.grad();
       const size_t n = param.numel;
       Optimizer::ensure_state_size(m1_[idx], n);
       Optimizer::ensure_state_size(m2_[idx], n);
       if (amsgrad_) {
         Optimizer::ensure_state_size(vhat_[idx], n);
       }
-      auto& m1_vec = m1_[idx];
-      auto& m2_vec = m2_[idx];
-      std::vector<float>* vhat_vec = amsgrad_ ? &vhat_[idx] : nullptr;
-
-      for (size_t i = 0; i < n; ++i) {
-        float grad = grad_ptr[i];
-        if (weight_decay_ != 0.0f) {
-          grad += weight_decay_ * data[i];
+      RowSparseGrad* sparse = Optimizer::sparse_grad(param);
+      if (!sparse) {
+        update_range(idx, param, 0, n, lr, bc1, bc2);
+        continue;
+      }
+      const size_t cols = static_cast<size_t>(sparse->cols);
+      Optimizer::for_each_update_row(*sparse, [&](int32_t r) {
+        const size_t begin = static_cast<size_t>(r) * cols;
+        const size_t skipped =
+            this->skipped_steps(last_step_[idx], sparse->rows, r);
+        if (skipped > 0) {
+          const float d1 = std::pow(beta1_, static_cast<float>(skipped));
+          const float d2 = std::pow(beta2_, static_cast<float>(skipped));
+          for (size_t i = begin; i < begin + cols; ++i) {
+            m1_[idx][i] *= d1;
+            m2_[idx][i] *= d2;
+          }
         }
+        update_range(idx, param, begin, begin + cols, lr, bc1, bc2);
+      });
+    }
+  }
 
-        m1_vec[i] = beta1_ * m1_vec[i] + (1.0f - beta1_) * grad;
-        m2_vec[i] = beta2_ * m2_vec[i] + (1.0f - beta2_) * grad * grad;
+ private:
+  void update_range(size_t idx, Tensor& param, size_t begin, size_t end,
+                    float lr, float bc1, float bc2) {
+    float* data = param.data();
+    const float* grad_ptr = param.grad();
+    auto& m1_vec = m1_[idx];
+    auto& m2_vec = m2_[idx];
+    std::vector<float>* vhat_vec = amsgrad_ ? &vhat_[idx] : nullptr;
+
+    for (size_t i = begin; i < end; ++i) {
+      float grad = grad_ptr[i];
+      if (weight_decay_ != 0.0f) {
+        grad += weight_decay_ * data[i];
+      }
 
-        float m1_hat = m1_vec[i] / bc1;
-        float m2_term = m2_vec[i];
-        if (amsgrad_) {
-          (*vhat_vec)[i] = std::max((*vhat_vec)[i], m2_vec[i]);
-          m2_term = (*vhat_vec)[i];
-        }
-        float m2_hat = m2_term / bc2;
-        data[i] -= lr * m1_hat / (std::sqrt(m2_hat) + epsilon_);
+      m1_vec[i] = beta1_ * m1_vec[i] + (1.0f - beta1_) * grad;
+      m2_vec[i] = beta2_ * m2_vec[i] + (1.0f - beta2_) * grad * grad;
+
+      float m1_hat = m1_vec[i] / bc1;
+      float m2_term = m2_vec[i];
+      if (amsgrad_) {
+        (*vhat_vec)[i] = std::max((*vhat_vec)[i], m2_vec[i]);
+        m2_term = (*vhat_vec)[i];
       }
+      float m2_hat = m2_term / bc2;
+      data[i] -= lr * m1_hat / (std::sqrt(m2_hat) + epsilon_);
     }
   }
 
- private:
   float beta1_;
   float beta2_;
   float weight_decay_;
@@ -246,6 +350,7 @@ class Adam : public OptimizerWithScheduler<Scheduler> {
   std::vector<std::vector<float>> m1_;
   std::vector<std::vector<float>> m2_;
   std::vector<std::vector<float>> vhat_;
+  std::vector<std::vector<size_t>> last_step_;
 };
 
 /**
@@ -283,7 +388,8 @@ class AdamW : public OptimizerWithScheduler<Scheduler> {
         epsilon_(epsilon),
         m1_(this->params_.size()),
         m2_(this->params_.size()),
-        vhat_(amsgrad ? this->params_.size() : 0) {}
+        vhat_(amsgrad ? this->params_.size() : 0),
+        last_step_(this->params_.size()) {}
 
   /**
    * @brief Perform AdamW update step.
@@ -299,58 +405,88 @@ class AdamW : public OptimizerWithScheduler<Scheduler> {
     for (size_t idx = 0; idx < this->params_.size(); ++idx) {
       Tensor& param = this->params_[idx];
       if (!Optimizer::valid_param(param)) continue;
-      float* data = param.data();
-      const float* grad_ptr = param.grad();
       const size_t n = param.numel;
       Optimizer::ensure_state_size(m1_[idx], n);
       Optimizer::ensure_state_size(m2_[idx], n);
       if (amsgrad_) {
         Optimizer::ensure_state_size(vhat_[idx], n);
       }
-      auto& m1_vec = m1_[idx];
-      auto& m2_vec = m2_[idx];
-      std::vector<float>* vhat_vec = amsgrad_ ? &vhat_[idx] : nullptr;
-
-      if (use_weight_decay_ && weight_decay_ != 0.0f) {
-        for (size_t i = 0; i < n; ++i) {
-          data[i] -= lr * weight_decay_ * data[i];
+      RowSparseGrad* sparse = Optimizer::sparse_grad(param);
+      if (!sparse) {
+        update_range(idx, param, 0, n, lr, bc1, bc2);
+        continue;
+      }
+      const bool decay = use_weight_decay_ && weight_decay_ != 0.0f;
+      const size_t cols = static_cast<size_t>(sparse->cols);
+      Optimizer::for_each_update_row(*sparse, [&](int32_t r) {
+        const size_t begin = static_cast<size_t>(r) * cols;
+        const size_t skipped =
+            this->skipped_steps(last_step_[idx], sparse->rows, r);
+        if (skipped > 0) {
+          const float k = static_cast<float>(skipped);
+          const float d1 = std::pow(beta1_, k);
+          const float d2 = std::pow(beta2_, k);
+          const float shrink =
+              decay ? std::pow(1.0f - lr * weight_decay_, k) : 1.0f;
+          float* data = param.data();
+          for (size_t i = begin; i < begin + cols; ++i) {
+            m1_[idx][i] *= d1;
+            m2_[idx][i] *= d2;
+            data[i] *= shrink;
+          }
         }
+        update_range(idx, param, begin, begin + cols, lr, bc1, bc2);
+      });
+    }
+  }
+
+ private:
+  void update_range(size_t idx, Tensor& param, size_t begin, size_t end,
+                    float lr, float bc1, float bc2) {
+    float* data = param.data();
+    const float* grad_ptr = param.grad();
+    auto& m1_vec = m1_[idx];
+    auto& m2_vec = m2_[idx];
+    std::vector<float>* vhat_vec = amsgrad_ ? &vhat_[idx] : nullptr;
+
+    if (use_weight_decay_ && weight_decay_ != 0.0f) {
+      for (size_t i = begin; i < end; ++i) {
+        data[i] -= lr * weight_decay_ * data[i];
       }
+    }
 
-      if (amsgrad_) {
-        for (size_t i = 0; i < n; ++i) {
-          float grad = grad_ptr[i];
-          m1_vec[i] = beta1_ * m1_vec[i] + (1.0f - beta1_) * grad;
-          m2_vec[i] = beta2_ * m2_vec[i] + (1.0f - beta2_) * grad * grad;
-
-          // 55%
-          float m1_hat = m1_vec[i] / bc1;
-          float m2_term = m2_vec[i];
-          (*vhat_vec)[i] = std::max((*vhat_vec)[i], m2_vec[i]);
-          m2_term = (*vhat_vec)[i];
-          float m2_hat = m2_term / bc2;
-          // 30%
-          data[i] -= lr * m1_hat / (std::sqrt(m2_hat) + epsilon_);
-        }
+    if (amsgrad_) {
+      for (size_t i = begin; i < end; ++i) {
+        float grad = grad_ptr[i];
+        m1_vec[i] = beta1_ * m1_vec[i] + (1.0f - beta1_) * grad;
+        m2_vec[i] = beta2_ * m2_vec[i] + (1.0f - beta2_) * grad * grad;
 
-      } else {
-        for (size_t i = 0; i < n; ++i) {
-          float grad = grad_ptr[i];
-          m1_vec[i] = beta1_ * m1_vec[i] + (1.0f - beta1_) * grad;
-          m2_vec[i] = beta2_ * m2_vec[i] + (1.0f - beta2_) * grad * grad;
-
-          // 55%
-          float m1_hat = m1_vec[i] / bc1;
-          float m2_term = m2_vec[i];
-          float m2_hat = m2_term / bc2;
-          // 30%
-          data[i] -= lr * m1_hat / (std::sqrt(m2_hat) + epsilon_);
-        }
+        // 55%
+        float m1_hat = m1_vec[i] / bc1;
+        float m2_term = m2_vec[i];
+        (*vhat_vec)[i] = std::max((*vhat_vec)[i], m2_vec[i]);
+        m2_term = (*vhat_vec)[i];
+        float m2_hat = m2_term / bc2;
+        // 30%
+        data[i] -= lr * m1_hat / (std::sqrt(m2_hat) + epsilon_);
+      }
+
+    } else {
+      for (size_t i = begin; i < end; ++i) {
+        float grad = grad_ptr[i];
+        m1_vec[i] = beta1_ * m1_vec[i] + (1.0f - beta1_) * grad;
+        m2_vec[i] = beta2_ * m2_vec[i] + (1.0f - beta2_) * grad * grad;
+
+        // 55%
+        float m1_hat = m1_vec[i] / bc1;
+        float m2_term = m2_vec[i];
+        float m2_hat = m2_term / bc2;
+        // 30%
+        data[i] -= lr * m1_hat / (std::sqrt(m2_hat) + epsilon_);
       }
     }
   }
 
- private:
   float beta1_;
   float beta2_;
   float weight_decay_;
@@ -360,6 +496,7 @@ class AdamW : public OptimizerWithScheduler<Scheduler> {
   std::vector<std::vector<float>> m1_;
   std::vector<std::vector<float>> m2_;
   std::vector<std::vector<float>> vhat_;
+  std::vector<std::vector<size_t>> last_step_;
 };
 
 }  // namespace optim
@@ -0,0 +1,64 @@
+/**
+ * @file parallel.hpp
+ * @brief Minimal persistent thread pool used by the CPU kernels.
+ *
+ * parallel_for splits an index range into chunks and runs them on a shared
+ * pool of worker threads, with the calling thread taking part. Nested calls
+ * from inside a worker run serially on that worker. The pool size defaults to
+ * the hardware concurrency and can be overridden with TFORMER_NUM_THREADS.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+namespace parallel {
+
+/**
+ * @brief Number of threads parallel_for may use, including the caller.
+ * @return Thread count (at least 1)
+ */
+size_t num_threads();
+
+/**
+ * @brief Resize the pool. Must not race with in-flight parallel_for calls.
+ * @param n Desired thread count including the caller (0 restores default)
+ */
+void set_num_threads(size_t n);
+
+/**
+ * @brief Type-erased range body: fn(ctx, begin, end).
+ */
+using RangeFn = void (*)(void* ctx, size_t begin, size_t end);
+
+/**
+ * @brief Run fn over [begin, end) in chunks of at least grain elements.
+ * @param begin First index
+ * @param end One past the last index
+ * @param grain Minimum chunk size
+ * @param fn Range body
+ * @param ctx Opaque pointer passed to fn
+ */
+void parallel_for_raw(size_t begin, size_t end, size_t grain, RangeFn fn,
+                      void* ctx);
+
+/**
+ * @brief Run f(begin, end) over sub-ranges of [begin, end) on the pool.
+ *
+ * Does not allocate: the callable is passed by reference to the workers.
+ * @param begin First index
+ * @param end One past the last index
+ * @param grain Minimum chunk size
+ * @param f Callable taking (size_t begin, size_t end)
+ */
+template <typename F>
+void parallel_for(size_t begin, size_t end, size_t grain, F&& f) {
+  using Fn = std::remove_reference_t<F>;
+  parallel_for_raw(
+      begin, end, grain,
+      [](void* ctx, size_t b, size_t e) { (*static_cast<Fn*>(ctx))(b, e); },
+      const_cast<void*>(static_cast<const void*>(&f)));
+}
+
+}  // namespace parallel
@@ -6,22 +6,131 @@
  * This library implements a minimal tensor API with separate contiguous storage
  * for data and gradients.
  * - ParameterStore manages memory allocation and owns data/grad buffers.
- * - Tensor provides a lightweight view into the buffers with shape and offset
- * information.
+ * - Tensor provides a lightweight view into the buffers with shape, stride and
+ * offset information. Views (transpose, narrow, slice, view) alias both the
+ * data and gradient buffers of their base, so they need no tape entry.
  * - Supports automatic differentiation via a tape-based system.
+ * - Shapes, strides and tape records are stored inline or in reused arrays,
+ * so a steady-state training step performs no heap allocation.
+ * - Data may be float32, bfloat16 (see DType and AutocastGuard), int32 or
+ * uint8; gradients are always float32 and only floating tensors have them.
  */
 
 #pragma once
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
+#include <initializer_list>
 #include <memory>
 #include <random>
 #include <stdexcept>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "arena.hpp"
+#include "kernels.hpp"
+
 struct ParameterStore;
 
+/// Maximum tensor rank; shapes and strides are stored inline up to this.
+constexpr size_t kMaxRank = 8;
+
+/**
+ * @class InlineVector
+ * @brief Fixed-capacity vector with inline storage.
+ *
+ * Provides the subset of std::vector used for shapes and strides, so copying
+ * a Tensor never touches the heap. Converts implicitly from std::vector and
+ * initializer lists.
+ * @tparam T Element type
+ * @tparam N Capacity
+ */
+template <typename T, size_t N>
+class InlineVector {
+ public:
+  using value_type = T;
+  using size_type = size_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  InlineVector() = default;
+
+  /**
+   * @brief Construct n copies of v.
+   * @throws std::invalid_argument if n exceeds the capacity
+   */
+  InlineVector(size_t n, const T& v) { assign(n, v); }
+
+  InlineVector(std::initializer_list<T> init) {
+    for (const T& v : init) push_back(v);
+  }
+
+  InlineVector(const std::vector<T>& v) {
+    for (const T& x : v) push_back(x);
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  static constexpr size_t capacity() { return N; }
+
+  T& operator[](size_t i) { return data_[i]; }
+  const T& operator[](size_t i) const { return data_[i]; }
+  T& back() { return data_[size_ - 1]; }
+  const T& back() const { return data_[size_ - 1]; }
+  T* data() { return data_; }
+  const T* data() const { return data_; }
+
+  T* begin() { return data_; }
+  T* end() { return data_ + size_; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+
+  /**
+   * @brief Append an element.
+   * @throws std::invalid_argument if the vector is full
+   */
+  void push_back(const T& v) {
+    if (size_ == N)
+      throw std::invalid_argument("tensor rank exceeds kMaxRank");
+    data_[size_++] = v;
+  }
+
+  void pop_back() { --size_; }
+  void clear() { size_ = 0; }
+
+  /**
+   * @brief Replace the contents with n copies of v.
+   * @throws std::invalid_argument if n exceeds the capacity
+   */
+  void assign(size_t n, const T& v) {
+    if (n > N) throw std::invalid_argument("tensor rank exceeds kMaxRank");
+    for (size_t i = 0; i < n; ++i) data_[i] = v;
+    size_ = n;
+  }
+
+  friend bool operator==(const InlineVector& a, const InlineVector& b) {
+    if (a.size_ != b.size_) return false;
+    for (size_t i = 0; i < a.size_; ++i)
+      if (!(a.data_[i] == b.data_[i])) return false;
+    return true;
+  }
+
+  friend bool operator!=(const InlineVector& a, const InlineVector& b) {
+    return !(a == b);
+  }
+
+ private:
+  T data_[N] = {};
+  size_t size_ = 0;
+};
+
+using Shape = InlineVector<int, kMaxRank>;       ///< Tensor dimensions
+using Strides = InlineVector<size_t, kMaxRank>;  ///< Per-dimension strides
+
 /**
  * @struct ParameterStoreStats
  * @brief Statistics for ParameterStore operations.
@@ -39,8 +148,14 @@ struct ParameterStoreStats {
   double zero_grad_ms = 0.0;        ///< Time spent zeroing gradients (ms)
   size_t reserve_calls = 0;         ///< Number of reserve() calls
   size_t reserve_elements = 0;      ///< Maximum reserved elements
-  size_t capacity_grow_events = 0;  ///< Number of buffer reallocations
-  size_t peak_elements = 0;         ///< Peak memory usage in elements
+  size_t capacity_grow_events = 0;  ///< Times a buffer moved to grow
+  size_t peak_elements = 0;         ///< Peak data arena usage in elements
+  size_t peak_grad_elements = 0;    ///< Peak gradient arena usage
+  size_t plan_calls = 0;            ///< Number of plan() calls
+  size_t plan_elements = 0;         ///< Data arena size plan() reserved
+  size_t plan_grad_elements = 0;    ///< Gradient arena size plan() reserved
+  ArenaStats data_arena;            ///< Data buffer commits and placement
+  ArenaStats grad_arena;            ///< Gradient buffer commits and placement
 };
 
 /**
@@ -52,21 +167,64 @@ enum class TensorInit {
   UninitializedData  ///< Leave tensor data uninitialized (faster)
 };
 
+/**
+ * @enum DType
+ * @brief Element type of a tensor's data.
+ */
+enum class DType : uint8_t {
+  Float32,   ///< IEEE single precision
+  BFloat16,  ///< Upper half of a float32: same range, 8-bit mantissa
+  Int32,     ///< Signed 32-bit integers, e.g. class labels and token ids
+  UInt8      ///< Unsigned bytes, e.g. raw pixels
+};
+
+/**
+ * @brief Bytes per element.
+ * @param dtype Element type
+ * @return Element size in bytes
+ */
+constexpr size_t dtype_size(DType dtype) {
+  switch (dtype) {
+    case DType::BFloat16:
+      return 2;
+    case DType::UInt8:
+      return 1;
+    default:
+      return 4;
+  }
+}
+
+/**
+ * @brief Whether a dtype can carry gradients.
+ * @param dtype Element type
+ * @return True for Float32 and BFloat16
+ */
+constexpr bool is_floating(DType dtype) {
+  return dtype == DType::Float32 || dtype == DType::BFloat16;
+}
+
 /**
  * @enum OpType
  * @brief Types of operations recorded in the autograd tape.
  */
 enum class OpType {
-  Add,        ///< Element-wise addition
-  Sub,        ///< Element-wise subtraction
-  Mul,        ///< Element-wise multiplication
-  Relu,       ///< Rectified Linear Unit activation
-  Tanh,       ///< Hyperbolic tangent activation
-  Sigmoid,    ///< Sigmoid activation
-  Log,        ///< Natural logarithm
-  Sum,        ///< Sum reduction to scalar
-  Matmul,     ///< Matrix multiplication
-  AddRowwise  ///< Add bias vector to each row
+  Add,                  ///< Element-wise addition (broadcasting)
+  Sub,                  ///< Element-wise subtraction (broadcasting)
+  Mul,                  ///< Element-wise multiplication (broadcasting)
+  Relu,                 ///< Rectified Linear Unit activation
+  Tanh,                 ///< Hyperbolic tangent activation
+  Sigmoid,              ///< Sigmoid activation
+  Log,                  ///< Natural logarithm
+  Sum,                  ///< Sum reduction to scalar
+  Matmul,               ///< Matrix multiplication
+  BatchMatmul,          ///< Batch of matrix multiplications
+  Contiguous,           ///< Copy a strided view into contiguous storage
+  BceWithLogits,        ///< Fused mean binary cross-entropy on logits
+  SoftmaxCrossEntropy,  ///< Fused mean softmax cross-entropy on class labels
+  Embedding,            ///< Row gather from an embedding table
+  Linear,               ///< Fused matmul + bias + activation
+  Cast,                 ///< Element type conversion
+  Custom                ///< Backward supplied by a callback, see BackwardFn
 };
 
 /**
@@ -75,34 +233,99 @@ enum class OpType {
  *
  * A Tensor represents a multi-dimensional array stored in a ParameterStore.
  * It provides access to data and gradients, and supports autograd operations.
+ * Only tensors that require grad own a slot in the store's gradient arena;
+ * element i of the view has its gradient at grad_offset + (its data offset
+ * - offset). Data offsets and strides count elements of dtype, so views work
+ * the same for every element type; gradients are float32 regardless.
  */
 struct Tensor {
+  /// grad_offset of a tensor without a gradient slot
+  static constexpr size_t kNoGrad = static_cast<size_t>(-1);
+
   ParameterStore* store = nullptr;  ///< Pointer to the owning ParameterStore
-  size_t offset = 0;                ///< Starting index into store buffers
-  std::vector<int> shape;           ///< Tensor dimensions (contiguous layout)
+  size_t offset = 0;                ///< Starting index into the data arena
+  size_t grad_offset = kNoGrad;     ///< Index into the gradient arena
+  Shape shape;                      ///< Tensor dimensions
+  Strides strides;                  ///< Element stride of each dimension
   size_t numel = 0;  ///< Total number of elements (product of shape)
+  DType dtype = DType::Float32;  ///< Element type of the data
 
   Tensor() = default;
 
   /**
-   * @brief Construct a Tensor view.
+   * @brief Construct a contiguous Tensor view.
    * @param s Owning ParameterStore
    * @param off Offset into buffers
    * @param sh Shape vector
    * @param n Number of elements
    */
-  Tensor(ParameterStore* s, size_t off, std::vector<int> sh, size_t n)
-      : store(s), offset(off), shape(std::move(sh)), numel(n) {}
+  Tensor(ParameterStore* s, size_t off, const Shape& sh, size_t n);
+
+  /**
+   * @brief Construct a strided Tensor view.
+   * @param s Owning ParameterStore
+   * @param off Offset of the first element
+   * @param sh Shape vector
+   * @param st Stride of each dimension in elements
+   * @param n Number of elements
+   */
+  Tensor(ParameterStore* s, size_t off, const Shape& sh, const Strides& st,
+         size_t n)
+      : store(s), offset(off), shape(sh), strides(st), numel(n) {}
+
+  /**
+   * @brief Check whether elements are laid out densely in row-major order.
+   * @return True if the view covers numel consecutive elements
+   */
+  bool is_contiguous() const;
+
+  /**
+   * @brief Whether this tensor has a gradient slot.
+   * @return True for parameters and activations that depend on one
+   */
+  bool requires_grad() const { return grad_offset != kNoGrad; }
 
   /**
    * @brief Get mutable pointer to tensor data.
+   *
+   * Points at the first element; index with strides for non-contiguous views.
+   * Only meaningful for float32 tensors; use data_as() for other dtypes.
    * @return Pointer to data buffer
    */
   float* data();
 
+  /**
+   * @brief Untyped pointer to the first element.
+   * @return Pointer into the data arena, or nullptr without storage
+   */
+  void* raw_data();
+
+  /**
+   * @brief Untyped const pointer to the first element.
+   * @return Pointer into the data arena, or nullptr without storage
+   */
+  const void* raw_data() const;
+
+  /**
+   * @brief Typed pointer to the first element, e.g. data_as<uint16_t>() for
+   * bfloat16 bits.
+   * @tparam T Storage type matching dtype
+   * @return Pointer to data buffer
+   */
+  template <typename T>
+  T* data_as() {
+    return static_cast<T*>(raw_data());
+  }
+
+  /// @copydoc data_as()
+  template <typename T>
+  const T* data_as() const {
+    return static_cast<const T*>(raw_data());
+  }
+
   /**
    * @brief Get mutable pointer to gradient buffer.
-   * @return Pointer to gradient buffer
+   * @return Pointer to gradient buffer, or nullptr if !requires_grad()
    */
   float* grad();
 
@@ -114,7 +337,7 @@ struct Tensor {
 
   /**
    * @brief Get const pointer to gradient buffer.
-   * @return Const pointer to gradient buffer
+   * @return Const pointer to gradient buffer, or nullptr if !requires_grad()
    */
   const float* grad() const;
 
@@ -125,7 +348,7 @@ struct Tensor {
 
   /**
    * @brief Fill tensor data with a constant value.
-   * @param v Value to fill
+   * @param v Value to fill, converted to dtype
    */
   void fill(float v);
 };
@@ -137,29 +360,209 @@ struct Tensor {
  * Each operation records its type, output tensor, and input tensors for
  * backward pass computation.
  */
+struct TapeOp;
+
+/**
+ * @brief Backward of an OpType::Custom record: fn(ctx, op, store).
+ *
+ * Must accumulate into the input gradients from op.out's gradient, like the
+ * built-in ops do.
+ */
+using BackwardFn = void (*)(void* ctx, const TapeOp& op,
+                            ParameterStore& store);
+
+/**
+ * @brief Forward of an OpType::Custom record: fn(ctx, op).
+ *
+ * Recomputes op.out from the inputs; run_forward() calls it when a captured
+ * graph replays the op.
+ */
+using ForwardFn = void (*)(void* ctx, const TapeOp& op);
+
 struct TapeOp {
   OpType type;  ///< Type of operation
   Tensor out;   ///< Output tensor
   Tensor a;     ///< First input tensor (or only input for unary ops)
   Tensor b;     ///< Second input tensor (unused for unary ops)
+  /// Integer indices (class labels or embedding rows); owned by the caller
+  const int32_t* indices = nullptr;
+  Tensor c;  ///< Third input (bias of a fused linear, may be empty)
+  kernels::Activation act = kernels::Activation::None;  ///< Fused activation
+  BackwardFn backward = nullptr;  ///< Backward of a Custom op
+  void* ctx = nullptr;            ///< Passed to backward and forward
+  ForwardFn forward = nullptr;    ///< Forward of a Custom op, if replayable
+  float alpha = 1.0f;  ///< Matmul/Linear product scale: act(alpha * a b + c)
+};
+
+/**
+ * @class Tape
+ * @brief Autograd tape stored as structure-of-arrays op records.
+ *
+ * Each record keeps its op type, fused activation and index pointer in
+ * parallel arrays, and refers to its tensors by id in a shared tensor
+ * table. An input that is the previous op's output reuses that op's id.
+ * clear() keeps every array's capacity, so once a step has been recorded
+ * at full size, recording it again performs no heap allocation.
+ */
+class Tape {
+ public:
+  /**
+   * @brief Append an op record.
+   * @param op Operation to record
+   */
+  void push_back(const TapeOp& op);
+
+  /**
+   * @brief Reassemble an op record.
+   * @param i Record index in recording order
+   * @return The op with its tensors resolved from the table
+   */
+  TapeOp operator[](size_t i) const;
+
+  /**
+   * @brief Most recently recorded op.
+   * @return The last op record
+   */
+  TapeOp back() const { return (*this)[size() - 1]; }
+
+  size_t size() const { return types_.size(); }
+  bool empty() const { return types_.empty(); }
+
+  /**
+   * @brief Drop all records, keeping allocated capacity.
+   */
+  void clear();
+
+  /**
+   * @brief Pre-size the record arrays.
+   * @param ops Expected number of ops per step
+   */
+  void reserve(size_t ops);
+
+  /**
+   * @brief Flag the records whose output can reach loss.
+   *
+   * Walks back from the record that produced loss, following each input
+   * that requires grad to the record whose output slot holds it. Other
+   * records only ever see a zero output gradient. If outputs were not
+   * allocated in tape order (a reset() without clear_tape()), every record
+   * is flagged.
+   * @param loss Tensor the backward pass starts from
+   * @return One flag per record, valid until the tape changes
+   */
+  const std::vector<uint8_t>& mark_live(const Tensor& loss);
+
+  /**
+   * @brief Whether backward reads t's data through a record from `from` on.
+   *
+   * Only operands an op's backward needs count: add, sub, sum and
+   * contiguous keep none of their tensors alive, softmax cross-entropy only
+   * its saved probabilities.
+   * @param t Tensor whose data region is checked
+   * @param from First record to consider
+   * @return True if some record overlapping t saves it for backward
+   */
+  bool saves(const Tensor& t, size_t from = 0) const;
+
+ private:
+  static constexpr uint32_t kNone = UINT32_MAX;  ///< Id of an empty Tensor
+
+  uint32_t intern(const Tensor& t);
+  size_t producer(const Tensor& t, size_t before) const;
+
+  std::vector<OpType> types_;                      ///< Op type per record
+  std::vector<kernels::Activation> acts_;          ///< Fused activation
+  std::vector<const int32_t*> indices_;            ///< Label/row indices
+  std::vector<BackwardFn> fns_;                    ///< Custom op backward
+  std::vector<void*> ctxs_;                        ///< Custom op context
+  std::vector<ForwardFn> forwards_;                ///< Custom op forward
+  std::vector<float> alphas_;                      ///< GEMM product scale
+  std::vector<std::array<uint32_t, 4>> operands_;  ///< out, a, b, c ids
+  std::vector<Tensor> tensors_;                    ///< Tensor table
+  std::vector<uint8_t> live_;                      ///< mark_live() result
+};
+
+/**
+ * @struct RowSparseGrad
+ * @brief Touched-row bookkeeping for a parameter with row-sparse gradients.
+ *
+ * Gradient rows still live in the store's grad buffer at their usual
+ * offsets; only the rows listed in touched may be nonzero. Backward of
+ * embedding() records rows here, optimizers update just those rows, and
+ * zero_grad() clears just those rows. If any other op writes the table's
+ * gradient (e.g. tied output weights), dense is set and optimizers and
+ * zero_grad() cover every row until the next zero_grad().
+ */
+struct RowSparseGrad {
+  size_t offset = 0;                 ///< Parameter grad_offset in the store
+  int rows = 0;                      ///< Number of rows (e.g. vocab size)
+  int cols = 0;                      ///< Row width
+  std::vector<int32_t> touched;      ///< Rows with gradient, first-touch order
+  std::vector<uint8_t> is_touched;   ///< Per-row membership in touched
+  bool dense = false;  ///< A non-embedding op wrote the gradient this step
+
+  /**
+   * @brief Record that a row received gradient.
+   * @param row Row index in [0, rows)
+   */
+  void touch(int32_t row) {
+    if (is_touched[row]) return;
+    is_touched[row] = 1;
+    touched.push_back(row);
+  }
+};
+
+/**
+ * @struct StoreMark
+ * @brief Arena positions captured by ParameterStore::mark().
+ */
+struct StoreMark {
+  size_t data = 0;  ///< Used data elements
+  size_t grad = 0;  ///< Used gradient elements
+};
+
+/**
+ * @struct FreeBlock
+ * @brief Released data range waiting to be reused by ParameterStore.
+ */
+struct FreeBlock {
+  size_t offset = 0;  ///< First element
+  size_t count = 0;   ///< Length in elements
 };
 
 /**
  * @class ParameterStore
  * @brief Memory manager for tensors with automatic differentiation support.
  *
- * Manages contiguous buffers for tensor data and gradients. Provides memory
- * allocation, reuse, and autograd functionality. Tracks statistics for
- * performance monitoring.
+ * Manages two bump arenas: one for tensor data and a separate, lazily grown
+ * one for gradients. Inputs, constants and activations that do not depend
+ * on a parameter take no gradient space. Both arenas grow in place inside
+ * a reserved address range (see ArenaBuffer), so growing them copies
+ * nothing and pointers from data_ptr()/grad_ptr() stay valid. Provides
+ * memory allocation, reuse, and autograd functionality. Tracks statistics
+ * for performance monitoring.
  */
 struct ParameterStore {
-  std::unique_ptr<float[]> data_buf;  ///< Buffer for tensor data
-  std::unique_ptr<float[]> grad_buf;  ///< Buffer for gradients
-  size_t capacity = 0;                ///< Current buffer capacity in elements
-  size_t used = 0;                    ///< Currently used elements
-  std::vector<TapeOp> tape;           ///< Operation tape for autograd
+  ParameterStore() = default;
+
+  /**
+   * @brief Store whose arenas allocate with policy instead of the
+   * environment's defaults.
+   * @param policy Alignment, huge page and NUMA policy for both arenas
+   */
+  explicit ParameterStore(const ArenaPolicy& policy)
+      : data_buf(policy), grad_buf(policy) {}
+
+  ArenaBuffer data_buf;               ///< Buffer for tensor data
+  ArenaBuffer grad_buf;               ///< Buffer for gradients
+  size_t used = 0;                    ///< Used data elements
+  size_t grad_used = 0;               ///< Used gradient elements
+  Tape tape;                          ///< Operation tape for autograd
   ParameterStoreStats stats;          ///< Performance statistics
   bool stats_enabled = false;         ///< Whether to collect statistics
+  bool grad_mode = true;              ///< False inside a NoGradGuard
+  DType autocast = DType::Float32;    ///< matmul/linear dtype, AutocastGuard
+  Tape* capture = nullptr;  ///< Also receives every op while a Graph captures
   std::mt19937 rng{5489u};            ///< Deterministic RNG for parameters
 
   // Internal tracking for parameter gradients
@@ -168,49 +571,120 @@ struct ParameterStore {
   size_t param_grad_elements = 0;
   bool param_block_initialized = false;
   bool param_block_contiguous = true;
+  /// Parameters with row-sparse gradients, sorted by grad offset
+  std::vector<RowSparseGrad> row_sparse_grads;
+  /// Reusable buffer for op temporaries, see scratch()
+  std::unique_ptr<float[]> scratch_buf;
+  size_t scratch_capacity = 0;
+  /// Released data ranges below `used`, sorted by offset and coalesced
+  std::vector<FreeBlock> free_blocks;
 
   /**
-   * @brief Allocate space for a tensor.
+   * @brief Allocate data space for a tensor.
+   *
+   * Takes the smallest released block that fits before bumping `used`.
    * @param count Number of elements to allocate
-   * @return Starting offset in buffers
+   * @return Starting offset in the data arena
    */
   size_t allocate(size_t count);
 
+  /**
+   * @brief Hand a dead tensor's data back for reuse by later allocations.
+   *
+   * t must be a whole contiguous tensor from tensor() whose data nothing
+   * reads again, including the tape (see Tape::saves()). Its gradient slot
+   * is untouched. Releasing the top of the arena lowers `used`.
+   * @param t Tensor to release
+   */
+  void release(const Tensor& t);
+
+  /**
+   * @brief Allocate gradient space for a tensor.
+   * @param count Number of elements to allocate
+   * @return Starting offset in the gradient arena
+   */
+  size_t allocate_grad(size_t count);
+
   /**
    * @brief Pre-allocate capacity for efficiency.
-   * @param total_elements Total elements to reserve
+   *
+   * Optional: growth is cheap, but committing once up front saves the
+   * handful of commit calls a growing store makes.
+   * @param total_elements Total data elements to reserve
+   * @param grad_elements Total gradient elements to reserve
    */
-  void reserve(size_t total_elements);
+  void reserve(size_t total_elements, size_t grad_elements = 0);
 
   /**
-   * @brief Ensure sufficient capacity (internal).
+   * @brief Ensure sufficient data capacity (internal).
    * @param required Minimum required elements
    */
   void ensure_capacity(size_t required);
 
+  /**
+   * @brief Ensure sufficient gradient capacity (internal).
+   * @param required Minimum required elements
+   */
+  void ensure_grad_capacity(size_t required);
+
   /**
    * @brief Mark current memory usage for later reset.
-   * @return Current used count
+   * @return Current positions of both arenas
    */
-  size_t mark() const;
+  StoreMark mark() const;
 
   /**
    * @brief Reset memory usage to a previous mark.
    * @param mark Value returned by mark()
    */
-  void reset(size_t mark);
+  void reset(const StoreMark& mark);
+
+  /**
+   * @brief Size both arenas by running one representative step.
+   *
+   * Runs step() from the current position, measures the highest data and
+   * gradient usage it reaches, then resets the store to where it started,
+   * clears the tape, zeroes parameter gradients and reserves exactly that
+   * much. Everything that outlives a step (parameters, inputs, optimizer
+   * state) should exist before planning. Phases that never coexist, such as
+   * a training step and an evaluation pass, can share one plan by having
+   * step reset() to its starting mark between them. Planned and peak sizes
+   * are reported by print_stats().
+   * @param step Callable run once; may call backward()
+   * @return Arena positions the step reached at its peak
+   */
+  template <typename F>
+  StoreMark plan(F&& step) {
+    using Fn = std::remove_reference_t<F>;
+    return plan_raw([](void* ctx) { (*static_cast<Fn*>(ctx))(); },
+                    const_cast<void*>(static_cast<const void*>(&step)));
+  }
 
   /**
-   * @brief Get current memory usage.
-   * @return Number of used elements
+   * @brief Type-erased plan(): runs step(ctx) as the measured step.
+   * @param step Step body
+   * @param ctx Opaque pointer passed to step
+   * @return Arena positions the step reached at its peak
+   */
+  StoreMark plan_raw(void (*step)(void*), void* ctx);
+
+  /**
+   * @brief Get current data arena usage.
+   * @return Number of used data elements
    */
   size_t size() const { return used; }
 
   /**
-   * @brief Get current buffer capacity.
+   * @brief Get current data buffer capacity.
    * @return Capacity in elements
    */
-  size_t capacity_count() const { return capacity; }
+  size_t capacity_count() const { return data_buf.capacity(); }
+
+  /**
+   * @brief Get current gradient arena usage.
+   * @return Number of used gradient elements
+   */
+  size_t grad_size() const { return grad_used; }
 
   /**
    * @brief Get data pointer at offset.
@@ -240,14 +714,35 @@ struct ParameterStore {
    */
   const float* grad_ptr(size_t offset) const;
 
+  /**
+   * @brief Borrow a temporary buffer that is not part of any tensor.
+   *
+   * The buffer is reused by every call: its contents are undefined and the
+   * pointer stays valid only until the next scratch() call. It only grows,
+   * so repeated steps of the same size do not allocate.
+   * @param count Number of floats needed
+   * @return Pointer to at least count floats
+   */
+  float* scratch(size_t count);
+
   /**
    * @brief Create a new tensor.
+   *
+   * Data of any dtype is carved from the float arena, rounded up to whole
+   * floats; a bfloat16 tensor takes half the space of a float32 one and a
+   * uint8 tensor a quarter.
    * @param shape Tensor dimensions
    * @param init Initialization type
+   * @param requires_grad Whether to give it a zeroed gradient slot; inputs
+   * and constants normally do not need one
+   * @param dtype Element type of the data
    * @return New tensor
+   * @throws std::invalid_argument if requires_grad is set for an integer
+   * dtype
    */
-  Tensor tensor(const std::vector<int>& shape,
-                TensorInit init = TensorInit::UninitializedData);
+  Tensor tensor(const Shape& shape,
+                TensorInit init = TensorInit::UninitializedData,
+                bool requires_grad = false, DType dtype = DType::Float32);
 
   /**
    * @brief Create a learnable parameter tensor.
@@ -256,7 +751,7 @@ struct ParameterStore {
    * @param seed Random seed
    * @return Parameter tensor
    */
-  Tensor parameter(const std::vector<int>& shape, float scale = 0.01f,
+  Tensor parameter(const Shape& shape, float scale = 0.01f,
                    unsigned seed = 0);
 
   /**
@@ -295,29 +790,150 @@ struct ParameterStore {
 
   /**
    * @brief Zero all gradients.
+   *
+   * Row-sparse parameters only have their touched rows cleared.
    */
   void zero_grad();
 
+  /**
+   * @brief Track a 2-D parameter's gradient as a set of touched rows.
+   *
+   * Intended for embedding tables whose gradient comes mostly from
+   * embedding(). A step in which any other op also writes the gradient,
+   * such as a tied output projection, falls back to a dense update and a
+   * dense clear. Zeroes the parameter's gradient.
+   * @param param Parameter [rows, cols] created by this store
+   */
+  void enable_row_sparse_grad(const Tensor& param);
+
+  /**
+   * @brief Row-sparse bookkeeping for a parameter, if enabled.
+   * @param param Parameter tensor
+   * @return Pointer to the entry, or nullptr for dense parameters
+   */
+  RowSparseGrad* row_sparse_grad(const Tensor& param);
+
   /**
    * @brief Clear the operation tape.
    */
   void clear_tape();
 
+  /**
+   * @brief Whether ops currently record to the tape.
+   * @return False while a NoGradGuard is active
+   */
+  bool grad_enabled() const { return grad_mode; }
+
+  /**
+   * @brief Append an op to the tape if its output requires grad.
+   *
+   * While a Graph is capturing, every op also goes to its capture tape.
+   * @param op Operation to record
+   */
+  void record(const TapeOp& op) {
+    if (capture) capture->push_back(op);
+    if (grad_mode && op.out.requires_grad()) tape.push_back(op);
+  }
+
   /**
    * @brief Compute gradients via backpropagation.
    * @param loss Loss tensor to differentiate
    */
   void backward(const Tensor& loss);
 
+  /**
+   * @brief Backpropagate through the tape from a tensor whose gradient is
+   * already filled in.
+   *
+   * backward() seeds the loss and calls this; custom ops that record and
+   * replay a sub-graph of their own use it directly.
+   * @param out Tensor the pass starts from
+   */
+  void propagate(const Tensor& out);
+
  private:
   /**
    * @brief Register parameter allocation for gradient management.
-   * @param offset Allocation offset
+   * @param offset Gradient arena offset
    * @param count Number of elements
    */
   void register_parameter_allocation(size_t offset, size_t count);
 };
 
+/**
+ * @class NoGradGuard
+ * @brief RAII scope that disables gradient tracking on a ParameterStore.
+ *
+ * While active, ops record nothing on the tape and their outputs take no
+ * gradient space, which is all inference needs. Guards nest; the previous
+ * mode is restored on destruction.
+ */
+class NoGradGuard {
+ public:
+  /**
+   * @brief Disable gradient tracking on store.
+   * @param store ParameterStore to switch to inference mode
+   */
+  explicit NoGradGuard(ParameterStore& store)
+      : store_(store), prev_(store.grad_mode) {
+    store_.grad_mode = false;
+  }
+  ~NoGradGuard() { store_.grad_mode = prev_; }
+  NoGradGuard(const NoGradGuard&) = delete;
+  NoGradGuard& operator=(const NoGradGuard&) = delete;
+
+ private:
+  ParameterStore& store_;
+  bool prev_;
+};
+
+/**
+ * @class AutocastGuard
+ * @brief RAII scope that runs matmul and linear in reduced precision.
+ *
+ * Inside a BFloat16 scope, matmul() and linear() cast their float32
+ * operands to bfloat16 (recorded on the tape, so float32 parameters stay
+ * the master copy the optimizer updates), accumulate in float32 and store
+ * their outputs as bfloat16. Other ops read bfloat16 inputs through a
+ * float32 cast, so reductions and losses accumulate in float32. Guards
+ * nest; the previous mode is restored on destruction.
+ */
+class AutocastGuard {
+ public:
+  /**
+   * @brief Set the compute dtype of store's matmul and linear ops.
+   * @param store ParameterStore to switch
+   * @param dtype Compute dtype, normally DType::BFloat16
+   */
+  AutocastGuard(ParameterStore& store, DType dtype)
+      : store_(store), prev_(store.autocast) {
+    store_.autocast = dtype;
+  }
+  ~AutocastGuard() { store_.autocast = prev_; }
+  AutocastGuard(const AutocastGuard&) = delete;
+  AutocastGuard& operator=(const AutocastGuard&) = delete;
+
+ private:
+  ParameterStore& store_;
+  DType prev_;
+};
+
+/**
+ * @brief Recompute a recorded op's output from its inputs.
+ *
+ * Runs the same kernels as the op function that recorded it, without shape
+ * checks or allocation. Custom ops run their forward callback, if any.
+ * @param op Recorded operation
+ */
+void run_forward(TapeOp& op);
+
+/**
+ * @brief Accumulate a recorded op's input gradients from its output's.
+ * @param op Recorded operation
+ * @param store Store the op's tensors live in
+ */
+void run_backward(TapeOp& op, ParameterStore& store);
+
 /**
  * @name Tensor Operations
  * @brief Basic tensor operations with autograd support.
@@ -325,38 +941,48 @@ struct ParameterStore {
  */
 
 /**
- * @brief Element-wise addition.
+ * @brief Element-wise addition with NumPy-style broadcasting.
  * @param a First tensor
- * @param b Second tensor (same shape as a)
+ * @param b Second tensor (broadcastable against a)
  * @param store ParameterStore for memory allocation
- * @return Result tensor
+ * @return Result tensor with the broadcast shape
  */
 Tensor add(const Tensor& a, const Tensor& b, ParameterStore& store);
 
 /**
- * @brief Element-wise subtraction.
+ * @brief Element-wise subtraction with NumPy-style broadcasting.
  * @param a First tensor
- * @param b Second tensor (same shape as a)
+ * @param b Second tensor (broadcastable against a)
  * @param store ParameterStore for memory allocation
- * @return Result tensor
+ * @return Result tensor with the broadcast shape
  */
 Tensor sub(const Tensor& a, const Tensor& b, ParameterStore& store);
 
 /**
- * @brief Element-wise multiplication.
+ * @brief Element-wise multiplication with NumPy-style broadcasting.
  * @param a First tensor
- * @param b Second tensor (same shape as a)
+ * @param b Second tensor (broadcastable against a)
  * @param store ParameterStore for memory allocation
- * @return Result tensor
+ * @return Result tensor with the broadcast shape
  */
 Tensor mul(const Tensor& a, const Tensor& b, ParameterStore& store);
 
 /**
- * @brief Matrix multiplication.
- * @param a Left matrix [M,K]
- * @param b Right matrix [K,N]
+ * @brief Matrix multiplication, single or batched.
+ *
+ * Either operand may be bfloat16; it is widened while the GEMM packs it and
+ * products accumulate in float32. The result is float32, or bfloat16 inside
+ * an AutocastGuard.
+ *
+ * With a 3-D operand the product is batched, [B,M,K] x [B,K,N] -> [B,M,N].
+ * A 2-D operand, or a batch dim of 1, is broadcast across the batch, so
+ * [B,T,D] x [D,N] applies one weight to every sequence. Batched products
+ * run in float32 regardless of autocast. Views whose matrices GEMM can read
+ * in place (e.g. transpose(x, 1, 2)) are not copied.
+ * @param a Left matrix [M,K] or batch [B,M,K]
+ * @param b Right matrix [K,N] or batch [B,K,N]
  * @param store ParameterStore for memory allocation
- * @return Result matrix [M,N]
+ * @return Result matrix [M,N], or [B,M,N] when batched
  */
 Tensor matmul(const Tensor& a, const Tensor& b, ParameterStore& store);
 
@@ -401,7 +1027,161 @@ Tensor vlog(const Tensor& x, ParameterStore& store);
 Tensor sum(const Tensor& x, ParameterStore& store);
 
 /**
- * @brief Add bias vector to each row.
+ * @brief Mean binary cross-entropy between logits and targets.
+ *
+ * Computes sum(max(x, 0) - x * y + log(1 + exp(-|x|))) / N in one pass,
+ * where N is the leading dimension, and records a single tape op whose
+ * backward adds (sigmoid(x) - y) / N into the logits gradient. Targets are
+ * treated as constants and receive no gradient.
+ * @param logits Logits [N, ...]
+ * @param targets Targets in [0, 1], same shape as logits
+ * @param store ParameterStore for memory allocation
+ * @return Scalar tensor [1]
+ */
+Tensor bce_with_logits(const Tensor& logits, const Tensor& targets,
+                       ParameterStore& store);
+
+/**
+ * @brief Mean softmax cross-entropy between logits and integer class labels.
+ *
+ * Computes sum(logsumexp(x_i) - x_i[labels[i]]) / N with one max-shifted
+ * softmax per row and records a single tape op whose backward adds
+ * (softmax(x) - onehot(labels)) / N into the logits gradient; one-hot
+ * targets are never materialized. Rows are split across the thread pool
+ * when the class count is large.
+ * @param logits Logits [N, C]
+ * @param labels N class indices in [0, C); must stay alive until backward()
+ * @param store ParameterStore for memory allocation
+ * @return Scalar tensor [1]
+ * @throws std::out_of_range if a label is outside [0, C)
+ */
+Tensor softmax_cross_entropy(const Tensor& logits, const int32_t* labels,
+                             ParameterStore& store);
+
+/**
+ * @brief softmax_cross_entropy() with labels held in an int32 tensor.
+ *
+ * The labels live in the store's arena, so a captured Graph reads new
+ * labels written into the same tensor.
+ * @param logits Logits [N, C]
+ * @param labels Int32 class indices [N]
+ * @param store ParameterStore for memory allocation
+ * @return Scalar tensor [1]
+ * @throws std::invalid_argument if labels is not a dense int32 [N] tensor
+ * @throws std::out_of_range if a label is outside [0, C)
+ */
+Tensor softmax_cross_entropy(const Tensor& logits, const Tensor& labels,
+                             ParameterStore& store);
+
+/**
+ * @brief Fused linear layer: act(x * W + b) as a single tape op.
+ *
+ * Bias and activation are applied by the GEMM epilogue while each output
+ * tile is still in cache, so the [N, out] activation is written once.
+ * Backward turns the output gradient into the pre-activation gradient in
+ * place and reuses it for the x, W and b gradients. x and W may be
+ * bfloat16 as in matmul(); the bias is read as float32. A uint8 x (raw
+ * pixels, say) is widened while the GEMM packs it, and x_scale folds its
+ * normalization into the same pass, so no float copy of x is made.
+ * @param x Input [N, in]
+ * @param W Weight [in, out]
+ * @param b Bias [out], or an empty Tensor for no bias
+ * @param act Activation applied after the bias
+ * @param store ParameterStore for memory allocation
+ * @param x_scale Factor applied to x, e.g. 1 / 255 for uint8 pixels
+ * @return Output [N, out]
+ */
+Tensor linear(const Tensor& x, const Tensor& W, const Tensor& b,
+              kernels::Activation act, ParameterStore& store,
+              float x_scale = 1.0f);
+
+/**
+ * @struct QuantizedMatrix
+ * @brief Linear weights quantized to int8 per output channel.
+ *
+ * Holds the weights packed by kernels::pack_s8() for the int8 GEMM, with a
+ * scale and a column sum per output channel. Built once by
+ * quantize_per_channel() and kept outside the arena.
+ */
+struct QuantizedMatrix {
+  int rows = 0;               ///< Output channels
+  int cols = 0;               ///< Input features
+  std::vector<int8_t> data;   ///< Packed weights, see kernels::pack_s8()
+  std::vector<int32_t> sums;  ///< Sum of quantized weights per channel
+  std::vector<float> scales;  ///< Dequantization scale per channel
+};
+
+/**
+ * @brief Quantize linear weights symmetrically per output channel.
+ * @param W Weight [in, out], float32 or bfloat16
+ * @return Channel-major int8 copy with one scale per output channel
+ */
+QuantizedMatrix quantize_per_channel(const Tensor& W);
+
+/**
+ * @brief Inference-only linear layer on int8 weights: act(x * W + b).
+ *
+ * Each row of x is quantized to int8 on the fly with its own scale, the
+ * product accumulates exactly in int32, and the GEMM epilogue dequantizes,
+ * adds the bias and applies the activation. Nothing is recorded on the
+ * tape.
+ * @param x Input [N, in]
+ * @param W Weights from quantize_per_channel()
+ * @param b Bias [out], or an empty Tensor for no bias
+ * @param act Activation applied after the bias
+ * @param store ParameterStore for memory allocation
+ * @param x_scale Factor applied to x, as in linear()
+ * @return Float32 output [N, out] that does not require grad
+ * @throws std::logic_error if x requires grad while recording is on
+ */
+Tensor linear_s8(const Tensor& x, const QuantizedMatrix& W, const Tensor& b,
+                 kernels::Activation act, ParameterStore& store,
+                 float x_scale = 1.0f);
+
+/**
+ * @brief Gather rows of an embedding table by integer index.
+ *
+ * Equivalent to multiplying one-hot rows by the table without building
+ * them: forward copies one row per index and backward scatter-adds the
+ * output gradient into only the rows that were looked up.
+ * @param table Embedding table [V, D]
+ * @param indices Row indices in [0, V), laid out row-major in index_shape;
+ * must stay alive until backward()
+ * @param index_shape Shape of the index array, e.g. [N, T]
+ * @param store ParameterStore for memory allocation
+ * @return Embeddings of shape index_shape + [D]
+ * @throws std::out_of_range if an index is outside [0, V)
+ */
+Tensor embedding(const Tensor& table, const int32_t* indices,
+                 const Shape& index_shape, ParameterStore& store);
+
+/**
+ * @brief embedding() with indices held in an int32 tensor.
+ * @param table Embedding table [V, D]
+ * @param indices Int32 row indices of any shape
+ * @param store ParameterStore for memory allocation
+ * @return Embeddings of shape indices.shape + [D]
+ * @throws std::invalid_argument if indices is not int32
+ * @throws std::out_of_range if an index is outside [0, V)
+ */
+Tensor embedding(const Tensor& table, const Tensor& indices,
+                 ParameterStore& store);
+
+/**
+ * @brief Convert a tensor to another element type.
+ *
+ * Rounds to nearest even when narrowing to bfloat16; float to integer
+ * truncates toward zero and the value must fit the target. Backward passes
+ * the float32 gradient straight through; integer results have none.
+ * @param x Input tensor
+ * @param dtype Target element type
+ * @param store ParameterStore for memory allocation
+ * @return x itself if it already has dtype, else a dense converted copy
+ */
+Tensor cast(const Tensor& x, DType dtype, ParameterStore& store);
+
+/**
+ * @brief Add bias vector to each row; a shape-checked add() broadcast.
  * @param X Matrix [N,H]
  * @param b Bias vector [H]
  * @param store ParameterStore for memory allocation
@@ -410,3 +1190,76 @@ Tensor sum(const Tensor& x, ParameterStore& store);
 Tensor add_rowwise(const Tensor& X, const Tensor& b, ParameterStore& store);
 
 /** @} */
+
+/**
+ * @name Views
+ * @brief Zero-copy reinterpretations of a tensor's storage.
+ *
+ * Views share offsets into both the data and gradient buffers with their
+ * base, so gradients written through a view land in the base directly and
+ * no tape entry is recorded. Ops that need dense inputs insert a
+ * contiguous() copy for strided views automatically; matmul consumes
+ * transposed and row-sliced matrices, 2-D or batched 3-D, in place through
+ * GEMM transpose flags and leading dimensions. Negative dims count from the
+ * end.
+ * @{
+ */
+
+/**
+ * @brief Swap two dimensions.
+ * @param x Input tensor
+ * @param dim0 First dimension
+ * @param dim1 Second dimension
+ * @return View with the two dimensions exchanged
+ */
+Tensor transpose(const Tensor& x, int dim0 = 0, int dim1 = 1);
+
+/**
+ * @brief Restrict one dimension to [start, start + length).
+ * @param x Input tensor
+ * @param dim Dimension to narrow
+ * @param start First index kept
+ * @param length Number of indices kept
+ * @return View over the sub-range
+ */
+Tensor narrow(const Tensor& x, int dim, int start, int length);
+
+/**
+ * @brief Take every step-th index of one dimension in [start, end).
+ * @param x Input tensor
+ * @param dim Dimension to slice
+ * @param start First index kept
+ * @param end One past the last index considered
+ * @param step Positive stride between kept indices
+ * @return Strided view
+ */
+Tensor slice(const Tensor& x, int dim, int start, int end, int step = 1);
+
+/**
+ * @brief Reinterpret a contiguous tensor with a new shape.
+ * @param x Contiguous input tensor
+ * @param shape New shape; one entry may be -1 to infer it
+ * @return View with the new shape
+ * @throws std::invalid_argument if x is not contiguous or numel differs
+ */
+Tensor view(const Tensor& x, const Shape& shape);
+
+/**
+ * @brief Reshape, viewing when possible and copying otherwise.
+ * @param x Input tensor
+ * @param shape New shape; one entry may be -1 to infer it
+ * @param store ParameterStore for the copy when x is not contiguous
+ * @return Tensor with the new shape
+ */
+Tensor reshape(const Tensor& x, const Shape& shape,
+               ParameterStore& store);
+
+/**
+ * @brief Materialize a view into fresh contiguous storage.
+ * @param x Input tensor
+ * @param store ParameterStore for memory allocation
+ * @return x itself if already contiguous, else a dense copy on the tape
+ */
+Tensor contiguous(const Tensor& x, ParameterStore& store);
+
+/** @} */
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <vector>
 
 #include "tensor.hpp"
@@ -10,11 +11,25 @@ struct Sequential;
 
 namespace train {
 
+// Produces next-token logits [1, vocab_size] for a single input token.
+using TokenLogitsFn = std::function<Tensor(int token)>;
+
 // Compute average negative log-likelihood over consecutive next-token targets.
+float evaluate_sequence_nll(const TokenLogitsFn& logits_for,
+                            ParameterStore& store,
+                            const std::vector<int>& sequence, int vocab_size);
+
+// Compute average negative log-likelihood using one-hot evaluation input.
 float evaluate_sequence_nll(nn::Sequential& model, ParameterStore& store,
                             Tensor& scratch_input,
                             const std::vector<int>& sequence, int vocab_size);
 
+// Measure next-token accuracy over a sequence.
+float evaluate_sequence_accuracy(const TokenLogitsFn& logits_for,
+                                 ParameterStore& store,
+                                 const std::vector<int>& sequence,
+                                 int vocab_size);
+
 // Measure next-token accuracy over a sequence using one-hot evaluation input.
 float evaluate_sequence_accuracy(nn::Sequential& model, ParameterStore& store,
                                  Tensor& scratch_input,
@@ -0,0 +1,278 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define TFORMER_HAVE_MMAP 1
+#endif
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+// Elements committed at least per step, so small stores grow in few calls.
+constexpr size_t kMinCommit = 1024;
+constexpr size_t kHugePageBytes = size_t{2} << 20;
+
+size_t page_bytes() {
+#ifdef TFORMER_HAVE_MMAP
+  static const size_t n = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return n;
+#else
+  return sizeof(float);
+#endif
+}
+
+size_t round_up(size_t n, size_t unit) { return (n + unit - 1) / unit * unit; }
+
+size_t reserve_elements() {
+  static const size_t n = [] {
+    size_t gib = 64;
+    if (const char* env = std::getenv("TFORMER_ARENA_RESERVE_GB")) {
+      const long v = std::strtol(env, nullptr, 10);
+      if (v > 0) gib = static_cast<size_t>(v);
+    }
+    return (gib << 30) / sizeof(float);
+  }();
+  return n;
+}
+
+#ifdef TFORMER_HAVE_MMAP
+// Inaccessible, uncharged range of bytes starting on an align boundary, or
+// nullptr. Over-reserves by align and trims the ends to get there.
+char* map_reserve(size_t bytes, size_t align) {
+  if (sizeof(void*) < 8) return nullptr;
+  const size_t slack = align > page_bytes() ? align : 0;
+  void* p = mmap(nullptr, bytes + slack, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) return nullptr;
+  char* base = static_cast<char*>(p);
+  char* start = reinterpret_cast<char*>(
+      round_up(reinterpret_cast<uintptr_t>(base), slack ? align : 1));
+  if (start > base) munmap(base, static_cast<size_t>(start - base));
+  char* end = base + bytes + slack;
+  if (end > start + bytes)
+    munmap(start + bytes, static_cast<size_t>(end - (start + bytes)));
+  return start;
+}
+
+// Replaces [p, p + bytes) of a reservation with 2 MB hugetlb pages.
+bool map_hugetlb(char* p, size_t bytes) {
+#ifdef MAP_HUGETLB
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+  flags |= 21 << MAP_HUGE_SHIFT;
+#endif
+  return mmap(p, bytes, PROT_READ | PROT_WRITE, flags, -1, 0) != MAP_FAILED;
+#else
+  (void)p;
+  (void)bytes;
+  return false;
+#endif
+}
+#endif
+
+bool numa_place(char* p, size_t bytes, const ArenaPolicy& policy) {
+#ifdef __linux__
+  unsigned long mask = 0;
+  int mode = MPOL_INTERLEAVE;
+  if (policy.numa == NumaPlacement::Bind) {
+    if (policy.numa_node < 0 ||
+        policy.numa_node >= static_cast<int>(8 * sizeof(mask)))
+      return false;
+    mask = 1UL << policy.numa_node;
+    mode = MPOL_BIND;
+  } else {
+    // Every node the process may use; the kernel drops the others.
+    mask = ~0UL;
+  }
+  return syscall(SYS_mbind, p, bytes, mode, &mask, 8 * sizeof(mask), 0) == 0;
+#else
+  (void)p;
+  (void)bytes;
+  (void)policy;
+  return false;
+#endif
+}
+
+}  // namespace
+
+ArenaPolicy ArenaPolicy::from_env() {
+  ArenaPolicy policy;
+  if (const char* env = std::getenv("TFORMER_HUGE_PAGES")) {
+    if (!std::strcmp(env, "transparent") || !std::strcmp(env, "thp"))
+      policy.huge_pages = HugePages::Transparent;
+    else if (!std::strcmp(env, "explicit") || !std::strcmp(env, "hugetlb"))
+      policy.huge_pages = HugePages::Explicit;
+  }
+  if (const char* env = std::getenv("TFORMER_NUMA")) {
+    char* end = nullptr;
+    const long node = std::strtol(env, &end, 10);
+    if (!std::strcmp(env, "interleave")) {
+      policy.numa = NumaPlacement::Interleave;
+    } else if (end != env && *end == '\0' && node >= 0) {
+      policy.numa = NumaPlacement::Bind;
+      policy.numa_node = static_cast<int>(node);
+    }
+  }
+  return policy;
+}
+
+ArenaBuffer::ArenaBuffer() : ArenaBuffer(ArenaPolicy::from_env()) {}
+
+ArenaBuffer::ArenaBuffer(const ArenaPolicy& policy)
+    : policy_(policy), pages_(policy.huge_pages) {
+  if (policy_.alignment < alignof(float) ||
+      (policy_.alignment & (policy_.alignment - 1)))
+    policy_.alignment = 64;
+}
+
+ArenaBuffer::~ArenaBuffer() { release(); }
+
+ArenaBuffer::ArenaBuffer(ArenaBuffer&& other) noexcept
+    : policy_(other.policy_),
+      pages_(other.pages_),
+      data_(std::exchange(other.data_, nullptr)),
+      committed_(std::exchange(other.committed_, 0)),
+      reserved_(std::exchange(other.reserved_, 0)),
+      stats_(std::exchange(other.stats_, ArenaStats{})) {}
+
+ArenaBuffer& ArenaBuffer::operator=(ArenaBuffer&& other) noexcept {
+  if (this != &other) {
+    release();
+    policy_ = other.policy_;
+    pages_ = other.pages_;
+    data_ = std::exchange(other.data_, nullptr);
+    committed_ = std::exchange(other.committed_, 0);
+    reserved_ = std::exchange(other.reserved_, 0);
+    stats_ = std::exchange(other.stats_, ArenaStats{});
+  }
+  return *this;
+}
+
+void ArenaBuffer::release() {
+  if (!data_) return;
+#ifdef TFORMER_HAVE_MMAP
+  if (reserved_) munmap(data_, reserved_ * sizeof(float));
+#endif
+  if (!reserved_)
+    ::operator delete[](data_, std::align_val_t(policy_.alignment));
+  data_ = nullptr;
+  committed_ = 0;
+  reserved_ = 0;
+}
+
+// Commit unit in elements: whole huge pages when they are in use.
+size_t ArenaBuffer::granule() const {
+  const size_t bytes =
+      pages_ == HugePages::None ? page_bytes() : kHugePageBytes;
+  return bytes / sizeof(float);
+}
+
+bool ArenaBuffer::reserve(size_t count) {
+#ifdef TFORMER_HAVE_MMAP
+  const size_t align = std::max(
+      policy_.alignment, pages_ == HugePages::None ? size_t{0}
+                                                   : kHugePageBytes);
+  char* base = map_reserve(count * sizeof(float), align);
+  if (!base) return false;
+  data_ = reinterpret_cast<float*>(base);
+  reserved_ = count;
+  stats_.mapped = true;
+  return true;
+#else
+  (void)count;
+  return false;
+#endif
+}
+
+void ArenaBuffer::commit(size_t from, size_t to) {
+#ifdef TFORMER_HAVE_MMAP
+  char* p = reinterpret_cast<char*>(data_ + from);
+  const size_t bytes = (to - from) * sizeof(float);
+  bool huge = false;
+  if (pages_ == HugePages::Explicit) {
+    huge = map_hugetlb(p, bytes);
+    // The pool is short: use transparent huge pages from here on. A failed
+    // MAP_FIXED may have unmapped the range, so map it afresh.
+    if (!huge) {
+      pages_ = HugePages::Transparent;
+      if (mmap(p, bytes, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1,
+               0) == MAP_FAILED)
+        throw std::bad_alloc();
+    }
+  }
+  if (!huge) {
+    if (mprotect(p, bytes, PROT_READ | PROT_WRITE) != 0)
+      throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    if (pages_ == HugePages::Transparent)
+      huge = madvise(p, bytes, MADV_HUGEPAGE) == 0;
+#endif
+  }
+  if (huge) stats_.huge_page_bytes += bytes;
+  if (policy_.numa != NumaPlacement::FirstTouch &&
+      numa_place(p, bytes, policy_))
+    stats_.numa_bound_bytes += bytes;
+  stats_.commit_calls += 1;
+  stats_.committed_bytes = to * sizeof(float);
+#else
+  (void)from;
+  (void)to;
+#endif
+}
+
+bool ArenaBuffer::grow(size_t required, size_t used) {
+  if (required <= committed_) return false;
+  // Commit geometrically so a store growing one tensor at a time makes
+  // O(log n) calls.
+  size_t target = std::max({required, committed_ * 2, kMinCommit});
+
+  if (!data_) reserve(round_up(std::max(target, reserve_elements()),
+                               granule()));
+  if (reserved_ && required <= reserved_) {
+    target = std::min(round_up(target, granule()), reserved_);
+    commit(committed_, target);
+    committed_ = target;
+    return false;
+  }
+  if (reserved_) {
+    // Past the reservation: move to one twice the size.
+    ArenaBuffer next(policy_);
+    next.pages_ = pages_;
+    if (next.reserve(round_up(std::max(target, reserved_ * 2), granule()))) {
+      target = round_up(target, next.granule());
+      next.commit(0, target);
+      next.committed_ = target;
+      std::copy_n(data_, used, next.data_);
+      next.stats_.commit_calls += stats_.commit_calls;
+      *this = std::move(next);
+      return true;
+    }
+  }
+
+  float* grown = static_cast<float*>(::operator new[](
+      target * sizeof(float), std::align_val_t(policy_.alignment)));
+  if (data_) std::copy_n(data_, used, grown);
+  const bool moved = data_ != nullptr;
+  release();
+  data_ = grown;
+  committed_ = target;
+  stats_.mapped = false;
+  stats_.huge_page_bytes = 0;
+  stats_.numa_bound_bytes = 0;
+  stats_.commit_calls += 1;
+  stats_.committed_bytes = target * sizeof(float);
+  return moved;
+}
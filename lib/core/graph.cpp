@@ -0,0 +1,322 @@
+#include "graph.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#include "parallel.hpp"
+
+namespace {
+
+// Elements per fused tile: a few operands of this size stay in L1/L2.
+constexpr size_t kFuseTile = 2048;
+
+std::array<Tensor*, 4> operands(TapeOp& op) {
+  return {&op.out, &op.a, &op.b, &op.c};
+}
+
+std::array<const Tensor*, 4> operands(const TapeOp& op) {
+  return {&op.out, &op.a, &op.b, &op.c};
+}
+
+// One past the last data element t touches, relative to t.offset.
+size_t span(const Tensor& t) {
+  if (t.numel == 0) return 0;
+  size_t last = 0;
+  for (size_t i = 0; i < t.shape.size(); ++i)
+    last += static_cast<size_t>(t.shape[i] - 1) * t.strides[i];
+  return last + 1;
+}
+
+// Compared in bytes, since offsets count elements of each tensor's dtype.
+bool overlaps(const Tensor& t, const Tensor& r) {
+  const size_t ts = dtype_size(t.dtype);
+  const size_t rs = dtype_size(r.dtype);
+  return t.store && t.store == r.store &&
+         t.offset * ts < (r.offset + span(r)) * rs &&
+         r.offset * rs < (t.offset + span(t)) * ts;
+}
+
+bool same_tensor(const Tensor& x, const Tensor& y) {
+  return x.store == y.store && x.offset == y.offset && x.dtype == y.dtype &&
+         x.numel == y.numel && x.shape == y.shape && x.strides == y.strides;
+}
+
+bool same_op(const TapeOp& x, const TapeOp& y) {
+  return x.type == y.type && x.act == y.act && x.indices == y.indices &&
+         x.alpha == y.alpha &&
+         same_tensor(x.a, y.a) && same_tensor(x.b, y.b) &&
+         same_tensor(x.c, y.c) && x.out.shape == y.out.shape &&
+         x.out.requires_grad() == y.out.requires_grad();
+}
+
+// Whether any op in [begin, end) writes data overlapping t.
+bool written(const std::vector<TapeOp>& ops, size_t begin, size_t end,
+             const Tensor& t) {
+  for (size_t i = begin; i < end; ++i) {
+    if (overlaps(ops[i].out, t)) return true;
+    if (ops[i].type == OpType::SoftmaxCrossEntropy && overlaps(ops[i].b, t))
+      return true;
+  }
+  return false;
+}
+
+// Points t at first's output if it is a view into dup's.
+void redirect(Tensor& t, const Tensor& dup, const Tensor& first) {
+  if (!t.store || t.store != dup.store || t.dtype != dup.dtype ||
+      t.offset < dup.offset ||
+      t.offset + span(t) > dup.offset + dup.numel)
+    return;
+  t.offset = t.offset - dup.offset + first.offset;
+  if (t.requires_grad() && dup.requires_grad())
+    t.grad_offset = t.grad_offset - dup.grad_offset + first.grad_offset;
+}
+
+// Elementwise size op runs over, or 0 if it cannot join a fused run.
+// Operands are either that size and dense, or single elements; in backward
+// a single-element input must not take a gradient, since every tile would
+// accumulate into it.
+size_t tile_numel(const TapeOp& op, bool backward) {
+  switch (op.type) {
+    case OpType::Add:
+    case OpType::Sub:
+    case OpType::Mul:
+    case OpType::Relu:
+    case OpType::Tanh:
+    case OpType::Sigmoid:
+    case OpType::Log:
+      break;
+    case OpType::Sum:
+      if (!backward) return 0;
+      break;
+    default:
+      return 0;
+  }
+  const size_t n = op.type == OpType::Sum ? op.a.numel : op.out.numel;
+  if (n <= 1) return 0;
+  for (const Tensor* t : operands(op)) {
+    if (!t->store) continue;
+    if (t->numel == n) {
+      if (!t->is_contiguous()) return 0;
+    } else if (t->numel != 1) {
+      return 0;
+    } else if (backward && t != &op.out && t->requires_grad()) {
+      return 0;
+    }
+  }
+  return n;
+}
+
+// Arena ranges an op of a fused run writes or reads through: data in
+// forward, gradient slots in backward.
+struct Range {
+  size_t offset;
+  size_t count;
+};
+
+void add_ranges(const TapeOp& op, bool backward, std::vector<Range>& out) {
+  for (const Tensor* t : operands(op)) {
+    if (!t->store) continue;
+    if (!backward) {
+      out.push_back(Range{t->offset, t->numel});
+    } else if (t->requires_grad()) {
+      out.push_back(Range{t->grad_offset, t->numel});
+    }
+  }
+}
+
+// Tiles map element i of every operand to element i of the others, so a
+// run may only touch a location through operands that line up exactly.
+bool lines_up(const TapeOp& op, bool backward,
+              const std::vector<Range>& ranges) {
+  std::vector<Range> mine;
+  add_ranges(op, backward, mine);
+  for (const Range& r : mine) {
+    for (const Range& e : ranges) {
+      const bool hit = r.offset < e.offset + e.count &&
+                       e.offset < r.offset + r.count;
+      if (hit && (r.offset != e.offset || r.count != e.count)) return false;
+    }
+  }
+  return true;
+}
+
+template <typename Group>
+std::vector<Group> group_ops(const std::vector<TapeOp>& ops, bool backward) {
+  std::vector<Group> groups;
+  std::vector<Range> ranges;
+  for (size_t i = 0; i < ops.size(); ++i) {
+    const size_t n = tile_numel(ops[i], backward);
+    if (n && !groups.empty() && groups.back().numel == n &&
+        lines_up(ops[i], backward, ranges)) {
+      groups.back().end = i + 1;
+      add_ranges(ops[i], backward, ranges);
+      continue;
+    }
+    groups.push_back(Group{i, i + 1, n});
+    ranges.clear();
+    add_ranges(ops[i], backward, ranges);
+  }
+  return groups;
+}
+
+// Elements [begin, begin + n) of an elementwise op of size numel.
+TapeOp tile_of(const TapeOp& op, size_t numel, size_t begin, size_t n) {
+  TapeOp tile = op;
+  for (Tensor* t : operands(tile)) {
+    if (t->numel != numel) continue;
+    t->offset += begin;
+    if (t->requires_grad()) t->grad_offset += begin;
+    t->numel = n;
+    t->shape = Shape{static_cast<int>(n)};
+    t->strides = Strides{1};
+  }
+  return tile;
+}
+
+template <typename Group, typename Run>
+void run_groups(std::vector<TapeOp>& ops, const std::vector<Group>& groups,
+                Run run) {
+  for (const Group& g : groups) {
+    if (g.end - g.begin == 1) {
+      run(ops[g.begin]);
+      continue;
+    }
+    const size_t tiles = (g.numel + kFuseTile - 1) / kFuseTile;
+    parallel::parallel_for(0, tiles, 1, [&](size_t lo, size_t hi) {
+      for (size_t t = lo; t < hi; ++t) {
+        const size_t begin = t * kFuseTile;
+        const size_t n = std::min(kFuseTile, g.numel - begin);
+        for (size_t i = g.begin; i < g.end; ++i) {
+          TapeOp tile = tile_of(ops[i], g.numel, begin, n);
+          run(tile);
+        }
+      }
+    });
+  }
+}
+
+template <typename Group>
+std::vector<Group> singletons(size_t count) {
+  std::vector<Group> groups(count);
+  for (size_t i = 0; i < count; ++i) groups[i] = Group{i, i + 1, 0};
+  return groups;
+}
+
+}  // namespace
+
+Graph::~Graph() {
+  if (store_.capture == &recorded_) store_.capture = nullptr;
+}
+
+void Graph::begin_capture() {
+  if (store_.capture)
+    throw std::logic_error("Graph::capture while another capture is active");
+  forward_.clear();
+  backward_.clear();
+  forward_groups_.clear();
+  backward_groups_.clear();
+  loss_ = Tensor{};
+  recorded_.clear();
+  store_.clear_tape();
+  begin_ = store_.mark();
+  store_.capture = &recorded_;
+}
+
+Tensor Graph::end_capture(const Tensor& loss) {
+  store_.capture = nullptr;
+  if (loss.store != &store_ || !loss.requires_grad())
+    throw std::invalid_argument("Graph::capture loss does not require grad");
+  end_ = store_.mark();
+
+  // Released blocks inside the step's range are reused by the step itself
+  // on every replay, so nothing else may take them.
+  auto& blocks = store_.free_blocks;
+  while (!blocks.empty() && blocks.back().offset >= begin_.data)
+    blocks.pop_back();
+  if (!blocks.empty()) {
+    FreeBlock& top = blocks.back();
+    top.count = std::min(top.count, begin_.data - top.offset);
+  }
+
+  forward_.reserve(recorded_.size());
+  for (size_t i = 0; i < recorded_.size(); ++i)
+    forward_.push_back(recorded_[i]);
+  const std::vector<uint8_t>& live = store_.tape.mark_live(loss);
+  for (size_t i = store_.tape.size(); i-- > 0;) {
+    if (live[i]) backward_.push_back(store_.tape[i]);
+  }
+  recorded_.clear();
+  store_.clear_tape();
+  forward_groups_ = singletons<Group>(forward_.size());
+  backward_groups_ = singletons<Group>(backward_.size());
+
+  loss_ = loss;
+  float* g = loss_.grad();
+  for (size_t i = 0; i < loss_.numel; ++i) g[i] += 1.0f;
+  run_backward_plan();
+  return loss_;
+}
+
+void Graph::replay() {
+  if (!captured()) throw std::logic_error("Graph::replay before capture");
+  run_groups(forward_, forward_groups_, [](TapeOp& op) { run_forward(op); });
+  // Gradient slots created by the step start from zero, as they did when
+  // the step allocated them.
+  std::fill(store_.grad_ptr(begin_.grad), store_.grad_ptr(end_.grad), 0.0f);
+  float* g = loss_.grad();
+  for (size_t i = 0; i < loss_.numel; ++i) g[i] += 1.0f;
+  run_backward_plan();
+}
+
+void Graph::optimize() {
+  if (!captured()) throw std::logic_error("Graph::optimize before capture");
+  eliminate_common_subexpressions();
+  forward_groups_ = group_ops<Group>(forward_, false);
+  backward_groups_ = group_ops<Group>(backward_, true);
+}
+
+// A repeat of an earlier op is dropped when the earlier output and the
+// shared inputs are not overwritten in between, and nothing later writes
+// over either output, so the tensors inside the repeat's output range are
+// exactly its readers.
+void Graph::eliminate_common_subexpressions() {
+  for (size_t i = 0; i < forward_.size(); ++i) {
+    const TapeOp dup = forward_[i];
+    if (dup.type == OpType::Custom ||
+        dup.type == OpType::SoftmaxCrossEntropy || !dup.out.is_contiguous())
+      continue;
+    for (size_t j = 0; j < i; ++j) {
+      const TapeOp& first = forward_[j];
+      if (!same_op(first, dup) || !first.out.is_contiguous()) continue;
+      if (written(forward_, j + 1, i, dup.a) ||
+          written(forward_, j + 1, i, dup.b) ||
+          written(forward_, j + 1, i, dup.c) ||
+          written(forward_, j + 1, forward_.size(), first.out) ||
+          written(forward_, i + 1, forward_.size(), dup.out))
+        continue;
+      const Tensor kept = first.out;
+      forward_.erase(forward_.begin() + static_cast<std::ptrdiff_t>(i));
+      for (size_t k = i; k < forward_.size(); ++k) {
+        for (Tensor* t : operands(forward_[k])) redirect(*t, dup.out, kept);
+      }
+      backward_.erase(
+          std::remove_if(backward_.begin(), backward_.end(),
+                         [&](const TapeOp& op) {
+                           return same_tensor(op.out, dup.out);
+                         }),
+          backward_.end());
+      for (TapeOp& op : backward_) {
+        for (Tensor* t : operands(op)) redirect(*t, dup.out, kept);
+      }
+      redirect(loss_, dup.out, kept);
+      --i;
+      break;
+    }
+  }
+}
+
+void Graph::run_backward_plan() {
+  run_groups(backward_, backward_groups_,
+             [this](TapeOp& op) { run_backward(op, store_); });
+}
@@ -0,0 +1,283 @@
+#include <Accelerate/Accelerate.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "backends.hpp"
+#include "gemm.hpp"
+#include "qgemm.hpp"
+
+namespace kernels::detail {
+
+namespace {
+
+inline vDSP_Length len(size_t n) { return static_cast<vDSP_Length>(n); }
+
+void add(const float* a, const float* b, float* out, size_t n) {
+  vDSP_vadd(a, 1, b, 1, out, 1, len(n));
+}
+
+void sub(const float* a, const float* b, float* out, size_t n) {
+  // vDSP_vsub computes B - A with its arguments swapped.
+  vDSP_vsub(b, 1, a, 1, out, 1, len(n));
+}
+
+void mul(const float* a, const float* b, float* out, size_t n) {
+  vDSP_vmul(a, 1, b, 1, out, 1, len(n));
+}
+
+void add_inplace(float* dst, const float* src, size_t n) {
+  vDSP_vadd(dst, 1, src, 1, dst, 1, len(n));
+}
+
+void sub_inplace(float* dst, const float* src, size_t n) {
+  vDSP_vsub(src, 1, dst, 1, dst, 1, len(n));
+}
+
+void mul_add_inplace(float* dst, const float* a, const float* b, size_t n) {
+  vDSP_vma(a, 1, b, 1, dst, 1, dst, 1, len(n));
+}
+
+void add_scalar_inplace(float* dst, float v, size_t n) {
+  vDSP_vsadd(dst, 1, &v, dst, 1, len(n));
+}
+
+void scale_inplace(float* dst, float v, size_t n) {
+  vDSP_vsmul(dst, 1, &v, dst, 1, len(n));
+}
+
+void axpy(float* dst, float alpha, const float* x, size_t n) {
+  vDSP_vsma(x, 1, &alpha, dst, 1, dst, 1, len(n));
+}
+
+void relu(const float* x, float* out, size_t n) {
+  const float threshold = 0.0f;
+  vDSP_vthres(x, 1, &threshold, out, 1, len(n));
+}
+
+void vtanh(const float* x, float* out, size_t n) {
+  const int count = static_cast<int>(n);
+  if (count > 0) vvtanhf(out, x, &count);
+}
+
+void sigmoid(const float* x, float* out, size_t n) {
+  const int count = static_cast<int>(n);
+  if (count <= 0) return;
+  const float one = 1.0f;
+  const float neg_one = -1.0f;
+  vDSP_vsmul(x, 1, &neg_one, out, 1, len(n));
+  vvexpf(out, out, &count);
+  vDSP_vsadd(out, 1, &one, out, 1, len(n));
+  vDSP_svdiv(&one, out, 1, out, 1, len(n));
+}
+
+void vlog(const float* x, float* out, size_t n) {
+  const int count = static_cast<int>(n);
+  if (count > 0) vvlogf(out, x, &count);
+}
+
+float sum(const float* x, size_t n) {
+  float acc = 0.0f;
+  if (n > 0) vDSP_sve(x, 1, &acc, len(n));
+  return acc;
+}
+
+float dot(const float* a, const float* b, size_t n) {
+  float acc = 0.0f;
+  if (n > 0) vDSP_dotpr(a, 1, b, 1, &acc, len(n));
+  return acc;
+}
+
+void relu_backward(const float* g, const float* x, float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) gx[i] += x[i] > 0.0f ? g[i] : 0.0f;
+}
+
+void tanh_backward(const float* g, const float* y, float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) gx[i] += g[i] * (1.0f - y[i] * y[i]);
+}
+
+void sigmoid_backward(const float* g, const float* y, float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) gx[i] += g[i] * y[i] * (1.0f - y[i]);
+}
+
+void log_backward(const float* g, const float* x, float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) gx[i] += g[i] / x[i];
+}
+
+float bce_with_logits(const float* x, const float* y, size_t n) {
+  float total = 0.0f;
+  for (size_t i = 0; i < n; ++i) {
+    total += std::max(x[i], 0.0f) - x[i] * y[i] +
+             std::log1p(std::exp(-std::fabs(x[i])));
+  }
+  return total;
+}
+
+void bce_with_logits_backward(const float* x, const float* y, float scale,
+                              float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    gx[i] += scale * (1.0f / (1.0f + std::exp(-x[i])) - y[i]);
+  }
+}
+
+float softmax(const float* x, float* p, size_t n) {
+  const int count = static_cast<int>(n);
+  if (count <= 0) return -INFINITY;
+  float mx = 0.0f;
+  vDSP_maxv(x, 1, &mx, len(n));
+  const float shift = -mx;
+  vDSP_vsadd(x, 1, &shift, p, 1, len(n));
+  vvexpf(p, p, &count);
+  float total = 0.0f;
+  vDSP_sve(p, 1, &total, len(n));
+  scale_inplace(p, 1.0f / total, n);
+  return mx + std::log(total);
+}
+
+void bias_act(float* x, const float* bias, Activation act, size_t n) {
+  if (bias) add_inplace(x, bias, n);
+  switch (act) {
+    case Activation::None:
+      return;
+    case Activation::Relu:
+      relu(x, x, n);
+      return;
+    case Activation::Tanh:
+      vtanh(x, x, n);
+      return;
+    case Activation::Sigmoid:
+      sigmoid(x, x, n);
+      return;
+  }
+}
+
+void act_backward(float* g, const float* y, Activation act, size_t n) {
+  switch (act) {
+    case Activation::None:
+      return;
+    case Activation::Relu:
+      for (size_t i = 0; i < n; ++i) g[i] = y[i] > 0.0f ? g[i] : 0.0f;
+      return;
+    case Activation::Tanh:
+      for (size_t i = 0; i < n; ++i) g[i] *= 1.0f - y[i] * y[i];
+      return;
+    case Activation::Sigmoid:
+      for (size_t i = 0; i < n; ++i) g[i] *= y[i] * (1.0f - y[i]);
+      return;
+  }
+}
+
+void sgemm(bool trans_a, bool trans_b, int M, int N, int K, float alpha,
+           const float* A, int lda, const float* B, int ldb, float beta,
+           float* C, int ldc) {
+  if (M == 0 || N == 0) return;
+  if (K == 0) {
+    // cblas_sgemm rejects k == 0 on some versions; apply beta by hand.
+    for (int i = 0; i < M; ++i) {
+      float* c = C + static_cast<size_t>(i) * ldc;
+      if (beta == 0.0f) {
+        std::memset(c, 0, static_cast<size_t>(N) * sizeof(float));
+      } else {
+        scale_inplace(c, beta, static_cast<size_t>(N));
+      }
+    }
+    return;
+  }
+  cblas_sgemm(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans,
+              trans_b ? CblasTrans : CblasNoTrans,
+              static_cast<__LAPACK_int>(M), static_cast<__LAPACK_int>(N),
+              static_cast<__LAPACK_int>(K), alpha, A,
+              static_cast<__LAPACK_int>(lda), B,
+              static_cast<__LAPACK_int>(ldb), beta, C,
+              static_cast<__LAPACK_int>(ldc));
+}
+
+void sgemm_batched(bool trans_a, bool trans_b, int M, int N, int K,
+                   float alpha, const float* A, int lda, size_t stride_a,
+                   const float* B, int ldb, size_t stride_b, float beta,
+                   float* C, int ldc, size_t stride_c, int batch) {
+  gemm::batched_sgemm(sgemm, trans_a, trans_b, M, N, K, alpha, A, lda,
+                      stride_a, B, ldb, stride_b, beta, C, ldc, stride_c,
+                      batch);
+}
+
+void sgemm_bias_act(bool trans_a, bool trans_b, int M, int N, int K,
+                    const float* A, int lda, const float* B, int ldb,
+                    const float* bias, Activation act, float* C, int ldc) {
+  sgemm(trans_a, trans_b, M, N, K, 1.0f, A, lda, B, ldb, 0.0f, C, ldc);
+  if (bias == nullptr && act == Activation::None) return;
+  for (int i = 0; i < M; ++i) {
+    bias_act(C + static_cast<size_t>(i) * ldc, bias, act,
+             static_cast<size_t>(N));
+  }
+}
+
+void f32_to_bf16(const float* x, uint16_t* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = float_to_bf16(x[i]);
+}
+
+void bf16_to_f32(const uint16_t* x, float* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = bf16_to_float(x[i]);
+}
+
+// BLAS has no bfloat16 or uint8 GEMM here; widen the operands and call
+// cblas.
+void gemm_mixed(bool trans_a, bool trans_b, int M, int N, int K, float alpha,
+                const void* A, Operand a_type, int lda, const void* B,
+                Operand b_type, int ldb, float beta, const float* bias,
+                Activation act, float* C, int ldc) {
+  gemm::widened_gemm(sgemm, bias_act, trans_a, trans_b, M, N, K, alpha, A,
+                     a_type, lda, B, b_type, ldb, beta, bias, act, C, ldc);
+}
+
+// BLAS has no int8 GEMM either; borrow the NEON sdot kernel on Apple
+// silicon and the portable one elsewhere.
+decltype(KernelTable::gemm_s8) gemm_s8() {
+#ifdef TFORMER_KERNELS_NEON
+  return neon_table().gemm_s8;
+#else
+  return scalar_table().gemm_s8;
+#endif
+}
+
+}  // namespace
+
+const KernelTable& accelerate_table() {
+  static const KernelTable table{"accelerate",
+                                 add,
+                                 sub,
+                                 mul,
+                                 add_inplace,
+                                 sub_inplace,
+                                 mul_add_inplace,
+                                 add_scalar_inplace,
+                                 scale_inplace,
+                                 axpy,
+                                 relu,
+                                 vtanh,
+                                 sigmoid,
+                                 vlog,
+                                 sum,
+                                 dot,
+                                 relu_backward,
+                                 tanh_backward,
+                                 sigmoid_backward,
+                                 log_backward,
+                                 bce_with_logits,
+                                 bce_with_logits_backward,
+                                 softmax,
+                                 bias_act,
+                                 act_backward,
+                                 sgemm,
+                                 sgemm_batched,
+                                 sgemm_bias_act,
+                                 f32_to_bf16,
+                                 bf16_to_f32,
+                                 gemm_mixed,
+                                 qgemm::quantize_s8,
+                                 gemm_s8()};
+  return table;
+}
+
+}  // namespace kernels::detail
@@ -0,0 +1,135 @@
+#include <immintrin.h>
+
+#include <cstring>
+
+#include "backends.hpp"
+#include "gemm.hpp"
+#include "qgemm.hpp"
+#include "simd.hpp"
+
+namespace kernels::detail {
+
+namespace {
+
+struct Avx2 {
+  using reg = __m256;
+  using mask = __m256;
+  static constexpr size_t width = 8;
+
+  static reg load(const float* p) { return _mm256_loadu_ps(p); }
+  static void store(float* p, reg v) { _mm256_storeu_ps(p, v); }
+  static reg set1(float v) { return _mm256_set1_ps(v); }
+  static reg zero() { return _mm256_setzero_ps(); }
+  static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+  static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+  static reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+  static reg min(reg a, reg b) { return _mm256_min_ps(a, b); }
+  static reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+  static reg abs(reg a) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+  }
+  static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+  static reg fnmadd(reg a, reg b, reg c) { return _mm256_fnmadd_ps(a, b, c); }
+  static mask lt(reg a, reg b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static mask gt(reg a, reg b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static reg blend(mask m, reg a, reg b) { return _mm256_blendv_ps(a, b, m); }
+  static reg round(reg x) {
+    return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  }
+  static reg pow2i(reg n) {
+    __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+  }
+  static reg frexp(reg x, reg& e) {
+    const __m256i bits = _mm256_castps_si256(x);
+    const __m256i exp_bits = _mm256_srli_epi32(bits, 23);
+    e = _mm256_cvtepi32_ps(_mm256_sub_epi32(exp_bits, _mm256_set1_epi32(126)));
+    const __m256i mant = _mm256_or_si256(
+        _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+        _mm256_set1_epi32(0x3f000000));
+    return _mm256_castsi256_ps(mant);
+  }
+  static reg load_bf16(const uint16_t* p) {
+    const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+  }
+  static void store_bf16(uint16_t* p, reg x) {
+    const __m256i bits = _mm256_castps_si256(x);
+    const __m256i lsb =
+        _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+    __m256i r = _mm256_add_epi32(bits, _mm256_set1_epi32(0x7fff));
+    r = _mm256_srli_epi32(_mm256_add_epi32(r, lsb), 16);
+    const __m256i nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16),
+                                        _mm256_set1_epi32(0x40));
+    r = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_castsi256_ps(r), _mm256_castsi256_ps(nan),
+        _mm256_cmp_ps(x, x, _CMP_UNORD_Q)));
+    // packus works per 128-bit lane; gather the two halves back in order.
+    const __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(r, r), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p),
+                     _mm256_castsi256_si128(packed));
+  }
+  static float reduce_add(reg v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+  }
+};
+
+using Avx2Gemm = gemm::Config<Avx2, 6, 16, 144, 256, 4080>;
+
+// Int8 dot products for qgemm. Without VNNI, maddubs multiplies |a| by
+// sign(a) * b into int16 pairs (at most 2 * 127 * 127, so no saturation)
+// and madd widens them to int32 lanes.
+struct Avx2Dot {
+  using acc = __m256i;
+  using b4 = __m256i;
+  struct a4 {
+    __m256i abs;
+    __m256i sign;
+  };
+  static constexpr int lanes = 8;
+  static constexpr int32_t offset = 0;
+
+  static acc zero() { return _mm256_setzero_si256(); }
+  static a4 load_a(const int8_t* p) {
+    int32_t bits;
+    std::memcpy(&bits, p, sizeof(bits));
+    const __m256i v = _mm256_set1_epi32(bits);
+    return {_mm256_abs_epi8(v), v};
+  }
+  static b4 load_b(const int8_t* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+  static acc madd(acc c, const a4& a, b4 b) {
+    const __m256i p = _mm256_maddubs_epi16(a.abs, _mm256_sign_epi8(b, a.sign));
+    return _mm256_add_epi32(c, _mm256_madd_epi16(p, _mm256_set1_epi16(1)));
+  }
+  static void store(int32_t* p, acc c) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), c);
+  }
+};
+
+using Avx2QGemm = qgemm::Config<Avx2Dot, 4, 16, 64>;
+
+}  // namespace
+
+const KernelTable& avx2_table() {
+  static const KernelTable table = simd::make_table<Avx2>(
+      "avx2", gemm::sgemm<Avx2Gemm, simd::sgemm<Avx2>>,
+      gemm::sgemm_batched<Avx2Gemm, simd::sgemm<Avx2>>,
+      gemm::sgemm_bias_act<Avx2Gemm, simd::sgemm<Avx2>,
+                           simd::bias_act<Avx2>>,
+      gemm::gemm_mixed<Avx2Gemm, simd::sgemm<Avx2>, simd::bias_act<Avx2>>,
+      qgemm::gemm_s8<Avx2QGemm, simd::bias_act<Avx2>>);
+  return table;
+}
+
+}  // namespace kernels::detail
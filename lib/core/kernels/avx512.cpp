@@ -0,0 +1,102 @@
+#include <immintrin.h>
+
+#include "backends.hpp"
+#include "gemm.hpp"
+#include "simd.hpp"
+
+namespace kernels::detail {
+
+namespace {
+
+struct Avx512 {
+  using reg = __m512;
+  using mask = __mmask16;
+  static constexpr size_t width = 16;
+
+  static reg load(const float* p) { return _mm512_loadu_ps(p); }
+  static void store(float* p, reg v) { _mm512_storeu_ps(p, v); }
+  static reg set1(float v) { return _mm512_set1_ps(v); }
+  static reg zero() { return _mm512_setzero_ps(); }
+  static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+  static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+  static reg div(reg a, reg b) { return _mm512_div_ps(a, b); }
+  static reg min(reg a, reg b) { return _mm512_min_ps(a, b); }
+  static reg max(reg a, reg b) { return _mm512_max_ps(a, b); }
+  static reg abs(reg a) { return _mm512_abs_ps(a); }
+  static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+  static reg fnmadd(reg a, reg b, reg c) { return _mm512_fnmadd_ps(a, b, c); }
+  static mask lt(reg a, reg b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+  }
+  static mask gt(reg a, reg b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+  }
+  static reg blend(mask m, reg a, reg b) {
+    return _mm512_mask_blend_ps(m, a, b);
+  }
+  static reg round(reg x) {
+    return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT |
+                                       _MM_FROUND_NO_EXC);
+  }
+  static reg pow2i(reg n) {
+    __m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+  }
+  static reg frexp(reg x, reg& e) {
+    const __m512i bits = _mm512_castps_si512(x);
+    const __m512i exp_bits = _mm512_srli_epi32(bits, 23);
+    e = _mm512_cvtepi32_ps(_mm512_sub_epi32(exp_bits, _mm512_set1_epi32(126)));
+    const __m512i mant = _mm512_or_si512(
+        _mm512_and_si512(bits, _mm512_set1_epi32(0x007fffff)),
+        _mm512_set1_epi32(0x3f000000));
+    return _mm512_castsi512_ps(mant);
+  }
+  static reg load_bf16(const uint16_t* p) {
+    const __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+  }
+  static void store_bf16(uint16_t* p, reg x) {
+    const __m512i bits = _mm512_castps_si512(x);
+    const __m512i lsb =
+        _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+    __m512i r = _mm512_add_epi32(bits, _mm512_set1_epi32(0x7fff));
+    r = _mm512_srli_epi32(_mm512_add_epi32(r, lsb), 16);
+    const __m512i nan = _mm512_or_si512(_mm512_srli_epi32(bits, 16),
+                                        _mm512_set1_epi32(0x40));
+    r = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q), r,
+                                nan);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p),
+                        _mm512_cvtepi32_epi16(r));
+  }
+  static float reduce_add(reg v) { return _mm512_reduce_add_ps(v); }
+};
+
+using Avx512Gemm = gemm::Config<Avx512, 8, 32, 128, 256, 4096>;
+
+// VNNI lives in its own translation unit (avx512_vnni.cpp) since this one
+// only assumes AVX-512F. Without it, fall back to the AVX2 maddubs kernel,
+// which every AVX-512 part can run.
+decltype(KernelTable::gemm_s8) avx512_gemm_s8() {
+  if (__builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vnni")) {
+    return avx512_vnni_gemm_s8;
+  }
+  return avx2_table().gemm_s8;
+}
+
+}  // namespace
+
+const KernelTable& avx512_table() {
+  static const KernelTable table = simd::make_table<Avx512>(
+      "avx512", gemm::sgemm<Avx512Gemm, simd::sgemm<Avx512>>,
+      gemm::sgemm_batched<Avx512Gemm, simd::sgemm<Avx512>>,
+      gemm::sgemm_bias_act<Avx512Gemm, simd::sgemm<Avx512>,
+                           simd::bias_act<Avx512>>,
+      gemm::gemm_mixed<Avx512Gemm, simd::sgemm<Avx512>,
+                      simd::bias_act<Avx512>>,
+      avx512_gemm_s8());
+  return table;
+}
+
+}  // namespace kernels::detail
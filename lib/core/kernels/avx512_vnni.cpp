@@ -0,0 +1,54 @@
+#include <immintrin.h>
+
+#include <cstring>
+
+#include "backends.hpp"
+#include "qgemm.hpp"
+
+// Int8 GEMM for CPUs with AVX-512 VNNI. Kept apart from avx512.cpp, which
+// only assumes AVX-512F; avx512_table() installs it after checking the CPU.
+namespace kernels::detail {
+
+namespace {
+
+// vpdpbusd multiplies unsigned bytes by signed bytes and adds each group of
+// four straight into an int32 lane. A arrives as a + 128 (offset below),
+// the driver subtracts 128 times the column sums of B afterwards.
+struct VnniDot {
+  using acc = __m512i;
+  using b4 = __m512i;
+  static constexpr int lanes = 16;
+  static constexpr int32_t offset = 128;
+
+  static acc zero() { return _mm512_setzero_si512(); }
+  static __m512i load_a(const int8_t* p) {
+    int32_t bits;
+    std::memcpy(&bits, p, sizeof(bits));
+    return _mm512_set1_epi32(bits);
+  }
+  static b4 load_b(const int8_t* p) { return _mm512_loadu_si512(p); }
+  static acc madd(acc c, __m512i a, b4 b) {
+    return _mm512_dpbusd_epi32(c, a, b);
+  }
+  static void store(int32_t* p, acc c) { _mm512_storeu_si512(p, c); }
+};
+
+using VnniQGemm = qgemm::Config<VnniDot, 8, 32, 64>;
+
+// The epilogue runs the AVX-512 backend's own bias/activation kernel.
+void bias_act(float* x, const float* bias, Activation act, size_t n) {
+  avx512_table().bias_act(x, bias, act, n);
+}
+
+}  // namespace
+
+void avx512_vnni_gemm_s8(int M, int N, int K, const int8_t* A, int lda,
+                         const float* a_scale, const int8_t* B,
+                         const int32_t* b_sum, const float* b_scale,
+                         const float* bias, Activation act, float* C,
+                         int ldc) {
+  qgemm::gemm_s8<VnniQGemm, bias_act>(M, N, K, A, lda, a_scale, B, b_sum,
+                                      b_scale, bias, act, C, ldc);
+}
+
+}  // namespace kernels::detail
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "kernels.hpp"
+
+// Per-backend kernel tables. Each SIMD backend lives in its own translation
+// unit compiled with the matching instruction-set flags; the dispatcher only
+// calls into one after checking the CPU supports it.
+namespace kernels::detail {
+
+const KernelTable& scalar_table();
+
+#ifdef TFORMER_KERNELS_AVX2
+const KernelTable& avx2_table();
+#endif
+
+#ifdef TFORMER_KERNELS_AVX512
+const KernelTable& avx512_table();
+// Built with AVX-512 BW and VNNI; only call after checking both.
+void avx512_vnni_gemm_s8(int M, int N, int K, const int8_t* A, int lda,
+                         const float* a_scale, const int8_t* B,
+                         const int32_t* b_sum, const float* b_scale,
+                         const float* bias, Activation act, float* C,
+                         int ldc);
+#endif
+
+#ifdef TFORMER_KERNELS_NEON
+const KernelTable& neon_table();
+#endif
+
+#ifdef TFORMER_KERNELS_ACCELERATE
+const KernelTable& accelerate_table();
+#endif
+
+}  // namespace kernels::detail
@@ -0,0 +1,99 @@
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "backends.hpp"
+#include "kernels.hpp"
+
+namespace kernels {
+
+namespace {
+
+struct Backend {
+  const char* name;
+  const KernelTable& (*table)();
+  bool (*supported)();
+};
+
+[[maybe_unused]] bool always() { return true; }
+
+#if defined(__x86_64__) || defined(__i386__)
+[[maybe_unused]] bool cpu_has_avx2() {
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+[[maybe_unused]] bool cpu_has_avx512() {
+  return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+// Ordered best first; the first supported entry becomes the default.
+const std::vector<Backend>& registry() {
+  static const std::vector<Backend> backends = {
+#ifdef TFORMER_KERNELS_ACCELERATE
+      {"accelerate", detail::accelerate_table, always},
+#endif
+#ifdef TFORMER_KERNELS_AVX512
+      {"avx512", detail::avx512_table, cpu_has_avx512},
+#endif
+#ifdef TFORMER_KERNELS_AVX2
+      {"avx2", detail::avx2_table, cpu_has_avx2},
+#endif
+#ifdef TFORMER_KERNELS_NEON
+      {"neon", detail::neon_table, always},
+#endif
+      {"scalar", detail::scalar_table, always},
+  };
+  return backends;
+}
+
+const KernelTable* pick_default() {
+  if (const char* env = std::getenv("TFORMER_KERNEL_BACKEND")) {
+    if (env[0] != '\0') {
+      if (const KernelTable* table = find_backend(env)) return table;
+      std::cerr << "TFORMER_KERNEL_BACKEND=" << env
+                << " is not available on this machine; using default"
+                << std::endl;
+    }
+  }
+  for (const auto& backend : registry()) {
+    if (backend.supported()) return &backend.table();
+  }
+  return &detail::scalar_table();
+}
+
+std::atomic<const KernelTable*>& current() {
+  static std::atomic<const KernelTable*> table{pick_default()};
+  return table;
+}
+
+}  // namespace
+
+const KernelTable* find_backend(const std::string& name) {
+  for (const auto& backend : registry()) {
+    if (name == backend.name && backend.supported()) return &backend.table();
+  }
+  return nullptr;
+}
+
+const KernelTable& active() {
+  return *current().load(std::memory_order_relaxed);
+}
+
+bool set_backend(const std::string& name) {
+  const KernelTable* table = find_backend(name);
+  if (!table) return false;
+  current().store(table, std::memory_order_relaxed);
+  return true;
+}
+
+std::vector<std::string> available_backends() {
+  std::vector<std::string> names;
+  for (const auto& backend : registry()) {
+    if (backend.supported()) names.emplace_back(backend.name);
+  }
+  return names;
+}
+
+}  // namespace kernels
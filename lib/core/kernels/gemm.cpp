@@ -0,0 +1,79 @@
+#include "gemm.hpp"
+
+#include <vector>
+
+namespace kernels::gemm {
+
+float* pack_workspace(int slot, size_t n) {
+  thread_local std::vector<float> buffers[4];
+  std::vector<float>& buf = buffers[slot];
+  if (buf.size() < n) buf.resize(n);
+  return buf.data();
+}
+
+namespace {
+
+// Dense float copy of a rows x cols operand stored with leading dimension
+// ld; float operands are used in place.
+const float* widen_operand(const void* X, Operand type, int rows, int cols,
+                           int& ld, int slot) {
+  if (type == Operand::F32) return static_cast<const float*>(X);
+  float* dst = pack_workspace(slot, static_cast<size_t>(rows) * cols);
+  with_operand(X, type, [&](auto src) {
+    for (int r = 0; r < rows; ++r) {
+      const auto* s = src + static_cast<size_t>(r) * ld;
+      float* d = dst + static_cast<size_t>(r) * cols;
+      for (int c = 0; c < cols; ++c) d[c] = widen(s[c]);
+    }
+  });
+  ld = cols;
+  return dst;
+}
+
+}  // namespace
+
+void widened_gemm(decltype(KernelTable::sgemm) gemm,
+                  decltype(KernelTable::bias_act) bias_act, bool trans_a,
+                  bool trans_b, int M, int N, int K, float alpha,
+                  const void* A, Operand a_type, int lda, const void* B,
+                  Operand b_type, int ldb, float beta, const float* bias,
+                  Activation act, float* C, int ldc) {
+  if (M <= 0 || N <= 0) return;
+  const int k = std::max(K, 0);
+  const float* a = widen_operand(A, k ? a_type : Operand::F32,
+                                 trans_a ? k : M, trans_a ? M : k, lda, 2);
+  const float* b = widen_operand(B, k ? b_type : Operand::F32,
+                                 trans_b ? N : k, trans_b ? k : N, ldb, 3);
+  gemm(trans_a, trans_b, M, N, K, alpha, a, lda, b, ldb, beta, C, ldc);
+  if (bias == nullptr && act == Activation::None) return;
+  for (int i = 0; i < M; ++i) {
+    bias_act(C + static_cast<size_t>(i) * ldc, bias, act,
+             static_cast<size_t>(N));
+  }
+}
+
+void batched_sgemm(decltype(KernelTable::sgemm) gemm, bool trans_a,
+                   bool trans_b, int M, int N, int K, float alpha,
+                   const float* A, int lda, size_t stride_a, const float* B,
+                   int ldb, size_t stride_b, float beta, float* C, int ldc,
+                   size_t stride_c, int batch) {
+  if (batch <= 0 || M <= 0 || N <= 0) return;
+  const auto one = [&](size_t i) {
+    gemm(trans_a, trans_b, M, N, K, alpha, A + i * stride_a, lda,
+         B + i * stride_b, ldb, beta, C + i * stride_c, ldc);
+  };
+  const size_t flops = static_cast<size_t>(M) * N * std::max(K, 1);
+  const size_t n = static_cast<size_t>(batch);
+  if (stride_c == 0 || n == 1 ||
+      (flops >= kBatchSplitFlops && n < parallel::num_threads())) {
+    for (size_t i = 0; i < n; ++i) one(i);
+    return;
+  }
+  // Enough matrices per chunk to amortize a task over small problems.
+  const size_t grain = std::max<size_t>(1, kSmallGemmFlops * 4 / flops);
+  parallel::parallel_for(0, n, grain, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i) one(i);
+  });
+}
+
+}  // namespace kernels::gemm
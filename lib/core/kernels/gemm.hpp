@@ -0,0 +1,402 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "kernels.hpp"
+#include "math.hpp"
+#include "parallel.hpp"
+
+// BLIS-style packed SGEMM shared by the native backends.
+//
+// Loop structure (row-major C[M,N] += op(A)[M,K] * op(B)[K,N]):
+//   pc: K in KC slices     -> pack all of op(A)[:, pc] into MR-row panels
+//     jc: N in NC slices   -> pack op(B)[pc, jc] into NR-column panels
+//       tasks over (MC rows x group of NR panels), run on the thread pool
+//         jr: NR panel     (B micro-panel stays in L1)
+//           ir: MR panel   (A block stays in L2)
+//             micro-kernel: MR x NR register tile over kc
+//
+// Transposes are absorbed by the packing routines, so the micro-kernel only
+// ever sees unit-stride panels. alpha is folded into the packed A panels and
+// beta is applied to C once up front. An optional epilogue (bias +
+// activation) runs on each tile right after its last K slice.
+//
+// Everything here is templated on the backend's Config so each ISA gets its
+// own instantiation; non-template helpers live in gemm.cpp, which is built
+// without any instruction-set flags.
+namespace kernels::gemm {
+
+/**
+ * @brief Per-thread scratch for packed panels, grown on demand.
+ *
+ * Thread-local so GEMMs issued from pool workers never share buffers; steady
+ * state calls do not allocate.
+ * @param slot 0 for the A panels, 1 for the B panels, 2 and 3 for operands
+ * widened by widened_gemm()
+ * @param n Minimum number of floats
+ */
+float* pack_workspace(int slot, size_t n);
+
+/**
+ * @brief gemm_mixed for problems not worth packing, and for backends without
+ * a packed driver: widens bfloat16 and uint8 operands into workspace slots 2
+ * and 3, then runs gemm and applies bias_act row by row.
+ */
+void widened_gemm(decltype(KernelTable::sgemm) gemm,
+                  decltype(KernelTable::bias_act) bias_act, bool trans_a,
+                  bool trans_b, int M, int N, int K, float alpha,
+                  const void* A, Operand a_type, int lda, const void* B,
+                  Operand b_type, int ldb, float beta, const float* bias,
+                  Activation act, float* C, int ldc);
+
+// Blocking parameters for one ISA. NR must be a multiple of V::width.
+template <class V, int MR_, int NR_, int MC_, int KC_, int NC_>
+struct Config {
+  using Vec = V;
+  static constexpr int MR = MR_;
+  static constexpr int NR = NR_;
+  static constexpr int MC = MC_;
+  static constexpr int KC = KC_;
+  static constexpr int NC = NC_;
+  static_assert(NR_ % V::width == 0, "NR must be a multiple of vector width");
+  static_assert(MC_ % MR_ == 0, "MC must be a multiple of MR");
+  static_assert(NC_ % NR_ == 0, "NC must be a multiple of NR");
+};
+
+// Below this many multiply-adds packing costs more than it saves.
+constexpr size_t kSmallGemmFlops = 32 * 32 * 32;
+
+// Below this many multiply-adds per matrix, a batch runs one matrix per pool
+// thread rather than splitting each GEMM across the pool.
+constexpr size_t kBatchSplitFlops = 128 * 128 * 128;
+
+/**
+ * @brief Shared driver behind KernelTable::sgemm_batched: calls gemm once
+ * per matrix, either from pool workers (where its own parallel_for runs
+ * serially) or in order from the caller when each GEMM is worth threading
+ * or every product lands in the same C.
+ */
+void batched_sgemm(decltype(KernelTable::sgemm) gemm, bool trans_a,
+                   bool trans_b, int M, int N, int K, float alpha,
+                   const float* A, int lda, size_t stride_a, const float* B,
+                   int ldb, size_t stride_b, float beta, float* C, int ldc,
+                   size_t stride_c, int batch);
+
+// c[MR, NR] (row stride ldc) += a_panel[kc, MR] * b_panel[kc, NR]
+template <class Cfg>
+inline void micro_kernel(int kc, const float* a, const float* b, float* c,
+                         size_t ldc) {
+  using V = typename Cfg::Vec;
+  constexpr int MR = Cfg::MR;
+  constexpr int NV = Cfg::NR / static_cast<int>(V::width);
+  constexpr int W = static_cast<int>(V::width);
+  typename V::reg acc[MR][NV];
+#pragma GCC unroll 16
+  for (int r = 0; r < MR; ++r) {
+#pragma GCC unroll 8
+    for (int v = 0; v < NV; ++v) acc[r][v] = V::zero();
+  }
+  for (int p = 0; p < kc; ++p) {
+    typename V::reg bv[NV];
+#pragma GCC unroll 8
+    for (int v = 0; v < NV; ++v) bv[v] = V::load(b + v * W);
+#pragma GCC unroll 16
+    for (int r = 0; r < MR; ++r) {
+      const auto av = V::set1(a[r]);
+#pragma GCC unroll 8
+      for (int v = 0; v < NV; ++v) acc[r][v] = V::fmadd(av, bv[v], acc[r][v]);
+    }
+    a += MR;
+    b += Cfg::NR;
+  }
+#pragma GCC unroll 16
+  for (int r = 0; r < MR; ++r) {
+    float* row = c + static_cast<size_t>(r) * ldc;
+#pragma GCC unroll 8
+    for (int v = 0; v < NV; ++v) {
+      V::store(row + v * W, V::add(V::load(row + v * W), acc[r][v]));
+    }
+  }
+}
+
+// Source element as float: bfloat16 and uint8 operands are widened during
+// packing. Internal linkage, like the helpers in kernels.hpp, since each ISA
+// translation unit compiles its own copy.
+static inline float widen(float v) { return v; }
+static inline float widen(uint16_t v) { return bf16_to_float(v); }
+static inline float widen(uint8_t v) { return static_cast<float>(v); }
+
+// Calls f with p cast to the element pointer type of t.
+template <class F>
+void with_operand(const void* p, Operand t, F&& f) {
+  switch (t) {
+    case Operand::BF16:
+      f(static_cast<const uint16_t*>(p));
+      break;
+    case Operand::U8:
+      f(static_cast<const uint8_t*>(p));
+      break;
+    case Operand::F32:
+      f(static_cast<const float*>(p));
+      break;
+  }
+}
+
+// Packs rows [i0, i0 + MR) of alpha * op(A)[:, p0:p0+kc] as one panel laid
+// out k-major (MR values per k). Rows past M are zero.
+template <class Cfg, class T>
+inline void pack_a_panel(bool trans_a, const T* A, int lda, int M, int i0,
+                         int p0, int kc, float alpha, float* dst) {
+  constexpr int MR = Cfg::MR;
+  const int rows = math::min(MR, M - i0);
+  if (!trans_a) {
+    for (int r = 0; r < rows; ++r) {
+      const T* src = A + static_cast<size_t>(i0 + r) * lda + p0;
+      for (int k = 0; k < kc; ++k) dst[k * MR + r] = alpha * widen(src[k]);
+    }
+  } else {
+    for (int k = 0; k < kc; ++k) {
+      const T* src = A + static_cast<size_t>(p0 + k) * lda + i0;
+      for (int r = 0; r < rows; ++r) dst[k * MR + r] = alpha * widen(src[r]);
+    }
+  }
+  if (rows < MR) {
+    for (int k = 0; k < kc; ++k) {
+      for (int r = rows; r < MR; ++r) dst[k * MR + r] = 0.0f;
+    }
+  }
+}
+
+// Packs columns [j0, j0 + NR) of op(B)[p0:p0+kc, :] as one panel laid out
+// k-major (NR values per k). Columns past N are zero.
+template <class Cfg, class T>
+inline void pack_b_panel(bool trans_b, const T* B, int ldb, int N, int j0,
+                         int p0, int kc, float* dst) {
+  constexpr int NR = Cfg::NR;
+  const int cols = math::min(NR, N - j0);
+  if (!trans_b) {
+    for (int k = 0; k < kc; ++k) {
+      const T* src = B + static_cast<size_t>(p0 + k) * ldb + j0;
+      float* d = dst + static_cast<size_t>(k) * NR;
+      if constexpr (std::is_same_v<T, float>) {
+        std::memcpy(d, src, static_cast<size_t>(cols) * sizeof(float));
+      } else {
+        for (int j = 0; j < cols; ++j) d[j] = widen(src[j]);
+      }
+      for (int j = cols; j < NR; ++j) d[j] = 0.0f;
+    }
+  } else {
+    for (int j = 0; j < cols; ++j) {
+      const T* src = B + static_cast<size_t>(j0 + j) * ldb + p0;
+      for (int k = 0; k < kc; ++k) dst[k * NR + j] = widen(src[k]);
+    }
+    if (cols < NR) {
+      for (int k = 0; k < kc; ++k) {
+        for (int j = cols; j < NR; ++j) dst[k * NR + j] = 0.0f;
+      }
+    }
+  }
+}
+
+template <class Cfg>
+inline void apply_beta(float beta, int M, int N, float* C, int ldc) {
+  if (beta == 1.0f) return;
+  for (int i = 0; i < M; ++i) {
+    float* c = C + static_cast<size_t>(i) * ldc;
+    if (beta == 0.0f) {
+      std::memset(c, 0, static_cast<size_t>(N) * sizeof(float));
+    } else {
+      for (int j = 0; j < N; ++j) c[j] *= beta;
+    }
+  }
+}
+
+// Row epilogue applied to finished tiles: c = act(c + bias). Plain data
+// so the per-ISA instantiations share no inline code.
+struct Epilogue {
+  decltype(KernelTable::bias_act) fn = nullptr;
+  const float* bias = nullptr;
+  Activation act = Activation::None;
+};
+
+// Packed driver; requires M, N, K > 0. epi.fn may be null. TA and TB are
+// float or uint16_t (bfloat16); either way the panels are float.
+template <class Cfg, class TA, class TB>
+void packed_sgemm(bool trans_a, bool trans_b, int M, int N, int K,
+                  float alpha, const TA* A, int lda, const TB* B, int ldb,
+                  float beta, float* C, int ldc, const Epilogue& epi) {
+  constexpr int MR = Cfg::MR;
+  constexpr int NR = Cfg::NR;
+  constexpr int MC = Cfg::MC;
+  constexpr int KC = Cfg::KC;
+  constexpr int NC = Cfg::NC;
+
+  apply_beta<Cfg>(beta, M, N, C, ldc);
+
+  const int m_panels = (M + MR - 1) / MR;
+  float* a_pack =
+      pack_workspace(0, static_cast<size_t>(m_panels) * MR * KC);
+  float* b_pack = pack_workspace(
+      1, static_cast<size_t>((math::min(N, NC) + NR - 1) / NR) * NR * KC);
+  const size_t threads = parallel::num_threads();
+
+  for (int pc = 0; pc < K; pc += KC) {
+    const int kc = math::min(KC, K - pc);
+    const size_t a_stride = static_cast<size_t>(MR) * kc;
+    parallel::parallel_for(
+        0, static_cast<size_t>(m_panels), 4, [&](size_t lo, size_t hi) {
+          for (size_t p = lo; p < hi; ++p) {
+            pack_a_panel<Cfg>(trans_a, A, lda, M, static_cast<int>(p) * MR, pc,
+                             kc, alpha, a_pack + p * a_stride);
+          }
+        });
+
+    const bool finish = epi.fn != nullptr && pc + kc == K;
+
+    for (int jc = 0; jc < N; jc += NC) {
+      const int nc = math::min(NC, N - jc);
+      const int n_panels = (nc + NR - 1) / NR;
+      const size_t b_stride = static_cast<size_t>(NR) * kc;
+      parallel::parallel_for(
+          0, static_cast<size_t>(n_panels), 4, [&](size_t lo, size_t hi) {
+            for (size_t p = lo; p < hi; ++p) {
+              pack_b_panel<Cfg>(trans_b, B, ldb, N,
+                               jc + static_cast<int>(p) * NR, pc, kc,
+                               b_pack + p * b_stride);
+            }
+          });
+
+      // Split the (MC block x NR panel group) grid finely enough to give
+      // every thread a few tasks; single-threaded runs get one group per
+      // MC block so B panels are swept in order.
+      const int m_blocks = (M + MC - 1) / MC;
+      const size_t want = threads > 1 ? threads * 4 : 1;
+      int group = n_panels;
+      if (static_cast<size_t>(m_blocks) < want) {
+        const size_t per_block = (want + m_blocks - 1) / m_blocks;
+        group = math::max<int>(
+            1, static_cast<int>((n_panels + per_block - 1) / per_block));
+      }
+      const int n_groups = (n_panels + group - 1) / group;
+
+      parallel::parallel_for(
+          0, static_cast<size_t>(m_blocks) * n_groups, 1,
+          [&](size_t lo, size_t hi) {
+            alignas(64) float edge[MR * NR];
+            for (size_t t = lo; t < hi; ++t) {
+              const int ib = static_cast<int>(t) / n_groups;
+              const int jg = static_cast<int>(t) % n_groups;
+              const int i_begin = ib * MC;
+              const int i_end = math::min(M, i_begin + MC);
+              const int jp_begin = jg * group;
+              const int jp_end = math::min(n_panels, jp_begin + group);
+              for (int jp = jp_begin; jp < jp_end; ++jp) {
+                const int j0 = jc + jp * NR;
+                const int cols = math::min(NR, N - j0);
+                const float* bp = b_pack + static_cast<size_t>(jp) * b_stride;
+                for (int i0 = i_begin; i0 < i_end; i0 += MR) {
+                  const int rows = math::min(MR, M - i0);
+                  const float* ap = a_pack + static_cast<size_t>(i0 / MR) *
+                                                 a_stride;
+                  float* c = C + static_cast<size_t>(i0) * ldc + j0;
+                  if (rows == MR && cols == NR) {
+                    micro_kernel<Cfg>(kc, ap, bp, c, static_cast<size_t>(ldc));
+                  } else {
+                    std::memset(edge, 0, sizeof(edge));
+                    micro_kernel<Cfg>(kc, ap, bp, edge, NR);
+                    for (int r = 0; r < rows; ++r) {
+                      float* dst = c + static_cast<size_t>(r) * ldc;
+                      const float* src = edge + r * NR;
+                      for (int j = 0; j < cols; ++j) dst[j] += src[j];
+                    }
+                  }
+                  if (finish) {
+                    const float* bias = epi.bias ? epi.bias + j0 : nullptr;
+                    for (int r = 0; r < rows; ++r) {
+                      epi.fn(c + static_cast<size_t>(r) * ldc, bias, epi.act,
+                             static_cast<size_t>(cols));
+                    }
+                  }
+                }
+              }
+            }
+          });
+    }
+  }
+}
+
+// Small selects the unpacked kernel used below kSmallGemmFlops.
+template <class Cfg, decltype(KernelTable::sgemm) Small>
+void sgemm(bool trans_a, bool trans_b, int M, int N, int K, float alpha,
+           const float* A, int lda, const float* B, int ldb, float beta,
+           float* C, int ldc) {
+  if (M <= 0 || N <= 0) return;
+  if (K <= 0 || alpha == 0.0f ||
+      static_cast<size_t>(M) * N * K < kSmallGemmFlops) {
+    Small(trans_a, trans_b, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+    return;
+  }
+  packed_sgemm<Cfg>(trans_a, trans_b, M, N, K, alpha, A, lda, B, ldb, beta, C,
+                    ldc, Epilogue{});
+}
+
+template <class Cfg, decltype(KernelTable::sgemm) Small>
+void sgemm_batched(bool trans_a, bool trans_b, int M, int N, int K,
+                   float alpha, const float* A, int lda, size_t stride_a,
+                   const float* B, int ldb, size_t stride_b, float beta,
+                   float* C, int ldc, size_t stride_c, int batch) {
+  batched_sgemm(sgemm<Cfg, Small>, trans_a, trans_b, M, N, K, alpha, A, lda,
+                stride_a, B, ldb, stride_b, beta, C, ldc, stride_c, batch);
+}
+
+// C = act(op(A) * op(B) + bias) with the epilogue fused into the tile loop.
+template <class Cfg, decltype(KernelTable::sgemm) Small,
+          decltype(KernelTable::bias_act) BiasAct>
+void sgemm_bias_act(bool trans_a, bool trans_b, int M, int N, int K,
+                    const float* A, int lda, const float* B, int ldb,
+                    const float* bias, Activation act, float* C, int ldc) {
+  if (M <= 0 || N <= 0) return;
+  const bool plain = bias == nullptr && act == Activation::None;
+  if (K <= 0 || static_cast<size_t>(M) * N * K < kSmallGemmFlops) {
+    Small(trans_a, trans_b, M, N, K, 1.0f, A, lda, B, ldb, 0.0f, C, ldc);
+    if (plain) return;
+    for (int i = 0; i < M; ++i) {
+      BiasAct(C + static_cast<size_t>(i) * ldc, bias, act,
+              static_cast<size_t>(N));
+    }
+    return;
+  }
+  packed_sgemm<Cfg>(trans_a, trans_b, M, N, K, 1.0f, A, lda, B, ldb, 0.0f, C,
+                    ldc, plain ? Epilogue{} : Epilogue{BiasAct, bias, act});
+}
+
+// gemm_mixed entry: large problems run the packed driver with narrow
+// operands widened during packing, the rest go through widened_gemm().
+template <class Cfg, decltype(KernelTable::sgemm) Small,
+          decltype(KernelTable::bias_act) BiasAct>
+void gemm_mixed(bool trans_a, bool trans_b, int M, int N, int K, float alpha,
+                const void* A, Operand a_type, int lda, const void* B,
+                Operand b_type, int ldb, float beta, const float* bias,
+                Activation act, float* C, int ldc) {
+  if (M <= 0 || N <= 0) return;
+  if (K <= 0 || alpha == 0.0f ||
+      static_cast<size_t>(M) * N * K < kSmallGemmFlops) {
+    widened_gemm(Small, BiasAct, trans_a, trans_b, M, N, K, alpha, A, a_type,
+                 lda, B, b_type, ldb, beta, bias, act, C, ldc);
+    return;
+  }
+  const Epilogue epi = bias == nullptr && act == Activation::None
+                           ? Epilogue{}
+                           : Epilogue{BiasAct, bias, act};
+  with_operand(A, a_type, [&](auto a) {
+    with_operand(B, b_type, [&](auto b) {
+      packed_sgemm<Cfg>(trans_a, trans_b, M, N, K, alpha, a, lda, b, ldb,
+                        beta, C, ldc, epi);
+    });
+  });
+}
+
+}  // namespace kernels::gemm
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <math.h>
+
+// Scalar helpers for code compiled into the ISA-flagged backends.
+//
+// Inline and template functions with external linkage are emitted as weak
+// COMDAT copies in every translation unit that does not inline them (all of
+// them at -O0), and the linker keeps one copy for the whole program. A copy
+// from a TU built with -mavx512f may then serve callers on CPUs without
+// AVX-512. std::max, std::exp and the like are such functions, so kernel
+// headers call these instead: each is static, giving every TU its own
+// private copy, and the math forwards to the C library, which is compiled
+// once for the baseline ISA. tests/check_isa_linkage.cmake fails if an ISA
+// object defines a weak symbol again.
+namespace kernels::math {
+
+template <class T>
+static inline T min(T a, T b) {
+  return b < a ? b : a;
+}
+
+template <class T>
+static inline T max(T a, T b) {
+  return a < b ? b : a;
+}
+
+static inline float fabs(float x) { return ::fabsf(x); }
+static inline float exp(float x) { return ::expf(x); }
+static inline float log(float x) { return ::logf(x); }
+static inline float log1p(float x) { return ::log1pf(x); }
+static inline float nearbyint(float x) { return ::nearbyintf(x); }
+
+}  // namespace kernels::math
@@ -0,0 +1,110 @@
+#include <arm_neon.h>
+
+#include <cstring>
+
+#include "backends.hpp"
+#include "gemm.hpp"
+#include "qgemm.hpp"
+#include "simd.hpp"
+
+namespace kernels::detail {
+
+namespace {
+
+struct Neon {
+  using reg = float32x4_t;
+  using mask = uint32x4_t;
+  static constexpr size_t width = 4;
+
+  static reg load(const float* p) { return vld1q_f32(p); }
+  static void store(float* p, reg v) { vst1q_f32(p, v); }
+  static reg set1(float v) { return vdupq_n_f32(v); }
+  static reg zero() { return vdupq_n_f32(0.0f); }
+  static reg add(reg a, reg b) { return vaddq_f32(a, b); }
+  static reg sub(reg a, reg b) { return vsubq_f32(a, b); }
+  static reg mul(reg a, reg b) { return vmulq_f32(a, b); }
+  static reg div(reg a, reg b) { return vdivq_f32(a, b); }
+  static reg min(reg a, reg b) { return vminq_f32(a, b); }
+  static reg max(reg a, reg b) { return vmaxq_f32(a, b); }
+  static reg abs(reg a) { return vabsq_f32(a); }
+  static reg fmadd(reg a, reg b, reg c) { return vfmaq_f32(c, a, b); }
+  static reg fnmadd(reg a, reg b, reg c) { return vfmsq_f32(c, a, b); }
+  static mask lt(reg a, reg b) { return vcltq_f32(a, b); }
+  static mask gt(reg a, reg b) { return vcgtq_f32(a, b); }
+  static reg blend(mask m, reg a, reg b) { return vbslq_f32(m, b, a); }
+  static reg round(reg x) { return vrndnq_f32(x); }
+  static reg pow2i(reg n) {
+    int32x4_t e = vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127));
+    return vreinterpretq_f32_s32(vshlq_n_s32(e, 23));
+  }
+  static reg frexp(reg x, reg& e) {
+    const uint32x4_t bits = vreinterpretq_u32_f32(x);
+    const int32x4_t exp_bits = vreinterpretq_s32_u32(vshrq_n_u32(bits, 23));
+    e = vcvtq_f32_s32(vsubq_s32(exp_bits, vdupq_n_s32(126)));
+    const uint32x4_t mant = vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007fffff)),
+                                      vdupq_n_u32(0x3f000000));
+    return vreinterpretq_f32_u32(mant);
+  }
+  static reg load_bf16(const uint16_t* p) {
+    return vreinterpretq_f32_u32(vshlq_n_u32(vmovl_u16(vld1_u16(p)), 16));
+  }
+  static void store_bf16(uint16_t* p, reg x) {
+    const uint32x4_t bits = vreinterpretq_u32_f32(x);
+    const uint32x4_t lsb = vandq_u32(vshrq_n_u32(bits, 16), vdupq_n_u32(1));
+    uint32x4_t r = vaddq_u32(vaddq_u32(bits, vdupq_n_u32(0x7fff)), lsb);
+    r = vshrq_n_u32(r, 16);
+    const uint32x4_t nan =
+        vorrq_u32(vshrq_n_u32(bits, 16), vdupq_n_u32(0x40));
+    r = vbslq_u32(vceqq_f32(x, x), r, nan);
+    vst1_u16(p, vmovn_u32(r));
+  }
+  static float reduce_add(reg v) { return vaddvq_f32(v); }
+};
+
+using NeonGemm = gemm::Config<Neon, 8, 12, 128, 256, 4092>;
+
+// Int8 dot products for qgemm: sdot (vdotq_s32) adds each lane's four
+// products straight into int32. Without the dot-product extension, widening
+// multiplies into int16 (two products per lane fit) are pairwise added
+// down to one int32 per column.
+struct NeonDot {
+  using acc = int32x4_t;
+  using b4 = int8x16_t;
+  static constexpr int lanes = 4;
+  static constexpr int32_t offset = 0;
+
+  static acc zero() { return vdupq_n_s32(0); }
+  static int8x16_t load_a(const int8_t* p) {
+    int32_t bits;
+    std::memcpy(&bits, p, sizeof(bits));
+    return vreinterpretq_s8_s32(vdupq_n_s32(bits));
+  }
+  static b4 load_b(const int8_t* p) { return vld1q_s8(p); }
+  static acc madd(acc c, int8x16_t a, b4 b) {
+#if defined(__ARM_FEATURE_DOTPROD)
+    return vdotq_s32(c, a, b);
+#else
+    const int16x8_t lo = vmull_s8(vget_low_s8(a), vget_low_s8(b));
+    const int16x8_t hi = vmull_high_s8(a, b);
+    return vpadalq_s16(c, vpaddq_s16(lo, hi));
+#endif
+  }
+  static void store(int32_t* p, acc c) { vst1q_s32(p, c); }
+};
+
+using NeonQGemm = qgemm::Config<NeonDot, 4, 16, 64>;
+
+}  // namespace
+
+const KernelTable& neon_table() {
+  static const KernelTable table = simd::make_table<Neon>(
+      "neon", gemm::sgemm<NeonGemm, simd::sgemm<Neon>>,
+      gemm::sgemm_batched<NeonGemm, simd::sgemm<Neon>>,
+      gemm::sgemm_bias_act<NeonGemm, simd::sgemm<Neon>,
+                           simd::bias_act<Neon>>,
+      gemm::gemm_mixed<NeonGemm, simd::sgemm<Neon>, simd::bias_act<Neon>>,
+      qgemm::gemm_s8<NeonQGemm, simd::bias_act<Neon>>);
+  return table;
+}
+
+}  // namespace kernels::detail
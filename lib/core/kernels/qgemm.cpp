@@ -0,0 +1,48 @@
+#include "qgemm.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace kernels::qgemm {
+
+uint8_t* offset_workspace(size_t n) {
+  thread_local std::vector<uint8_t> buffer;
+  if (buffer.size() < n) buffer.resize(n);
+  return buffer.data();
+}
+
+float quantize_s8(const float* x, int8_t* q, size_t n) {
+  float amax = 0.0f;
+  for (size_t i = 0; i < n; ++i) amax = std::max(amax, std::fabs(x[i]));
+  if (amax == 0.0f) {
+    std::memset(q, 0, n);
+    return 0.0f;
+  }
+  const float inv = 127.0f / amax;
+  for (size_t i = 0; i < n; ++i) {
+    const float r = std::nearbyint(x[i] * inv);
+    q[i] = static_cast<int8_t>(std::min(127.0f, std::max(-127.0f, r)));
+  }
+  return amax / 127.0f;
+}
+
+}  // namespace kernels::qgemm
+
+namespace kernels {
+
+void pack_s8(const int8_t* W, int N, int K, int8_t* packed, int32_t* sums) {
+  const size_t ld = static_cast<size_t>(s8_ld(N));
+  std::memset(packed, 0, static_cast<size_t>(s8_groups(K)) * ld * 4);
+  for (int n = 0; n < N; ++n) {
+    const int8_t* w = W + static_cast<size_t>(n) * K;
+    int32_t sum = 0;
+    for (int k = 0; k < K; ++k) {
+      packed[((k / 4) * ld + n) * 4 + k % 4] = w[k];
+      sum += w[k];
+    }
+    sums[n] = sum;
+  }
+}
+
+}  // namespace kernels
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "kernels.hpp"
+#include "math.hpp"
+#include "parallel.hpp"
+
+// Int8 GEMM for dynamically quantized linear layers.
+//
+//   C[m,n] = act(sa[m] * sb[n] * sum_k A[m,k] * B[k,n] + bias[n])
+//
+// A holds activations quantized per row, B weights quantized per output
+// channel and packed once by pack_s8() in groups of four K values per
+// column (see kernels.hpp), the layout the dot-product instructions consume
+// directly: one vector of B covers four K values for a run of columns, and
+// four bytes of an A row broadcast to every lane. Products accumulate
+// exactly in int32 over the whole of K, so there is no K blocking.
+//
+// Loop structure:
+//   tasks over (MC rows x group of NR-column panels), run on the thread pool
+//     jr: NR panel     (K * NR bytes of B stay in L1/L2)
+//       ir: MR rows    (A block stays in L2)
+//         micro-kernel: MR x NR int32 tile over all K groups
+//   epilogue per tile: dequantize, then bias + activation while in cache
+//
+// The backend supplies a Dot policy:
+//   lanes             int32 lanes (columns) per vector
+//   offset            128 when madd reads A as unsigned: the driver flips
+//                     the sign bits of A once up front (a + 128) and
+//                     subtracts 128 times the column sums of B at the end
+//   acc / b4          accumulator and B register types
+//   zero(), load_a(p) (four bytes of a row), load_b(p) (lanes * 4 bytes),
+//   madd(acc, a, b), store(int32_t*, acc)
+// Like gemm.hpp, the driver is a template so each ISA gets its own
+// instantiation.
+namespace kernels::qgemm {
+
+// Portable symmetric quantization for backends without SIMD traits. Lives
+// in qgemm.cpp, built without ISA flags.
+float quantize_s8(const float* x, int8_t* q, size_t n);
+
+/**
+ * @brief Per-thread scratch for A with its sign bits flipped.
+ * @param n Minimum number of bytes
+ */
+uint8_t* offset_workspace(size_t n);
+
+// Blocking parameters for one ISA. NR must divide kS8Columns.
+template <class D, int MR_, int NR_, int MC_>
+struct Config {
+  using Dot = D;
+  static constexpr int MR = MR_;
+  static constexpr int NR = NR_;
+  static constexpr int MC = MC_;
+  static_assert(NR_ % D::lanes == 0, "NR must be a multiple of Dot::lanes");
+  static_assert(kS8Columns % NR_ == 0, "NR must divide kS8Columns");
+  static_assert(MC_ % MR_ == 0, "MC must be a multiple of MR");
+};
+
+// tile[MR, NR] = sum over k4 groups of a rows x B panel. Rows are passed as
+// pointers so the edge tile can repeat the last row instead of branching.
+template <class Cfg>
+inline void micro_kernel(int k4, const int8_t* const* a, const int8_t* b,
+                         size_t b_stride, int32_t* tile) {
+  using D = typename Cfg::Dot;
+  constexpr int MR = Cfg::MR;
+  constexpr int L = D::lanes;
+  constexpr int NV = Cfg::NR / L;
+  typename D::acc acc[MR][NV];
+#pragma GCC unroll 16
+  for (int r = 0; r < MR; ++r) {
+#pragma GCC unroll 8
+    for (int v = 0; v < NV; ++v) acc[r][v] = D::zero();
+  }
+  for (int g = 0; g < k4; ++g) {
+    typename D::b4 bv[NV];
+#pragma GCC unroll 8
+    for (int v = 0; v < NV; ++v) bv[v] = D::load_b(b + v * L * 4);
+#pragma GCC unroll 16
+    for (int r = 0; r < MR; ++r) {
+      const auto av = D::load_a(a[r] + 4 * g);
+#pragma GCC unroll 8
+      for (int v = 0; v < NV; ++v) acc[r][v] = D::madd(acc[r][v], av, bv[v]);
+    }
+    b += b_stride;
+  }
+#pragma GCC unroll 16
+  for (int r = 0; r < MR; ++r) {
+#pragma GCC unroll 8
+    for (int v = 0; v < NV; ++v) D::store(tile + r * Cfg::NR + v * L, acc[r][v]);
+  }
+}
+
+template <class Cfg, decltype(KernelTable::bias_act) BiasAct>
+void gemm_s8(int M, int N, int K, const int8_t* A, int lda,
+             const float* a_scale, const int8_t* B, const int32_t* b_sum,
+             const float* b_scale, const float* bias, Activation act,
+             float* C, int ldc) {
+  constexpr int MR = Cfg::MR;
+  constexpr int NR = Cfg::NR;
+  constexpr int MC = Cfg::MC;
+  constexpr int32_t offset = Cfg::Dot::offset;
+  if (M <= 0 || N <= 0) return;
+  const int k4 = s8_groups(K);
+  const size_t b_stride = static_cast<size_t>(s8_ld(N)) * 4;
+  const int n_panels = (N + NR - 1) / NR;
+  const int m_blocks = (M + MC - 1) / MC;
+  const bool epilogue = bias != nullptr || act != Activation::None;
+  if constexpr (offset != 0) {
+    static_assert(offset == 128, "only a sign-bit flip is supported");
+    uint8_t* biased = offset_workspace(static_cast<size_t>(M) * lda);
+    const auto* src = reinterpret_cast<const uint8_t*>(A);
+    for (size_t i = 0, n = static_cast<size_t>(M) * lda; i < n; ++i) {
+      biased[i] = src[i] ^ 0x80u;
+    }
+    A = reinterpret_cast<const int8_t*>(biased);
+  }
+
+  // Same task split as the float driver: enough (MC block x panel group)
+  // tasks for every thread, whole rows of panels when single-threaded.
+  const size_t threads = parallel::num_threads();
+  const size_t want = threads > 1 ? threads * 4 : 1;
+  int group = n_panels;
+  if (static_cast<size_t>(m_blocks) < want) {
+    const size_t per_block = (want + m_blocks - 1) / m_blocks;
+    group = math::max<int>(
+        1, static_cast<int>((n_panels + per_block - 1) / per_block));
+  }
+  const int n_groups = (n_panels + group - 1) / group;
+
+  parallel::parallel_for(
+      0, static_cast<size_t>(m_blocks) * n_groups, 1,
+      [&](size_t lo, size_t hi) {
+        alignas(64) int32_t tile[MR * NR];
+        const int8_t* rows[MR];
+        for (size_t t = lo; t < hi; ++t) {
+          const int i_begin = static_cast<int>(t) / n_groups * MC;
+          const int i_end = math::min(M, i_begin + MC);
+          const int jp_begin = static_cast<int>(t) % n_groups * group;
+          const int jp_end = math::min(n_panels, jp_begin + group);
+          for (int jp = jp_begin; jp < jp_end; ++jp) {
+            const int j0 = jp * NR;
+            const int cols = math::min(NR, N - j0);
+            const int8_t* bp = B + static_cast<size_t>(j0) * 4;
+            for (int i0 = i_begin; i0 < i_end; i0 += MR) {
+              const int live = math::min(MR, i_end - i0);
+              for (int r = 0; r < MR; ++r) {
+                rows[r] = A + static_cast<size_t>(i0 + math::min(r, live - 1)) *
+                                  lda;
+              }
+              micro_kernel<Cfg>(k4, rows, bp, b_stride, tile);
+              for (int r = 0; r < live; ++r) {
+                float* c = C + static_cast<size_t>(i0 + r) * ldc + j0;
+                const int32_t* acc = tile + r * NR;
+                const float sa = a_scale[i0 + r];
+                for (int j = 0; j < cols; ++j) {
+                  const int32_t dot = acc[j] - offset * b_sum[j0 + j];
+                  c[j] = static_cast<float>(dot) * sa * b_scale[j0 + j];
+                }
+                if (epilogue) {
+                  BiasAct(c, bias ? bias + j0 : nullptr, act,
+                          static_cast<size_t>(cols));
+                }
+              }
+            }
+          }
+        }
+      });
+}
+
+}  // namespace kernels::qgemm
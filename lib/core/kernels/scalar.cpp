@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "backends.hpp"
+#include "gemm.hpp"
+#include "qgemm.hpp"
+
+namespace kernels::detail {
+
+namespace {
+
+void add(const float* a, const float* b, float* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = a[i] + b[i];
+}
+
+void sub(const float* a, const float* b, float* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = a[i] - b[i];
+}
+
+void mul(const float* a, const float* b, float* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = a[i] * b[i];
+}
+
+void add_inplace(float* dst, const float* src, size_t n) {
+  for (size_t i = 0; i < n; ++i) dst[i] += src[i];
+}
+
+void sub_inplace(float* dst, const float* src, size_t n) {
+  for (size_t i = 0; i < n; ++i) dst[i] -= src[i];
+}
+
+void mul_add_inplace(float* dst, const float* a, const float* b, size_t n) {
+  for (size_t i = 0; i < n; ++i) dst[i] += a[i] * b[i];
+}
+
+void add_scalar_inplace(float* dst, float v, size_t n) {
+  for (size_t i = 0; i < n; ++i) dst[i] += v;
+}
+
+void scale_inplace(float* dst, float v, size_t n) {
+  for (size_t i = 0; i < n; ++i) dst[i] *= v;
+}
+
+void axpy(float* dst, float alpha, const float* x, size_t n) {
+  for (size_t i = 0; i < n; ++i) dst[i] += alpha * x[i];
+}
+
+void relu(const float* x, float* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = x[i] > 0.0f ? x[i] : 0.0f;
+}
+
+void vtanh(const float* x, float* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = std::tanh(x[i]);
+}
+
+void sigmoid(const float* x, float* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = 1.0f / (1.0f + std::exp(-x[i]));
+}
+
+void vlog(const float* x, float* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = std::log(x[i]);
+}
+
+float sum(const float* x, size_t n) {
+  float acc = 0.0f;
+  for (size_t i = 0; i < n; ++i) acc += x[i];
+  return acc;
+}
+
+float dot(const float* a, const float* b, size_t n) {
+  float acc = 0.0f;
+  for (size_t i = 0; i < n; ++i) acc += a[i] * b[i];
+  return acc;
+}
+
+void relu_backward(const float* g, const float* x, float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) gx[i] += x[i] > 0.0f ? g[i] : 0.0f;
+}
+
+void tanh_backward(const float* g, const float* y, float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) gx[i] += g[i] * (1.0f - y[i] * y[i]);
+}
+
+void sigmoid_backward(const float* g, const float* y, float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) gx[i] += g[i] * y[i] * (1.0f - y[i]);
+}
+
+void log_backward(const float* g, const float* x, float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) gx[i] += g[i] / x[i];
+}
+
+float bce_with_logits(const float* x, const float* y, size_t n) {
+  float total = 0.0f;
+  for (size_t i = 0; i < n; ++i) {
+    total += std::max(x[i], 0.0f) - x[i] * y[i] +
+             std::log1p(std::exp(-std::fabs(x[i])));
+  }
+  return total;
+}
+
+void bce_with_logits_backward(const float* x, const float* y, float scale,
+                              float* gx, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    gx[i] += scale * (1.0f / (1.0f + std::exp(-x[i])) - y[i]);
+  }
+}
+
+float softmax(const float* x, float* p, size_t n) {
+  if (n == 0) return -INFINITY;
+  const float mx = *std::max_element(x, x + n);
+  float total = 0.0f;
+  for (size_t i = 0; i < n; ++i) {
+    p[i] = std::exp(x[i] - mx);
+    total += p[i];
+  }
+  scale_inplace(p, 1.0f / total, n);
+  return mx + std::log(total);
+}
+
+void bias_act(float* x, const float* bias, Activation act, size_t n) {
+  if (bias) add_inplace(x, bias, n);
+  switch (act) {
+    case Activation::None:
+      return;
+    case Activation::Relu:
+      relu(x, x, n);
+      return;
+    case Activation::Tanh:
+      vtanh(x, x, n);
+      return;
+    case Activation::Sigmoid:
+      sigmoid(x, x, n);
+      return;
+  }
+}
+
+void act_backward(float* g, const float* y, Activation act, size_t n) {
+  switch (act) {
+    case Activation::None:
+      return;
+    case Activation::Relu:
+      for (size_t i = 0; i < n; ++i) g[i] = y[i] > 0.0f ? g[i] : 0.0f;
+      return;
+    case Activation::Tanh:
+      for (size_t i = 0; i < n; ++i) g[i] *= 1.0f - y[i] * y[i];
+      return;
+    case Activation::Sigmoid:
+      for (size_t i = 0; i < n; ++i) g[i] *= y[i] * (1.0f - y[i]);
+      return;
+  }
+}
+
+void f32_to_bf16(const float* x, uint16_t* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = float_to_bf16(x[i]);
+}
+
+void bf16_to_f32(const uint16_t* x, float* out, size_t n) {
+  for (size_t i = 0; i < n; ++i) out[i] = bf16_to_float(x[i]);
+}
+
+void sgemm(bool trans_a, bool trans_b, int M, int N, int K, float alpha,
+           const float* A, int lda, const float* B, int ldb, float beta,
+           float* C, int ldc) {
+  for (int i = 0; i < M; ++i) {
+    float* c = C + static_cast<size_t>(i) * ldc;
+    if (beta == 0.0f) {
+      std::memset(c, 0, static_cast<size_t>(N) * sizeof(float));
+    } else if (beta != 1.0f) {
+      scale_inplace(c, beta, static_cast<size_t>(N));
+    }
+  }
+  if (K == 0 || alpha == 0.0f) return;
+
+  const auto a_at = [&](int i, int k) {
+    return trans_a ? A[static_cast<size_t>(k) * lda + i]
+                   : A[static_cast<size_t>(i) * lda + k];
+  };
+  for (int i = 0; i < M; ++i) {
+    float* c = C + static_cast<size_t>(i) * ldc;
+    if (!trans_b) {
+      // i-k-j order keeps both B and C rows streaming.
+      for (int k = 0; k < K; ++k) {
+        const float a = alpha * a_at(i, k);
+        const float* b = B + static_cast<size_t>(k) * ldb;
+        for (int j = 0; j < N; ++j) c[j] += a * b[j];
+      }
+    } else {
+      for (int j = 0; j < N; ++j) {
+        const float* b = B + static_cast<size_t>(j) * ldb;
+        float acc = 0.0f;
+        for (int k = 0; k < K; ++k) acc += a_at(i, k) * b[k];
+        c[j] += alpha * acc;
+      }
+    }
+  }
+}
+
+// One-lane "vector" so the scalar backend shares the packed GEMM driver.
+struct Scalar {
+  using reg = float;
+  static constexpr size_t width = 1;
+
+  static reg load(const float* p) { return *p; }
+  static void store(float* p, reg v) { *p = v; }
+  static reg set1(float v) { return v; }
+  static reg zero() { return 0.0f; }
+  static reg add(reg a, reg b) { return a + b; }
+  static reg fmadd(reg a, reg b, reg c) { return a * b + c; }
+};
+
+using ScalarGemm = gemm::Config<Scalar, 4, 4, 64, 256, 4096>;
+
+// One-column "vector" of four K values so the scalar backend shares the
+// int8 driver.
+struct ScalarDot {
+  using acc = int32_t;
+  struct b4 {
+    int8_t v[4];
+  };
+  using a4 = b4;
+  static constexpr int lanes = 1;
+  static constexpr int32_t offset = 0;
+
+  static acc zero() { return 0; }
+  static a4 load_a(const int8_t* p) { return {{p[0], p[1], p[2], p[3]}}; }
+  static b4 load_b(const int8_t* p) { return {{p[0], p[1], p[2], p[3]}}; }
+  static acc madd(acc c, const a4& a, const b4& b) {
+    for (int i = 0; i < 4; ++i) c += static_cast<int32_t>(a.v[i]) * b.v[i];
+    return c;
+  }
+  static void store(int32_t* p, acc c) { *p = c; }
+};
+
+using ScalarQGemm = qgemm::Config<ScalarDot, 4, 4, 64>;
+
+}  // namespace
+
+const KernelTable& scalar_table() {
+  static const KernelTable table{"scalar",
+                                 add,
+                                 sub,
+                                 mul,
+                                 add_inplace,
+                                 sub_inplace,
+                                 mul_add_inplace,
+                                 add_scalar_inplace,
+                                 scale_inplace,
+                                 axpy,
+                                 relu,
+                                 vtanh,
+                                 sigmoid,
+                                 vlog,
+                                 sum,
+                                 dot,
+                                 relu_backward,
+                                 tanh_backward,
+                                 sigmoid_backward,
+                                 log_backward,
+                                 bce_with_logits,
+                                 bce_with_logits_backward,
+                                 softmax,
+                                 bias_act,
+                                 act_backward,
+                                 gemm::sgemm<ScalarGemm, sgemm>,
+                                 gemm::sgemm_batched<ScalarGemm, sgemm>,
+                                 gemm::sgemm_bias_act<ScalarGemm, sgemm,
+                                                      bias_act>,
+                                 f32_to_bf16,
+                                 bf16_to_f32,
+                                 gemm::gemm_mixed<ScalarGemm, sgemm,
+                                                  bias_act>,
+                                 qgemm::quantize_s8,
+                                 qgemm::gemm_s8<ScalarQGemm, bias_act>};
+  return table;
+}
+
+}  // namespace kernels::detail
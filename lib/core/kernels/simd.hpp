@@ -0,0 +1,566 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "kernels.hpp"
+#include "math.hpp"
+
+// Width-generic kernel bodies shared by the SIMD backends.
+//
+// A backend supplies a traits struct V describing its vector register:
+//   reg, mask, width
+//   load, store, set1, zero
+//   add, sub, mul, div, min, max, abs
+//   fmadd(a, b, c) = a * b + c, fnmadd(a, b, c) = c - a * b
+//   lt(a, b), gt(a, b) -> mask, blend(m, a, b) = m ? b : a
+//   round(x) (nearest), pow2i(n) = 2^n for integral n
+//   frexp(x, e) -> mantissa in [0.5, 1), exponent written to e
+//   reduce_add(x) -> float
+//   load_bf16(p), store_bf16(p, x): width bfloat16 values widened to or
+//   rounded (nearest even, NaN kept quiet) from a register
+// and instantiates make_table<V>() in a translation unit compiled with the
+// matching instruction-set flags. Everything here is header-only so each
+// instantiation is compiled for exactly one ISA.
+namespace kernels::simd {
+
+// Cephes-style single precision exp. Inputs are clamped so the result stays a
+// normal float; accuracy is within a couple of ulp of std::exp.
+template <class V>
+inline typename V::reg vexp(typename V::reg x) {
+  using R = typename V::reg;
+  x = V::min(x, V::set1(88.0f));
+  x = V::max(x, V::set1(-87.3365447504019f));
+  const R n = V::round(V::mul(x, V::set1(1.44269504088896341f)));
+  R r = V::fnmadd(n, V::set1(0.693359375f), x);
+  r = V::fnmadd(n, V::set1(-2.12194440e-4f), r);
+  const R r2 = V::mul(r, r);
+  R p = V::set1(1.9875691500e-4f);
+  p = V::fmadd(p, r, V::set1(1.3981999507e-3f));
+  p = V::fmadd(p, r, V::set1(8.3334519073e-3f));
+  p = V::fmadd(p, r, V::set1(4.1665795894e-2f));
+  p = V::fmadd(p, r, V::set1(1.6666665459e-1f));
+  p = V::fmadd(p, r, V::set1(5.0000001201e-1f));
+  p = V::fmadd(p, r2, V::add(r, V::set1(1.0f)));
+  return V::mul(p, V::pow2i(n));
+}
+
+// Cephes-style natural log. Returns -inf for 0 and NaN for negative inputs;
+// denormals are flushed to the smallest normal float.
+template <class V>
+inline typename V::reg vlog(typename V::reg x) {
+  using R = typename V::reg;
+  const R zero = V::zero();
+  const auto is_zero = V::lt(x, V::set1(__FLT_DENORM_MIN__));
+  const auto is_neg = V::lt(x, zero);
+  R e;
+  R m = V::frexp(V::max(x, V::set1(1.17549435e-38f)), e);
+  const auto small = V::lt(m, V::set1(0.707106781186547524f));
+  // m in [sqrt(0.5), sqrt(2)) after folding; keep the exponent in sync.
+  e = V::blend(small, e, V::sub(e, V::set1(1.0f)));
+  m = V::blend(small, V::sub(m, V::set1(1.0f)),
+               V::sub(V::add(m, m), V::set1(1.0f)));
+  const R z = V::mul(m, m);
+  R y = V::set1(7.0376836292e-2f);
+  y = V::fmadd(y, m, V::set1(-1.1514610310e-1f));
+  y = V::fmadd(y, m, V::set1(1.1676998740e-1f));
+  y = V::fmadd(y, m, V::set1(-1.2420140846e-1f));
+  y = V::fmadd(y, m, V::set1(1.4249322787e-1f));
+  y = V::fmadd(y, m, V::set1(-1.6668057665e-1f));
+  y = V::fmadd(y, m, V::set1(2.0000714765e-1f));
+  y = V::fmadd(y, m, V::set1(-2.4999993993e-1f));
+  y = V::fmadd(y, m, V::set1(3.3333331174e-1f));
+  y = V::mul(V::mul(y, m), z);
+  y = V::fmadd(e, V::set1(-2.12194440e-4f), y);
+  y = V::fnmadd(z, V::set1(0.5f), y);
+  R out = V::add(m, y);
+  out = V::fmadd(e, V::set1(0.693359375f), out);
+  out = V::blend(is_zero, out, V::set1(-__builtin_inff()));
+  return V::blend(is_neg, out, V::set1(__builtin_nanf("")));
+}
+
+template <class V>
+inline typename V::reg vsigmoid(typename V::reg x) {
+  const auto one = V::set1(1.0f);
+  return V::div(one, V::add(one, vexp<V>(V::sub(V::zero(), x))));
+}
+
+// tanh uses an odd polynomial near zero (where 1 - 2/(e^2x + 1) cancels
+// badly) and the exp form elsewhere.
+template <class V>
+inline typename V::reg vtanh(typename V::reg x) {
+  using R = typename V::reg;
+  const R ax = V::abs(x);
+  const R z = V::mul(x, x);
+  R p = V::set1(-5.70498872745e-3f);
+  p = V::fmadd(p, z, V::set1(2.06390887954e-2f));
+  p = V::fmadd(p, z, V::set1(-5.37397155531e-2f));
+  p = V::fmadd(p, z, V::set1(1.33314422036e-1f));
+  p = V::fmadd(p, z, V::set1(-3.33332819422e-1f));
+  const R small = V::fmadd(V::mul(p, z), x, x);
+  const R one = V::set1(1.0f);
+  const R e2 = vexp<V>(V::add(ax, ax));
+  R large = V::sub(one, V::div(V::set1(2.0f), V::add(e2, one)));
+  large = V::blend(V::lt(x, V::zero()), large, V::sub(V::zero(), large));
+  return V::blend(V::lt(ax, V::set1(0.625f)), large, small);
+}
+
+// Runs f over full vectors and pads the tail through a stack buffer so tail
+// elements see the same arithmetic as the body.
+template <class V, class F>
+inline void map1(const float* x, float* out, size_t n, F f) {
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(out + i, f(V::load(x + i)));
+  }
+  if (i < n) {
+    alignas(64) float xb[V::width] = {};
+    alignas(64) float ob[V::width];
+    std::memcpy(xb, x + i, (n - i) * sizeof(float));
+    V::store(ob, f(V::load(xb)));
+    std::memcpy(out + i, ob, (n - i) * sizeof(float));
+  }
+}
+
+template <class V, class F>
+inline void map2(const float* a, const float* b, float* out, size_t n, F f) {
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(out + i, f(V::load(a + i), V::load(b + i)));
+  }
+  if (i < n) {
+    alignas(64) float ab[V::width] = {};
+    alignas(64) float bb[V::width] = {};
+    alignas(64) float ob[V::width];
+    std::memcpy(ab, a + i, (n - i) * sizeof(float));
+    std::memcpy(bb, b + i, (n - i) * sizeof(float));
+    V::store(ob, f(V::load(ab), V::load(bb)));
+    std::memcpy(out + i, ob, (n - i) * sizeof(float));
+  }
+}
+
+// out = f(a, b, out): used by the accumulating backward kernels.
+template <class V, class F>
+inline void map3(const float* a, const float* b, float* out, size_t n, F f) {
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(out + i, f(V::load(a + i), V::load(b + i), V::load(out + i)));
+  }
+  if (i < n) {
+    alignas(64) float ab[V::width] = {};
+    alignas(64) float bb[V::width] = {};
+    alignas(64) float ob[V::width] = {};
+    const size_t rem = (n - i) * sizeof(float);
+    std::memcpy(ab, a + i, rem);
+    std::memcpy(bb, b + i, rem);
+    std::memcpy(ob, out + i, rem);
+    V::store(ob, f(V::load(ab), V::load(bb), V::load(ob)));
+    std::memcpy(out + i, ob, rem);
+  }
+}
+
+template <class V>
+void add(const float* a, const float* b, float* out, size_t n) {
+  map2<V>(a, b, out, n, [](auto x, auto y) { return V::add(x, y); });
+}
+
+template <class V>
+void sub(const float* a, const float* b, float* out, size_t n) {
+  map2<V>(a, b, out, n, [](auto x, auto y) { return V::sub(x, y); });
+}
+
+template <class V>
+void mul(const float* a, const float* b, float* out, size_t n) {
+  map2<V>(a, b, out, n, [](auto x, auto y) { return V::mul(x, y); });
+}
+
+template <class V>
+void add_inplace(float* dst, const float* src, size_t n) {
+  map2<V>(dst, src, dst, n, [](auto x, auto y) { return V::add(x, y); });
+}
+
+template <class V>
+void sub_inplace(float* dst, const float* src, size_t n) {
+  map2<V>(dst, src, dst, n, [](auto x, auto y) { return V::sub(x, y); });
+}
+
+template <class V>
+void mul_add_inplace(float* dst, const float* a, const float* b, size_t n) {
+  map3<V>(a, b, dst, n,
+          [](auto x, auto y, auto acc) { return V::fmadd(x, y, acc); });
+}
+
+template <class V>
+void add_scalar_inplace(float* dst, float v, size_t n) {
+  const auto vv = V::set1(v);
+  map1<V>(dst, dst, n, [vv](auto x) { return V::add(x, vv); });
+}
+
+template <class V>
+void scale_inplace(float* dst, float v, size_t n) {
+  const auto vv = V::set1(v);
+  map1<V>(dst, dst, n, [vv](auto x) { return V::mul(x, vv); });
+}
+
+template <class V>
+void relu(const float* x, float* out, size_t n) {
+  map1<V>(x, out, n, [](auto v) { return V::max(v, V::zero()); });
+}
+
+template <class V>
+void tanh(const float* x, float* out, size_t n) {
+  map1<V>(x, out, n, [](auto v) { return vtanh<V>(v); });
+}
+
+template <class V>
+void sigmoid(const float* x, float* out, size_t n) {
+  map1<V>(x, out, n, [](auto v) { return vsigmoid<V>(v); });
+}
+
+template <class V>
+void log(const float* x, float* out, size_t n) {
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(out + i, vlog<V>(V::load(x + i)));
+  }
+  if (i < n) {
+    // Pad with ones so the unused lanes stay finite.
+    alignas(64) float xb[V::width];
+    alignas(64) float ob[V::width];
+    for (size_t l = 0; l < V::width; ++l) xb[l] = 1.0f;
+    std::memcpy(xb, x + i, (n - i) * sizeof(float));
+    V::store(ob, vlog<V>(V::load(xb)));
+    std::memcpy(out + i, ob, (n - i) * sizeof(float));
+  }
+}
+
+template <class V>
+float sum(const float* x, size_t n) {
+  auto acc0 = V::zero();
+  auto acc1 = V::zero();
+  size_t i = 0;
+  for (; i + 2 * V::width <= n; i += 2 * V::width) {
+    acc0 = V::add(acc0, V::load(x + i));
+    acc1 = V::add(acc1, V::load(x + i + V::width));
+  }
+  for (; i + V::width <= n; i += V::width) {
+    acc0 = V::add(acc0, V::load(x + i));
+  }
+  float acc = V::reduce_add(V::add(acc0, acc1));
+  for (; i < n; ++i) acc += x[i];
+  return acc;
+}
+
+template <class V>
+void relu_backward(const float* g, const float* x, float* gx, size_t n) {
+  map3<V>(g, x, gx, n, [](auto gv, auto xv, auto acc) {
+    return V::add(acc, V::blend(V::gt(xv, V::zero()), V::zero(), gv));
+  });
+}
+
+template <class V>
+void tanh_backward(const float* g, const float* y, float* gx, size_t n) {
+  map3<V>(g, y, gx, n, [](auto gv, auto yv, auto acc) {
+    const auto d = V::fnmadd(yv, yv, V::set1(1.0f));
+    return V::fmadd(gv, d, acc);
+  });
+}
+
+template <class V>
+void sigmoid_backward(const float* g, const float* y, float* gx, size_t n) {
+  map3<V>(g, y, gx, n, [](auto gv, auto yv, auto acc) {
+    const auto d = V::mul(yv, V::sub(V::set1(1.0f), yv));
+    return V::fmadd(gv, d, acc);
+  });
+}
+
+template <class V>
+void log_backward(const float* g, const float* x, float* gx, size_t n) {
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    const auto q = V::div(V::load(g + i), V::load(x + i));
+    V::store(gx + i, V::add(V::load(gx + i), q));
+  }
+  for (; i < n; ++i) gx[i] += g[i] / x[i];
+}
+
+template <class V>
+float bce_with_logits(const float* x, const float* y, size_t n) {
+  const auto one = V::set1(1.0f);
+  auto acc = V::zero();
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    const auto xv = V::load(x + i);
+    const auto t = vexp<V>(V::sub(V::zero(), V::abs(xv)));
+    const auto lin = V::fnmadd(xv, V::load(y + i), V::max(xv, V::zero()));
+    acc = V::add(acc, V::add(lin, vlog<V>(V::add(one, t))));
+  }
+  float total = V::reduce_add(acc);
+  for (; i < n; ++i) {
+    total += math::max(x[i], 0.0f) - x[i] * y[i] +
+             math::log1p(math::exp(-math::fabs(x[i])));
+  }
+  return total;
+}
+
+template <class V>
+void bce_with_logits_backward(const float* x, const float* y, float scale,
+                              float* gx, size_t n) {
+  const auto sv = V::set1(scale);
+  map3<V>(x, y, gx, n, [sv](auto xv, auto yv, auto acc) {
+    return V::fmadd(sv, V::sub(vsigmoid<V>(xv), yv), acc);
+  });
+}
+
+template <class V>
+float softmax(const float* x, float* p, size_t n) {
+  if (n == 0) return -INFINITY;
+  float mx = x[0];
+  size_t i = 0;
+  if (n >= V::width) {
+    auto mv = V::load(x);
+    for (i = V::width; i + V::width <= n; i += V::width) {
+      mv = V::max(mv, V::load(x + i));
+    }
+    alignas(64) float lanes[V::width];
+    V::store(lanes, mv);
+    for (size_t l = 0; l < V::width; ++l) mx = math::max(mx, lanes[l]);
+  }
+  for (; i < n; ++i) mx = math::max(mx, x[i]);
+
+  const auto shift = V::set1(mx);
+  auto acc = V::zero();
+  for (i = 0; i + V::width <= n; i += V::width) {
+    const auto e = vexp<V>(V::sub(V::load(x + i), shift));
+    V::store(p + i, e);
+    acc = V::add(acc, e);
+  }
+  float total = V::reduce_add(acc);
+  for (; i < n; ++i) {
+    p[i] = math::exp(x[i] - mx);
+    total += p[i];
+  }
+  scale_inplace<V>(p, 1.0f / total, n);
+  return mx + math::log(total);
+}
+
+template <class V, class F>
+inline void bias_then(float* x, const float* bias, size_t n, F f) {
+  if (bias) {
+    map2<V>(x, bias, x, n, [f](auto v, auto b) { return f(V::add(v, b)); });
+  } else {
+    map1<V>(x, x, n, f);
+  }
+}
+
+template <class V>
+void bias_act(float* x, const float* bias, Activation act, size_t n) {
+  switch (act) {
+    case Activation::None:
+      if (bias) add_inplace<V>(x, bias, n);
+      return;
+    case Activation::Relu:
+      bias_then<V>(x, bias, n, [](auto v) { return V::max(v, V::zero()); });
+      return;
+    case Activation::Tanh:
+      bias_then<V>(x, bias, n, [](auto v) { return vtanh<V>(v); });
+      return;
+    case Activation::Sigmoid:
+      bias_then<V>(x, bias, n, [](auto v) { return vsigmoid<V>(v); });
+      return;
+  }
+}
+
+template <class V>
+void act_backward(float* g, const float* y, Activation act, size_t n) {
+  switch (act) {
+    case Activation::None:
+      return;
+    case Activation::Relu:
+      map2<V>(g, y, g, n, [](auto gv, auto yv) {
+        return V::blend(V::gt(yv, V::zero()), V::zero(), gv);
+      });
+      return;
+    case Activation::Tanh:
+      map2<V>(g, y, g, n, [](auto gv, auto yv) {
+        return V::mul(gv, V::fnmadd(yv, yv, V::set1(1.0f)));
+      });
+      return;
+    case Activation::Sigmoid:
+      map2<V>(g, y, g, n, [](auto gv, auto yv) {
+        return V::mul(gv, V::mul(yv, V::sub(V::set1(1.0f), yv)));
+      });
+      return;
+  }
+}
+
+template <class V>
+void axpy(float* y, float a, const float* x, size_t n) {
+  const auto av = V::set1(a);
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(y + i, V::fmadd(av, V::load(x + i), V::load(y + i)));
+  }
+  for (; i < n; ++i) y[i] += a * x[i];
+}
+
+template <class V>
+float dot(const float* a, const float* b, size_t n) {
+  auto acc0 = V::zero();
+  auto acc1 = V::zero();
+  size_t i = 0;
+  for (; i + 2 * V::width <= n; i += 2 * V::width) {
+    acc0 = V::fmadd(V::load(a + i), V::load(b + i), acc0);
+    acc1 = V::fmadd(V::load(a + i + V::width), V::load(b + i + V::width), acc1);
+  }
+  for (; i + V::width <= n; i += V::width) {
+    acc0 = V::fmadd(V::load(a + i), V::load(b + i), acc0);
+  }
+  float acc = V::reduce_add(V::add(acc0, acc1));
+  for (; i < n; ++i) acc += a[i] * b[i];
+  return acc;
+}
+
+template <class V>
+void f32_to_bf16(const float* x, uint16_t* out, size_t n) {
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store_bf16(out + i, V::load(x + i));
+  }
+  for (; i < n; ++i) out[i] = float_to_bf16(x[i]);
+}
+
+template <class V>
+void bf16_to_f32(const uint16_t* x, float* out, size_t n) {
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(out + i, V::load_bf16(x + i));
+  }
+  for (; i < n; ++i) out[i] = bf16_to_float(x[i]);
+}
+
+// Symmetric int8 quantization. Rounded values are integral and within
+// [-127, 127], so narrowing them through a lane buffer is exact.
+template <class V>
+float quantize_s8(const float* x, int8_t* q, size_t n) {
+  constexpr size_t W = V::width;
+  alignas(64) float lane[W];
+  auto m = V::zero();
+  size_t i = 0;
+  for (; i + W <= n; i += W) m = V::max(m, V::abs(V::load(x + i)));
+  V::store(lane, m);
+  float amax = 0.0f;
+  for (size_t j = 0; j < W; ++j) amax = math::max(amax, lane[j]);
+  for (; i < n; ++i) amax = math::max(amax, math::fabs(x[i]));
+  if (amax == 0.0f) {
+    std::memset(q, 0, n);
+    return 0.0f;
+  }
+  const float inv = 127.0f / amax;
+  const auto iv = V::set1(inv);
+  for (i = 0; i + W <= n; i += W) {
+    V::store(lane, V::round(V::mul(V::load(x + i), iv)));
+    for (size_t j = 0; j < W; ++j) q[i + j] = static_cast<int8_t>(lane[j]);
+  }
+  for (; i < n; ++i) q[i] = static_cast<int8_t>(math::nearbyint(x[i] * inv));
+  return amax / 127.0f;
+}
+
+// Straightforward row-oriented GEMM: NoTrans B streams rows of B through
+// axpy, Trans B reduces contiguous rows with dot products. Used directly for
+// small problems where packing does not pay off.
+template <class V>
+void sgemm(bool trans_a, bool trans_b, int M, int N, int K, float alpha,
+           const float* A, int lda, const float* B, int ldb, float beta,
+           float* C, int ldc) {
+  for (int i = 0; i < M; ++i) {
+    float* c = C + static_cast<size_t>(i) * ldc;
+    if (beta == 0.0f) {
+      std::memset(c, 0, static_cast<size_t>(N) * sizeof(float));
+    } else if (beta != 1.0f) {
+      scale_inplace<V>(c, beta, static_cast<size_t>(N));
+    }
+  }
+  if (K == 0 || alpha == 0.0f) return;
+
+  if (!trans_b) {
+    for (int i = 0; i < M; ++i) {
+      float* c = C + static_cast<size_t>(i) * ldc;
+      for (int k = 0; k < K; ++k) {
+        const float a = trans_a ? A[static_cast<size_t>(k) * lda + i]
+                                : A[static_cast<size_t>(i) * lda + k];
+        axpy<V>(c, alpha * a, B + static_cast<size_t>(k) * ldb, N);
+      }
+    }
+    return;
+  }
+
+  // Trans A gathers column i of A through a fixed stack buffer, K_CHUNK
+  // values at a time, so the contiguous dot kernel still applies.
+  constexpr int K_CHUNK = 256;
+  float a_col[K_CHUNK];
+  for (int i = 0; i < M; ++i) {
+    float* c = C + static_cast<size_t>(i) * ldc;
+    if (!trans_a) {
+      const float* a = A + static_cast<size_t>(i) * lda;
+      for (int j = 0; j < N; ++j) {
+        c[j] += alpha * dot<V>(a, B + static_cast<size_t>(j) * ldb, K);
+      }
+      continue;
+    }
+    for (int k0 = 0; k0 < K; k0 += K_CHUNK) {
+      const int kc = math::min(K_CHUNK, K - k0);
+      for (int k = 0; k < kc; ++k) {
+        a_col[k] = A[static_cast<size_t>(k0 + k) * lda + i];
+      }
+      for (int j = 0; j < N; ++j) {
+        c[j] += alpha * dot<V>(a_col, B + static_cast<size_t>(j) * ldb + k0,
+                               kc);
+      }
+    }
+  }
+}
+
+template <class V>
+KernelTable make_table(const char* name, decltype(KernelTable::sgemm) gemm,
+                       decltype(KernelTable::sgemm_batched) gemm_batched,
+                       decltype(KernelTable::sgemm_bias_act) gemm_bias_act,
+                       decltype(KernelTable::gemm_mixed) gemm_mixed,
+                       decltype(KernelTable::gemm_s8) gemm_s8) {
+  return KernelTable{name,
+                     add<V>,
+                     sub<V>,
+                     mul<V>,
+                     add_inplace<V>,
+                     sub_inplace<V>,
+                     mul_add_inplace<V>,
+                     add_scalar_inplace<V>,
+                     scale_inplace<V>,
+                     axpy<V>,
+                     relu<V>,
+                     tanh<V>,
+                     sigmoid<V>,
+                     log<V>,
+                     sum<V>,
+                     dot<V>,
+                     relu_backward<V>,
+                     tanh_backward<V>,
+                     sigmoid_backward<V>,
+                     log_backward<V>,
+                     bce_with_logits<V>,
+                     bce_with_logits_backward<V>,
+                     softmax<V>,
+                     bias_act<V>,
+                     act_backward<V>,
+                     gemm,
+                     gemm_batched,
+                     gemm_bias_act,
+                     f32_to_bf16<V>,
+                     bf16_to_f32<V>,
+                     gemm_mixed,
+                     quantize_s8<V>,
+                     gemm_s8};
+}
+
+}  // namespace kernels::simd
@@ -0,0 +1,147 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+namespace {
+
+thread_local bool in_parallel_region = false;
+
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t threads) {
+    for (size_t i = 1; i < threads; ++i) {
+      workers_.emplace_back([this] { worker_loop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stop_ = true;
+    }
+    cv_work_.notify_all();
+    for (auto& t : workers_) t.join();
+  }
+
+  size_t size() const { return workers_.size() + 1; }
+
+  // Returns false without running anything if another thread owns the pool.
+  bool try_run(size_t begin, size_t end, size_t chunk, RangeFn fn,
+               void* ctx) {
+    std::unique_lock<std::mutex> run_lock(run_mu_, std::try_to_lock);
+    if (!run_lock.owns_lock()) return false;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      fn_ = fn;
+      ctx_ = ctx;
+      end_ = end;
+      chunk_ = chunk;
+      next_.store(begin, std::memory_order_relaxed);
+      pending_ = workers_.size();
+      ++generation_;
+    }
+    cv_work_.notify_all();
+    drain();
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_done_.wait(lock, [this] { return pending_ == 0; });
+    return true;
+  }
+
+ private:
+  void drain() {
+    in_parallel_region = true;
+    for (;;) {
+      const size_t b = next_.fetch_add(chunk_, std::memory_order_relaxed);
+      if (b >= end_) break;
+      fn_(ctx_, b, std::min(end_, b + chunk_));
+    }
+    in_parallel_region = false;
+  }
+
+  void worker_loop() {
+    uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_work_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+      }
+      drain();
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (--pending_ == 0) cv_done_.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex run_mu_;
+  std::mutex mu_;
+  std::condition_variable cv_work_;
+  std::condition_variable cv_done_;
+  uint64_t generation_ = 0;
+  size_t pending_ = 0;
+  bool stop_ = false;
+
+  RangeFn fn_ = nullptr;
+  void* ctx_ = nullptr;
+  size_t end_ = 0;
+  size_t chunk_ = 1;
+  std::atomic<size_t> next_{0};
+};
+
+size_t default_threads() {
+  if (const char* env = std::getenv("TFORMER_NUM_THREADS")) {
+    const long n = std::strtol(env, nullptr, 10);
+    if (n > 0) return static_cast<size_t>(n);
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+std::mutex pool_mu;
+std::unique_ptr<ThreadPool> pool;
+
+ThreadPool& get_pool() {
+  std::lock_guard<std::mutex> lock(pool_mu);
+  if (!pool) pool = std::make_unique<ThreadPool>(default_threads());
+  return *pool;
+}
+
+}  // namespace
+
+size_t num_threads() { return get_pool().size(); }
+
+void set_num_threads(size_t n) {
+  std::lock_guard<std::mutex> lock(pool_mu);
+  pool.reset();
+  pool = std::make_unique<ThreadPool>(n == 0 ? default_threads() : n);
+}
+
+void parallel_for_raw(size_t begin, size_t end, size_t grain, RangeFn fn,
+                      void* ctx) {
+  if (begin >= end) return;
+  grain = std::max<size_t>(grain, 1);
+  const size_t n = end - begin;
+  ThreadPool& p = get_pool();
+  if (in_parallel_region || p.size() == 1 || n <= grain) {
+    fn(ctx, begin, end);
+    return;
+  }
+  // A few chunks per thread keeps the tail short when chunks are uneven.
+  const size_t target = (n + p.size() * 4 - 1) / (p.size() * 4);
+  const size_t chunk = std::max(grain, target);
+  if (!p.try_run(begin, end, chunk, fn, ctx)) fn(ctx, begin, end);
+}
+
+}  // namespace parallel
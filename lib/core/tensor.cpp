@@ -1,7 +1,6 @@
 #include "tensor.hpp"
 
-#include <Accelerate/Accelerate.h>
-
+#include <array>
 #include <algorithm>
 #include <cassert>
 #include <chrono>
@@ -12,8 +11,11 @@
 #include <stdexcept>
 #include <vector>
 
+#include "kernels.hpp"
+#include "parallel.hpp"
+
 namespace {
-size_t compute_numel(const std::vector<int>& shape) {
+size_t compute_numel(const Shape& shape) {
   size_t n = 1;
   for (int d : shape) {
     if (d <= 0) throw std::invalid_argument("Tensor shape must be positive");
@@ -26,160 +28,982 @@ inline void zero_buffer(float* ptr, size_t count) {
   if (!ptr || count == 0) return;
   std::memset(ptr, 0, count * sizeof(float));
 }
-}  // namespace
 
-namespace {
+// Whether an op output needs a gradient slot: gradients are being tracked
+// and some input is on a path to a parameter.
+bool needs_grad(const ParameterStore& store, const Tensor& a,
+                const Tensor& b = Tensor{}, const Tensor& c = Tensor{}) {
+  return store.grad_enabled() &&
+         (a.requires_grad() || b.requires_grad() || c.requires_grad());
+}
 
-void backward_add(TapeOp& op) {
-  const float* g_out = op.out.grad();
-  float* ga = op.a.grad();
-  float* gb = op.b.grad();
-  if (!g_out || !ga || !gb) return;
-  vDSP_Length len = static_cast<vDSP_Length>(op.out.numel);
-  vDSP_vadd(ga, 1, g_out, 1, ga, 1, len);
-  vDSP_vadd(gb, 1, g_out, 1, gb, 1, len);
+// Uninitialized op output, with a zeroed gradient slot if requires_grad.
+Tensor op_output(ParameterStore& store, const Shape& shape,
+                 bool requires_grad, DType dtype = DType::Float32) {
+  return store.tensor(shape, TensorInit::UninitializedData, requires_grad,
+                      dtype);
 }
 
-void backward_sub(TapeOp& op) {
-  const float* g_out = op.out.grad();
-  float* ga = op.a.grad();
-  float* gb = op.b.grad();
-  if (!g_out || !ga || !gb) return;
-  vDSP_Length len = static_cast<vDSP_Length>(op.out.numel);
-  vDSP_vadd(ga, 1, g_out, 1, ga, 1, len);
-  vDSP_vsub(g_out, 1, gb, 1, gb, 1, len);
+// Floats of arena space holding count elements of dtype.
+size_t arena_floats(size_t count, DType dtype) {
+  return (count * dtype_size(dtype) + sizeof(float) - 1) / sizeof(float);
+}
+
+// Clears the gradient rows recorded in sparse (grad points at row 0), or the
+// whole table if it was flagged dense, and empties the touched set. Returns
+// the number of elements zeroed.
+size_t zero_touched_rows(RowSparseGrad& sparse, float* grad) {
+  const size_t cols = static_cast<size_t>(sparse.cols);
+  size_t zeroed = sparse.touched.size() * cols;
+  if (sparse.dense) {
+    zeroed = static_cast<size_t>(sparse.rows) * cols;
+    zero_buffer(grad, zeroed);
+  }
+  for (int32_t r : sparse.touched) {
+    if (!sparse.dense) zero_buffer(grad + static_cast<size_t>(r) * cols, cols);
+    sparse.is_touched[r] = 0;
+  }
+  sparse.touched.clear();
+  sparse.dense = false;
+  return zeroed;
+}
+
+// Flags row-sparse tables that op's backward writes into other than through
+// embedding(), e.g. an output projection tied to the embedding weights. Such
+// a write can reach any row, so the table is treated densely until the next
+// zero_grad().
+void mark_dense_sparse_grads(const TapeOp& op, ParameterStore& store) {
+  for (const Tensor* t : {&op.a, &op.b, &op.c}) {
+    if (t->store != &store || !t->requires_grad()) continue;
+    for (auto& sparse : store.row_sparse_grads) {
+      const size_t end =
+          sparse.offset + static_cast<size_t>(sparse.rows) * sparse.cols;
+      if (t->grad_offset >= sparse.offset && t->grad_offset < end)
+        sparse.dense = true;
+    }
+  }
+}
+
+Strides contiguous_strides(const Shape& shape) {
+  Strides strides(shape.size(), 0);
+  size_t stride = 1;
+  for (size_t i = shape.size(); i-- > 0;) {
+    strides[i] = stride;
+    stride *= static_cast<size_t>(shape[i]);
+  }
+  return strides;
+}
+
+// Calls f(i, off) for every element in row-major logical order, where i is
+// the dense index and off the element offset relative to the first element.
+template <typename F>
+void for_each_strided(const Tensor& t, F&& f) {
+  const size_t rank = t.shape.size();
+  if (t.numel == 0) return;
+  if (rank == 0) {
+    f(size_t{0}, size_t{0});
+    return;
+  }
+  const size_t inner = static_cast<size_t>(t.shape[rank - 1]);
+  const size_t inner_stride = t.strides[rank - 1];
+  int idx[kMaxRank] = {};
+  size_t base = 0;
+  for (size_t i = 0; i < t.numel; i += inner) {
+    for (size_t j = 0; j < inner; ++j) f(i + j, base + j * inner_stride);
+    // Advance the outer index like an odometer.
+    for (size_t d = rank - 1; d-- > 0;) {
+      base += t.strides[d];
+      if (++idx[d] < t.shape[d]) break;
+      base -= t.strides[d] * static_cast<size_t>(t.shape[d]);
+      idx[d] = 0;
+    }
+  }
+}
+
+int normalize_dim(int dim, size_t rank) {
+  const int r = static_cast<int>(rank);
+  if (dim < -r || dim >= r) throw std::out_of_range("dimension out of range");
+  return dim < 0 ? dim + r : dim;
+}
+
+Shape infer_shape(const Shape& shape, size_t numel) {
+  Shape out = shape;
+  int infer = -1;
+  size_t known = 1;
+  for (size_t i = 0; i < out.size(); ++i) {
+    if (out[i] == -1) {
+      if (infer >= 0)
+        throw std::invalid_argument("only one dimension can be inferred");
+      infer = static_cast<int>(i);
+    } else {
+      if (out[i] <= 0)
+        throw std::invalid_argument("Tensor shape must be positive");
+      known *= static_cast<size_t>(out[i]);
+    }
+  }
+  if (infer >= 0) {
+    if (known == 0 || numel % known != 0)
+      throw std::invalid_argument("cannot infer dimension for shape");
+    out[infer] = static_cast<int>(numel / known);
+  }
+  if (compute_numel(out) != numel)
+    throw std::invalid_argument("shape does not match number of elements");
+  return out;
+}
+
+// How a 2-D tensor maps onto a row-major GEMM operand.
+struct GemmOperand {
+  bool trans = false;
+  int ld = 0;
+};
+
+// Row-major views map directly; column-major views (transposes) map with the
+// transpose flag. Anything else needs a contiguous copy first.
+bool gemm_operand(const Tensor& t, GemmOperand& op) {
+  const size_t rows = static_cast<size_t>(t.shape[0]);
+  const size_t cols = static_cast<size_t>(t.shape[1]);
+  const size_t s0 = t.strides[0];
+  const size_t s1 = t.strides[1];
+  const auto fits = [](size_t ld) {
+    return ld <= static_cast<size_t>(std::numeric_limits<int>::max());
+  };
+  if (s1 == 1 || cols == 1) {
+    const size_t ld = rows == 1 ? cols : s0;
+    if (ld >= cols && fits(ld)) {
+      op = GemmOperand{false, static_cast<int>(ld)};
+      return true;
+    }
+  }
+  if (s0 == 1 || rows == 1) {
+    const size_t ld = cols == 1 ? rows : s1;
+    if (ld >= rows && fits(ld)) {
+      op = GemmOperand{true, static_cast<int>(ld)};
+      return true;
+    }
+  }
+  return false;
+}
+
+// A 2-D or 3-D tensor as a batch of GEMM operands: the last two dims map
+// as in gemm_operand and stride separates consecutive matrices. A 2-D
+// tensor, or a batch of one, is a single matrix shared by every product
+// (stride 0). Batches whose matrices overlap need a contiguous copy.
+bool batch_operand(const Tensor& t, GemmOperand& op, size_t& stride) {
+  stride = 0;
+  if (t.shape.size() == 2) return gemm_operand(t, op);
+  const size_t rows = static_cast<size_t>(t.shape[1]);
+  const size_t cols = static_cast<size_t>(t.shape[2]);
+  const Tensor m(t.store, t.offset, {t.shape[1], t.shape[2]},
+                 {t.strides[1], t.strides[2]}, rows * cols);
+  if (!gemm_operand(m, op)) return false;
+  if (t.shape[0] == 1) return true;
+  stride = t.strides[0];
+  return stride >= (rows - 1) * t.strides[1] + (cols - 1) * t.strides[2] + 1;
 }
 
-void backward_mul(TapeOp& op) {
+// Whether a batch of M-row, non-transposed matrices is stored one after
+// another, so the batch reads as one [batch * M, K] matrix.
+bool stacked(const GemmOperand& op, size_t stride, int M) {
+  return !op.trans && stride == static_cast<size_t>(M) * op.ld;
+}
+
+bool is_bf16(const Tensor& t) { return t.dtype == DType::BFloat16; }
+
+// GEMM element type of a Float32, BFloat16 or UInt8 operand.
+kernels::Operand operand_type(const Tensor& t) {
+  switch (t.dtype) {
+    case DType::BFloat16:
+      return kernels::Operand::BF16;
+    case DType::UInt8:
+      return kernels::Operand::U8;
+    default:
+      return kernels::Operand::F32;
+  }
+}
+
+// C = act(alpha * op(A) * op(B) + bias), with A and B read in their own
+// dtype.
+void gemm(bool trans_a, bool trans_b, int M, int N, int K, float alpha,
+          const Tensor& A, int lda, const Tensor& B, int ldb,
+          const float* bias, kernels::Activation act, float* C, int ldc) {
+  const auto& k = kernels::active();
+  const auto ta = operand_type(A), tb = operand_type(B);
+  if (alpha == 1.0f && ta == kernels::Operand::F32 &&
+      tb == kernels::Operand::F32) {
+    k.sgemm_bias_act(trans_a, trans_b, M, N, K, A.data(), lda, B.data(), ldb,
+                     bias, act, C, ldc);
+    return;
+  }
+  k.gemm_mixed(trans_a, trans_b, M, N, K, alpha, A.raw_data(), ta, lda,
+               B.raw_data(), tb, ldb, 0.0f, bias, act, C, ldc);
+}
+
+// Iteration plan for a broadcast binary op over dense operands. Size-1 axes
+// are dropped and adjacent axes merged wherever both operands stay
+// row-major across them, so same-shape ops collapse to one flat row and a
+// bias add to [rows, H] with a shared row.
+struct BroadcastPlan {
+  Shape out_shape;  ///< Broadcast result shape
+  Strides dims;     ///< Merged extents, innermost last
+  Strides sa;       ///< a strides per merged axis (0 = broadcast)
+  Strides sb;       ///< b strides per merged axis (0 = broadcast)
+};
+
+BroadcastPlan plan_broadcast(const Shape& a, const Shape& b) {
+  BroadcastPlan plan;
+  const size_t rank = std::max(a.size(), b.size());
+  plan.out_shape.assign(rank, 1);
+  Strides sa(rank, 0), sb(rank, 0);
+  size_t stride_a = 1, stride_b = 1;
+  for (size_t i = 0; i < rank; ++i) {
+    const size_t d = rank - 1 - i;
+    const int da = i < a.size() ? a[a.size() - 1 - i] : 1;
+    const int db = i < b.size() ? b[b.size() - 1 - i] : 1;
+    if (da != db && da != 1 && db != 1)
+      throw std::invalid_argument("Shapes are not broadcastable");
+    plan.out_shape[d] = std::max(da, db);
+    sa[d] = da == 1 ? 0 : stride_a;
+    sb[d] = db == 1 ? 0 : stride_b;
+    stride_a *= static_cast<size_t>(da);
+    stride_b *= static_cast<size_t>(db);
+  }
+  for (size_t d = 0; d < rank; ++d) {
+    const size_t n = static_cast<size_t>(plan.out_shape[d]);
+    if (n == 1) continue;
+    if (!plan.dims.empty() && plan.sa.back() == sa[d] * n &&
+        plan.sb.back() == sb[d] * n) {
+      plan.dims.back() *= n;
+      plan.sa.back() = sa[d];
+      plan.sb.back() = sb[d];
+      continue;
+    }
+    plan.dims.push_back(n);
+    plan.sa.push_back(sa[d]);
+    plan.sb.push_back(sb[d]);
+  }
+  if (plan.dims.empty()) {
+    plan.dims.push_back(1);
+    plan.sa.push_back(0);
+    plan.sb.push_back(0);
+  }
+  return plan;
+}
+
+// Calls f(out_off, a_off, b_off) for each innermost row of the plan. The
+// output is dense, so row r starts at r * dims.back().
+template <typename F>
+void for_each_broadcast_row(const BroadcastPlan& plan, F&& f) {
+  const size_t outer = plan.dims.size() - 1;
+  const size_t inner = plan.dims.back();
+  size_t rows = 1;
+  for (size_t d = 0; d < outer; ++d) rows *= plan.dims[d];
+  size_t idx[kMaxRank] = {};
+  size_t a_off = 0, b_off = 0;
+  for (size_t r = 0; r < rows; ++r) {
+    f(r * inner, a_off, b_off);
+    for (size_t d = outer; d-- > 0;) {
+      a_off += plan.sa[d];
+      b_off += plan.sb[d];
+      if (++idx[d] < plan.dims[d]) break;
+      a_off -= plan.sa[d] * plan.dims[d];
+      b_off -= plan.sb[d] * plan.dims[d];
+      idx[d] = 0;
+    }
+  }
+}
+
+// One output row of a broadcast add/sub/mul. Inner strides are 1 (a full
+// row) or 0 (a single broadcast value).
+void binary_row(OpType type, const float* a, size_t sa, const float* b,
+                size_t sb, float* out, size_t n) {
+  const auto& k = kernels::active();
+  if (sa == 1 && sb == 1) {
+    if (type == OpType::Add) k.add(a, b, out, n);
+    if (type == OpType::Sub) k.sub(a, b, out, n);
+    if (type == OpType::Mul) k.mul(a, b, out, n);
+    return;
+  }
+  if (sa == 0 && sb == 0) {
+    const float v = type == OpType::Add   ? a[0] + b[0]
+                    : type == OpType::Sub ? a[0] - b[0]
+                                          : a[0] * b[0];
+    std::fill(out, out + n, v);
+    return;
+  }
+  // Exactly one side is a scalar: copy the row, then apply the scalar.
+  const float* row = sa == 1 ? a : b;
+  const float v = sa == 1 ? b[0] : a[0];
+  std::memcpy(out, row, n * sizeof(float));
+  if (type == OpType::Mul) {
+    k.scale_inplace(out, v, n);
+  } else if (type == OpType::Add) {
+    k.add_scalar_inplace(out, v, n);
+  } else if (sa == 1) {
+    k.add_scalar_inplace(out, -v, n);
+  } else {
+    k.scale_inplace(out, -1.0f, n);
+    k.add_scalar_inplace(out, v, n);
+  }
+}
+
+// gx (inner stride sx) += sign * g * w, reduced over a broadcast row. w is
+// null for add/sub, otherwise the other operand with inner stride sw.
+void accumulate_row(float* gx, size_t sx, const float* g, const float* w,
+                    size_t sw, float sign, size_t n) {
+  const auto& k = kernels::active();
+  if (!w) {
+    if (sx == 0) {
+      gx[0] += sign * k.sum(g, n);
+    } else if (sign > 0.0f) {
+      k.add_inplace(gx, g, n);
+    } else {
+      k.sub_inplace(gx, g, n);
+    }
+    return;
+  }
+  if (sx == 1 && sw == 1) {
+    k.mul_add_inplace(gx, g, w, n);
+  } else if (sx == 1) {
+    k.axpy(gx, w[0], g, n);
+  } else if (sw == 1) {
+    gx[0] += k.dot(g, w, n);
+  } else {
+    gx[0] += w[0] * k.sum(g, n);
+  }
+}
+
+// Forward for Add/Sub/Mul on dense operands.
+void forward_binary(TapeOp& op) {
+  const auto& k = kernels::active();
+  const float* ap = op.a.data();
+  const float* bp = op.b.data();
+  float* out = op.out.data();
+  if (op.a.shape == op.b.shape) {
+    if (op.type == OpType::Add) k.add(ap, bp, out, op.a.numel);
+    if (op.type == OpType::Sub) k.sub(ap, bp, out, op.a.numel);
+    if (op.type == OpType::Mul) k.mul(ap, bp, out, op.a.numel);
+    return;
+  }
+  const BroadcastPlan plan = plan_broadcast(op.a.shape, op.b.shape);
+  const size_t inner = plan.dims.back();
+  for_each_broadcast_row(plan, [&](size_t o, size_t ao, size_t bo) {
+    binary_row(op.type, ap + ao, plan.sa.back(), bp + bo, plan.sb.back(),
+               out + o, inner);
+  });
+}
+
+Tensor broadcast_binary(OpType type, const Tensor& a, const Tensor& b,
+                        ParameterStore& store) {
+  const Shape shape =
+      a.shape == b.shape ? a.shape : plan_broadcast(a.shape, b.shape).out_shape;
+  TapeOp op{type, op_output(store, shape, needs_grad(store, a, b)), a, b};
+  forward_binary(op);
+  store.record(op);
+  return op.out;
+}
+}  // namespace
+
+namespace {
+
+// Shared backward for Add/Sub/Mul. Broadcast operands get the output
+// gradient summed over their broadcast axes: rows accumulate into a shared
+// row with vector adds, and scalar-broadcast rows reduce with sum/dot.
+void backward_binary(TapeOp& op) {
   const float* g_out = op.out.grad();
-  const float* a_data = op.a.data();
-  const float* b_data = op.b.data();
   float* ga = op.a.grad();
   float* gb = op.b.grad();
-  if (!g_out || !a_data || !b_data || !ga || !gb) return;
-  vDSP_Length len = static_cast<vDSP_Length>(op.out.numel);
-  std::vector<float> scratch(op.out.numel);
-  vDSP_vmul(g_out, 1, b_data, 1, scratch.data(), 1, len);
-  vDSP_vadd(ga, 1, scratch.data(), 1, ga, 1, len);
-  vDSP_vmul(g_out, 1, a_data, 1, scratch.data(), 1, len);
-  vDSP_vadd(gb, 1, scratch.data(), 1, gb, 1, len);
+  if (!g_out) return;
+  const bool is_mul = op.type == OpType::Mul;
+  const float sign_b = op.type == OpType::Sub ? -1.0f : 1.0f;
+  const float* ap = is_mul ? op.a.data() : nullptr;
+  const float* bp = is_mul ? op.b.data() : nullptr;
+  if (op.a.shape == op.b.shape) {
+    const size_t n = op.out.numel;
+    if (ga) accumulate_row(ga, 1, g_out, bp, 1, 1.0f, n);
+    if (gb) accumulate_row(gb, 1, g_out, ap, 1, sign_b, n);
+    return;
+  }
+  const BroadcastPlan plan = plan_broadcast(op.a.shape, op.b.shape);
+  const size_t inner = plan.dims.back();
+  const size_t sa = plan.sa.back();
+  const size_t sb = plan.sb.back();
+  for_each_broadcast_row(plan, [&](size_t o, size_t ao, size_t bo) {
+    if (ga) {
+      accumulate_row(ga + ao, sa, g_out + o, bp ? bp + bo : nullptr, sb, 1.0f,
+                     inner);
+    }
+    if (gb) {
+      accumulate_row(gb + bo, sb, g_out + o, ap ? ap + ao : nullptr, sa,
+                     sign_b, inner);
+    }
+  });
 }
 
 void backward_relu(TapeOp& op) {
-  const float* g_out = op.out.grad();
-  const float* x = op.a.data();
-  float* gx = op.a.grad();
-  for (size_t i = 0; i < op.out.numel; ++i) {
-    gx[i] += g_out[i] * (x[i] > 0.0f ? 1.0f : 0.0f);
-  }
+  kernels::active().relu_backward(op.out.grad(), op.a.data(), op.a.grad(),
+                                  op.out.numel);
 }
 
 void backward_tanh(TapeOp& op) {
-  const float* g_out = op.out.grad();
-  const float* y = op.out.data();
-  float* gx = op.a.grad();
-  for (size_t i = 0; i < op.out.numel; ++i) {
-    gx[i] += g_out[i] * (1.0f - y[i] * y[i]);
-  }
+  kernels::active().tanh_backward(op.out.grad(), op.out.data(), op.a.grad(),
+                                  op.out.numel);
 }
 
 void backward_sigmoid(TapeOp& op) {
-  const float* g_out = op.out.grad();
-  const float* y = op.out.data();
-  float* gx = op.a.grad();
-  for (size_t i = 0; i < op.out.numel; ++i) {
-    gx[i] += g_out[i] * y[i] * (1.0f - y[i]);
-  }
+  kernels::active().sigmoid_backward(op.out.grad(), op.out.data(),
+                                     op.a.grad(), op.out.numel);
 }
 
 void backward_log(TapeOp& op) {
-  const float* g_out = op.out.grad();
-  const float* x = op.a.data();
-  float* gx = op.a.grad();
-  for (size_t i = 0; i < op.out.numel; ++i) {
-    gx[i] += g_out[i] / x[i];
-  }
+  kernels::active().log_backward(op.out.grad(), op.a.data(), op.a.grad(),
+                                 op.out.numel);
 }
 
 void backward_sum(TapeOp& op) {
   const float* g_out_ptr = op.out.grad();
   float* gx = op.a.grad();
   if (!g_out_ptr || !gx) return;
-  const float g_out = g_out_ptr[0];
-  vDSP_Length len = static_cast<vDSP_Length>(op.a.numel);
-  vDSP_vsadd(gx, 1, &g_out, gx, 1, len);
+  kernels::active().add_scalar_inplace(gx, g_out_ptr[0], op.a.numel);
 }
 
-// Use Accelerate-backed GEMM for matmul gradients.
 void backward_matmul(TapeOp& op) {
   int M = op.a.shape[0];
   int K = op.a.shape[1];
   int N = op.b.shape[1];
-  const float* A = op.a.data();
-  const float* B = op.b.data();
-  const float* gY = op.out.grad();
+  const Tensor& A = op.a;
+  const Tensor& B = op.b;
+  const float* g = op.out.grad();
+  float* gA = op.a.grad();
+  float* gB = op.b.grad();
+  const auto& k = kernels::active();
+  GemmOperand a, b;
+  gemm_operand(op.a, a);
+  gemm_operand(op.b, b);
+  const auto none = kernels::Activation::None;
+
+  // Gradients share the layout of their inputs; a transposed input gets the
+  // transposed product written into its storage. bfloat16 and uint8 inputs
+  // are widened by the GEMM, so every gradient accumulates in float32.
+  const float alpha = op.alpha;
+  const auto ta = operand_type(A), tb = operand_type(B);
+  if (ta == kernels::Operand::F32 && tb == kernels::Operand::F32) {
+    if (gA && !a.trans) {
+      // gA[M,K] += gY[M,N] * B^T
+      k.sgemm(false, !b.trans, M, K, N, alpha, g, N, B.data(), b.ld, 1.0f, gA,
+              a.ld);
+    } else if (gA) {
+      // gA^T[K,M] += B * gY^T
+      k.sgemm(b.trans, true, K, M, N, alpha, B.data(), b.ld, g, N, 1.0f, gA,
+              a.ld);
+    }
+    if (gB && !b.trans) {
+      // gB[K,N] += A^T * gY[M,N]
+      k.sgemm(!a.trans, false, K, N, M, alpha, A.data(), a.ld, g, N, 1.0f, gB,
+              b.ld);
+    } else if (gB) {
+      // gB^T[N,K] += gY^T * A
+      k.sgemm(true, a.trans, N, K, M, alpha, g, N, A.data(), a.ld, 1.0f, gB,
+              b.ld);
+    }
+    return;
+  }
+  const auto f32 = kernels::Operand::F32;
+  if (gA && !a.trans) {
+    k.gemm_mixed(false, !b.trans, M, K, N, alpha, g, f32, N, B.raw_data(), tb,
+                 b.ld, 1.0f, nullptr, none, gA, a.ld);
+  } else if (gA) {
+    k.gemm_mixed(b.trans, true, K, M, N, alpha, B.raw_data(), tb, b.ld, g,
+                 f32, N, 1.0f, nullptr, none, gA, a.ld);
+  }
+  if (gB && !b.trans) {
+    k.gemm_mixed(!a.trans, false, K, N, M, alpha, A.raw_data(), ta, a.ld, g,
+                 f32, N, 1.0f, nullptr, none, gB, b.ld);
+  } else if (gB) {
+    k.gemm_mixed(true, a.trans, N, K, M, alpha, g, f32, N, A.raw_data(), ta,
+                 a.ld, 1.0f, nullptr, none, gB, b.ld);
+  }
+}
+
+// Per-matrix form of backward_matmul. Gradients keep their input's batch
+// stride, so a shared operand (stride 0) sums the gradient of every product
+// into its one matrix.
+void backward_bmm(TapeOp& op) {
+  const float* g = op.out.grad();
   float* gA = op.a.grad();
   float* gB = op.b.grad();
+  if (!g) return;
+  GemmOperand a, b;
+  size_t sa, sb;
+  batch_operand(op.a, a, sa);
+  batch_operand(op.b, b, sb);
+  const int batch = op.out.shape[0];
+  const int M = op.out.shape[1];
+  const int N = op.out.shape[2];
+  const int K = op.a.shape[op.a.shape.size() - 1];
+  const size_t sg = static_cast<size_t>(M) * N;
+  const float alpha = op.alpha;
+  const float* A = op.a.data();
+  const float* B = op.b.data();
+  const auto& k = kernels::active();
+
+  if (sb == 0 && batch > 1 && stacked(a, sa, M)) {
+    // Shared B: the batch is one [batch * M, K] x [K, N] product.
+    const int rows = batch * M;
+    if (gA) {
+      k.sgemm(false, !b.trans, rows, K, N, alpha, g, N, B, b.ld, 1.0f, gA,
+              a.ld);
+    }
+    if (gB && !b.trans) {
+      k.sgemm(true, false, K, N, rows, alpha, A, a.ld, g, N, 1.0f, gB, b.ld);
+    } else if (gB) {
+      k.sgemm(true, false, N, K, rows, alpha, g, N, A, a.ld, 1.0f, gB, b.ld);
+    }
+    return;
+  }
+  if (gA && !a.trans) {
+    // gA[M,K] += gY[M,N] * B^T
+    k.sgemm_batched(false, !b.trans, M, K, N, alpha, g, N, sg, B, b.ld, sb,
+                    1.0f, gA, a.ld, sa, batch);
+  } else if (gA) {
+    // gA^T[K,M] += B * gY^T
+    k.sgemm_batched(b.trans, true, K, M, N, alpha, B, b.ld, sb, g, N, sg,
+                    1.0f, gA, a.ld, sa, batch);
+  }
+  if (gB && !b.trans) {
+    // gB[K,N] += A^T * gY[M,N]
+    k.sgemm_batched(!a.trans, false, K, N, M, alpha, A, a.ld, sa, g, N, sg,
+                    1.0f, gB, b.ld, sb, batch);
+  } else if (gB) {
+    // gB^T[N,K] += gY^T * A
+    k.sgemm_batched(true, a.trans, N, K, M, alpha, g, N, sg, A, a.ld, sa,
+                    1.0f, gB, b.ld, sb, batch);
+  }
+}
+
+// op.a = x, op.b = W, op.c = bias. The output gradient is rewritten as the
+// pre-activation gradient, which is then a plain matmul + bias backward.
+void backward_linear(TapeOp& op) {
+  float* g = op.out.grad();
+  if (!g) return;
+  const auto& k = kernels::active();
+  if (op.act != kernels::Activation::None && is_bf16(op.out)) {
+    float* y = op.out.store->scratch(op.out.numel);
+    k.bf16_to_f32(op.out.data_as<uint16_t>(), y, op.out.numel);
+    k.act_backward(g, y, op.act, op.out.numel);
+  } else {
+    k.act_backward(g, op.out.data(), op.act, op.out.numel);
+  }
+  backward_matmul(op);
+  if (float* gb = op.c.numel ? op.c.grad() : nullptr) {
+    const size_t N = static_cast<size_t>(op.out.shape[1]);
+    for (int r = 0; r < op.out.shape[0]; ++r) k.add_inplace(gb, g + r * N, N);
+  }
+}
+
+void backward_bce_with_logits(TapeOp& op) {
+  const float* g_out = op.out.grad();
+  float* gx = op.a.grad();
+  if (!g_out || !gx) return;
+  const float scale = g_out[0] / static_cast<float>(op.a.shape[0]);
+  kernels::active().bce_with_logits_backward(op.a.data(), op.b.data(), scale,
+                                             gx, op.a.numel);
+}
 
-  const float alpha = 1.0f;
-  const float beta = 1.0f;
-  const __LAPACK_int m = static_cast<__LAPACK_int>(M);
-  const __LAPACK_int n = static_cast<__LAPACK_int>(N);
-  const __LAPACK_int k = static_cast<__LAPACK_int>(K);
-  const __LAPACK_int ldgy = n;
-  const __LAPACK_int ldb = n;
-  const __LAPACK_int ldga = k;
+// Rows per parallel_for chunk so each chunk covers roughly kRowWork floats.
+size_t row_grain(size_t width) {
+  constexpr size_t kRowWork = 16384;
+  return std::max<size_t>(1, kRowWork / width);
+}
 
-  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, m, k, n, alpha, gY, ldgy,
-              B, ldb, beta, gA, ldga);
+// op.a holds the logits, op.b the saved softmax probabilities.
+void backward_softmax_cross_entropy(TapeOp& op) {
+  const float* g_out = op.out.grad();
+  float* gx = op.a.grad();
+  if (!g_out || !gx) return;
+  const int C = op.a.shape[1];
+  const float scale = g_out[0] / static_cast<float>(op.a.shape[0]);
+  const float* p = op.b.data();
+  const int32_t* labels = op.indices;
+  parallel::parallel_for(
+      0, static_cast<size_t>(op.a.shape[0]), row_grain(C),
+      [&](size_t lo, size_t hi) {
+        const auto& k = kernels::active();
+        for (size_t r = lo; r < hi; ++r) {
+          float* g = gx + r * C;
+          k.axpy(g, scale, p + r * C, static_cast<size_t>(C));
+          g[labels[r]] -= scale;
+        }
+      });
+}
 
-  const __LAPACK_int lda = k;
-  const __LAPACK_int ldgb = n;
-  cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, k, n, m, alpha, A, lda,
-              gY, ldgy, beta, gB, ldgb);
+// Scatter-add: each thread owns a column range of the table, so repeated
+// indices never race and the summation order is fixed.
+void backward_embedding(TapeOp& op) {
+  const float* g_out = op.out.grad();
+  float* gw = op.a.grad();
+  if (!g_out || !gw) return;
+  const int D = op.a.shape[1];
+  const size_t count = op.out.numel / static_cast<size_t>(D);
+  const int32_t* idx = op.indices;
+  if (RowSparseGrad* sparse = op.a.store->row_sparse_grad(op.a)) {
+    for (size_t i = 0; i < count; ++i) sparse->touch(idx[i]);
+  }
+  parallel::parallel_for(
+      0, static_cast<size_t>(D), std::max<size_t>(64, row_grain(count)),
+      [&](size_t lo, size_t hi) {
+        const auto& k = kernels::active();
+        for (size_t i = 0; i < count; ++i) {
+          k.add_inplace(gw + static_cast<size_t>(idx[i]) * D + lo,
+                        g_out + i * D + lo, hi - lo);
+        }
+      });
 }
 
-void backward_add_rowwise(TapeOp& op) {
-  int N = op.a.shape[0];
-  int H = op.a.shape[1];
+void backward_contiguous(TapeOp& op) {
   const float* g_out = op.out.grad();
-  float* gX = op.a.grad();
-  float* gb = op.b.grad();
-  if (!g_out || !gX || !gb) return;
-  vDSP_Length total = static_cast<vDSP_Length>(N * H);
-  vDSP_vadd(gX, 1, g_out, 1, gX, 1, total);
-  for (int h = 0; h < H; ++h) {
-    float acc = 0.0f;
-    vDSP_Length len = static_cast<vDSP_Length>(N);
-    vDSP_sve(g_out + h, H, &acc, len);
-    gb[h] += acc;
+  float* gx = op.a.grad();
+  if (!g_out || !gx) return;
+  for_each_strided(op.a, [&](size_t i, size_t off) { gx[off] += g_out[i]; });
+}
+
+// Gradients are float32 on both sides of a cast.
+void backward_cast(TapeOp& op) {
+  const float* g_out = op.out.grad();
+  float* gx = op.a.grad();
+  if (!g_out || !gx) return;
+  if (op.a.is_contiguous()) {
+    kernels::active().add_inplace(gx, g_out, op.a.numel);
+    return;
+  }
+  for_each_strided(op.a, [&](size_t i, size_t off) { gx[off] += g_out[i]; });
+}
+
+// Forward kernels. Each recomputes op.out from the op's recorded inputs, so
+// a captured op can be replayed without going through the op function.
+
+void forward_unary(TapeOp& op) {
+  const auto& k = kernels::active();
+  const float* x = op.a.data();
+  float* out = op.out.data();
+  const size_t n = op.a.numel;
+  switch (op.type) {
+    case OpType::Relu:
+      k.relu(x, out, n);
+      break;
+    case OpType::Tanh:
+      k.tanh(x, out, n);
+      break;
+    case OpType::Sigmoid:
+      k.sigmoid(x, out, n);
+      break;
+    case OpType::Log:
+      k.log(x, out, n);
+      break;
+    default:
+      break;
+  }
+}
+
+void forward_sum(TapeOp& op) {
+  op.out.data()[0] = kernels::active().sum(op.a.data(), op.a.numel);
+}
+
+// Shared by Matmul and Linear. A bfloat16 output is accumulated in float32
+// scratch and rounded once at the end.
+void forward_gemm(TapeOp& op) {
+  GemmOperand ga, gb;
+  gemm_operand(op.a, ga);
+  gemm_operand(op.b, gb);
+  const int M = op.a.shape[0];
+  const int K = op.a.shape[1];
+  const int N = op.b.shape[1];
+  const float* bias = op.c.numel ? op.c.data() : nullptr;
+  float* C = is_bf16(op.out) ? op.out.store->scratch(op.out.numel)
+                             : op.out.data();
+  gemm(ga.trans, gb.trans, M, N, K, op.alpha, op.a, ga.ld, op.b, gb.ld, bias,
+       op.act, C, N);
+  if (is_bf16(op.out)) {
+    kernels::active().f32_to_bf16(C, op.out.data_as<uint16_t>(),
+                                  op.out.numel);
+  }
+}
+
+// out[i] = alpha * a[i] * b[i] in float32, where a 2-D operand (or a
+// batch of one) is shared by every i. A shared B against stacked A rows is
+// one [batch * M, K] x [K, N] GEMM.
+void forward_bmm(TapeOp& op) {
+  GemmOperand ga, gb;
+  size_t sa, sb;
+  batch_operand(op.a, ga, sa);
+  batch_operand(op.b, gb, sb);
+  const int batch = op.out.shape[0];
+  const int M = op.out.shape[1];
+  const int N = op.out.shape[2];
+  const int K = op.a.shape[op.a.shape.size() - 1];
+  const auto& k = kernels::active();
+  if (sb == 0 && batch > 1 && stacked(ga, sa, M)) {
+    k.sgemm(false, gb.trans, batch * M, N, K, op.alpha, op.a.data(), ga.ld,
+            op.b.data(), gb.ld, 0.0f, op.out.data(), N);
+    return;
+  }
+  k.sgemm_batched(ga.trans, gb.trans, M, N, K, op.alpha, op.a.data(), ga.ld,
+                  sa, op.b.data(), gb.ld, sb, 0.0f, op.out.data(), N,
+                  static_cast<size_t>(M) * N, batch);
+}
+
+void forward_bce_with_logits(TapeOp& op) {
+  const float total = kernels::active().bce_with_logits(
+      op.a.data(), op.b.data(), op.a.numel);
+  op.out.data()[0] = total / static_cast<float>(op.a.shape[0]);
+}
+
+// op.b receives the softmax probabilities that backward reuses.
+void forward_softmax_cross_entropy(TapeOp& op) {
+  const int N = op.a.shape[0];
+  const int C = op.a.shape[1];
+  const float* xp = op.a.data();
+  float* pp = op.b.data();
+  const int32_t* labels = op.indices;
+  float* lp = op.out.store->scratch(static_cast<size_t>(N));
+  parallel::parallel_for(
+      0, static_cast<size_t>(N), row_grain(C),
+      [&](size_t lo, size_t hi) {
+        const auto& k = kernels::active();
+        for (size_t r = lo; r < hi; ++r) {
+          const float* row = xp + r * C;
+          const float lse = k.softmax(row, pp + r * C, static_cast<size_t>(C));
+          lp[r] = lse - row[labels[r]];
+        }
+      });
+  // Summing per-row losses serially keeps the result independent of the
+  // thread count.
+  op.out.data()[0] =
+      kernels::active().sum(lp, static_cast<size_t>(N)) / static_cast<float>(N);
+}
+
+void forward_embedding(TapeOp& op) {
+  const int D = op.a.shape[1];
+  const size_t count = op.out.numel / static_cast<size_t>(D);
+  const float* wp = op.a.data();
+  float* out = op.out.data();
+  const int32_t* idx = op.indices;
+  const size_t row_bytes = static_cast<size_t>(D) * sizeof(float);
+  parallel::parallel_for(0, count, row_grain(D), [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i) {
+      std::memcpy(out + i * D, wp + static_cast<size_t>(idx[i]) * D,
+                  row_bytes);
+    }
+  });
+}
+
+template <typename T>
+void copy_strided(const Tensor& x, T* out) {
+  const T* xp = x.data_as<T>();
+  for_each_strided(x, [&](size_t i, size_t off) { out[i] = xp[off]; });
+}
+
+// Elements are copied as same-sized integers, whatever their dtype.
+void forward_contiguous(TapeOp& op) {
+  switch (dtype_size(op.a.dtype)) {
+    case 1:
+      copy_strided(op.a, op.out.data_as<uint8_t>());
+      break;
+    case 2:
+      copy_strided(op.a, op.out.data_as<uint16_t>());
+      break;
+    default:
+      copy_strided(op.a, op.out.data_as<uint32_t>());
+      break;
   }
 }
 
+// out[i] = static_cast<Dst>(x[i]) for integer <-> float32 casts.
+template <typename Src, typename Dst>
+void convert(const Tensor& x, Dst* out) {
+  const Src* xp = x.data_as<Src>();
+  if (x.is_contiguous()) {
+    for (size_t i = 0; i < x.numel; ++i) out[i] = static_cast<Dst>(xp[i]);
+    return;
+  }
+  for_each_strided(x, [&](size_t i, size_t off) {
+    out[i] = static_cast<Dst>(xp[off]);
+  });
+}
+
+// One side of a cast is always float32; cast() routes the rest through it.
+void forward_cast(TapeOp& op) {
+  switch (op.out.dtype) {
+    case DType::Int32:
+      convert<float>(op.a, op.out.data_as<int32_t>());
+      return;
+    case DType::UInt8:
+      convert<float>(op.a, op.out.data_as<uint8_t>());
+      return;
+    default:
+      break;
+  }
+  if (op.a.dtype == DType::Int32) {
+    convert<int32_t>(op.a, op.out.data());
+    return;
+  }
+  if (op.a.dtype == DType::UInt8) {
+    convert<uint8_t>(op.a, op.out.data());
+    return;
+  }
+  const auto& k = kernels::active();
+  const size_t n = op.a.numel;
+  if (op.a.is_contiguous()) {
+    if (is_bf16(op.out)) {
+      k.f32_to_bf16(op.a.data(), op.out.data_as<uint16_t>(), n);
+    } else {
+      k.bf16_to_f32(op.a.data_as<uint16_t>(), op.out.data(), n);
+    }
+    return;
+  }
+  if (is_bf16(op.out)) {
+    const float* xp = op.a.data();
+    uint16_t* out = op.out.data_as<uint16_t>();
+    for_each_strided(op.a, [&](size_t i, size_t off) {
+      out[i] = kernels::float_to_bf16(xp[off]);
+    });
+  } else {
+    const uint16_t* xp = op.a.data_as<uint16_t>();
+    float* out = op.out.data();
+    for_each_strided(op.a, [&](size_t i, size_t off) {
+      out[i] = kernels::bf16_to_float(xp[off]);
+    });
+  }
+}
+
+// Operand slots (bit 0 out, 1 a, 2 b, 3 c) whose data the backward of an op
+// reads; must match the backward_* functions above.
+unsigned saved_operands(OpType type, kernels::Activation act) {
+  switch (type) {
+    case OpType::Mul:
+    case OpType::Matmul:
+    case OpType::BatchMatmul:
+    case OpType::BceWithLogits:
+      return 0b0110;
+    case OpType::Relu:
+    case OpType::Log:
+      return 0b0010;
+    case OpType::Tanh:
+    case OpType::Sigmoid:
+      return 0b0001;
+    case OpType::SoftmaxCrossEntropy:
+      return 0b0100;
+    case OpType::Linear:
+      return act == kernels::Activation::None ? 0b0110 : 0b0111;
+    case OpType::Add:
+    case OpType::Sub:
+    case OpType::Sum:
+    case OpType::Contiguous:
+    case OpType::Embedding:
+    case OpType::Cast:
+      return 0;
+    case OpType::Custom:
+      return 0b1111;
+  }
+  return 0b1111;
+}
+
+// Half-open byte ranges the (possibly strided) tensors touch intersect.
+bool data_overlaps(const Tensor& x, const Tensor& y) {
+  const auto begin = [](const Tensor& t) {
+    return t.offset * dtype_size(t.dtype);
+  };
+  const auto end = [&](const Tensor& t) {
+    size_t last = 0;
+    for (size_t i = 0; i < t.shape.size(); ++i) {
+      last += static_cast<size_t>(t.shape[i] - 1) * t.strides[i];
+    }
+    return begin(t) + (t.numel ? last + 1 : 0) * dtype_size(t.dtype);
+  };
+  return x.store && x.store == y.store && begin(x) < end(y) &&
+         begin(y) < end(x);
+}
+
 }  // namespace
 
 // Tensor methods
-float* Tensor::data() { return store ? store->data_ptr(offset) : nullptr; }
-float* Tensor::grad() { return store ? store->grad_ptr(offset) : nullptr; }
+Tensor::Tensor(ParameterStore* s, size_t off, const Shape& sh, size_t n)
+    : store(s),
+      offset(off),
+      shape(sh),
+      strides(contiguous_strides(sh)),
+      numel(n) {}
+
+bool Tensor::is_contiguous() const {
+  size_t expected = 1;
+  for (size_t i = shape.size(); i-- > 0;) {
+    if (shape[i] != 1 && strides[i] != expected) return false;
+    expected *= static_cast<size_t>(shape[i]);
+  }
+  return true;
+}
+
+void* Tensor::raw_data() {
+  float* base = store ? store->data_ptr(0) : nullptr;
+  return base ? reinterpret_cast<char*>(base) + offset * dtype_size(dtype)
+              : nullptr;
+}
+
+const void* Tensor::raw_data() const {
+  const float* base = store ? store->data_ptr(0) : nullptr;
+  return base
+             ? reinterpret_cast<const char*>(base) + offset * dtype_size(dtype)
+             : nullptr;
+}
+
+float* Tensor::data() { return static_cast<float*>(raw_data()); }
+float* Tensor::grad() {
+  return store && requires_grad() ? store->grad_ptr(grad_offset) : nullptr;
+}
 const float* Tensor::data() const {
-  return store ? store->data_ptr(offset) : nullptr;
+  return static_cast<const float*>(raw_data());
 }
 const float* Tensor::grad() const {
-  return store ? store->grad_ptr(offset) : nullptr;
+  return store && requires_grad() ? store->grad_ptr(grad_offset) : nullptr;
 }
 
 void Tensor::zero_grad() {
-  if (!store) return;
-  float* ptr = store->grad_ptr(offset);
+  float* ptr = grad();
   if (!ptr) return;
-  zero_buffer(ptr, numel);
+  if (RowSparseGrad* sparse = store->row_sparse_grad(*this)) {
+    zero_touched_rows(*sparse, ptr);
+    return;
+  }
+  if (is_contiguous()) {
+    zero_buffer(ptr, numel);
+    return;
+  }
+  for_each_strided(*this, [&](size_t, size_t off) { ptr[off] = 0.0f; });
 }
 
 void Tensor::fill(float v) {
-  if (!store) return;
-  float* ptr = store->data_ptr(offset);
-  if (!ptr) return;
-  std::fill(ptr, ptr + numel, v);
+  if (!raw_data()) return;
+  const auto fill_as = [&](auto* ptr, auto value) {
+    for_each_strided(*this, [&](size_t, size_t off) { ptr[off] = value; });
+  };
+  switch (dtype) {
+    case DType::BFloat16:
+      fill_as(data_as<uint16_t>(), kernels::float_to_bf16(v));
+      return;
+    case DType::Int32:
+      fill_as(data_as<int32_t>(), static_cast<int32_t>(v));
+      return;
+    case DType::UInt8:
+      fill_as(data_as<uint8_t>(), static_cast<uint8_t>(v));
+      return;
+    default:
+      break;
+  }
+  float* ptr = data();
+  if (is_contiguous()) {
+    std::fill(ptr, ptr + numel, v);
+    return;
+  }
+  for_each_strided(*this, [&](size_t, size_t off) { ptr[off] = v; });
 }
 
 void ParameterStore::register_parameter_allocation(size_t offset,
@@ -215,122 +1039,204 @@ void ParameterStore::register_parameter_allocation(size_t offset,
 
 // ParameterStore
 size_t ParameterStore::allocate(size_t count) {
-  const size_t off = used;
-  if (count == 0) {
-    if (stats_enabled) {
-      stats.peak_elements = std::max(stats.peak_elements, used);
+  if (count > 0 && !free_blocks.empty()) {
+    size_t best = free_blocks.size();
+    for (size_t i = 0; i < free_blocks.size(); ++i) {
+      const size_t n = free_blocks[i].count;
+      if (n >= count && (best == free_blocks.size() ||
+                         n < free_blocks[best].count)) {
+        best = i;
+      }
+    }
+    if (best < free_blocks.size()) {
+      FreeBlock& block = free_blocks[best];
+      const size_t off = block.offset;
+      block.offset += count;
+      block.count -= count;
+      if (block.count == 0) free_blocks.erase(free_blocks.begin() + best);
+      return off;
     }
-    return off;
   }
 
+  const size_t off = used;
+  if (count == 0) return off;
+
   const size_t required = used + count;
   ensure_capacity(required);
   used = required;
-  if (stats_enabled) {
-    stats.peak_elements = std::max(stats.peak_elements, used);
-  }
+  // Peaks are tracked even without stats: plan() measures with them.
+  stats.peak_elements = std::max(stats.peak_elements, used);
+  return off;
+}
+
+size_t ParameterStore::allocate_grad(size_t count) {
+  const size_t off = grad_used;
+  ensure_grad_capacity(grad_used + count);
+  grad_used += count;
+  stats.peak_grad_elements = std::max(stats.peak_grad_elements, grad_used);
   return off;
 }
 
-void ParameterStore::reserve(size_t total_elements) {
+void ParameterStore::reserve(size_t total_elements, size_t grad_elements) {
   ensure_capacity(total_elements);
+  ensure_grad_capacity(grad_elements);
   if (stats_enabled) {
     stats.reserve_calls += 1;
     stats.reserve_elements = std::max(stats.reserve_elements, total_elements);
   }
 }
 
-size_t ParameterStore::mark() const { return used; }
+void ParameterStore::release(const Tensor& t) {
+  if (t.store != this || t.numel == 0) return;
+  // Back to float units; tensor() starts every tensor on a float boundary.
+  size_t off = t.offset * dtype_size(t.dtype) / sizeof(float);
+  size_t count = arena_floats(t.numel, t.dtype);
+  if (!t.is_contiguous() || off + count > used)
+    throw std::invalid_argument("ParameterStore::release invalid tensor");
+  auto it = std::lower_bound(
+      free_blocks.begin(), free_blocks.end(), off,
+      [](const FreeBlock& b, size_t o) { return b.offset < o; });
+  auto prev = it == free_blocks.begin() ? it : std::prev(it);
+  if (prev != it && prev->offset + prev->count == off) {
+    it = prev;
+    off = it->offset;
+    count += it->count;
+    it = free_blocks.erase(it);
+  }
+  if (it != free_blocks.end() && off + count == it->offset) {
+    count += it->count;
+    it = free_blocks.erase(it);
+  }
+  if (off + count == used) {
+    used = off;
+    return;
+  }
+  free_blocks.insert(it, FreeBlock{off, count});
+}
+
+StoreMark ParameterStore::mark() const { return StoreMark{used, grad_used}; }
+
+StoreMark ParameterStore::plan_raw(void (*step)(void*), void* ctx) {
+  clear_tape();
+  const StoreMark start = mark();
+  const size_t outer_peak = stats.peak_elements;
+  const size_t outer_grad_peak = stats.peak_grad_elements;
+  stats.peak_elements = used;
+  stats.peak_grad_elements = grad_used;
+  step(ctx);
+  const StoreMark need{stats.peak_elements, stats.peak_grad_elements};
+  stats.peak_elements = std::max(outer_peak, need.data);
+  stats.peak_grad_elements = std::max(outer_grad_peak, need.grad);
+
+  reset(start);
+  clear_tape();
+  zero_grad();
+  reserve(need.data, need.grad);
+  stats.plan_calls += 1;
+  stats.plan_elements = std::max(stats.plan_elements, need.data);
+  stats.plan_grad_elements = std::max(stats.plan_grad_elements, need.grad);
+  return need;
+}
 
-void ParameterStore::reset(size_t mark) {
-  if (mark > used)
+void ParameterStore::reset(const StoreMark& mark) {
+  if (mark.data > used || mark.grad > grad_used)
     throw std::invalid_argument("ParameterStore::reset mark beyond used");
-  used = mark;
-  if (stats_enabled) {
-    stats.peak_elements = std::max(stats.peak_elements, used);
+  used = mark.data;
+  grad_used = mark.grad;
+  while (!free_blocks.empty() && free_blocks.back().offset >= used) {
+    free_blocks.pop_back();
+  }
+  if (!free_blocks.empty()) {
+    FreeBlock& top = free_blocks.back();
+    top.count = std::min(top.count, used - top.offset);
   }
 }
 
 void ParameterStore::ensure_capacity(size_t required) {
-  if (required <= capacity) return;
-
-  size_t new_capacity = capacity == 0 ? required : capacity;
-  while (new_capacity < required) {
-    new_capacity =
-        std::max(new_capacity * 2, new_capacity + static_cast<size_t>(1024));
+  if (data_buf.grow(required, used) && stats_enabled) {
+    stats.capacity_grow_events += 1;
   }
+  stats.data_arena = data_buf.stats();
+}
 
-  std::unique_ptr<float[]> new_data(new float[new_capacity]);
-  std::unique_ptr<float[]> new_grad(new float[new_capacity]);
-
-  if (data_buf) std::copy_n(data_buf.get(), used, new_data.get());
-  if (grad_buf) std::copy_n(grad_buf.get(), used, new_grad.get());
-
-  data_buf.swap(new_data);
-  grad_buf.swap(new_grad);
-  capacity = new_capacity;
-
-  if (stats_enabled) {
+void ParameterStore::ensure_grad_capacity(size_t required) {
+  if (grad_buf.grow(required, grad_used) && stats_enabled) {
     stats.capacity_grow_events += 1;
   }
+  stats.grad_arena = grad_buf.stats();
 }
 
 float* ParameterStore::data_ptr(size_t offset) {
-  return data_buf ? data_buf.get() + offset : nullptr;
+  return data_buf.data() ? data_buf.data() + offset : nullptr;
 }
 
 const float* ParameterStore::data_ptr(size_t offset) const {
-  return data_buf ? data_buf.get() + offset : nullptr;
+  return data_buf.data() ? data_buf.data() + offset : nullptr;
 }
 
 float* ParameterStore::grad_ptr(size_t offset) {
-  return grad_buf ? grad_buf.get() + offset : nullptr;
+  return grad_buf.data() ? grad_buf.data() + offset : nullptr;
 }
 
 const float* ParameterStore::grad_ptr(size_t offset) const {
-  return grad_buf ? grad_buf.get() + offset : nullptr;
+  return grad_buf.data() ? grad_buf.data() + offset : nullptr;
 }
 
-Tensor ParameterStore::tensor(const std::vector<int>& shape, TensorInit init) {
+float* ParameterStore::scratch(size_t count) {
+  if (count > scratch_capacity) {
+    scratch_buf.reset(new float[count]);
+    scratch_capacity = count;
+  }
+  return scratch_buf.get();
+}
+
+Tensor ParameterStore::tensor(const Shape& shape, TensorInit init,
+                              bool requires_grad, DType dtype) {
+  if (requires_grad && !is_floating(dtype))
+    throw std::invalid_argument("integer tensors cannot require grad");
   const bool zero_data = (init == TensorInit::ZeroData);
   const size_t n = compute_numel(shape);
-  const size_t off = allocate(n);
+  const size_t floats = arena_floats(n, dtype);
+  const size_t off = allocate(floats);
+  Tensor t{this, off * sizeof(float) / dtype_size(dtype), shape, n};
+  t.dtype = dtype;
+  if (requires_grad) t.grad_offset = allocate_grad(n);
 
-  if (n == 0) return Tensor{this, off, shape, n};
+  if (n == 0) return t;
 
   float* data = data_ptr(off);
-  float* grad = grad_ptr(off);
+  float* grad = t.grad();
 
   if (stats_enabled) {
     auto start = std::chrono::steady_clock::now();
     if (zero_data && data) {
-      zero_buffer(data, n);
+      zero_buffer(data, floats);
     }
     if (grad) {
       zero_buffer(grad, n);
     }
     auto end = std::chrono::steady_clock::now();
     stats.tensor_zero_calls += 1;
-    stats.tensor_zero_elems += n + (zero_data ? n : 0);
+    stats.tensor_zero_elems += (grad ? n : 0) + (zero_data ? floats : 0);
     stats.tensor_zero_ms +=
         std::chrono::duration<double, std::milli>(end - start).count();
   } else {
     if (zero_data && data) {
-      zero_buffer(data, n);
+      zero_buffer(data, floats);
     }
     if (grad) {
       zero_buffer(grad, n);
     }
   }
 
-  return Tensor{this, off, shape, n};
+  return t;
 }
 
-Tensor ParameterStore::parameter(const std::vector<int>& shape, float scale,
+Tensor ParameterStore::parameter(const Shape& shape, float scale,
                                  unsigned seed) {
-  auto t = tensor(shape);
+  auto t = tensor(shape, TensorInit::UninitializedData, true);
   if (t.numel > 0) {
-    register_parameter_allocation(t.offset, t.numel);
+    register_parameter_allocation(t.grad_offset, t.numel);
   }
   std::uniform_real_distribution<float> dist(-scale, scale);
   auto* p = t.data();
@@ -354,7 +1260,11 @@ void ParameterStore::enable_stats(bool enabled) {
   reset_stats();
 }
 
-void ParameterStore::reset_stats() { stats = ParameterStoreStats{}; }
+void ParameterStore::reset_stats() {
+  stats = ParameterStoreStats{};
+  stats.data_arena = data_buf.stats();
+  stats.grad_arena = grad_buf.stats();
+}
 
 const ParameterStoreStats& ParameterStore::get_stats() const { return stats; }
 
@@ -391,7 +1301,26 @@ void ParameterStore::print_stats() const {
   cout << "  reserve(): " << stats.reserve_calls
        << " calls, max hinted elements: " << stats.reserve_elements << endl;
   cout << "  capacity growth events: " << stats.capacity_grow_events
-       << " (peak elements: " << stats.peak_elements << ")" << endl;
+       << " (peak elements: " << stats.peak_elements
+       << ", peak grad elements: " << stats.peak_grad_elements << ")" << endl;
+  const auto print_arena = [](const char* name, const ArenaStats& a) {
+    const double mb = 1024.0 * 1024.0;
+    cout << "  " << name << " arena: " << a.committed_bytes / mb
+         << " MB committed in " << a.commit_calls << " calls, "
+         << a.huge_page_bytes / mb << " MB huge pages, "
+         << a.numa_bound_bytes / mb << " MB NUMA-placed"
+         << (a.mapped ? "" : " (heap, moves on growth)") << endl;
+  };
+  print_arena("data", stats.data_arena);
+  print_arena("grad", stats.grad_arena);
+  if (stats.plan_calls) {
+    const bool within = stats.peak_elements <= stats.plan_elements &&
+                        stats.peak_grad_elements <= stats.plan_grad_elements;
+    cout << "  memory plan: " << stats.plan_elements << " data + "
+         << stats.plan_grad_elements << " grad elements planned, peak "
+         << stats.peak_elements << " + " << stats.peak_grad_elements
+         << (within ? " (within plan)" : " (exceeds plan)") << endl;
+  }
 }
 
 void ParameterStore::zero_grad() {
@@ -403,7 +1332,7 @@ void ParameterStore::zero_grad() {
     zero_count = param_grad_span;
   } else {
     zero_offset = 0;
-    zero_count = used;
+    zero_count = grad_used;
   }
 
 #ifndef NDEBUG
@@ -412,241 +1341,687 @@ void ParameterStore::zero_grad() {
   }
 #endif
 
-  if (zero_count == 0) {
+  float* grad_base = zero_count == 0 ? nullptr : grad_ptr(zero_offset);
+  if (!grad_base) {
     if (stats_enabled) {
       stats.zero_grad_calls += 1;
     }
     return;
   }
 
-  float* grad_base = grad_ptr(zero_offset);
-  if (!grad_base) {
-    if (stats_enabled) {
-      stats.zero_grad_calls += 1;
+  // Dense runs between row-sparse parameters are memset; the sparse
+  // parameters themselves only clear the rows they touched, unless a
+  // non-embedding op wrote their gradient this step.
+  const auto zero_all = [&]() {
+    size_t zeroed = 0;
+    size_t pos = zero_offset;
+    const size_t end = zero_offset + zero_count;
+    for (auto& sparse : row_sparse_grads) {
+      if (sparse.offset < pos || sparse.offset >= end) continue;
+      zero_buffer(grad_ptr(pos), sparse.offset - pos);
+      zeroed += sparse.offset - pos;
+      zeroed += zero_touched_rows(sparse, grad_ptr(sparse.offset));
+      pos = sparse.offset + static_cast<size_t>(sparse.rows) * sparse.cols;
     }
-    return;
-  }
+    zero_buffer(grad_ptr(pos), end - pos);
+    return zeroed + (end - pos);
+  };
 
   if (stats_enabled) {
     auto start = std::chrono::steady_clock::now();
-    zero_buffer(grad_base, zero_count);
+    const size_t zeroed = zero_all();
     auto end = std::chrono::steady_clock::now();
     stats.zero_grad_calls += 1;
-    stats.zero_grad_elems += zero_count;
+    stats.zero_grad_elems += zeroed;
     stats.zero_grad_ms +=
         std::chrono::duration<double, std::milli>(end - start).count();
   } else {
-    zero_buffer(grad_base, zero_count);
+    zero_all();
+  }
+}
+
+void ParameterStore::enable_row_sparse_grad(const Tensor& param) {
+  if (param.store != this || param.shape.size() != 2 ||
+      !param.is_contiguous() || !param.requires_grad())
+    throw std::invalid_argument(
+        "enable_row_sparse_grad expects a contiguous 2-D parameter");
+  if (row_sparse_grad(param)) return;
+  RowSparseGrad sparse;
+  sparse.offset = param.grad_offset;
+  sparse.rows = param.shape[0];
+  sparse.cols = param.shape[1];
+  sparse.is_touched.assign(static_cast<size_t>(sparse.rows), 0);
+  zero_buffer(grad_ptr(param.grad_offset), param.numel);
+  auto it = std::lower_bound(
+      row_sparse_grads.begin(), row_sparse_grads.end(), sparse.offset,
+      [](const RowSparseGrad& e, size_t off) { return e.offset < off; });
+  row_sparse_grads.insert(it, std::move(sparse));
+}
+
+RowSparseGrad* ParameterStore::row_sparse_grad(const Tensor& param) {
+  for (auto& sparse : row_sparse_grads) {
+    if (sparse.offset == param.grad_offset &&
+        static_cast<size_t>(sparse.rows) * sparse.cols == param.numel)
+      return &sparse;
   }
+  return nullptr;
 }
 
 void ParameterStore::clear_tape() { tape.clear(); }
 
+// Tape
+uint32_t Tape::intern(const Tensor& t) {
+  if (!t.store && t.numel == 0) return kNone;
+  // Chained ops feed the previous output straight back in.
+  if (!operands_.empty() && operands_.back()[0] != kNone) {
+    const uint32_t prev = operands_.back()[0];
+    const Tensor& p = tensors_[prev];
+    if (p.store == t.store && p.offset == t.offset && p.dtype == t.dtype &&
+        p.grad_offset == t.grad_offset && p.numel == t.numel &&
+        p.shape == t.shape && p.strides == t.strides)
+      return prev;
+  }
+  tensors_.push_back(t);
+  return static_cast<uint32_t>(tensors_.size() - 1);
+}
+
+void Tape::push_back(const TapeOp& op) {
+  const std::array<uint32_t, 4> ids = {intern(op.out), intern(op.a),
+                                       intern(op.b), intern(op.c)};
+  types_.push_back(op.type);
+  acts_.push_back(op.act);
+  indices_.push_back(op.indices);
+  fns_.push_back(op.backward);
+  ctxs_.push_back(op.ctx);
+  forwards_.push_back(op.forward);
+  alphas_.push_back(op.alpha);
+  operands_.push_back(ids);
+}
+
+TapeOp Tape::operator[](size_t i) const {
+  const auto& ids = operands_[i];
+  const auto get = [&](uint32_t id) {
+    return id == kNone ? Tensor{} : tensors_[id];
+  };
+  return TapeOp{types_[i], get(ids[0]), get(ids[1]), get(ids[2]),
+                indices_[i], get(ids[3]), acts_[i], fns_[i], ctxs_[i],
+                forwards_[i], alphas_[i]};
+}
+
+void Tape::clear() {
+  types_.clear();
+  acts_.clear();
+  indices_.clear();
+  fns_.clear();
+  ctxs_.clear();
+  forwards_.clear();
+  alphas_.clear();
+  operands_.clear();
+  tensors_.clear();
+}
+
+void Tape::reserve(size_t ops) {
+  types_.reserve(ops);
+  acts_.reserve(ops);
+  indices_.reserve(ops);
+  fns_.reserve(ops);
+  ctxs_.reserve(ops);
+  forwards_.reserve(ops);
+  alphas_.reserve(ops);
+  operands_.reserve(ops);
+  tensors_.reserve(3 * ops);
+}
+
+// Record before `before` whose output slot holds t's gradient, or size() if
+// t is a leaf. Output slots increase along the tape, so binary search on
+// the first element's grad offset.
+size_t Tape::producer(const Tensor& t, size_t before) const {
+  size_t lo = 0, hi = before;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (tensors_[operands_[mid][0]].grad_offset <= t.grad_offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) return size();
+  const Tensor& out = tensors_[operands_[lo - 1][0]];
+  return t.grad_offset < out.grad_offset + out.numel ? lo - 1 : size();
+}
+
+const std::vector<uint8_t>& Tape::mark_live(const Tensor& loss) {
+  const size_t n = size();
+  bool ordered = true;
+  for (size_t i = 1; i < n && ordered; ++i) {
+    ordered = tensors_[operands_[i - 1][0]].grad_offset <
+              tensors_[operands_[i][0]].grad_offset;
+  }
+  live_.assign(n, ordered ? 0 : 1);
+  if (!ordered || !loss.requires_grad()) return live_;
+  const size_t root = producer(loss, n);
+  if (root == n) return live_;
+  live_[root] = 1;
+  for (size_t i = root + 1; i-- > 0;) {
+    if (!live_[i]) continue;
+    for (size_t k = 1; k < 4; ++k) {
+      const uint32_t id = operands_[i][k];
+      if (id == kNone || !tensors_[id].requires_grad()) continue;
+      const size_t p = producer(tensors_[id], i);
+      if (p < n) live_[p] = 1;
+    }
+  }
+  return live_;
+}
+
+bool Tape::saves(const Tensor& t, size_t from) const {
+  for (size_t i = from; i < size(); ++i) {
+    const unsigned mask = saved_operands(types_[i], acts_[i]);
+    for (size_t k = 0; k < 4; ++k) {
+      const uint32_t id = operands_[i][k];
+      if ((mask >> k & 1u) && id != kNone && data_overlaps(tensors_[id], t))
+        return true;
+    }
+  }
+  return false;
+}
+
 void ParameterStore::backward(const Tensor& loss) {
   if (loss.store != this)
     throw std::invalid_argument("loss belongs to different store");
   // Seed dL/dL = 1
-  float* g = loss.store->grad_ptr(loss.offset);
+  if (!loss.requires_grad())
+    throw std::invalid_argument("loss does not require grad");
+  float* g = grad_ptr(loss.grad_offset);
   if (loss.numel == 1) {
     g[0] += 1.0f;
   } else {
     for (size_t i = 0; i < loss.numel; ++i) g[i] += 1.0f;
   }
-  // Traverse tape in reverse
-  for (auto it = tape.rbegin(); it != tape.rend(); ++it) {
-    TapeOp& op = *it;
-    switch (op.type) {
-      case OpType::Add:
-        backward_add(op);
-        break;
-      case OpType::Sub:
-        backward_sub(op);
-        break;
-      case OpType::Mul:
-        backward_mul(op);
-        break;
-      case OpType::Relu:
-        backward_relu(op);
-        break;
-      case OpType::Tanh:
-        backward_tanh(op);
-        break;
-      case OpType::Sigmoid:
-        backward_sigmoid(op);
-        break;
-      case OpType::Log:
-        backward_log(op);
-        break;
-      case OpType::Sum:
-        backward_sum(op);
-        break;
-      case OpType::Matmul:
-        backward_matmul(op);
-        break;
-      case OpType::AddRowwise:
-        backward_add_rowwise(op);
-        break;
-    }
+  propagate(loss);
+}
+
+void ParameterStore::propagate(const Tensor& out) {
+  // Traverse tape in reverse, skipping ops that cannot reach out.
+  const std::vector<uint8_t>& live = tape.mark_live(out);
+  for (size_t i = tape.size(); i-- > 0;) {
+    if (!live[i]) continue;
+    TapeOp op = tape[i];
+    run_backward(op, *this);
+  }
+}
+
+void run_forward(TapeOp& op) {
+  switch (op.type) {
+    case OpType::Add:
+    case OpType::Sub:
+    case OpType::Mul:
+      forward_binary(op);
+      break;
+    case OpType::Relu:
+    case OpType::Tanh:
+    case OpType::Sigmoid:
+    case OpType::Log:
+      forward_unary(op);
+      break;
+    case OpType::Sum:
+      forward_sum(op);
+      break;
+    case OpType::Matmul:
+    case OpType::Linear:
+      forward_gemm(op);
+      break;
+    case OpType::BatchMatmul:
+      forward_bmm(op);
+      break;
+    case OpType::Contiguous:
+      forward_contiguous(op);
+      break;
+    case OpType::BceWithLogits:
+      forward_bce_with_logits(op);
+      break;
+    case OpType::SoftmaxCrossEntropy:
+      forward_softmax_cross_entropy(op);
+      break;
+    case OpType::Embedding:
+      forward_embedding(op);
+      break;
+    case OpType::Cast:
+      forward_cast(op);
+      break;
+    case OpType::Custom:
+      if (op.forward) op.forward(op.ctx, op);
+      break;
+  }
+}
+
+void run_backward(TapeOp& op, ParameterStore& store) {
+  if (op.type != OpType::Embedding && !store.row_sparse_grads.empty())
+    mark_dense_sparse_grads(op, store);
+  switch (op.type) {
+    case OpType::Add:
+    case OpType::Sub:
+    case OpType::Mul:
+      backward_binary(op);
+      break;
+    case OpType::Relu:
+      backward_relu(op);
+      break;
+    case OpType::Tanh:
+      backward_tanh(op);
+      break;
+    case OpType::Sigmoid:
+      backward_sigmoid(op);
+      break;
+    case OpType::Log:
+      backward_log(op);
+      break;
+    case OpType::Sum:
+      backward_sum(op);
+      break;
+    case OpType::Matmul:
+      backward_matmul(op);
+      break;
+    case OpType::BatchMatmul:
+      backward_bmm(op);
+      break;
+    case OpType::Contiguous:
+      backward_contiguous(op);
+      break;
+    case OpType::BceWithLogits:
+      backward_bce_with_logits(op);
+      break;
+    case OpType::SoftmaxCrossEntropy:
+      backward_softmax_cross_entropy(op);
+      break;
+    case OpType::Embedding:
+      backward_embedding(op);
+      break;
+    case OpType::Linear:
+      backward_linear(op);
+      break;
+    case OpType::Cast:
+      backward_cast(op);
+      break;
+    case OpType::Custom:
+      op.backward(op.ctx, op, store);
+      break;
   }
 }
 
 // Ops
-static void assert_same_shape(const Tensor& a, const Tensor& b) {
-  if (a.shape.size() != b.shape.size())
-    throw std::invalid_argument("Shape rank mismatch");
-  if (a.numel != b.numel) throw std::invalid_argument("Numel mismatch");
-  for (size_t i = 0; i < a.shape.size(); ++i)
-    if (a.shape[i] != b.shape[i]) throw std::invalid_argument("Shape mismatch");
+static Tensor dense(const Tensor& x, ParameterStore& store) {
+  return x.is_contiguous() ? x : contiguous(x, store);
+}
+
+// Dense float32 operand for ops without bfloat16 kernels.
+static Tensor dense_f32(const Tensor& x, ParameterStore& store) {
+  return x.dtype == DType::Float32 ? dense(x, store)
+                                   : cast(x, DType::Float32, store);
+}
+
+// matmul/linear operand: float32 is cast to the autocast dtype and int32 to
+// float, uint8 stays as is for the GEMM to widen while packing; then copied
+// only if GEMM cannot read the layout directly.
+static Tensor gemm_input(const Tensor& x, ParameterStore& store) {
+  const Tensor t = x.dtype == DType::Float32 || x.dtype == DType::Int32
+                       ? cast(x, store.autocast, store)
+                       : x;
+  GemmOperand g;
+  return gemm_operand(t, g) ? t : contiguous(t, store);
+}
+
+// batched matmul operand: float32, copied only if no batch layout fits.
+static Tensor bmm_input(const Tensor& x, ParameterStore& store) {
+  const Tensor t =
+      x.dtype == DType::Float32 ? x : cast(x, DType::Float32, store);
+  GemmOperand g;
+  size_t stride;
+  return batch_operand(t, g, stride) ? t : contiguous(t, store);
 }
 
 Tensor add(const Tensor& a, const Tensor& b, ParameterStore& store) {
-  assert_same_shape(a, b);
-  Tensor out = store.tensor(a.shape);
-  const float* ap = a.data();
-  const float* bp = b.data();
-  float* op = out.data();
-  vDSP_Length len = static_cast<vDSP_Length>(a.numel);
-  vDSP_vadd(ap, 1, bp, 1, op, 1, len);
-  store.tape.push_back(TapeOp{OpType::Add, out, a, b});
-  return out;
+  return broadcast_binary(OpType::Add, dense_f32(a, store),
+                          dense_f32(b, store), store);
 }
 
 Tensor sub(const Tensor& a, const Tensor& b, ParameterStore& store) {
-  assert_same_shape(a, b);
-  Tensor out = store.tensor(a.shape);
-  const float* ap = a.data();
-  const float* bp = b.data();
-  float* op = out.data();
-  vDSP_Length len = static_cast<vDSP_Length>(a.numel);
-  vDSP_vsub(bp, 1, ap, 1, op, 1, len);
-  store.tape.push_back(TapeOp{OpType::Sub, out, a, b});
-  return out;
+  return broadcast_binary(OpType::Sub, dense_f32(a, store),
+                          dense_f32(b, store), store);
 }
 
 Tensor mul(const Tensor& a, const Tensor& b, ParameterStore& store) {
-  assert_same_shape(a, b);
-  Tensor out = store.tensor(a.shape);
-  const float* ap = a.data();
-  const float* bp = b.data();
-  float* op = out.data();
-  vDSP_Length len = static_cast<vDSP_Length>(a.numel);
-  vDSP_vmul(ap, 1, bp, 1, op, 1, len);
-  store.tape.push_back(TapeOp{OpType::Mul, out, a, b});
-  return out;
+  return broadcast_binary(OpType::Mul, dense_f32(a, store),
+                          dense_f32(b, store), store);
+}
+
+static Tensor unary(OpType type, const Tensor& x_in, ParameterStore& store) {
+  const Tensor x = dense_f32(x_in, store);
+  TapeOp op{type, op_output(store, x.shape, needs_grad(store, x)), x};
+  if (!x.data() || !op.out.data()) return op.out;
+  forward_unary(op);
+  store.record(op);
+  return op.out;
 }
 
 Tensor relu(const Tensor& x, ParameterStore& store) {
-  Tensor out = store.tensor(x.shape);
-  const float* xp = x.data();
-  float* op = out.data();
-  if (!xp || !op) return out;
-  vDSP_Length len = static_cast<vDSP_Length>(x.numel);
-  float threshold = 0.0f;
-  vDSP_vthres(xp, 1, &threshold, op, 1, len);
-  store.tape.push_back(TapeOp{OpType::Relu, out, x, Tensor{}});
-  return out;
+  return unary(OpType::Relu, x, store);
 }
 
 Tensor vtanh(const Tensor& x, ParameterStore& store) {
-  Tensor out = store.tensor(x.shape);
-  const float* xp = x.data();
-  float* op = out.data();
-  if (!xp || !op) return out;
-  int len = static_cast<int>(x.numel);
-  if (len > 0) vvtanhf(op, xp, &len);
-  store.tape.push_back(TapeOp{OpType::Tanh, out, x, Tensor{}});
-  return out;
+  return unary(OpType::Tanh, x, store);
 }
 
 Tensor sigmoid(const Tensor& x, ParameterStore& store) {
-  Tensor out = store.tensor(x.shape);
-  const float* xp = x.data();
-  float* op = out.data();
-  if (!xp || !op) return out;
-  int len_int = static_cast<int>(x.numel);
-  if (len_int > 0) {
-    vDSP_Length len = static_cast<vDSP_Length>(x.numel);
-    const float one = 1.0f;
-    const float neg_one = -1.0f;
-    vDSP_vsmul(xp, 1, &neg_one, op, 1, len);
-    vvexpf(op, op, &len_int);
-    vDSP_vsadd(op, 1, &one, op, 1, len);
-    vDSP_svdiv(&one, op, 1, op, 1, len);
-  }
-  store.tape.push_back(TapeOp{OpType::Sigmoid, out, x, Tensor{}});
-  return out;
+  return unary(OpType::Sigmoid, x, store);
 }
 
 Tensor vlog(const Tensor& x, ParameterStore& store) {
-  Tensor out = store.tensor(x.shape);
-  const float* xp = x.data();
-  float* op = out.data();
-  if (!xp || !op) return out;
-  int len = static_cast<int>(x.numel);
-  if (len > 0) vvlogf(op, xp, &len);
-  store.tape.push_back(TapeOp{OpType::Log, out, x, Tensor{}});
-  return out;
+  return unary(OpType::Log, x, store);
 }
 
-Tensor sum(const Tensor& x, ParameterStore& store) {
-  Tensor out = store.tensor({1});
-  const float* xp = x.data();
-  float* op = out.data();
-  if (!xp || !op) return out;
-  vDSP_Length len = static_cast<vDSP_Length>(x.numel);
-  float acc = 0.0f;
-  if (len > 0) vDSP_sve(xp, 1, &acc, len);
-  op[0] = acc;
-  store.tape.push_back(TapeOp{OpType::Sum, out, x, Tensor{}});
-  return out;
+Tensor sum(const Tensor& x_in, ParameterStore& store) {
+  const Tensor x = dense_f32(x_in, store);
+  TapeOp op{OpType::Sum, op_output(store, {1}, needs_grad(store, x)), x};
+  if (!x.data() || !op.out.data()) return op.out;
+  forward_sum(op);
+  store.record(op);
+  return op.out;
+}
+
+static Tensor batch_matmul(const Tensor& a, const Tensor& b,
+                           ParameterStore& store) {
+  const size_t ra = a.shape.size();
+  const size_t rb = b.shape.size();
+  const int batch_a = ra == 3 ? a.shape[0] : 1;
+  const int batch_b = rb == 3 ? b.shape[0] : 1;
+  if (batch_a != batch_b && batch_a != 1 && batch_b != 1)
+    throw std::invalid_argument("matmul batch dim mismatch");
+  const int M = a.shape[ra - 2];
+  const int K = a.shape[ra - 1];
+  const int N = b.shape[rb - 1];
+  if (b.shape[rb - 2] != K)
+    throw std::invalid_argument("matmul inner dim mismatch");
+  const Tensor A = bmm_input(a, store);
+  const Tensor B = bmm_input(b, store);
+  TapeOp op{OpType::BatchMatmul,
+            op_output(store, {std::max(batch_a, batch_b), M, N},
+                      needs_grad(store, A, B)),
+            A, B};
+  forward_bmm(op);
+  store.record(op);
+  return op.out;
 }
 
-// Matmul uses Accelerate-backed GEMM exclusively.
 Tensor matmul(const Tensor& a, const Tensor& b, ParameterStore& store) {
-  if (a.shape.size() != 2 || b.shape.size() != 2)
-    throw std::invalid_argument("matmul expects 2D tensors");
+  const size_t ra = a.shape.size();
+  const size_t rb = b.shape.size();
+  if (ra < 2 || ra > 3 || rb < 2 || rb > 3)
+    throw std::invalid_argument("matmul expects 2D or 3D tensors");
+  if (ra == 3 || rb == 3) return batch_matmul(a, b, store);
   int M = a.shape[0];
   int K = a.shape[1];
   int K2 = b.shape[0];
   int N = b.shape[1];
   if (K != K2) throw std::invalid_argument("matmul inner dim mismatch");
+  const Tensor A = gemm_input(a, store);
+  const Tensor B = gemm_input(b, store);
+  TapeOp op{OpType::Matmul,
+            op_output(store, {M, N}, needs_grad(store, A, B), store.autocast),
+            A, B};
+  forward_gemm(op);
+  store.record(op);
+  return op.out;
+}
+
+Tensor linear(const Tensor& x, const Tensor& W, const Tensor& b_in,
+              kernels::Activation act, ParameterStore& store, float x_scale) {
+  if (x.shape.size() != 2 || W.shape.size() != 2)
+    throw std::invalid_argument("linear expects x[N,in], W[in,out]");
+  const int M = x.shape[0];
+  const int K = x.shape[1];
+  const int N = W.shape[1];
+  if (W.shape[0] != K) throw std::invalid_argument("linear inner dim mismatch");
+  const bool has_bias = b_in.numel > 0;
+  if (has_bias && (b_in.shape.size() != 1 || b_in.shape[0] != N))
+    throw std::invalid_argument("linear bias must be [out]");
+  const Tensor X = gemm_input(x, store);
+  const Tensor Wt = gemm_input(W, store);
+  const Tensor b = has_bias ? dense_f32(b_in, store) : Tensor{};
+  TapeOp op{OpType::Linear,
+            op_output(store, {M, N}, needs_grad(store, X, Wt, b),
+                      store.autocast),
+            X,
+            Wt,
+            nullptr,
+            b,
+            act};
+  op.alpha = x_scale;
+  forward_gemm(op);
+  store.record(op);
+  return op.out;
+}
+
+QuantizedMatrix quantize_per_channel(const Tensor& W_in) {
+  if (W_in.shape.size() != 2)
+    throw std::invalid_argument("quantize_per_channel expects W[in,out]");
+  const int K = W_in.shape[0];
+  const int N = W_in.shape[1];
+  ParameterStore& store = *W_in.store;
+  const auto& k = kernels::active();
+  // Quantize one output channel (a column of W) at a time, then pack.
+  std::vector<float> channel(static_cast<size_t>(K));
+  std::vector<int8_t> rows(static_cast<size_t>(N) * K);
+  QuantizedMatrix q;
+  q.rows = N;
+  q.cols = K;
+  q.scales.resize(static_cast<size_t>(N));
+  NoGradGuard no_grad(store);
+  const StoreMark mark = store.mark();
+  const float* w = dense_f32(W_in, store).data();
+  for (int n = 0; n < N; ++n) {
+    for (int i = 0; i < K; ++i) channel[i] = w[static_cast<size_t>(i) * N + n];
+    q.scales[n] = k.quantize_s8(channel.data(),
+                                rows.data() + static_cast<size_t>(n) * K, K);
+  }
+  store.reset(mark);
+  q.data.resize(static_cast<size_t>(kernels::s8_groups(K)) *
+                kernels::s8_ld(N) * 4);
+  q.sums.resize(static_cast<size_t>(N));
+  kernels::pack_s8(rows.data(), N, K, q.data.data(), q.sums.data());
+  return q;
+}
+
+Tensor linear_s8(const Tensor& x_in, const QuantizedMatrix& W,
+                 const Tensor& b_in, kernels::Activation act,
+                 ParameterStore& store, float x_scale) {
+  if (x_in.shape.size() != 2)
+    throw std::invalid_argument("linear_s8 expects x[N,in]");
+  if (x_in.shape[1] != W.cols)
+    throw std::invalid_argument("linear_s8 inner dim mismatch");
+  if (store.grad_enabled() && x_in.requires_grad())
+    throw std::logic_error("linear_s8 is inference-only; use a NoGradGuard");
+  const int M = x_in.shape[0];
+  const int K = W.cols;
+  const int N = W.rows;
+  const bool has_bias = b_in.numel > 0;
+  if (has_bias && (b_in.shape.size() != 1 || b_in.shape[0] != N))
+    throw std::invalid_argument("linear_s8 bias must be [out]");
+  const Tensor x = dense_f32(x_in, store);
+  const Tensor b = has_bias ? dense_f32(b_in, store) : Tensor{};
   Tensor out = store.tensor({M, N});
 
-  const float* A = a.data();
-  const float* B = b.data();
-  float* C = out.data();
-  const float alpha = 1.0f;
-  const float beta = 0.0f;
-  const __LAPACK_int m = static_cast<__LAPACK_int>(M);
-  const __LAPACK_int n = static_cast<__LAPACK_int>(N);
-  const __LAPACK_int k = static_cast<__LAPACK_int>(K);
-  const __LAPACK_int lda = k;
-  const __LAPACK_int ldb = n;
-  const __LAPACK_int ldc = n;
-
-  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, alpha, A, lda,
-              B, ldb, beta, C, ldc);
-  store.tape.push_back(TapeOp{OpType::Matmul, out, a, b});
+  // Row scales, then the quantized rows padded to whole K groups, share one
+  // scratch buffer.
+  const int lda = 4 * kernels::s8_groups(K);
+  const size_t q_floats = static_cast<size_t>(M) * lda / 4;
+  float* a_scale = store.scratch(static_cast<size_t>(M) + q_floats);
+  auto* A = reinterpret_cast<int8_t*>(a_scale + M);
+  const auto& k = kernels::active();
+  const float* xp = x.data();
+  for (int i = 0; i < M; ++i) {
+    int8_t* row = A + static_cast<size_t>(i) * lda;
+    a_scale[i] =
+        x_scale * k.quantize_s8(xp + static_cast<size_t>(i) * K, row, K);
+    std::fill(row + K, row + lda, int8_t{0});
+  }
+  k.gemm_s8(M, N, K, A, lda, a_scale, W.data.data(), W.sums.data(),
+            W.scales.data(), has_bias ? b.data() : nullptr, act, out.data(),
+            N);
   return out;
 }
 
+Tensor bce_with_logits(const Tensor& logits_in, const Tensor& targets_in,
+                       ParameterStore& store) {
+  if (logits_in.shape != targets_in.shape || logits_in.shape.empty())
+    throw std::invalid_argument("bce_with_logits shape mismatch");
+  const Tensor x = dense_f32(logits_in, store);
+  const Tensor y = dense_f32(targets_in, store);
+  TapeOp op{OpType::BceWithLogits,
+            op_output(store, {1}, needs_grad(store, x)), x, y};
+  forward_bce_with_logits(op);
+  store.record(op);
+  return op.out;
+}
+
+Tensor softmax_cross_entropy(const Tensor& logits_in, const int32_t* labels,
+                             ParameterStore& store) {
+  if (logits_in.shape.size() != 2)
+    throw std::invalid_argument("softmax_cross_entropy expects logits[N,C]");
+  if (!labels) throw std::invalid_argument("softmax_cross_entropy labels");
+  const int N = logits_in.shape[0];
+  const int C = logits_in.shape[1];
+  for (int r = 0; r < N; ++r) {
+    if (labels[r] < 0 || labels[r] >= C)
+      throw std::out_of_range("softmax_cross_entropy label out of range");
+  }
+  const Tensor x = dense_f32(logits_in, store);
+  Tensor probs = store.tensor({N, C});
+  TapeOp op{OpType::SoftmaxCrossEntropy,
+            op_output(store, {1}, needs_grad(store, x)), x, probs, labels};
+  forward_softmax_cross_entropy(op);
+  store.record(op);
+  return op.out;
+}
+
+Tensor softmax_cross_entropy(const Tensor& logits, const Tensor& labels,
+                             ParameterStore& store) {
+  if (labels.dtype != DType::Int32 || labels.shape.size() != 1 ||
+      !labels.is_contiguous())
+    throw std::invalid_argument(
+        "softmax_cross_entropy expects dense int32 labels[N]");
+  if (logits.shape.size() == 2 && labels.shape[0] != logits.shape[0])
+    throw std::invalid_argument("softmax_cross_entropy label count mismatch");
+  return softmax_cross_entropy(logits, labels.data_as<int32_t>(), store);
+}
+
+Tensor embedding(const Tensor& table_in, const int32_t* indices,
+                 const Shape& index_shape, ParameterStore& store) {
+  if (table_in.shape.size() != 2)
+    throw std::invalid_argument("embedding expects table[V,D]");
+  if (!indices) throw std::invalid_argument("embedding indices");
+  const int V = table_in.shape[0];
+  const int D = table_in.shape[1];
+  const size_t count = compute_numel(index_shape);
+  for (size_t i = 0; i < count; ++i) {
+    if (indices[i] < 0 || indices[i] >= V)
+      throw std::out_of_range("embedding index out of range");
+  }
+  const Tensor table = dense_f32(table_in, store);
+  Shape out_shape = index_shape;
+  out_shape.push_back(D);
+  TapeOp op{OpType::Embedding,
+            op_output(store, out_shape, needs_grad(store, table)), table,
+            Tensor{}, indices};
+  forward_embedding(op);
+  store.record(op);
+  return op.out;
+}
+
+Tensor embedding(const Tensor& table, const Tensor& indices_in,
+                 ParameterStore& store) {
+  if (indices_in.dtype != DType::Int32)
+    throw std::invalid_argument("embedding expects int32 indices");
+  const Tensor indices = contiguous(indices_in, store);
+  return embedding(table, indices.data_as<int32_t>(), indices.shape, store);
+}
+
 Tensor add_rowwise(const Tensor& X, const Tensor& b, ParameterStore& store) {
   if (X.shape.size() != 2 || b.shape.size() != 1)
     throw std::invalid_argument("add_rowwise expects X[N,H], b[H]");
-  int N = X.shape[0];
-  int H = X.shape[1];
-  if (b.shape[0] != H) throw std::invalid_argument("add_rowwise dim mismatch");
-  Tensor out = store.tensor({N, H});
-  const float* xp = X.data();
-  const float* bp = b.data();
-  float* op = out.data();
-  if (!xp || !bp || !op) return out;
-  vDSP_Length row_len = static_cast<vDSP_Length>(H);
-  for (int n = 0; n < N; ++n) {
-    const float* x_row = xp + n * H;
-    float* out_row = op + n * H;
-    vDSP_vadd(x_row, 1, bp, 1, out_row, 1, row_len);
-  }
-  store.tape.push_back(TapeOp{OpType::AddRowwise, out, X, b});
+  if (b.shape[0] != X.shape[1])
+    throw std::invalid_argument("add_rowwise dim mismatch");
+  return add(X, b, store);
+}
+
+Tensor contiguous(const Tensor& x, ParameterStore& store) {
+  if (x.is_contiguous()) return x;
+  TapeOp op{OpType::Contiguous,
+            op_output(store, x.shape, needs_grad(store, x), x.dtype), x};
+  if (!x.raw_data() || !op.out.raw_data()) return op.out;
+  forward_contiguous(op);
+  store.record(op);
+  return op.out;
+}
+
+Tensor cast(const Tensor& x, DType dtype, ParameterStore& store) {
+  if (x.dtype == dtype) return x;
+  if (x.dtype != DType::Float32 && dtype != DType::Float32)
+    return cast(cast(x, DType::Float32, store), dtype, store);
+  TapeOp op{OpType::Cast,
+            op_output(store, x.shape,
+                      needs_grad(store, x) && is_floating(dtype), dtype),
+            x};
+  if (!x.raw_data() || !op.out.raw_data()) return op.out;
+  forward_cast(op);
+  store.record(op);
+  return op.out;
+}
+
+// Views
+Tensor transpose(const Tensor& x, int dim0, int dim1) {
+  dim0 = normalize_dim(dim0, x.shape.size());
+  dim1 = normalize_dim(dim1, x.shape.size());
+  Tensor out = x;
+  std::swap(out.shape[dim0], out.shape[dim1]);
+  std::swap(out.strides[dim0], out.strides[dim1]);
   return out;
 }
+
+Tensor narrow(const Tensor& x, int dim, int start, int length) {
+  const int d = normalize_dim(dim, x.shape.size());
+  if (length <= 0 || start < 0 || start + length > x.shape[d])
+    throw std::out_of_range("narrow range out of bounds");
+  return slice(x, d, start, start + length);
+}
+
+Tensor slice(const Tensor& x, int dim, int start, int end, int step) {
+  dim = normalize_dim(dim, x.shape.size());
+  if (step <= 0) throw std::invalid_argument("slice step must be positive");
+  end = std::min(end, x.shape[dim]);
+  if (start < 0 || start >= end)
+    throw std::out_of_range("slice range out of bounds");
+  const int length = (end - start + step - 1) / step;
+  Tensor out = x;
+  const size_t skip = static_cast<size_t>(start) * x.strides[dim];
+  out.offset += skip;
+  if (out.requires_grad()) out.grad_offset += skip;
+  out.shape[dim] = length;
+  out.strides[dim] *= static_cast<size_t>(step);
+  out.numel = x.numel / static_cast<size_t>(x.shape[dim]) * length;
+  return out;
+}
+
+Tensor view(const Tensor& x, const Shape& shape) {
+  if (!x.is_contiguous())
+    throw std::invalid_argument("view requires a contiguous tensor");
+  Tensor out = x;
+  out.shape = infer_shape(shape, x.numel);
+  out.strides = contiguous_strides(out.shape);
+  return out;
+}
+
+Tensor reshape(const Tensor& x, const Shape& shape,
+               ParameterStore& store) {
+  return view(dense(x, store), shape);
+}
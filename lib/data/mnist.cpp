@@ -61,11 +61,11 @@ void load_csv_with_mmap(const std::string& filename, MNIST_INS& images,
     labels.reserve(estimated_rows);
   }
 
-  std::vector<float> pixels(784, 0.0f);
+  MNIST_IN pixels(784, 0);
   bool have_label = false;
-  float label = 0.0f;
+  MNIST_OUT label = 0;
   int pixel_index = 0;
-  float value = 0.0f;
+  int value = 0;
 
   try {
     const char* ptr = data;
@@ -74,7 +74,7 @@ void load_csv_with_mmap(const std::string& filename, MNIST_INS& images,
     while (ptr < end) {
       unsigned char current = static_cast<unsigned char>(*ptr);
       if (current >= '0' && current <= '9') {
-        value = value * 10.0f + static_cast<float>(current - '0');
+        value = value * 10 + (current - '0');
       }
 
       const char* next_ptr = ptr + 1;
@@ -86,23 +86,23 @@ void load_csv_with_mmap(const std::string& filename, MNIST_INS& images,
           label = value;
           have_label = true;
         } else if (pixel_index < static_cast<int>(pixels.size())) {
-          pixels[pixel_index] = value / 255.0f;
+          pixels[pixel_index] = static_cast<uint8_t>(std::min(value, 255));
           ++pixel_index;
         }
 
-        value = 0.0f;
+        value = 0;
 
         if (next == '\n' || next == '\r' || at_end) {
           if (have_label) {
             if (pixel_index < static_cast<int>(pixels.size())) {
-              std::fill(pixels.begin() + pixel_index, pixels.end(), 0.0f);
+              std::fill(pixels.begin() + pixel_index, pixels.end(), 0);
             }
             images.push_back(pixels);
             labels.push_back(label);
           }
           have_label = false;
           pixel_index = 0;
-          std::fill(pixels.begin(), pixels.end(), 0.0f);
+          std::fill(pixels.begin(), pixels.end(), 0);
         }
 
         ptr = next_ptr;
@@ -2,19 +2,20 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
 #include <cstdlib>
+#include <stdexcept>
 #include <vector>
 
+size_t Sampler::window_start(const std::vector<int>& data, uint32_t i) const {
+  unsigned seed = batch_size + i;
+  return rand_r(&seed) % (static_cast<int>(data.size()) - block_size);
+}
+
 void Sampler::sample(Batch& batch, bool is_train) {
-  auto get_random_index = [](int size) {
-    unsigned seed = 1234;
-    return rand_r(&seed) % size;
-  };
-  auto data_vec = is_train ? train_data : val_data;
+  const auto& data_vec = is_train ? train_data : val_data;
   for (uint32_t i = 0; i < batch_size; ++i) {
-    unsigned seed = batch_size + i;
-    auto rnd_idx =
-        rand_r(&seed) % (static_cast<int>(data_vec.size()) - block_size);
+    const auto rnd_idx = window_start(data_vec, i);
     auto train_seq = std::vector<int>(data_vec.begin() + rnd_idx,
                                       data_vec.begin() + rnd_idx + block_size);
     auto target = std::vector<int>(data_vec.begin() + rnd_idx + 1,
@@ -23,3 +24,21 @@ void Sampler::sample(Batch& batch, bool is_train) {
     batch.second.push_back(target);
   }
 }
+
+void Sampler::sample(Tensor& inputs, Tensor& targets, bool is_train) {
+  const Shape shape{static_cast<int>(batch_size),
+                    static_cast<int>(block_size)};
+  for (const Tensor* t : {&inputs, &targets}) {
+    if (t->dtype != DType::Int32 || t->shape != shape || !t->is_contiguous())
+      throw std::invalid_argument(
+          "Sampler::sample expects int32 [batch_size, block_size] tensors");
+  }
+  const auto& data_vec = is_train ? train_data : val_data;
+  int32_t* x = inputs.data_as<int32_t>();
+  int32_t* y = targets.data_as<int32_t>();
+  for (uint32_t i = 0; i < batch_size; ++i) {
+    const auto start = data_vec.begin() + window_start(data_vec, i);
+    std::copy(start, start + block_size, x + i * block_size);
+    std::copy(start + 1, start + block_size + 1, y + i * block_size);
+  }
+}
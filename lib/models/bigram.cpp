@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <set>
@@ -66,25 +67,24 @@ void BigraLmPT() {
   optim::SGD optimizer(params, scheduler);
 
   Tensor batch_X = store.tensor({batch_size, vocab_size}, TensorInit::ZeroData);
-  Tensor batch_y = store.tensor({batch_size, vocab_size}, TensorInit::ZeroData);
+  std::vector<int32_t> batch_labels(batch_size);
 
   std::vector<float> losses;
   store.clear_tape();
   for (int epoch = 0; epoch < epochs; ++epoch) {
     optimizer.zero_grad();
     batch_X.fill(0.0f);
-    batch_y.fill(0.0f);
 
     for (int i = 0; i < batch_size; ++i) {
       int idx = rand() % (static_cast<int>(train_data.size()) - 1);
       int current = train_data[idx];
       int next = train_data[idx + 1];
       fill_one_hot(batch_X, i, current);
-      fill_one_hot(batch_y, i, next);
+      batch_labels[i] = next;
     }
 
     Tensor logits = model(batch_X, store);
-    Tensor loss = nn::bce_with_logits_loss(logits, batch_y, store);
+    Tensor loss = nn::cross_entropy_loss(logits, batch_labels.data(), store);
     losses.push_back(loss.data()[0]);
 
     store.backward(loss);
@@ -99,6 +99,7 @@ void BigraLmPT() {
   cout << "Final training loss: " << (losses.empty() ? 0.0f : losses.back())
        << endl;
 
+  NoGradGuard no_grad(store);
   Tensor eval_input = store.tensor({1, vocab_size}, TensorInit::ZeroData);
   float train_nll = train::evaluate_sequence_nll(model, store, eval_input,
                                                  train_data, vocab_size);
@@ -110,12 +111,13 @@ void BigraLmPT() {
   cout << "Sampled text:" << endl;
   int current = tokenizer.encode(' ');
   int total = 200;
+  const StoreMark mark = store.mark();
   for (int i = 0; i < total; ++i) {
     eval_input.fill(0.0f);
     fill_one_hot(eval_input, 0, current);
     Tensor logits = model(eval_input, store);
     current = train::sample_next_token(logits, vocab_size);
-    store.clear_tape();
+    store.reset(mark);
     std::cout << tokenizer.decode(current);
   }
   std::cout << std::endl;
@@ -1,6 +1,7 @@
 #include "bigramnn.hpp"
 
 #include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <set>
@@ -52,13 +53,15 @@ void BigramNNPT() {
   store.enable_stats(true);
 
   constexpr int hidden_dim = 128;
+  // Token embeddings stand in for a one-hot input times a dense first layer.
+  nn::Embedding embed(vocab_size, hidden_dim, store);
   nn::Sequential model;
-  model.emplace_back<nn::Linear>(vocab_size, hidden_dim, store);
   model.emplace_back<nn::Relu>();
   model.emplace_back<nn::Linear>(hidden_dim, hidden_dim, store);
   model.emplace_back<nn::Relu>();
   model.emplace_back<nn::Linear>(hidden_dim, vocab_size, store);
-  auto params = model.params();
+  auto params = embed.params();
+  for (auto& p : model.params()) params.push_back(p);
 
   const int base_batch = 64;
   const int batch_size = std::max(
@@ -69,26 +72,25 @@ void BigramNNPT() {
   ConstantLRScheduler scheduler(lr);
   optim::AdamW optimizer(params, scheduler, 0.9f, 0.999f, 1e-4f);
 
-  Tensor batch_X = store.tensor({batch_size, vocab_size}, TensorInit::ZeroData);
-  Tensor batch_y = store.tensor({batch_size, vocab_size}, TensorInit::ZeroData);
+  std::vector<int32_t> batch_tokens(batch_size);
+  std::vector<int32_t> batch_labels(batch_size);
 
   std::vector<float> losses;
   store.clear_tape();
   for (int epoch = 0; epoch < epochs; ++epoch) {
     optimizer.zero_grad();
-    batch_X.fill(0.0f);
-    batch_y.fill(0.0f);
 
     for (int i = 0; i < batch_size; ++i) {
       int idx = rand() % (static_cast<int>(train_data.size()) - 1);
       int current = train_data[idx];
       int next = train_data[idx + 1];
-      fill_one_hot(batch_X, i, current);
-      fill_one_hot(batch_y, i, next);
+      batch_tokens[i] = current;
+      batch_labels[i] = next;
     }
 
-    Tensor logits = model(batch_X, store);
-    Tensor loss = nn::bce_with_logits_loss(logits, batch_y, store);
+    Tensor h = embed(batch_tokens.data(), {batch_size}, store);
+    Tensor logits = model(h, store);
+    Tensor loss = nn::cross_entropy_loss(logits, batch_labels.data(), store);
     losses.push_back(loss.data()[0]);
 
     store.backward(loss);
@@ -103,20 +105,24 @@ void BigramNNPT() {
   cout << "Final training loss: " << (losses.empty() ? 0.0f : losses.back())
        << endl;
 
-  Tensor eval_input = store.tensor({1, vocab_size}, TensorInit::ZeroData);
-  float accuracy = train::evaluate_sequence_accuracy(model, store, eval_input,
+  NoGradGuard no_grad(store);
+  int32_t eval_token = 0;
+  const auto next_logits = [&](int token) {
+    eval_token = token;
+    return model(embed(&eval_token, {1}, store), store);
+  };
+  float accuracy = train::evaluate_sequence_accuracy(next_logits, store,
                                                      val_data, vocab_size);
   cout << "Validation accuracy: " << accuracy << endl;
 
   cout << "Sampled text:" << endl;
   int current = tokenizer.encode(' ');
   int total_steps = 200;
+  const StoreMark mark = store.mark();
   for (int i = 0; i < total_steps; ++i) {
-    eval_input.fill(0.0f);
-    fill_one_hot(eval_input, 0, current);
-    Tensor logits = model(eval_input, store);
+    Tensor logits = next_logits(current);
     int next = train::sample_next_token(logits, vocab_size);
-    store.clear_tape();
+    store.reset(mark);
     current = next;
     std::cout << tokenizer.decode(current);
   }
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <set>
@@ -17,25 +18,6 @@
 #include "train/language_utils.hpp"
 #include "utils.hpp"
 
-namespace {
-
-void encode_context_row(Tensor& tensor, int row,
-                        const std::vector<int>& context, int vocab_size) {
-  if (tensor.shape.size() != 2) return;
-  const int stride = tensor.shape[1];
-  if (stride % vocab_size != 0) return;
-  const int context_length = stride / vocab_size;
-  float* ptr = tensor.data() + row * stride;
-  for (int pos = 0; pos < context_length; ++pos) {
-    const int idx = pos < static_cast<int>(context.size()) ? context[pos] : -1;
-    if (idx >= 0 && idx < vocab_size) {
-      ptr[pos * vocab_size + idx] = 1.0f;
-    }
-  }
-}
-
-}  // namespace
-
 BigramMLPData getBigramMLPData(std::vector<int>& data, int context_length,
                                int start_char_index) {
   BigramMLPData seq_data;
@@ -99,19 +81,28 @@ void EmbedNLPPT() {
     return;
   }
 
-  const int input_dim = context_length * vocab_size;
+  // Each context position is embedded separately and the vectors are
+  // concatenated, instead of a context_length * vocab_size one-hot row.
+  constexpr int embed_dim = 16;
+  const int input_dim = context_length * embed_dim;
 
   ParameterStore store;
   store.enable_stats(true);
 
   constexpr int hidden_dim = 256;
+  nn::Embedding embed(vocab_size, embed_dim, store);
   nn::Sequential model;
   model.emplace_back<nn::Linear>(input_dim, hidden_dim, store);
   model.emplace_back<nn::Relu>();
   model.emplace_back<nn::Linear>(hidden_dim, hidden_dim, store);
   model.emplace_back<nn::Relu>();
   model.emplace_back<nn::Linear>(hidden_dim, vocab_size, store);
-  auto params = model.params();
+  auto params = embed.params();
+  for (auto& p : model.params()) params.push_back(p);
+  const auto forward = [&](const int32_t* contexts, int rows) {
+    Tensor e = embed(contexts, {rows, context_length}, store);
+    return model(view(e, {rows, input_dim}), store);
+  };
 
   ConstantLRScheduler scheduler(0.03f);
   optim::AdamW optimizer(params, scheduler, 0.9f, 0.999f, 1e-4f);
@@ -121,8 +112,9 @@ void EmbedNLPPT() {
       1, std::min<int>(base_batch, static_cast<int>(train_seq.input.size())));
   const int epochs = 400;
 
-  Tensor batch_X = store.tensor({batch_size, input_dim}, TensorInit::ZeroData);
-  Tensor batch_y = store.tensor({batch_size, vocab_size}, TensorInit::ZeroData);
+  std::vector<int32_t> batch_contexts(
+      static_cast<size_t>(batch_size) * context_length);
+  std::vector<int32_t> batch_labels(batch_size);
 
   std::vector<float> losses;
   losses.reserve(epochs);
@@ -131,20 +123,15 @@ void EmbedNLPPT() {
     optimizer.zero_grad();
     store.clear_tape();
 
-    batch_X.fill(0.0f);
-    batch_y.fill(0.0f);
-
     for (int i = 0; i < batch_size; ++i) {
       const int idx = rand() % static_cast<int>(train_seq.input.size());
-      encode_context_row(batch_X, i, train_seq.input[idx], vocab_size);
-      const int target = train_seq.target[idx];
-      if (target >= 0 && target < vocab_size) {
-        batch_y.data()[i * vocab_size + target] = 1.0f;
-      }
+      std::copy(train_seq.input[idx].begin(), train_seq.input[idx].end(),
+                batch_contexts.begin() + i * context_length);
+      batch_labels[i] = train_seq.target[idx];
     }
 
-    Tensor logits = model(batch_X, store);
-    Tensor loss = nn::bce_with_logits_loss(logits, batch_y, store);
+    Tensor logits = forward(batch_contexts.data(), batch_size);
+    Tensor loss = nn::cross_entropy_loss(logits, batch_labels.data(), store);
     losses.push_back(loss.data()[0]);
 
     store.backward(loss);
@@ -158,20 +145,23 @@ void EmbedNLPPT() {
   cout << "Final training loss: " << (losses.empty() ? 0.0f : losses.back())
        << endl;
 
-  Tensor eval_input = store.tensor({1, input_dim}, TensorInit::ZeroData);
+  NoGradGuard no_grad(store);
+  const StoreMark mark = store.mark();
+  std::vector<int32_t> eval_context(context_length);
   const size_t eval_limit = std::min<size_t>(val_seq.input.size(), 4000);
   int correct = 0;
   int total = 0;
 
   for (size_t i = 0; i < eval_limit; ++i) {
-    eval_input.fill(0.0f);
-    encode_context_row(eval_input, 0, val_seq.input[i], vocab_size);
-    Tensor logits = model(eval_input, store);
+    std::copy(val_seq.input[i].begin(), val_seq.input[i].end(),
+              eval_context.begin());
+    Tensor logits = forward(eval_context.data(), 1);
     const float* logits_ptr = logits.data();
     const int predicted = argmax_from_logits(logits_ptr, vocab_size);
     const int expected = val_seq.target[i];
     if (predicted == expected) ++correct;
     ++total;
+    store.reset(mark);
   }
 
   const float accuracy =
@@ -180,13 +170,12 @@ void EmbedNLPPT() {
   cout << "Validation accuracy (" << total << " samples): " << accuracy << endl;
 
   cout << "Sampled text:" << endl;
-  std::vector<int> context(context_length, start_char_index);
+  std::vector<int32_t> context(context_length, start_char_index);
   const int total_chars = 200;
   for (int i = 0; i < total_chars; ++i) {
-    eval_input.fill(0.0f);
-    encode_context_row(eval_input, 0, context, vocab_size);
-    Tensor logits = model(eval_input, store);
+    Tensor logits = forward(context.data(), 1);
     const int next = train::sample_next_token(logits, vocab_size);
+    store.reset(mark);
     std::cout << tokenizer.decode(next);
     for (int j = 0; j < context_length - 1; ++j) {
       context[j] = context[j + 1];
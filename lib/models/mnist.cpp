@@ -1,13 +1,17 @@
 #include "mnist.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <climits>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include "dataloader.hpp"
+#include "graph.hpp"
 #include "learning_rate.hpp"
 #include "nn.hpp"
 #include "optimizer.hpp"
@@ -65,155 +69,186 @@ void MnistDnnPT() {
        << ", eval_batch=" << eval_batch << ", epochs=" << epochs
        << ", lr=" << lr << endl;
 
-  ParameterStore store;
-  store.enable_stats(true);
-
-  const size_t param_elements =
-      static_cast<size_t>(input_dim) * hidden_dim1 + hidden_dim1 +
-      static_cast<size_t>(hidden_dim1) * hidden_dim2 + hidden_dim2 +
-      static_cast<size_t>(hidden_dim2) * num_classes + num_classes;
-
-  const size_t batch_elems = static_cast<size_t>(batch_size);
-  size_t static_buffers = param_elements;
-  static_buffers += batch_elems * static_cast<size_t>(input_dim);
-  static_buffers += batch_elems * static_cast<size_t>(num_classes);
-  static_buffers +=
-      static_cast<size_t>(eval_batch) * static_cast<size_t>(input_dim);
-
-  const auto activation_block = [](size_t batch, int out_dim) {
-    return batch * static_cast<size_t>(out_dim) * 3ULL;
-  };
-
-  const size_t forward_train =
-      activation_block(batch_elems, hidden_dim1) +
-      activation_block(batch_elems, hidden_dim2) +
-      batch_elems * static_cast<size_t>(num_classes) * 2ULL;
-
-  const size_t loss_buffers =
-      batch_elems * static_cast<size_t>(num_classes) * 6ULL + 2048ULL;
-
-  const size_t eval_batch_sz = static_cast<size_t>(eval_batch);
-  const size_t forward_eval =
-      activation_block(eval_batch_sz, hidden_dim1) +
-      activation_block(eval_batch_sz, hidden_dim2) +
-      eval_batch_sz * static_cast<size_t>(num_classes) * 2ULL;
-
-  const size_t per_step_scratch = forward_train + loss_buffers;
-  const size_t per_eval_scratch = forward_eval;
-  const size_t reserve_hint =
-      static_buffers + per_step_scratch + per_eval_scratch + 16384ULL;
-  store.reserve(reserve_hint);
-
-  nn::Sequential model;
-  model.emplace_back<nn::Linear>(input_dim, hidden_dim1, store);
-  model.emplace_back<nn::Relu>();
-  model.emplace_back<nn::Linear>(hidden_dim1, hidden_dim2, store);
-  model.emplace_back<nn::Relu>();
-  model.emplace_back<nn::Linear>(hidden_dim2, num_classes, store);
-
-  auto params = model.params();
-
-  const int lr_cliff = std::max(1, (steps_per_epoch * epochs) / 5);
-  StepLRScheduler scheduler(lr, lr_cliff, 0.5f);
-  optim::AdamW optimizer(params, scheduler, 0.9f, 0.999f, 1e-4f);
-
-  Tensor batch_X = store.tensor({batch_size, input_dim});
-  Tensor batch_y =
-      store.tensor({batch_size, num_classes}, TensorInit::ZeroData);
-  Tensor eval_X = store.tensor({eval_batch, input_dim});
-
-  const size_t scratch_mark = store.mark();
-  const auto reset_scratch = [&]() {
-    store.reset(scratch_mark);
-    store.clear_tape();
-  };
-  reset_scratch();
-
-  std::vector<float> epoch_losses;
-  for (int epoch = 0; epoch < epochs; ++epoch) {
-    float epoch_loss = 0.0f;
-    for (int step = 0; step < steps_per_epoch; ++step) {
+  // MNIST_PRECISION=bf16 trains with bfloat16 activations and GEMM inputs
+  // (float32 master weights); "compare" trains both and reports the delta.
+  const char* precision_env = std::getenv("MNIST_PRECISION");
+  const std::string precision = precision_env ? precision_env : "fp32";
+
+  const auto train_and_test = [&](DType dtype) {
+    ParameterStore store;
+    store.enable_stats(true);
+
+    // Pixels stay uint8 in the arena; the first layer widens and scales them
+    // to [0, 1] while its GEMM packs the batch.
+    nn::Sequential model;
+    model.emplace_back<nn::Linear>(input_dim, hidden_dim1, store)
+        .input_scale = 1.0f / 255.0f;
+    model.emplace_back<nn::Relu>();
+    model.emplace_back<nn::Linear>(hidden_dim1, hidden_dim2, store);
+    model.emplace_back<nn::Relu>();
+    model.emplace_back<nn::Linear>(hidden_dim2, num_classes, store);
+
+    auto params = model.params();
+    AutocastGuard autocast(store, dtype);
+
+    const int lr_cliff = std::max(1, (steps_per_epoch * epochs) / 5);
+    StepLRScheduler scheduler(lr, lr_cliff, 0.5f);
+    optim::AdamW optimizer(params, scheduler, 0.9f, 0.999f, 1e-4f);
+
+    const auto pixels = [&](int rows) {
+      return store.tensor({rows, input_dim}, TensorInit::UninitializedData,
+                          false, DType::UInt8);
+    };
+    // plan() runs a step on the batch before any sample is copied in, and
+    // the loss range-checks labels, so start both from zeros.
+    Tensor batch_X = store.tensor({batch_size, input_dim}, TensorInit::ZeroData,
+                                  false, DType::UInt8);
+    Tensor batch_labels =
+        store.tensor({batch_size}, TensorInit::ZeroData, false, DType::Int32);
+    const auto load_rows = [&](const MNIST_INS& rows, int begin, int count) {
+      Tensor t = pixels(std::max(count, 1));
+      for (int i = 0; i < count; ++i) {
+        const auto& sample = rows[begin + i];
+        std::copy(sample.begin(), sample.end(),
+                  t.data_as<uint8_t>() + static_cast<size_t>(i) * input_dim);
+      }
+      return t;
+    };
+    Tensor val_X = load_rows(mnist.data.train_data, train_count, val_count);
+    Tensor test_X = load_rows(mnist.data.test_data, 0, test_total);
+
+    const StoreMark scratch_mark = store.mark();
+    const auto reset_scratch = [&]() {
+      store.reset(scratch_mark);
+      store.clear_tape();
+    };
+
+    // Size the arenas from one training step and one evaluation batch.
+    store.plan([&] {
+      store.backward(
+          nn::cross_entropy_loss(model(batch_X, store), batch_labels, store));
       reset_scratch();
-      optimizer.zero_grad();
-      batch_y.fill(0.0f);
-
-      for (int i = 0; i < batch_size; ++i) {
-        int idx = rand() % train_count;
-        float* dst = batch_X.data() + i * input_dim;
-        const auto& sample = mnist.data.train_data[idx];
-        std::copy(sample.begin(), sample.end(), dst);
-        int label = static_cast<int>(mnist.data.train_labels[idx]);
-        fill_one_hot(batch_y, i, label);
+      NoGradGuard no_grad(store);
+      model(narrow(test_X, 0, 0, std::min(eval_batch, test_X.shape[0])), store);
+    });
+
+    // Every step has the same shapes: capture the first one and replay it
+    // with new batch contents afterwards.
+    Graph train_step(store);
+    Tensor loss;
+    std::vector<float> epoch_losses;
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+      float epoch_loss = 0.0f;
+      for (int step = 0; step < steps_per_epoch; ++step) {
+        optimizer.zero_grad();
+
+        uint8_t* X = batch_X.data_as<uint8_t>();
+        int32_t* labels = batch_labels.data_as<int32_t>();
+        for (int i = 0; i < batch_size; ++i) {
+          int idx = rand() % train_count;
+          const auto& sample = mnist.data.train_data[idx];
+          std::copy(sample.begin(), sample.end(), X + i * input_dim);
+          labels[i] = mnist.data.train_labels[idx];
+        }
+
+        if (train_step.captured()) {
+          train_step.replay();
+        } else {
+          loss = train_step.capture([&] {
+            return nn::cross_entropy_loss(model(batch_X, store), batch_labels,
+                                          store);
+          });
+        }
+        epoch_loss += loss.data()[0];
+        optimizer.step();
       }
-
-      Tensor logits = model(batch_X, store);
-      Tensor loss = nn::bce_with_logits_loss(logits, batch_y, store);
-      epoch_loss += loss.data()[0];
-
-      store.backward(loss);
-      optimizer.step();
+      float avg_loss = epoch_loss / static_cast<float>(steps_per_epoch);
+      epoch_losses.push_back(avg_loss);
+      cout << "Epoch: " << epoch << " Avg Loss: " << avg_loss << endl;
     }
-    float avg_loss = epoch_loss / static_cast<float>(steps_per_epoch);
-    epoch_losses.push_back(avg_loss);
-    cout << "Epoch: " << epoch << " Avg Loss: " << avg_loss << endl;
-  }
 
-  reset_scratch();
+    reset_scratch();
+    NoGradGuard no_grad(store);
 
-  cout << "Final training loss: "
-       << (epoch_losses.empty() ? 0.0f : epoch_losses.back()) << endl;
+    cout << "Final training loss: "
+         << (epoch_losses.empty() ? 0.0f : epoch_losses.back()) << endl;
 
-  int correct = 0;
-  int total = 0;
-  int start_idx = train_count;
-  int end_idx = train_count + val_count;
-  end_idx = std::min(end_idx, total_samples);
-  for (int idx = start_idx; idx < end_idx; idx += eval_batch) {
-    reset_scratch();
-    int current_batch = std::min(eval_batch, end_idx - idx);
-    for (int i = 0; i < current_batch; ++i) {
-      float* dst = eval_X.data() + i * input_dim;
-      const auto& sample = mnist.data.train_data[idx + i];
-      std::copy(sample.begin(), sample.end(), dst);
-    }
-    Tensor logits = model(eval_X, store);
-    const float* logits_ptr = logits.data();
-    for (int i = 0; i < current_batch; ++i) {
-      int predicted =
-          argmax_from_logits(logits_ptr + i * num_classes, num_classes);
-      int label = static_cast<int>(mnist.data.train_labels[idx + i]);
-      if (predicted == label) ++correct;
-      ++total;
-    }
-  }
-  float val_accuracy = total > 0 ? static_cast<float>(correct) / total : 0.0f;
-  cout << "Validation accuracy (" << total << " samples): " << val_accuracy
-       << endl;
-
-  const auto& test_data = mnist.data.test_data;
-  const auto& test_labels = mnist.data.test_labels;
-  correct = 0;
-  total = 0;
-  for (int idx = 0; idx < test_total; idx += eval_batch) {
-    reset_scratch();
-    int current_batch = std::min(eval_batch, test_total - idx);
-    for (int i = 0; i < current_batch; ++i) {
-      float* dst = eval_X.data() + i * input_dim;
-      const auto& sample = test_data[idx + i];
-      std::copy(sample.begin(), sample.end(), dst);
+    int correct = 0;
+    int total = 0;
+    int start_idx = train_count;
+    int end_idx = train_count + val_count;
+    end_idx = std::min(end_idx, total_samples);
+    for (int idx = start_idx; idx < end_idx; idx += eval_batch) {
+      reset_scratch();
+      int current_batch = std::min(eval_batch, end_idx - idx);
+      Tensor eval_X = narrow(val_X, 0, idx - start_idx, current_batch);
+      Tensor logits = cast(model(eval_X, store), DType::Float32, store);
+      const float* logits_ptr = logits.data();
+      for (int i = 0; i < current_batch; ++i) {
+        int predicted =
+            argmax_from_logits(logits_ptr + i * num_classes, num_classes);
+        int label = mnist.data.train_labels[idx + i];
+        if (predicted == label) ++correct;
+        ++total;
+      }
     }
-    Tensor logits = model(eval_X, store);
-    const float* logits_ptr = logits.data();
-    for (int i = 0; i < current_batch; ++i) {
-      int predicted =
-          argmax_from_logits(logits_ptr + i * num_classes, num_classes);
-      int label = static_cast<int>(test_labels[idx + i]);
-      if (predicted == label) ++correct;
-      ++total;
+    float val_accuracy = total > 0 ? static_cast<float>(correct) / total : 0.0f;
+    cout << "Validation accuracy (" << total << " samples): " << val_accuracy
+         << endl;
+
+    const auto& test_labels = mnist.data.test_labels;
+    // Test-set accuracy and the seconds spent in forward passes.
+    const auto test_pass = [&](double& seconds) {
+      int hits = 0;
+      int seen = 0;
+      seconds = 0.0;
+      for (int idx = 0; idx < test_total; idx += eval_batch) {
+        reset_scratch();
+        int current_batch = std::min(eval_batch, test_total - idx);
+        Tensor eval_X = narrow(test_X, 0, idx, current_batch);
+        const auto start = std::chrono::steady_clock::now();
+        Tensor logits = cast(model(eval_X, store), DType::Float32, store);
+        seconds += std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+        const float* logits_ptr = logits.data();
+        for (int i = 0; i < current_batch; ++i) {
+          int predicted =
+              argmax_from_logits(logits_ptr + i * num_classes, num_classes);
+          int label = test_labels[idx + i];
+          if (predicted == label) ++hits;
+          ++seen;
+        }
+      }
+      return seen > 0 ? static_cast<float>(hits) / seen : 0.0f;
+    };
+    double test_seconds = 0.0;
+    const float test_accuracy = test_pass(test_seconds);
+    cout << "Test accuracy (" << test_total << " samples): " << test_accuracy
+         << endl;
+
+    // MNIST_QUANTIZE=1 converts the trained layers to int8 weights with
+    // dynamic activation quantization and reruns the test set.
+    if (getenv_int("MNIST_QUANTIZE", 0) != 0) {
+      nn::quantize_dynamic(model);
+      double int8_seconds = 0.0;
+      const float int8_accuracy = test_pass(int8_seconds);
+      cout << "Int8 test accuracy: " << int8_accuracy
+           << ", delta: " << int8_accuracy - test_accuracy
+           << ", speedup: " << test_seconds / std::max(int8_seconds, 1e-9)
+           << "x" << endl;
     }
-  }
-  float test_accuracy = total > 0 ? static_cast<float>(correct) / total : 0.0f;
-  cout << "Test accuracy (" << total << " samples): " << test_accuracy << endl;
 
-  store.print_stats();
+    store.print_stats();
+    return test_accuracy;
+  };
+
+  if (precision == "compare") {
+    const float fp32 = train_and_test(DType::Float32);
+    const float bf16 = train_and_test(DType::BFloat16);
+    cout << "Test accuracy fp32: " << fp32 << ", bf16: " << bf16
+         << ", delta: " << bf16 - fp32 << endl;
+  } else {
+    train_and_test(precision == "bf16" ? DType::BFloat16 : DType::Float32);
+  }
 }
@@ -7,6 +7,8 @@
 #include <iostream>
 #include <vector>
 
+#include "expr.hpp"
+#include "graph.hpp"
 #include "learning_rate.hpp"
 #include "nn.hpp"
 #include "optimizer.hpp"
@@ -55,12 +57,8 @@ Batch sample_batch(const std::vector<std::array<float, 2>>& x,
 
 Tensor mse_loss(const Tensor& predicted, const Tensor& expected,
                 ParameterStore& store) {
-  auto diff = sub(predicted, expected, store);
-  auto diff_sq = mul(diff, diff, store);
-  auto total = sum(diff_sq, store);
-  Tensor scale = store.tensor({1});
-  scale.data()[0] = 1.0f / static_cast<float>(predicted.numel);
-  return mul(total, scale, store);
+  const auto p = expr::ref(predicted), y = expr::ref(expected);
+  return expr::mean((p - y) * (p - y), store);
 }
 
 }  // namespace
@@ -104,49 +102,11 @@ void XORWithTensors() {
   std::vector<float> y_train(y_all.begin(), y_all.begin() + train_size);
   std::vector<std::array<float, 2>> x_val(x_all.begin() + train_size,
                                           x_all.end());
-  const size_t val_size = x_val.size();
 
   cout << "Total dataset size: " << dataset_size << endl;
   cout << "Batch size: " << batch_size << endl;
   cout << "Total epochs: " << epochs << endl;
 
-  const auto activation_block = [](size_t batch, int out_dim) {
-    return batch * static_cast<size_t>(out_dim) * 3ULL;
-  };
-  const size_t batch_elems = static_cast<size_t>(batch_size);
-  const size_t param_hint =
-      static_cast<size_t>(input_dim) * hidden_dim1 +
-      static_cast<size_t>(hidden_dim1) * hidden_dim2 +
-      static_cast<size_t>(hidden_dim2) * output_dim +
-      static_cast<size_t>(hidden_dim1 + hidden_dim2 + output_dim);
-  const size_t static_buffers =
-      param_hint + batch_elems * static_cast<size_t>(input_dim + output_dim);
-  const size_t train_forward = activation_block(batch_elems, hidden_dim1) +
-                               activation_block(batch_elems, hidden_dim2) +
-                               activation_block(batch_elems, output_dim);
-  const size_t loss_buffers =
-      batch_elems * static_cast<size_t>(output_dim) * 2ULL + 3ULL;
-  const size_t train_hint =
-      (train_forward + loss_buffers) * static_cast<size_t>(epochs);
-
-  size_t val_hint = 0;
-  if (val_size > 0) {
-    const size_t val_runs =
-        trace_every > 0
-            ? static_cast<size_t>((epochs + trace_every - 1) / trace_every)
-            : 0;
-    const size_t val_batch = val_size;
-    const size_t per_val = val_batch * static_cast<size_t>(input_dim) +
-                           activation_block(val_batch, hidden_dim1) +
-                           activation_block(val_batch, hidden_dim2) +
-                           activation_block(val_batch, output_dim);
-    val_hint = per_val * val_runs;
-  }
-
-  size_t approx_hint = static_buffers + train_hint + val_hint;
-  approx_hint += approx_hint / 10ULL + 1024ULL;  // margin for dynamics
-  store.reserve(approx_hint);
-
   nn::Sequential model;
   model.emplace_back<nn::Linear>(input_dim, hidden_dim1, store);
   model.emplace_back<nn::Relu>();
@@ -162,38 +122,48 @@ void XORWithTensors() {
   size_t total_param_count = 0;
   for (const auto& p : params) total_param_count += p.numel;
   cout << "Total params: " << total_param_count << endl;
-  if (total_param_count != param_hint) {
-    cout << "(parameter hint mismatch: expected " << param_hint << ")" << endl;
-  }
 
   Tensor batch_X = store.tensor({batch_size, input_dim});
   Tensor batch_y = store.tensor({batch_size, output_dim});
+  const int val_size = static_cast<int>(x_val.size());
+  Tensor Xv = store.tensor({val_size, input_dim});
+  fill_tensor(Xv, x_val);
+
+  // Size the arena from one training step and one validation pass. The
+  // captured step keeps its memory, so validation runs on top of it.
+  store.plan([&] {
+    store.backward(mse_loss(model(batch_X, store), batch_y, store));
+    NoGradGuard no_grad(store);
+    model(Xv, store);
+  });
 
   std::vector<float> losses;
   std::vector<std::vector<float>> y_val_epoch;
   std::vector<float> val_accuracy;
 
+  // The step is tiny, so dispatch dominates: capture it once and replay.
+  Graph train_step(store);
+  Tensor loss;
   for (int epoch = 0; epoch < epochs; ++epoch) {
     optimizer.zero_grad();
-    store.clear_tape();
 
     Batch batch = sample_batch(x_train, y_train, batch_size);
     fill_tensor(batch_X, batch.x);
     fill_tensor(batch_y, batch.y);
 
-    Tensor preds = model(batch_X, store);
-    Tensor loss = mse_loss(preds, batch_y, store);
+    if (train_step.captured()) {
+      train_step.replay();
+    } else {
+      loss = train_step.capture(
+          [&] { return mse_loss(model(batch_X, store), batch_y, store); });
+    }
     float loss_value = loss.data()[0];
     losses.push_back(loss_value);
-
-    store.backward(loss);
     optimizer.step();
-    store.clear_tape();
 
     if (epoch % trace_every == 0) {
-      int val_size = static_cast<int>(x_val.size());
-      Tensor Xv = store.tensor({val_size, input_dim});
-      fill_tensor(Xv, x_val);
+      NoGradGuard no_grad(store);
+      const StoreMark val_mark = store.mark();
       Tensor logits_val = model(Xv, store);
       const float* logits_ptr = logits_val.data();
 
@@ -215,7 +185,7 @@ void XORWithTensors() {
            << " Accuracy: " << accuracy << endl;
       val_accuracy.push_back(accuracy);
       y_val_epoch.push_back(std::move(y_val));
-      store.clear_tape();
+      store.reset(val_mark);
     }
   }
 
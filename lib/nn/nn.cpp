@@ -14,11 +14,12 @@ Linear::Linear(int in_f, int out_f, ParameterStore& store, bool bias,
              : Tensor{}) {}
 
 Tensor Linear::forward(const Tensor& x, ParameterStore& store) {
-  auto y = matmul(x, W, store);
-  if (use_bias) {
-    y = add_rowwise(y, b, store);
-  }
-  return y;
+  return forward(x, kernels::Activation::None, store);
+}
+
+Tensor Linear::forward(const Tensor& x, kernels::Activation act,
+                       ParameterStore& store) {
+  return linear(x, W, use_bias ? b : Tensor{}, act, store, input_scale);
 }
 
 std::vector<Tensor> Linear::params() {
@@ -26,6 +27,37 @@ std::vector<Tensor> Linear::params() {
   return {W};
 }
 
+QuantizedLinear::QuantizedLinear(const Linear& src)
+    : W(quantize_per_channel(src.W)),
+      b(src.use_bias ? src.b : Tensor{}),
+      input_scale(src.input_scale) {}
+
+Tensor QuantizedLinear::forward(const Tensor& x, ParameterStore& store) {
+  return forward(x, kernels::Activation::None, store);
+}
+
+Tensor QuantizedLinear::forward(const Tensor& x, kernels::Activation act,
+                                ParameterStore& store) {
+  return linear_s8(x, W, b, act, store, input_scale);
+}
+
+Embedding::Embedding(int num, int dim, ParameterStore& store,
+                     float init_scale, unsigned seed, bool sparse_grad)
+    : num_embeddings(num),
+      embedding_dim(dim),
+      W(store.parameter({num, dim}, init_scale, seed)) {
+  if (sparse_grad) store.enable_row_sparse_grad(W);
+}
+
+Tensor Embedding::forward(const int32_t* indices, const Shape& shape,
+                          ParameterStore& store) {
+  return embedding(W, indices, shape, store);
+}
+
+Tensor Embedding::forward(const Tensor& indices, ParameterStore& store) {
+  return embedding(W, indices, store);
+}
+
 Tensor Tanh::forward(const Tensor& x, ParameterStore& store) {
   return vtanh(x, store);
 }
@@ -38,14 +70,139 @@ Tensor Sigmoid::forward(const Tensor& x, ParameterStore& store) {
   return sigmoid(x, store);
 }
 
+namespace {
+
+// Activation a fused linear can absorb, or None if m is something else.
+kernels::Activation fusable_activation(const Module* m) {
+  if (dynamic_cast<const Relu*>(m)) return kernels::Activation::Relu;
+  if (dynamic_cast<const Tanh*>(m)) return kernels::Activation::Tanh;
+  if (dynamic_cast<const Sigmoid*>(m)) return kernels::Activation::Sigmoid;
+  return kernels::Activation::None;
+}
+
+// Whether y starts inside x's data, i.e. y may be a view of x.
+bool shares_data(const Tensor& y, const Tensor& x) {
+  return y.store == x.store && y.offset < x.offset + x.numel &&
+         x.offset < y.offset + y.numel;
+}
+
+}  // namespace
+
+// Runs layers from i up to end, or until a checkpoint segment is full, and
+// leaves i at the first layer not run. An intermediate this call allocated
+// is dead once the next layer has run, unless that layer returned a view of
+// it or the tape saves it for backward; its data then goes back to the store
+// for the following layers.
+Tensor Sequential::run(size_t& i, size_t end, const Tensor& x,
+                       ParameterStore& store, const CheckpointPolicy* policy) {
+  const size_t begin = i;
+  size_t interior = 0;
+  Tensor h = x;
+  bool owned = false;
+  size_t h_ops = store.tape.size();
+  while (i < end) {
+    if (policy && i > begin) {
+      const bool full = policy->every
+                            ? i - begin >= policy->every
+                            : interior + h.numel > policy->budget_elements;
+      if (full) break;
+      interior += h.numel;
+    }
+    const size_t ops = store.tape.size();
+    Tensor next;
+    auto* lin = dynamic_cast<Linear*>(layers[i].get());
+    auto* qlin = dynamic_cast<QuantizedLinear*>(layers[i].get());
+    const auto act = (lin || qlin) && i + 1 < end
+                         ? fusable_activation(layers[i + 1].get())
+                         : kernels::Activation::None;
+    if (act != kernels::Activation::None) {
+      next = lin ? lin->forward(h, act, store) : qlin->forward(h, act, store);
+      i += 2;
+    } else {
+      next = layers[i]->forward(h, store);
+      i += 1;
+    }
+    const bool fresh = !shares_data(next, h) && next.is_contiguous();
+    if (owned && fresh && !store.tape.saves(h, h_ops)) store.release(h);
+    owned = fresh && next.store == &store;
+    h = next;
+    h_ops = ops;
+  }
+  return h;
+}
+
+Sequential::Segment* Sequential::segment(size_t begin, size_t end) {
+  for (auto& seg : segments_) {
+    if (seg->begin == begin && seg->end == end) {
+      seg->seq = this;
+      return seg.get();
+    }
+  }
+  segments_.push_back(std::make_unique<Segment>());
+  Segment& seg = *segments_.back();
+  seg.seq = this;
+  seg.begin = begin;
+  seg.end = end;
+  return &seg;
+}
+
 Tensor Sequential::forward(const Tensor& x, ParameterStore& store) {
+  size_t i = 0;
+  const bool checkpointed = checkpoint.every || checkpoint.budget_elements;
+  if (!checkpointed || !store.grad_enabled())
+    return run(i, layers.size(), x, store, nullptr);
+
   Tensor h = x;
-  for (auto& m : layers) {
-    h = m->forward(h, store);
+  while (i < layers.size()) {
+    const size_t begin = i;
+    Tensor y;
+    {
+      NoGradGuard no_grad(store);
+      y = run(i, layers.size(), h, store, &checkpoint);
+      if (!y.is_contiguous()) y = contiguous(y, store);
+    }
+    y.grad_offset = store.allocate_grad(y.numel);
+    std::fill_n(y.grad(), y.numel, 0.0f);
+    store.record(TapeOp{OpType::Custom, y, h, Tensor{}, nullptr, Tensor{},
+                        kernels::Activation::None, &backward_segment,
+                        segment(begin, i)});
+    h = y;
   }
   return h;
 }
 
+// Replays the segment from its saved input with the tape on, then
+// backpropagates the output gradient through the replay. The replay records
+// into the segment's own tape, swapped in for the duration, and allocates
+// above the current mark with the free list set aside, so a reset drops all
+// of it while the caller's tape and arena stay as they were.
+void Sequential::backward_segment(void* ctx, const TapeOp& op,
+                                  ParameterStore& store) {
+  Segment& seg = *static_cast<Segment*>(ctx);
+  const float* g_out = op.out.grad();
+  if (!g_out) return;
+  const StoreMark mark = store.mark();
+  std::vector<FreeBlock> free_blocks;
+  free_blocks.swap(store.free_blocks);
+  std::swap(store.tape, seg.tape);
+  store.tape.clear();
+  const bool grad_mode = store.grad_mode;
+  store.grad_mode = true;
+
+  size_t i = seg.begin;
+  Tensor y = seg.seq->run(i, seg.end, op.a, store, nullptr);
+  if (!y.is_contiguous()) y = contiguous(y, store);
+  if (float* g = y.grad()) {
+    std::copy_n(g_out, y.numel, g);
+    store.propagate(y);
+  }
+
+  store.grad_mode = grad_mode;
+  std::swap(store.tape, seg.tape);
+  store.reset(mark);
+  store.free_blocks.swap(free_blocks);
+}
+
 std::vector<Tensor> Sequential::params() {
   std::vector<Tensor> all;
   for (auto& m : layers) {
@@ -55,24 +212,32 @@ std::vector<Tensor> Sequential::params() {
   return all;
 }
 
+size_t quantize_dynamic(Sequential& model) {
+  size_t converted = 0;
+  for (auto& layer : model.layers) {
+    if (auto* lin = dynamic_cast<Linear*>(layer.get())) {
+      layer = std::make_unique<QuantizedLinear>(*lin);
+      ++converted;
+    } else if (auto* seq = dynamic_cast<Sequential*>(layer.get())) {
+      converted += quantize_dynamic(*seq);
+    }
+  }
+  return converted;
+}
+
 Tensor bce_with_logits_loss(const Tensor& logits, const Tensor& targets,
-                            ParameterStore& store, float eps) {
-  auto probs = sigmoid(logits, store);
-  Tensor ones = store.tensor(targets.shape);
-  std::fill(ones.data(), ones.data() + ones.numel, 1.0f);
-  Tensor epsT = store.tensor(targets.shape);
-  std::fill(epsT.data(), epsT.data() + epsT.numel, eps);
-  auto p_eps = add(probs, epsT, store);
-  auto q = sub(ones, probs, store);
-  auto q_eps = add(q, epsT, store);
-  auto term1 = mul(targets, vlog(p_eps, store), store);
-  auto one_minus_y = sub(ones, targets, store);
-  auto term2 = mul(one_minus_y, vlog(q_eps, store), store);
-  auto sum_terms = add(term1, term2, store);
-  auto s = sum(sum_terms, store);
-  Tensor scale = store.tensor({1});
-  scale.data()[0] = -1.0f / static_cast<float>(targets.shape[0]);
-  return mul(s, scale, store);
+                            ParameterStore& store, float /*eps*/) {
+  return bce_with_logits(logits, targets, store);
+}
+
+Tensor cross_entropy_loss(const Tensor& logits, const int32_t* labels,
+                          ParameterStore& store) {
+  return softmax_cross_entropy(logits, labels, store);
+}
+
+Tensor cross_entropy_loss(const Tensor& logits, const Tensor& labels,
+                          ParameterStore& store) {
+  return softmax_cross_entropy(logits, labels, store);
 }
 
 }  // namespace nn
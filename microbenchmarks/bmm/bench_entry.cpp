@@ -0,0 +1,197 @@
+#if defined(MATMUL_BENCH_ACCELERATE)
+#include <Accelerate/Accelerate.h>
+#elif defined(MATMUL_BENCH_HAS_CBLAS)
+#include <cblas.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "kernels.hpp"
+
+// Batched attention-head products: B independent GEMMs per call, as in
+// multi-head attention with B = batch * heads.
+//   qk: scores[T,T] = Q[T,D] * K[T,D]^T
+//   pv: out[T,D]    = P[T,T] * V[T,D]
+// Each case times a loop of per-matrix cblas_sgemm calls (when a CBLAS is
+// available), a loop of per-matrix KernelTable::sgemm calls, and one
+// KernelTable::sgemm_batched call per backend.
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+struct Config {
+  int batch = 16;
+  int T = 0;  // 0 runs the default sweep
+  int D = 64;
+  int iterations = 10;
+};
+
+// One batched product: C_i = op(A_i) * op(B_i) for i in [0, batch).
+struct Problem {
+  bool trans_b;
+  int M, N, K;
+  size_t stride_a, stride_b, stride_c;
+};
+
+using BatchFn = std::function<void(const Problem&, int, const float*,
+                                   const float*, float*)>;
+
+struct Impl {
+  std::string name;
+  BatchFn fn;
+};
+
+#ifdef MATMUL_BENCH_HAS_CBLAS
+void loop_cblas(const Problem& p, int batch, const float* A, const float* B,
+                float* C) {
+  const int ldb = p.trans_b ? p.K : p.N;
+  for (int i = 0; i < batch; ++i) {
+    cblas_sgemm(CblasRowMajor, CblasNoTrans,
+                p.trans_b ? CblasTrans : CblasNoTrans, p.M, p.N, p.K, 1.0f,
+                A + i * p.stride_a, p.K, B + i * p.stride_b, ldb, 0.0f,
+                C + i * p.stride_c, p.N);
+  }
+}
+#endif
+
+BatchFn loop_table(const kernels::KernelTable* table) {
+  return [table](const Problem& p, int batch, const float* A, const float* B,
+                 float* C) {
+    const int ldb = p.trans_b ? p.K : p.N;
+    for (int i = 0; i < batch; ++i) {
+      table->sgemm(false, p.trans_b, p.M, p.N, p.K, 1.0f, A + i * p.stride_a,
+                   p.K, B + i * p.stride_b, ldb, 0.0f, C + i * p.stride_c,
+                   p.N);
+    }
+  };
+}
+
+BatchFn batched_table(const kernels::KernelTable* table) {
+  return [table](const Problem& p, int batch, const float* A, const float* B,
+                 float* C) {
+    table->sgemm_batched(false, p.trans_b, p.M, p.N, p.K, 1.0f, A, p.K,
+                         p.stride_a, B, p.trans_b ? p.K : p.N, p.stride_b,
+                         0.0f, C, p.N, p.stride_c, batch);
+  };
+}
+
+std::vector<Impl> implementations() {
+  std::vector<Impl> list;
+#ifdef MATMUL_BENCH_HAS_CBLAS
+  list.push_back({"loop_cblas_sgemm", loop_cblas});
+#endif
+  for (const auto& name : kernels::available_backends()) {
+    const auto* table = kernels::find_backend(name);
+    list.push_back({"loop_" + name, loop_table(table)});
+    list.push_back({"batched_" + name, batched_table(table)});
+  }
+  return list;
+}
+
+std::vector<float> random_vec(size_t n, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<float> v(n);
+  for (auto& x : v) x = dist(rng);
+  return v;
+}
+
+void run_case(const std::string& label, const Problem& p, const Config& cfg) {
+  const auto A = random_vec(p.stride_a * cfg.batch, 1);
+  const auto B = random_vec(p.stride_b * cfg.batch, 2);
+  std::vector<float> reference;
+  const double flops =
+      2.0 * p.M * p.N * static_cast<double>(p.K) * cfg.batch;
+
+  std::cout << "[" << label << "] batch=" << cfg.batch << " M=" << p.M
+            << " N=" << p.N << " K=" << p.K << std::endl;
+  double baseline = 0.0;
+  for (const auto& impl : implementations()) {
+    std::vector<float> C(p.stride_c * cfg.batch);
+    impl.fn(p, cfg.batch, A.data(), B.data(), C.data());  // warm up
+    const auto start = clock::now();
+    for (int it = 0; it < cfg.iterations; ++it)
+      impl.fn(p, cfg.batch, A.data(), B.data(), C.data());
+    const std::chrono::duration<double, std::milli> elapsed =
+        clock::now() - start;
+    const double ms = elapsed.count() / cfg.iterations;
+
+    double max_abs = 0.0;
+    if (reference.empty()) {
+      reference = C;
+    } else {
+      for (size_t i = 0; i < C.size(); ++i)
+        max_abs = std::max(max_abs, std::fabs(double(C[i]) - reference[i]));
+    }
+    if (baseline == 0.0) baseline = ms;
+
+    std::cout << std::fixed << std::setprecision(3) << "  " << impl.name
+              << ": " << ms << " ms (" << flops / (ms * 1e6) << " GFLOP/s, x"
+              << baseline / ms << ")";
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << " max|d|=" << std::setprecision(2) << max_abs
+              << std::setprecision(6) << std::endl;
+  }
+}
+
+void run_head(int T, const Config& cfg) {
+  const int D = cfg.D;
+  const size_t td = static_cast<size_t>(T) * D;
+  const size_t tt = static_cast<size_t>(T) * T;
+  run_case("qk T=" + std::to_string(T), Problem{true, T, T, D, td, td, tt},
+           cfg);
+  run_case("pv T=" + std::to_string(T), Problem{false, T, D, T, tt, td, td},
+           cfg);
+}
+
+Config parse_flags(int argc, char** argv) {
+  Config cfg;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if (arg.rfind("B=", 0) == 0) {
+      cfg.batch = std::atoi(arg.c_str() + 2);
+    } else if (arg.rfind("T=", 0) == 0) {
+      cfg.T = std::atoi(arg.c_str() + 2);
+    } else if (arg.rfind("D=", 0) == 0) {
+      cfg.D = std::atoi(arg.c_str() + 2);
+    } else if (arg.rfind("I=", 0) == 0) {
+      cfg.iterations = std::atoi(arg.c_str() + 2);
+    } else {
+      std::cerr << "Unknown argument: " << arg << std::endl;
+      std::exit(1);
+    }
+  }
+  return cfg;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config cfg = parse_flags(argc, argv);
+  if (cfg.batch <= 0 || cfg.D <= 0 || cfg.T < 0) {
+    std::cerr << "Dimensions must be positive." << std::endl;
+    return 1;
+  }
+  if (cfg.iterations <= 0) cfg.iterations = 1;
+  if (cfg.T > 0) {
+    run_head(cfg.T, cfg);
+    return 0;
+  }
+  std::cout << "No sequence length provided. Running T=128..1024 with D="
+            << cfg.D << "..." << std::endl;
+  for (const int T : {128, 256, 512, 1024}) {
+    run_head(T, cfg);
+    std::cout << std::endl;
+  }
+  return 0;
+}
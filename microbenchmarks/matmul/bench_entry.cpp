@@ -42,6 +42,11 @@ int main(int argc, char** argv) {
         {"exp-1", BenchmarkConfig{64, 10, 64, 10}},
         {"exp-2", BenchmarkConfig{20000, 10, 5, 10}},
         {"exp-3", BenchmarkConfig{64, 5, 1, 10}},
+        {"mlp-128x784x512", BenchmarkConfig{128, 784, 512, 20}},
+        {"square-256", BenchmarkConfig{256, 256, 256, 20}},
+        {"square-1024", BenchmarkConfig{1024, 1024, 1024, 5}},
+        {"square-2048", BenchmarkConfig{2048, 2048, 2048, 3}},
+        {"square-4096", BenchmarkConfig{4096, 4096, 4096, 2}},
     };
     std::cout
         << "No dimensions provided. Running default matmul benchmark suite..."
@@ -13,8 +13,12 @@ using MatmulFn =
 struct MatmulBenchmark {
   std::string name;
   MatmulFn fn;
+  // Unblocked reference kernels; skipped above kSlowBenchmarkFlops.
+  bool slow = false;
 };
 
+constexpr double kSlowBenchmarkFlops = 1e9;
+
 const std::vector<MatmulBenchmark>& get_matmul_benchmarks();
 
 struct BenchmarkConfig {
@@ -27,6 +31,7 @@ struct BenchmarkConfig {
 struct BenchmarkResult {
   std::string name;
   double milliseconds;
+  double gflops;
   double max_abs_error;
   double max_rel_error;
 };
@@ -1,10 +1,20 @@
+#if defined(MATMUL_BENCH_ACCELERATE)
 #include <Accelerate/Accelerate.h>
+#elif defined(MATMUL_BENCH_HAS_CBLAS)
+#include <cblas.h>
+#endif
 
 #include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 #include "bench_runner.hpp"
+#include "kernels.hpp"
+#ifdef MATMUL_BENCH_HAS_MLX
 #include "mlx/device.h"
 #include "mlx/mlx.h"
+#endif
 
 #if defined(__ARM_NEON) || defined(__ARM_NEON__)
 #include <arm_neon.h>
@@ -12,7 +22,6 @@
 
 namespace {
 
-namespace mx = mlx::core;
 void matmul_naive(const float* A, const float* B, float* C, int M, int K,
                   int N) {
   for (int m = 0; m < M; ++m) {
@@ -167,6 +176,9 @@ void matmul_skinny_specialized_neon(const float* A, const float* B, float* C,
 
 #endif
 
+#ifdef MATMUL_BENCH_HAS_MLX
+namespace mx = mlx::core;
+
 void matmul_mlx(const float* A, const float* B, float* C, int M, int K, int N) {
   mx::set_default_device(mx::Device::cpu);
   mx::array lhs(A, mx::Shape{M, K}, mx::float32);
@@ -194,24 +206,95 @@ void matmul_mlx_gpu(const float* A, const float* B, float* C, int M, int K,
   std::copy(result_ptr, result_ptr + static_cast<size_t>(M) * N, C);
 }
 
+#endif
+
+#ifdef MATMUL_BENCH_HAS_CBLAS
 void matmul_cblas_sgemm(const float* A, const float* B, float* C, int M, int K,
                         int N) {
   // Row-major SGEMM: C = A x B
   cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, 1.0f, A, K, B,
               N, 0.0f, C, N);
 }
+#endif
+
+// In-tree packed GEMM through one specific kernel backend.
+MatmulFn matmul_packed(const kernels::KernelTable* table) {
+  return [table](const float* A, const float* B, float* C, int M, int K,
+                 int N) {
+    table->sgemm(false, false, M, N, K, 1.0f, A, K, B, N, 0.0f, C, N);
+  };
+}
+
+// Dynamic int8 GEMM through one backend, as nn::quantize_dynamic runs it:
+// B is quantized per output column and packed once (re-packed only when
+// its contents change), rows of A are quantized inside every timed call.
+MatmulFn matmul_int8(const kernels::KernelTable* table) {
+  struct Buffers {
+    std::vector<float> source;  // B as last packed
+    std::vector<int8_t> a, b, rows;
+    std::vector<int32_t> sums;
+    std::vector<float> a_scale, b_scale, column;
+  };
+  auto buf = std::make_shared<Buffers>();
+  return [table, buf](const float* A, const float* B, float* C, int M, int K,
+                      int N) {
+    const size_t kn = static_cast<size_t>(K) * N;
+    if (buf->source.size() != kn ||
+        !std::equal(B, B + kn, buf->source.begin())) {
+      buf->source.assign(B, B + kn);
+      buf->rows.resize(kn);
+      buf->b_scale.resize(N);
+      buf->column.resize(K);
+      for (int n = 0; n < N; ++n) {
+        for (int k = 0; k < K; ++k) buf->column[k] = B[k * N + n];
+        buf->b_scale[n] = table->quantize_s8(
+            buf->column.data(), buf->rows.data() + static_cast<size_t>(n) * K,
+            K);
+      }
+      buf->b.resize(static_cast<size_t>(kernels::s8_groups(K)) *
+                    kernels::s8_ld(N) * 4);
+      buf->sums.resize(N);
+      kernels::pack_s8(buf->rows.data(), N, K, buf->b.data(),
+                       buf->sums.data());
+    }
+    const int lda = 4 * kernels::s8_groups(K);
+    buf->a.assign(static_cast<size_t>(M) * lda, 0);
+    buf->a_scale.resize(M);
+    for (int m = 0; m < M; ++m) {
+      buf->a_scale[m] =
+          table->quantize_s8(A + static_cast<size_t>(m) * K,
+                             buf->a.data() + static_cast<size_t>(m) * lda, K);
+    }
+    table->gemm_s8(M, N, K, buf->a.data(), lda, buf->a_scale.data(),
+                   buf->b.data(), buf->sums.data(), buf->b_scale.data(),
+                   nullptr, kernels::Activation::None, C, N);
+  };
+}
 
 const std::vector<MatmulBenchmark>& registry() {
-  static std::vector<MatmulBenchmark> benches = {
-      {"naive", matmul_naive},
-      {"tiled_v3_256", matmul_tiled_v3<256>},
+  static std::vector<MatmulBenchmark> benches = [] {
+    std::vector<MatmulBenchmark> list = {
+        {"naive", matmul_naive, true},
+        {"tiled_v3_256", matmul_tiled_v3<256>, true},
 #if defined(__ARM_NEON) || defined(__ARM_NEON__)
-      {"tiled_256_neon", matmul_tiled_neon<256>},
+        {"tiled_256_neon", matmul_tiled_neon<256>, true},
 #endif
-      {"cblas_sgemm", matmul_cblas_sgemm},
-      {"mlx_auto", matmul_mlx},
-      {"mlx_gpu", matmul_mlx_gpu},
-  };
+#ifdef MATMUL_BENCH_HAS_CBLAS
+        {"cblas_sgemm", matmul_cblas_sgemm},
+#endif
+#ifdef MATMUL_BENCH_HAS_MLX
+        {"mlx_auto", matmul_mlx},
+        {"mlx_gpu", matmul_mlx_gpu},
+#endif
+    };
+    for (const auto& name : kernels::available_backends()) {
+      list.push_back({"packed_" + name,
+                      matmul_packed(kernels::find_backend(name))});
+      list.push_back({"int8_" + name,
+                      matmul_int8(kernels::find_backend(name))});
+    }
+    return list;
+  }();
   return benches;
 }
 
@@ -16,6 +16,9 @@ case "$TARGET" in
   matmul)
     ./build/release/microbenchmarks/matmul/matmul_bench_main "$@"
     ;;
+  bmm)
+    ./build/release/microbenchmarks/bmm/bmm_bench_main "$@"
+    ;;
   elementwise)
     ./build/release/microbenchmarks/elementwise/elementwise_bench_main "$@"
     ;;
@@ -21,7 +21,10 @@ detect_apple_mcpu() {
       return
     fi
   fi
-  printf '%s' "-mcpu=apple-m1"
+  # Non-Apple hosts rely on runtime kernel dispatch instead of -mcpu.
+  if [[ "$(uname -s)" == "Darwin" && "$(uname -m)" == "arm64" ]]; then
+    printf '%s' "-mcpu=apple-m1"
+  fi
 }
 
 BUILD_DIR=${BUILD_DIR:-build/release}
@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "graph.hpp"
+#include "learning_rate.hpp"
+#include "nn.hpp"
+#include "optimizer.hpp"
+#include "tensor.hpp"
+
+// Replaces the global allocator for this binary so tests can count heap
+// allocations made by the library, worker threads included.
+namespace {
+std::atomic<bool> g_counting{false};
+std::atomic<size_t> g_allocations{0};
+}  // namespace
+
+void* operator new(size_t size) {
+  if (g_counting.load(std::memory_order_relaxed))
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+// Counts allocations made while in scope.
+class AllocationCounter {
+ public:
+  AllocationCounter() {
+    g_allocations.store(0);
+    g_counting.store(true);
+  }
+  ~AllocationCounter() { g_counting.store(false); }
+  size_t count() const { return g_allocations.load(); }
+};
+
+TEST(Allocation, TensorCopiesStayOnTheStack) {
+  ParameterStore ps;
+  Tensor x = ps.tensor({2, 3, 4, 5});
+  AllocationCounter counter;
+  Tensor y = transpose(x, 1, 3);
+  Tensor z = view(x, {6, -1});
+  TapeOp op{OpType::Add, x, y, z};
+  EXPECT_EQ(counter.count(), 0u);
+  EXPECT_EQ(op.b.shape, (std::vector<int>{6, 20}));
+}
+
+TEST(Allocation, RankAboveLimitThrows) {
+  ParameterStore ps;
+  EXPECT_THROW(ps.tensor(std::vector<int>(kMaxRank + 1, 1)),
+               std::invalid_argument);
+}
+
+TEST(Allocation, SteadyStateTrainingStepDoesNotAllocate) {
+  constexpr int kVocab = 50, kContext = 4, kDim = 8, kBatch = 32;
+  ParameterStore store;
+  nn::Embedding embed(kVocab, kDim, store, 0.5f, 1, /*sparse_grad=*/true);
+  nn::Sequential head;
+  head.emplace_back<nn::Linear>(kContext * kDim, 64, store, true, 0.1f, 2);
+  head.emplace_back<nn::Relu>();
+  head.emplace_back<nn::Linear>(64, kVocab, store, true, 0.1f, 3);
+  auto params = head.params();
+  params.push_back(embed.W);
+  ConstantLRScheduler scheduler(0.01f);
+  optim::AdamW<ConstantLRScheduler> opt(params, scheduler);
+
+  std::vector<int32_t> tokens(kBatch * kContext);
+  std::vector<int32_t> labels(kBatch);
+  for (size_t i = 0; i < tokens.size(); ++i) tokens[i] = (i * 7) % kVocab;
+  for (size_t i = 0; i < labels.size(); ++i) labels[i] = (i * 3) % kVocab;
+
+  const StoreMark mark = store.mark();
+  const auto step = [&] {
+    store.reset(mark);
+    store.clear_tape();
+    store.zero_grad();
+    Tensor e = embed(tokens.data(), {kBatch, kContext}, store);
+    Tensor logits = head(view(e, {kBatch, kContext * kDim}), store);
+    Tensor loss = nn::cross_entropy_loss(logits, labels.data(), store);
+    store.backward(loss);
+    opt.step();
+    return loss.data()[0];
+  };
+
+  // The first step sizes the arena, tape, scratch and optimizer state.
+  const float first = step();
+  AllocationCounter counter;
+  float last = first;
+  for (int i = 0; i < 5; ++i) last = step();
+  EXPECT_EQ(counter.count(), 0u);
+  EXPECT_LT(last, first);
+}
+
+TEST(Allocation, GraphReplayDoesNotAllocate) {
+  constexpr int kBatch = 4, kIn = 2, kHidden = 8;
+  ParameterStore store;
+  nn::Sequential model;
+  model.emplace_back<nn::Linear>(kIn, kHidden, store, true, 0.5f, 1);
+  model.emplace_back<nn::Relu>();
+  model.emplace_back<nn::Linear>(kHidden, 1, store, true, 0.5f, 2);
+  model.emplace_back<nn::Sigmoid>();
+  auto params = model.params();
+  ConstantLRScheduler scheduler(0.05f);
+  optim::AdamW<ConstantLRScheduler> opt(params, scheduler);
+
+  Tensor x = store.tensor({kBatch, kIn});
+  Tensor y = store.tensor({kBatch, 1});
+  const float xs[] = {0, 0, 0, 1, 1, 0, 1, 1};
+  const float ys[] = {0, 1, 1, 0};
+  std::copy(xs, xs + 8, x.data());
+  std::copy(ys, ys + 4, y.data());
+
+  Graph graph(store);
+  store.zero_grad();
+  Tensor loss = graph.capture([&] {
+    Tensor diff = sub(model(x, store), y, store);
+    return sum(mul(diff, diff, store), store);
+  });
+  opt.step();
+  const float first = loss.data()[0];
+
+  AllocationCounter counter;
+  for (int i = 0; i < 20; ++i) {
+    store.zero_grad();
+    graph.replay();
+    opt.step();
+  }
+  EXPECT_EQ(counter.count(), 0u);
+  EXPECT_LT(loss.data()[0], first);
+}
+
+}  // namespace
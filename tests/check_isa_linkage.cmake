@@ -0,0 +1,53 @@
+# Fails if an object built with instruction-set flags defines a weak symbol.
+#
+# The linker keeps one copy of each weak (COMDAT) definition for the whole
+# program, so a weak function emitted by an -mavx2/-mavx512f translation
+# unit may end up serving every caller, including on CPUs without those
+# instructions. Code in the kernel headers must have internal linkage
+# instead (see lib/core/kernels/math.hpp).
+#
+#   cmake -DNM=<nm> -DOBJECTS=<a.o|b.o|...> -DSOURCES=<avx2;avx512;...>
+#         -P check_isa_linkage.cmake
+
+cmake_minimum_required(VERSION 3.14)
+
+string(REPLACE "|" ";" objects "${OBJECTS}")
+set(checked 0)
+set(failed FALSE)
+foreach(object IN LISTS objects)
+  get_filename_component(file "${object}" NAME)
+  string(REGEX REPLACE "\\.cpp\\.(o|obj)$" "" source "${file}")
+  if(NOT source IN_LIST SOURCES)
+    continue()
+  endif()
+  math(EXPR checked "${checked} + 1")
+  execute_process(
+    COMMAND "${NM}" -P --defined-only "${object}"
+    OUTPUT_VARIABLE symbols
+    RESULT_VARIABLE result
+  )
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${NM} failed on ${object}")
+  endif()
+  string(REPLACE "\n" ";" symbols "${symbols}")
+  foreach(line IN LISTS symbols)
+    # DW.ref.__gxx_personality_v0 only points at the EH personality routine.
+    if(NOT line MATCHES "^([^ ]+) [WVui] ")
+      continue()
+    endif()
+    set(symbol "${CMAKE_MATCH_1}")
+    if(NOT symbol MATCHES "^DW\\.ref\\.")
+      message(SEND_ERROR "${source}.cpp defines weak symbol ${symbol}")
+      set(failed TRUE)
+    endif()
+  endforeach()
+endforeach()
+
+list(LENGTH SOURCES expected)
+if(NOT checked EQUAL expected)
+  message(FATAL_ERROR "found ${checked} of ${expected} ISA objects")
+endif()
+if(failed)
+  message(FATAL_ERROR "ISA objects must not define weak symbols")
+endif()
+message(STATUS "checked ${checked} ISA objects: no weak symbols")
@@ -0,0 +1,595 @@
+#include "kernels.hpp"
+#include "parallel.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<float> random_vec(size_t n, float lo, float hi, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(lo, hi);
+  std::vector<float> v(n);
+  for (auto& x : v) x = dist(rng);
+  return v;
+}
+
+// Restores the default backend when a test switches tables.
+class BackendGuard {
+ public:
+  BackendGuard() : saved_(kernels::active().name) {}
+  ~BackendGuard() { kernels::set_backend(saved_); }
+
+ private:
+  std::string saved_;
+};
+
+// Restores the default pool size when a test resizes it.
+class ThreadGuard {
+ public:
+  explicit ThreadGuard(size_t n) { parallel::set_num_threads(n); }
+  ~ThreadGuard() { parallel::set_num_threads(0); }
+};
+
+// Reference C = alpha * op(A) * op(B) + beta * C in double precision.
+void reference_gemm(bool ta, bool tb, int M, int N, int K, float alpha,
+                    const float* A, int lda, const float* B, int ldb,
+                    float beta, float* C, int ldc) {
+  for (int m = 0; m < M; ++m) {
+    for (int n = 0; n < N; ++n) {
+      double acc = 0.0;
+      for (int k = 0; k < K; ++k) {
+        const float a = ta ? A[k * lda + m] : A[m * lda + k];
+        const float b = tb ? B[n * ldb + k] : B[k * ldb + n];
+        acc += static_cast<double>(a) * b;
+      }
+      float& c = C[m * ldc + n];
+      c = static_cast<float>(alpha * acc + (beta == 0.0f ? 0.0 : beta * c));
+    }
+  }
+}
+
+class KernelBackends : public ::testing::TestWithParam<std::string> {};
+
+TEST_P(KernelBackends, UnaryMatchesReference) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const auto& k = kernels::active();
+  // Odd length exercises the vector tail handling.
+  const size_t n = 1037;
+  const auto x = random_vec(n, -12.0f, 12.0f, 1);
+  const auto pos = random_vec(n, 1e-4f, 50.0f, 2);
+  std::vector<float> out(n);
+
+  k.tanh(x.data(), out.data(), n);
+  for (size_t i = 0; i < n; ++i) EXPECT_NEAR(out[i], std::tanh(x[i]), 2e-6f);
+
+  k.sigmoid(x.data(), out.data(), n);
+  for (size_t i = 0; i < n; ++i) {
+    EXPECT_NEAR(out[i], 1.0f / (1.0f + std::exp(-x[i])), 2e-6f);
+  }
+
+  k.log(pos.data(), out.data(), n);
+  for (size_t i = 0; i < n; ++i) {
+    EXPECT_NEAR(out[i], std::log(pos[i]), 2e-6f * std::fabs(std::log(pos[i])));
+  }
+
+  k.relu(x.data(), out.data(), n);
+  for (size_t i = 0; i < n; ++i) EXPECT_FLOAT_EQ(out[i], std::max(x[i], 0.f));
+
+  EXPECT_NEAR(k.sum(pos.data(), n), [&] {
+    double acc = 0.0;
+    for (float v : pos) acc += v;
+    return static_cast<float>(acc);
+  }(), 1e-2f);
+}
+
+TEST_P(KernelBackends, AxpyAndDot) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const auto& k = kernels::active();
+  const size_t n = 515;
+  const auto x = random_vec(n, -1.0f, 1.0f, 11);
+  const auto y0 = random_vec(n, -1.0f, 1.0f, 12);
+  auto y = y0;
+  k.axpy(y.data(), -0.5f, x.data(), n);
+  double ref = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    EXPECT_NEAR(y[i], y0[i] - 0.5f * x[i], 1e-6f);
+    ref += static_cast<double>(x[i]) * y0[i];
+  }
+  EXPECT_NEAR(k.dot(x.data(), y0.data(), n), ref, 1e-4);
+}
+
+TEST_P(KernelBackends, BceWithLogitsMatchesReference) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const auto& k = kernels::active();
+  const size_t n = 1031;
+  const auto x = random_vec(n, -30.0f, 30.0f, 13);
+  auto y = random_vec(n, 0.0f, 1.0f, 14);
+  for (auto& v : y) v = v > 0.5f ? 1.0f : 0.0f;
+  double ref = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    ref += std::max(x[i], 0.0f) - x[i] * y[i] +
+           std::log1p(std::exp(-std::fabs(x[i])));
+  }
+  EXPECT_NEAR(k.bce_with_logits(x.data(), y.data(), n), ref, 1e-5 * ref);
+
+  std::vector<float> gx(n, 1.0f);
+  k.bce_with_logits_backward(x.data(), y.data(), 0.25f, gx.data(), n);
+  for (size_t i = 0; i < n; ++i) {
+    const float sig = 1.0f / (1.0f + std::exp(-x[i]));
+    EXPECT_NEAR(gx[i], 1.0f + 0.25f * (sig - y[i]), 1e-6f);
+  }
+}
+
+TEST_P(KernelBackends, SoftmaxMatchesReference) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  for (size_t n : {size_t{1}, size_t{7}, size_t{1029}}) {
+    auto x = random_vec(n, -20.0f, 20.0f, 15);
+    x[0] = 80.0f;  // large logits must not overflow
+    std::vector<float> p(n);
+    const float lse = kernels::active().softmax(x.data(), p.data(), n);
+    double total = 0.0;
+    for (float v : x) total += std::exp(static_cast<double>(v) - 80.0);
+    EXPECT_NEAR(lse, 80.0 + std::log(total), 1e-5);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_NEAR(p[i], std::exp(x[i] - 80.0) / total, 1e-6) << n << " " << i;
+    }
+  }
+}
+
+TEST_P(KernelBackends, LogEdgeCases) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const std::vector<float> x = {0.0f, -1.0f, 1.0f};
+  std::vector<float> out(x.size());
+  kernels::active().log(x.data(), out.data(), x.size());
+  EXPECT_TRUE(std::isinf(out[0]) && out[0] < 0.0f);
+  EXPECT_TRUE(std::isnan(out[1]));
+  EXPECT_FLOAT_EQ(out[2], 0.0f);
+}
+
+TEST_P(KernelBackends, SgemmAllTransposeCombos) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const int M = 19, N = 23, K = 17;
+  const auto A = random_vec(static_cast<size_t>(M) * K, -1.0f, 1.0f, 3);
+  const auto B = random_vec(static_cast<size_t>(K) * N, -1.0f, 1.0f, 4);
+  const auto C0 = random_vec(static_cast<size_t>(M) * N, -1.0f, 1.0f, 5);
+
+  for (int ta = 0; ta < 2; ++ta) {
+    for (int tb = 0; tb < 2; ++tb) {
+      // Stored layouts: A is [M,K] or [K,M], B is [K,N] or [N,K].
+      const int lda = ta ? M : K;
+      const int ldb = tb ? K : N;
+      std::vector<float> Ast(A.size());
+      std::vector<float> Bst(B.size());
+      for (int m = 0; m < M; ++m)
+        for (int k = 0; k < K; ++k)
+          Ast[ta ? k * lda + m : m * lda + k] = A[m * K + k];
+      for (int k = 0; k < K; ++k)
+        for (int n = 0; n < N; ++n)
+          Bst[tb ? n * ldb + k : k * ldb + n] = B[k * N + n];
+
+      std::vector<float> C = C0;
+      kernels::active().sgemm(ta, tb, M, N, K, 0.5f, Ast.data(), lda,
+                              Bst.data(), ldb, 2.0f, C.data(), N);
+      for (int m = 0; m < M; ++m) {
+        for (int n = 0; n < N; ++n) {
+          float ref = 0.0f;
+          for (int k = 0; k < K; ++k) ref += A[m * K + k] * B[k * N + n];
+          ref = 0.5f * ref + 2.0f * C0[m * N + n];
+          EXPECT_NEAR(C[m * N + n], ref, 1e-4f)
+              << "ta=" << ta << " tb=" << tb << " m=" << m << " n=" << n;
+        }
+      }
+    }
+  }
+}
+
+// Sizes straddle the packed path's MR/NR/KC/MC boundaries, and every
+// operand lives inside a wider buffer so leading dimensions exceed the
+// logical width.
+TEST_P(KernelBackends, SgemmPackedMatchesReference) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  struct Case {
+    int M, N, K;
+  };
+  const Case cases[] = {{67, 45, 33}, {150, 130, 300}, {9, 257, 129},
+                        {200, 7, 70}};
+  for (const auto& [M, N, K] : cases) {
+    for (int ta = 0; ta < 2; ++ta) {
+      for (int tb = 0; tb < 2; ++tb) {
+        const int lda = (ta ? M : K) + 3;
+        const int ldb = (tb ? K : N) + 5;
+        const int ldc = N + 2;
+        const auto A = random_vec(static_cast<size_t>(ta ? K : M) * lda,
+                                  -1.0f, 1.0f, 6);
+        const auto B = random_vec(static_cast<size_t>(tb ? N : K) * ldb,
+                                  -1.0f, 1.0f, 7);
+        auto C = random_vec(static_cast<size_t>(M) * ldc, -1.0f, 1.0f, 8);
+        auto ref = C;
+        kernels::active().sgemm(ta, tb, M, N, K, 0.75f, A.data(), lda,
+                                B.data(), ldb, -0.5f, C.data(), ldc);
+        reference_gemm(ta, tb, M, N, K, 0.75f, A.data(), lda, B.data(), ldb,
+                       -0.5f, ref.data(), ldc);
+        for (size_t i = 0; i < C.size(); ++i) {
+          ASSERT_NEAR(C[i], ref[i], 1e-4f * (1.0f + std::sqrt(float(K))))
+              << "M=" << M << " N=" << N << " K=" << K << " ta=" << ta
+              << " tb=" << tb << " i=" << i;
+        }
+      }
+    }
+  }
+}
+
+TEST_P(KernelBackends, SgemmMultithreadedMatchesSingleThreaded) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const int M = 131, N = 517, K = 263;
+  const auto A = random_vec(static_cast<size_t>(M) * K, -1.0f, 1.0f, 9);
+  const auto B = random_vec(static_cast<size_t>(K) * N, -1.0f, 1.0f, 10);
+  std::vector<float> serial(static_cast<size_t>(M) * N);
+  std::vector<float> threaded(serial.size(), 123.0f);
+  {
+    ThreadGuard threads(1);
+    kernels::active().sgemm(false, false, M, N, K, 1.0f, A.data(), K,
+                            B.data(), N, 0.0f, serial.data(), N);
+  }
+  {
+    ThreadGuard threads(4);
+    // beta == 0 must ignore the garbage already in C.
+    kernels::active().sgemm(false, false, M, N, K, 1.0f, A.data(), K,
+                            B.data(), N, 0.0f, threaded.data(), N);
+  }
+  // Every thread count sees the same blocking along K, so results match
+  // bit for bit.
+  EXPECT_EQ(serial, threaded);
+}
+
+// Batches of small matrices run one per task on a 4-thread pool; a shared
+// operand has stride 0, and a C stride of 0 sums the batch into one C.
+TEST_P(KernelBackends, SgemmBatchedMatchesPerMatrixReference) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  ThreadGuard threads(4);
+  const int batch = 13, M = 17, N = 23, K = 19;
+  for (int ta = 0; ta < 2; ++ta) {
+    for (int tb = 0; tb < 2; ++tb) {
+      for (int shared_b = 0; shared_b < 2; ++shared_b) {
+        const int lda = (ta ? M : K) + 1;
+        const int ldb = (tb ? K : N) + 2;
+        const int ldc = N + 3;
+        const size_t sa = static_cast<size_t>(ta ? K : M) * lda + 5;
+        const size_t sb = shared_b ? 0 : static_cast<size_t>(tb ? N : K) * ldb;
+        const size_t sc = static_cast<size_t>(M) * ldc;
+        const auto A = random_vec(sa * batch, -1.0f, 1.0f, 30);
+        const auto B = random_vec(static_cast<size_t>(tb ? N : K) * ldb +
+                                      sb * (batch - 1),
+                                  -1.0f, 1.0f, 31);
+        auto C = random_vec(sc * batch, -1.0f, 1.0f, 32);
+        auto ref = C;
+        kernels::active().sgemm_batched(ta, tb, M, N, K, 0.5f, A.data(), lda,
+                                        sa, B.data(), ldb, sb, 2.0f, C.data(),
+                                        ldc, sc, batch);
+        for (int i = 0; i < batch; ++i) {
+          reference_gemm(ta, tb, M, N, K, 0.5f, A.data() + i * sa, lda,
+                         B.data() + i * sb, ldb, 2.0f, ref.data() + i * sc,
+                         ldc);
+        }
+        for (size_t i = 0; i < C.size(); ++i) {
+          ASSERT_NEAR(C[i], ref[i], 1e-4f)
+              << "ta=" << ta << " tb=" << tb << " shared_b=" << shared_b
+              << " i=" << i;
+        }
+      }
+    }
+  }
+
+  const auto A = random_vec(static_cast<size_t>(batch) * M * K, -1.0f, 1.0f,
+                            33);
+  const auto B = random_vec(static_cast<size_t>(batch) * K * N, -1.0f, 1.0f,
+                            34);
+  std::vector<float> C(static_cast<size_t>(M) * N, 1.0f);
+  auto ref = C;
+  kernels::active().sgemm_batched(false, false, M, N, K, 1.0f, A.data(), K,
+                                  static_cast<size_t>(M) * K, B.data(), N,
+                                  static_cast<size_t>(K) * N, 1.0f, C.data(),
+                                  N, 0, batch);
+  for (int i = 0; i < batch; ++i) {
+    reference_gemm(false, false, M, N, K, 1.0f, A.data() + i * M * K, K,
+                   B.data() + i * K * N, N, 1.0f, ref.data(), N);
+  }
+  for (size_t i = 0; i < C.size(); ++i) ASSERT_NEAR(C[i], ref[i], 1e-3f);
+}
+
+TEST_P(KernelBackends, SgemmBiasActMatchesReference) {
+  using kernels::Activation;
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const auto& k = kernels::active();
+  struct Case {
+    int M, N, K;
+  };
+  // Below and above the packed threshold, with ragged edge tiles.
+  const Case cases[] = {{5, 7, 3}, {67, 45, 33}, {9, 257, 129}};
+  for (const auto& [M, N, K] : cases) {
+    const auto A = random_vec(static_cast<size_t>(M) * K, -1.0f, 1.0f, 16);
+    const auto B = random_vec(static_cast<size_t>(K) * N, -1.0f, 1.0f, 17);
+    const auto bias = random_vec(static_cast<size_t>(N), -1.0f, 1.0f, 18);
+    std::vector<float> ref(static_cast<size_t>(M) * N);
+    reference_gemm(false, false, M, N, K, 1.0f, A.data(), K, B.data(), N,
+                   0.0f, ref.data(), N);
+    for (Activation act : {Activation::None, Activation::Relu,
+                           Activation::Tanh, Activation::Sigmoid}) {
+      for (const float* b : {static_cast<const float*>(nullptr), bias.data()}) {
+        std::vector<float> C(ref.size(), 7.0f);
+        k.sgemm_bias_act(false, false, M, N, K, A.data(), K, B.data(), N, b,
+                         act, C.data(), N);
+        for (size_t i = 0; i < C.size(); ++i) {
+          float z = ref[i] + (b ? b[i % N] : 0.0f);
+          if (act == Activation::Relu) z = std::max(z, 0.0f);
+          if (act == Activation::Tanh) z = std::tanh(z);
+          if (act == Activation::Sigmoid) z = 1.0f / (1.0f + std::exp(-z));
+          ASSERT_NEAR(C[i], z, 1e-4f)
+              << "M=" << M << " act=" << static_cast<int>(act) << " i=" << i;
+        }
+      }
+    }
+  }
+}
+
+TEST_P(KernelBackends, ActBackwardMatchesReference) {
+  using kernels::Activation;
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const size_t n = 77;
+  const auto g0 = random_vec(n, -1.0f, 1.0f, 19);
+  auto y = random_vec(n, -1.0f, 1.0f, 20);
+  y[3] = 0.0f;  // relu'(0) is taken as 0
+  for (Activation act : {Activation::None, Activation::Relu, Activation::Tanh,
+                         Activation::Sigmoid}) {
+    auto g = g0;
+    kernels::active().act_backward(g.data(), y.data(), act, n);
+    for (size_t i = 0; i < n; ++i) {
+      float d = 1.0f;
+      if (act == Activation::Relu) d = y[i] > 0.0f ? 1.0f : 0.0f;
+      if (act == Activation::Tanh) d = 1.0f - y[i] * y[i];
+      if (act == Activation::Sigmoid) d = y[i] * (1.0f - y[i]);
+      EXPECT_NEAR(g[i], g0[i] * d, 1e-6f) << static_cast<int>(act);
+    }
+  }
+}
+
+TEST_P(KernelBackends, Bf16ConversionRoundsToNearestEven) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const auto& k = kernels::active();
+  auto x = random_vec(1035, -1e3f, 1e3f, 21);
+  // 1 + 2^-8 is a tie that rounds down to even, 1 + 3 * 2^-8 one that
+  // rounds up; NaN must stay NaN.
+  x[0] = 1.00390625f;
+  x[1] = 1.01171875f;
+  x[2] = std::nanf("");
+  x[3] = -0.0f;
+  std::vector<uint16_t> h(x.size());
+  std::vector<float> back(x.size());
+  k.f32_to_bf16(x.data(), h.data(), x.size());
+  k.bf16_to_f32(h.data(), back.data(), x.size());
+  EXPECT_EQ(h[0], 0x3f80);
+  EXPECT_EQ(h[1], 0x3f82);
+  EXPECT_TRUE(std::isnan(back[2]));
+  EXPECT_EQ(h[3], 0x8000);
+  for (size_t i = 4; i < x.size(); ++i) {
+    ASSERT_EQ(h[i], kernels::float_to_bf16(x[i])) << i;
+    EXPECT_NEAR(back[i], x[i], std::fabs(x[i]) / 256.0f) << i;
+  }
+}
+
+TEST_P(KernelBackends, GemmBf16MatchesWidenedReference) {
+  using kernels::Activation;
+  using kernels::Operand;
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const auto& k = kernels::active();
+  struct Case {
+    int M, N, K;
+  };
+  // Below and above the packed threshold, with ragged edge tiles.
+  const Case cases[] = {{5, 7, 3}, {67, 45, 33}, {9, 257, 129}};
+  for (const auto& [M, N, K] : cases) {
+    auto A = random_vec(static_cast<size_t>(M) * K, -1.0f, 1.0f, 22);
+    auto B = random_vec(static_cast<size_t>(K) * N, -1.0f, 1.0f, 23);
+    const auto bias = random_vec(static_cast<size_t>(N), -1.0f, 1.0f, 24);
+    std::vector<uint16_t> A16(A.size()), B16(B.size());
+    k.f32_to_bf16(A.data(), A16.data(), A.size());
+    k.f32_to_bf16(B.data(), B16.data(), B.size());
+    for (bool ta : {false, true}) {
+      for (bool tb : {false, true}) {
+        for (int mix = 1; mix < 4; ++mix) {
+          const bool a16 = mix & 1, b16 = mix & 2;
+          // Reference on the values the GEMM actually sees.
+          auto Aw = A, Bw = B;
+          if (a16) k.bf16_to_f32(A16.data(), Aw.data(), A.size());
+          if (b16) k.bf16_to_f32(B16.data(), Bw.data(), B.size());
+          const int lda = ta ? M : K, ldb = tb ? K : N;
+          std::vector<float> ref(static_cast<size_t>(M) * N, 0.5f);
+          reference_gemm(ta, tb, M, N, K, 2.0f, Aw.data(), lda, Bw.data(),
+                         ldb, 1.0f, ref.data(), N);
+          std::vector<float> C(ref.size(), 0.5f);
+          k.gemm_mixed(ta, tb, M, N, K, 2.0f,
+                       a16 ? static_cast<const void*>(A16.data()) : A.data(),
+                       a16 ? Operand::BF16 : Operand::F32, lda,
+                       b16 ? static_cast<const void*>(B16.data()) : B.data(),
+                       b16 ? Operand::BF16 : Operand::F32, ldb, 1.0f,
+                       bias.data(), Activation::Relu, C.data(), N);
+          for (size_t i = 0; i < C.size(); ++i) {
+            const float z = std::max(ref[i] + bias[i % N], 0.0f);
+            ASSERT_NEAR(C[i], z, 1e-4f) << "M=" << M << " ta=" << ta
+                                        << " tb=" << tb << " mix=" << mix;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_P(KernelBackends, GemmMixedWidensUint8Operands) {
+  using kernels::Activation;
+  using kernels::Operand;
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const auto& k = kernels::active();
+  struct Case {
+    int M, N, K;
+  };
+  const Case cases[] = {{4, 6, 5}, {37, 64, 97}};
+  for (const auto& [M, N, K] : cases) {
+    std::vector<uint8_t> A8(static_cast<size_t>(M) * K);
+    for (size_t i = 0; i < A8.size(); ++i) A8[i] = (i * 37 + 11) % 256;
+    std::vector<float> A(A8.begin(), A8.end());
+    auto B = random_vec(static_cast<size_t>(K) * N, -1.0f, 1.0f, 26);
+    const auto bias = random_vec(static_cast<size_t>(N), -1.0f, 1.0f, 27);
+    for (bool ta : {false, true}) {
+      // A is stored as op(A) expects, so transpose the test data.
+      std::vector<uint8_t> a8 = A8;
+      std::vector<float> a = A;
+      if (ta) {
+        for (int i = 0; i < M; ++i) {
+          for (int j = 0; j < K; ++j) {
+            a8[static_cast<size_t>(j) * M + i] = A8[i * K + j];
+            a[static_cast<size_t>(j) * M + i] = A[i * K + j];
+          }
+        }
+      }
+      const int lda = ta ? M : K;
+      const float alpha = 1.0f / 255.0f;
+      std::vector<float> ref(static_cast<size_t>(M) * N, 0.0f);
+      reference_gemm(ta, false, M, N, K, alpha, a.data(), lda, B.data(), N,
+                     0.0f, ref.data(), N);
+      std::vector<float> C(ref.size(), 0.0f);
+      k.gemm_mixed(ta, false, M, N, K, alpha, a8.data(), Operand::U8, lda,
+                   B.data(), Operand::F32, N, 0.0f, bias.data(),
+                   Activation::None, C.data(), N);
+      for (size_t i = 0; i < C.size(); ++i) {
+        ASSERT_NEAR(C[i], ref[i] + bias[i % N], 1e-4f)
+            << "M=" << M << " ta=" << ta;
+      }
+    }
+  }
+}
+
+TEST_P(KernelBackends, QuantizeS8ScalesPerRow) {
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const auto& k = kernels::active();
+  auto x = random_vec(77, -3.0f, 3.0f, 25);
+  x[5] = -4.0f;  // the extreme maps to -127
+  std::vector<int8_t> q(x.size());
+  const float scale = k.quantize_s8(x.data(), q.data(), x.size());
+  EXPECT_FLOAT_EQ(scale, 4.0f / 127.0f);
+  EXPECT_EQ(q[5], -127);
+  for (size_t i = 0; i < x.size(); ++i) {
+    EXPECT_NEAR(q[i] * scale, x[i], 0.5f * scale + 1e-6f) << i;
+  }
+  const std::vector<float> zeros(9, 0.0f);
+  std::vector<int8_t> qz(zeros.size(), 1);
+  EXPECT_EQ(k.quantize_s8(zeros.data(), qz.data(), zeros.size()), 0.0f);
+  for (int8_t v : qz) EXPECT_EQ(v, 0);
+}
+
+TEST_P(KernelBackends, GemmS8MatchesReference) {
+  using kernels::Activation;
+  BackendGuard guard;
+  ASSERT_TRUE(kernels::set_backend(GetParam()));
+  const auto& k = kernels::active();
+  struct Case {
+    int M, N, K;
+  };
+  // Ragged K groups, row and column edge tiles, and a large K.
+  const Case cases[] = {{3, 5, 7}, {37, 45, 97}, {65, 70, 784}};
+  std::mt19937 rng(26);
+  std::uniform_int_distribution<int> dist(-127, 127);
+  for (const auto& [M, N, K] : cases) {
+    // A padded past whole K groups; W one output channel per row.
+    const int lda = 4 * kernels::s8_groups(K) + 8;
+    std::vector<int8_t> A(static_cast<size_t>(M) * lda);
+    std::vector<int8_t> W(static_cast<size_t>(N) * K);
+    for (auto& v : A) v = static_cast<int8_t>(dist(rng));
+    for (auto& v : W) v = static_cast<int8_t>(dist(rng));
+    A[0] = -127;
+    W[0] = -127;
+    std::vector<int8_t> packed(static_cast<size_t>(kernels::s8_groups(K)) *
+                               kernels::s8_ld(N) * 4);
+    std::vector<int32_t> sums(N);
+    kernels::pack_s8(W.data(), N, K, packed.data(), sums.data());
+    const auto sa = random_vec(static_cast<size_t>(M), 0.01f, 0.1f, 27);
+    const auto sb = random_vec(static_cast<size_t>(N), 0.01f, 0.1f, 28);
+    const auto bias = random_vec(static_cast<size_t>(N), -1.0f, 1.0f, 29);
+    for (Activation act : {Activation::None, Activation::Relu}) {
+      for (const float* b : {static_cast<const float*>(nullptr), bias.data()}) {
+        std::vector<float> C(static_cast<size_t>(M) * N, 7.0f);
+        k.gemm_s8(M, N, K, A.data(), lda, sa.data(), packed.data(),
+                  sums.data(), sb.data(), b, act, C.data(), N);
+        for (int m = 0; m < M; ++m) {
+          for (int n = 0; n < N; ++n) {
+            int64_t acc = 0;
+            for (int kk = 0; kk < K; ++kk) {
+              acc += A[static_cast<size_t>(m) * lda + kk] *
+                     W[static_cast<size_t>(n) * K + kk];
+            }
+            float z = static_cast<float>(acc) * sa[m] * sb[n] +
+                      (b ? b[n] : 0.0f);
+            if (act == Activation::Relu) z = std::max(z, 0.0f);
+            ASSERT_NEAR(C[static_cast<size_t>(m) * N + n], z,
+                        1e-5f * std::fabs(z) + 1e-5f)
+                << "M=" << M << " m=" << m << " n=" << n;
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Available, KernelBackends,
+    ::testing::ValuesIn(kernels::available_backends()),
+    [](const ::testing::TestParamInfo<std::string>& info) {
+      return info.param;
+    });
+
+TEST(Parallel, ParallelForCoversRangeOnce) {
+  ThreadGuard threads(4);
+  std::vector<std::atomic<int>> hits(10007);
+  parallel::parallel_for(3, hits.size(), 16, [&](size_t b, size_t e) {
+    for (size_t i = b; i < e; ++i) hits[i].fetch_add(1);
+  });
+  for (size_t i = 0; i < hits.size(); ++i) {
+    EXPECT_EQ(hits[i].load(), i < 3 ? 0 : 1) << i;
+  }
+}
+
+TEST(Parallel, NestedParallelForRunsSerially) {
+  ThreadGuard threads(4);
+  std::atomic<size_t> total{0};
+  parallel::parallel_for(0, 64, 1, [&](size_t b, size_t e) {
+    for (size_t i = b; i < e; ++i) {
+      parallel::parallel_for(0, 100, 1, [&](size_t ib, size_t ie) {
+        total.fetch_add(ie - ib);
+      });
+    }
+  });
+  EXPECT_EQ(total.load(), 6400u);
+}
+
+}  // namespace
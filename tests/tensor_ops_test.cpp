@@ -1,12 +1,19 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
+#include <random>
 #include <vector>
 
+#include "data/sampler.hpp"
+#include "expr.hpp"
+#include "graph.hpp"
 #include "learning_rate.hpp"
 #include "nn.hpp"
 #include "optimizer.hpp"
+#include "parallel.hpp"
 #include "tensor.hpp"
 #include "utils.hpp"
 
@@ -14,6 +21,12 @@ static void fill_vec(float* p, const std::vector<float>& vals) {
   std::copy(vals.begin(), vals.end(), p);
 }
 
+// Leaf tensor with a gradient slot, so tests can read input gradients.
+static Tensor grad_tensor(ParameterStore& ps, const Shape& shape,
+                          TensorInit init = TensorInit::UninitializedData) {
+  return ps.tensor(shape, init, true);
+}
+
 TEST(ParameterStore, ReserveHint) {
   ParameterStore ps;
   EXPECT_EQ(ps.size(), 0u);
@@ -37,12 +50,148 @@ TEST(ParameterStore, ReserveHint) {
   EXPECT_GE(ps.capacity_count(), prev_capacity);
 }
 
+TEST(ParameterStore, GrowthKeepsBuffersInPlace) {
+  ParameterStore ps;
+  ps.enable_stats();
+  Tensor first = ps.tensor({4}, TensorInit::UninitializedData, true);
+  for (int i = 0; i < 4; ++i) first.data()[i] = static_cast<float>(i);
+  const float* data = first.data();
+  const float* grad = first.grad();
+
+  // Grow both arenas well past their first commit.
+  for (int i = 0; i < 64; ++i)
+    ps.tensor({1 << 14}, TensorInit::UninitializedData, true);
+  EXPECT_GE(ps.capacity_count(), ps.size());
+  for (int i = 0; i < 4; ++i)
+    EXPECT_FLOAT_EQ(first.data()[i], static_cast<float>(i));
+  if (ps.data_buf.mapped() && ps.grad_buf.mapped()) {
+    EXPECT_EQ(first.data(), data);
+    EXPECT_EQ(first.grad(), grad);
+    EXPECT_EQ(ps.get_stats().capacity_grow_events, 0u);
+  }
+}
+
+TEST(ParameterStore, ArenaPolicyAlignsAndReportsStats) {
+  ArenaPolicy policy;
+  policy.alignment = 256;
+  policy.huge_pages = HugePages::Transparent;
+  ParameterStore ps(policy);
+  Tensor t = ps.tensor({1 << 16}, TensorInit::ZeroData, true);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ps.data_buf.data()) % 256, 0u);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ps.grad_buf.data()) % 256, 0u);
+  for (size_t i = 0; i < t.numel; ++i) EXPECT_EQ(t.data()[i], 0.0f);
+
+  const ParameterStoreStats& stats = ps.get_stats();
+  EXPECT_GE(stats.data_arena.committed_bytes, t.numel * sizeof(float));
+  EXPECT_GE(stats.grad_arena.committed_bytes, t.numel * sizeof(float));
+  EXPECT_GE(stats.data_arena.commit_calls, 1u);
+  EXPECT_LE(stats.data_arena.huge_page_bytes,
+            stats.data_arena.committed_bytes);
+  EXPECT_EQ(stats.data_arena.mapped, ps.data_buf.mapped());
+}
+
+// Fills an arena's first commit, grows it by a second commit, fills that
+// too, and checks the first pattern survived and the commit counters.
+static void write_across_two_commits(ArenaBuffer& buf) {
+  buf.grow(1024, 0);
+  const size_t first = buf.capacity();
+  const float* start = buf.data();
+  for (size_t i = 0; i < first; ++i) buf.data()[i] = static_cast<float>(i);
+  const bool moved = buf.grow(first + 1, first);
+  const size_t n = buf.capacity();
+  ASSERT_GT(n, first);
+  for (size_t i = first; i < n; ++i) buf.data()[i] = static_cast<float>(n + i);
+  for (size_t i = 0; i < n; ++i) {
+    ASSERT_EQ(buf.data()[i], static_cast<float>(i < first ? i : n + i)) << i;
+  }
+
+  const ArenaStats& stats = buf.stats();
+  EXPECT_EQ(stats.commit_calls, 2u);
+  EXPECT_EQ(stats.committed_bytes, n * sizeof(float));
+  EXPECT_LE(stats.huge_page_bytes, stats.committed_bytes);
+  EXPECT_LE(stats.numa_bound_bytes, stats.committed_bytes);
+  EXPECT_EQ(stats.mapped, buf.mapped());
+  if (buf.mapped()) {
+    EXPECT_FALSE(moved);
+    EXPECT_EQ(buf.data(), start);
+  } else {
+    EXPECT_EQ(stats.huge_page_bytes, 0u);
+    EXPECT_EQ(stats.numa_bound_bytes, 0u);
+  }
+}
+
+TEST(ArenaBuffer, ExplicitHugePagesFallBackToTransparent) {
+  ArenaPolicy policy;
+  policy.huge_pages = HugePages::Explicit;
+  ArenaBuffer buf(policy);
+  write_across_two_commits(buf);
+  if (!buf.mapped()) return;
+  // Commits are whole 2 MB pages. With an empty hugetlb pool each one is
+  // remapped and madvised instead, so huge_page_bytes still counts whole
+  // commits, but not necessarily all of them.
+  const size_t huge = size_t{2} << 20;
+  const ArenaStats& stats = buf.stats();
+  EXPECT_EQ(stats.committed_bytes % huge, 0u);
+  EXPECT_EQ(stats.huge_page_bytes % huge, 0u);
+  EXPECT_EQ(stats.numa_bound_bytes, 0u);
+}
+
+TEST(ArenaBuffer, NumaBindToNodeZero) {
+  ArenaPolicy policy;
+  policy.numa = NumaPlacement::Bind;
+  policy.numa_node = 0;
+  ArenaBuffer buf(policy);
+  write_across_two_commits(buf);
+  // Node 0 exists wherever mbind is allowed; where it is not, nothing is
+  // counted.
+  const ArenaStats& stats = buf.stats();
+  if (stats.numa_bound_bytes != 0)
+    EXPECT_EQ(stats.numa_bound_bytes, stats.committed_bytes);
+  EXPECT_EQ(stats.huge_page_bytes, 0u);
+}
+
+TEST(ArenaBuffer, NumaBindToMissingNodeKeepsFirstTouch) {
+  ArenaPolicy policy;
+  policy.numa = NumaPlacement::Bind;
+  policy.numa_node = 64;  // Past the node mask
+  ArenaBuffer buf(policy);
+  write_across_two_commits(buf);
+  EXPECT_EQ(buf.stats().numa_bound_bytes, 0u);
+}
+
+TEST(ParameterStore, PlanMeasuresOneStepAndRewinds) {
+  ParameterStore ps;
+  ps.enable_stats();
+  Tensor w = ps.parameter({8, 4}, 0.5f, 1);
+  Tensor x = ps.tensor({16, 8}, TensorInit::ZeroData);
+  const auto step = [&] {
+    return sum(relu(matmul(x, w, ps), ps), ps);
+  };
+
+  const StoreMark start = ps.mark();
+  const StoreMark need = ps.plan([&] { ps.backward(step()); });
+  EXPECT_EQ(ps.size(), start.data);
+  EXPECT_EQ(ps.grad_size(), start.grad);
+  EXPECT_EQ(ps.tape.size(), 0u);
+  for (size_t i = 0; i < w.numel; ++i) EXPECT_EQ(w.grad()[i], 0.0f);
+  EXPECT_GE(ps.capacity_count(), need.data);
+
+  // The real step lands exactly on the plan.
+  ps.backward(step());
+  EXPECT_EQ(ps.size(), need.data);
+  EXPECT_EQ(ps.grad_size(), need.grad);
+  const ParameterStoreStats& stats = ps.get_stats();
+  EXPECT_EQ(stats.plan_calls, 1u);
+  EXPECT_EQ(stats.plan_elements, stats.peak_elements);
+  EXPECT_EQ(stats.plan_grad_elements, stats.peak_grad_elements);
+}
+
 TEST(ParameterStore, ResetReuse) {
   ParameterStore ps;
   auto persistent = ps.tensor({4}, TensorInit::ZeroData);
   fill_vec(persistent.data(), {1.f, 2.f, 3.f, 4.f});
 
-  size_t mark = ps.mark();
+  StoreMark mark = ps.mark();
   auto scratch = ps.tensor({2});
   const size_t scratch_offset = scratch.offset;
 
@@ -53,11 +202,125 @@ TEST(ParameterStore, ResetReuse) {
   EXPECT_FLOAT_EQ(persistent.data()[3], 4.f);
 }
 
+TEST(ParameterStore, ReleaseReusesDeadRegions) {
+  ParameterStore ps;
+  auto a = ps.tensor({4});
+  auto b = ps.tensor({6});
+  auto c = ps.tensor({2});
+  const StoreMark mark = ps.mark();
+
+  ps.release(b);
+  EXPECT_EQ(ps.size(), 12u);
+  auto d = ps.tensor({5});
+  EXPECT_EQ(d.offset, b.offset);
+  // The leftover element merges with c once c is released, and the pair is
+  // at the top of the arena.
+  ps.release(c);
+  EXPECT_EQ(ps.size(), 9u);
+  ps.release(a);
+  auto e = ps.tensor({3});
+  EXPECT_EQ(e.offset, a.offset);
+  EXPECT_THROW(ps.release(transpose(ps.tensor({2, 3}), 0, 1)),
+               std::invalid_argument);
+
+  ps.reset(mark);
+  EXPECT_EQ(ps.size(), 12u);
+  EXPECT_EQ(ps.tensor({2}).offset, 12u);
+  EXPECT_EQ(ps.tensor({1}).offset, 3u);
+}
+
+TEST(ParameterStore, NoGradGuardSkipsTapeAndGradSpace) {
+  ParameterStore ps;
+  auto w = ps.parameter({3, 2}, 0.5f, 1);
+  auto x = ps.tensor({4, 3});
+  x.fill(1.0f);
+  const size_t grad_before = ps.grad_size();
+  {
+    NoGradGuard no_grad(ps);
+    EXPECT_FALSE(ps.grad_enabled());
+    {
+      NoGradGuard nested(ps);
+    }
+    EXPECT_FALSE(ps.grad_enabled());
+    auto y = relu(matmul(x, w, ps), ps);
+    EXPECT_FALSE(y.requires_grad());
+    EXPECT_EQ(y.grad(), nullptr);
+    EXPECT_TRUE(ps.tape.empty());
+    EXPECT_EQ(ps.grad_size(), grad_before);
+    // Parameters still get a zeroed gradient.
+    auto late = ps.parameter({2});
+    EXPECT_FLOAT_EQ(late.grad()[0], 0.0f);
+    EXPECT_FLOAT_EQ(late.grad()[1], 0.0f);
+  }
+  EXPECT_TRUE(ps.grad_enabled());
+  auto y = matmul(x, w, ps);
+  EXPECT_EQ(ps.tape.size(), 1u);
+  EXPECT_FLOAT_EQ(y.grad()[0], 0.0f);
+}
+
+TEST(ParameterStore, GradSpaceOnlyOnPathToParameters) {
+  ParameterStore ps;
+  auto w = ps.parameter({8, 4});
+  auto b = ps.parameter({4});
+  EXPECT_EQ(ps.grad_size(), 36u);
+  auto x = ps.tensor({16, 8});
+  x.fill(0.5f);
+  EXPECT_FALSE(x.requires_grad());
+  EXPECT_EQ(x.grad(), nullptr);
+  // Ops on inputs alone are constants: no gradient slot, no tape entry.
+  auto xx = relu(mul(x, x, ps), ps);
+  EXPECT_FALSE(xx.requires_grad());
+  EXPECT_TRUE(ps.tape.empty());
+  EXPECT_EQ(ps.grad_size(), 36u);
+
+  auto h = add(matmul(xx, w, ps), b, ps);
+  EXPECT_TRUE(h.requires_grad());
+  auto loss = sum(h, ps);
+  EXPECT_EQ(ps.tape.size(), 3u);
+  // Matmul output, add output and loss; none for the [16, 8] inputs.
+  EXPECT_EQ(ps.grad_size(), 36u + 64 + 64 + 1);
+  EXPECT_LT(ps.grad_size(), ps.size());
+  ps.backward(loss);
+  EXPECT_FLOAT_EQ(b.grad()[0], 16.0f);
+  EXPECT_FLOAT_EQ(w.grad()[0], 16.0f * 0.25f);
+
+  // Views keep the base's gradient slot.
+  auto rows = narrow(w, 0, 2, 3);
+  EXPECT_EQ(rows.grad(), w.grad() + 2 * 4);
+  EXPECT_EQ(narrow(x, 0, 1, 2).grad(), nullptr);
+
+  const StoreMark mark = ps.mark();
+  sum(matmul(x, w, ps), ps);
+  EXPECT_GT(ps.grad_size(), mark.grad);
+  ps.reset(mark);
+  EXPECT_EQ(ps.grad_size(), mark.grad);
+  EXPECT_THROW(ps.backward(sum(x, ps)), std::invalid_argument);
+}
+
+TEST(ParameterStore, BackwardSkipsOpsThatCannotReachLoss) {
+  ParameterStore ps;
+  auto w = ps.parameter({3, 2});
+  auto x = ps.tensor({4, 3});
+  x.fill(1.0f);
+  w.fill(0.5f);
+  // A branch recorded before the loss that the loss never reads.
+  auto dead = relu(mul(w, w, ps), ps);
+  auto h = matmul(x, w, ps);
+  auto loss = sum(h, ps);
+  ASSERT_EQ(ps.tape.size(), 4u);
+  EXPECT_EQ(ps.tape.mark_live(loss), (std::vector<uint8_t>{0, 0, 1, 1}));
+  EXPECT_EQ(ps.tape.mark_live(dead), (std::vector<uint8_t>{1, 1, 0, 0}));
+
+  ps.backward(loss);
+  for (int i = 0; i < 6; ++i) EXPECT_FLOAT_EQ(w.grad()[i], 4.0f);
+  for (int i = 0; i < 6; ++i) EXPECT_FLOAT_EQ(dead.grad()[i], 0.0f);
+}
+
 TEST(TensorOps, AddBackward) {
   ParameterStore ps;
   ps.clear_tape();
-  auto a = ps.tensor({2, 3});
-  auto b = ps.tensor({2, 3});
+  auto a = grad_tensor(ps, {2, 3});
+  auto b = grad_tensor(ps, {2, 3});
   fill_vec(a.data(), {1, 2, 3, 4, 5, 6});
   fill_vec(b.data(), {6, 5, 4, 3, 2, 1});
   auto c = add(a, b, ps);
@@ -75,8 +338,8 @@ TEST(TensorOps, AddBackward) {
 TEST(TensorOps, MulBackward) {
   ParameterStore ps;
   ps.clear_tape();
-  auto a = ps.tensor({2, 2});
-  auto b = ps.tensor({2, 2});
+  auto a = grad_tensor(ps, {2, 2});
+  auto b = grad_tensor(ps, {2, 2});
   fill_vec(a.data(), {1, 2, 3, 4});
   fill_vec(b.data(), {5, 6, 7, 8});
   auto c = mul(a, b, ps);
@@ -92,7 +355,7 @@ TEST(TensorOps, MulBackward) {
 TEST(TensorOps, ReluBackward) {
   ParameterStore ps;
   ps.clear_tape();
-  auto x = ps.tensor({4});
+  auto x = grad_tensor(ps, {4});
   fill_vec(x.data(), {-1.f, 0.2f, 3.f, -0.5f});
   auto y = relu(x, ps);
   auto s = sum(y, ps);
@@ -105,7 +368,7 @@ TEST(TensorOps, ReluBackward) {
 TEST(TensorOps, SumBackward) {
   ParameterStore ps;
   ps.clear_tape();
-  auto x = ps.tensor({3});
+  auto x = grad_tensor(ps, {3});
   fill_vec(x.data(), {1.f, 2.f, 3.f});
   auto s = sum(x, ps);
   ps.zero_grad();
@@ -117,8 +380,8 @@ TEST(TensorOps, MatmulBackward) {
   ParameterStore ps;
   ps.clear_tape();
   // A[2,2], B[2,2]
-  auto A = ps.tensor({2, 2});
-  auto B = ps.tensor({2, 2});
+  auto A = grad_tensor(ps, {2, 2});
+  auto B = grad_tensor(ps, {2, 2});
   fill_vec(A.data(), {1.f, 2.f, 3.f, 4.f});  // rows: [1,2], [3,4]
   fill_vec(B.data(), {5.f, 6.f, 7.f, 8.f});  // rows: [5,6], [7,8]
   auto C = matmul(A, B, ps);
@@ -145,8 +408,8 @@ TEST(TensorOps, MatmulBackward) {
 TEST(TensorOps, AddRowwiseBackward) {
   ParameterStore ps;
   ps.clear_tape();
-  auto X = ps.tensor({3, 2});
-  auto b = ps.tensor({2});
+  auto X = grad_tensor(ps, {3, 2});
+  auto b = grad_tensor(ps, {2});
   fill_vec(X.data(), {1, 2, 3, 4, 5, 6});
   fill_vec(b.data(), {0.5f, -1.0f});
   auto Y = add_rowwise(X, b, ps);
@@ -162,7 +425,7 @@ TEST(TensorOps, AddRowwiseBackward) {
 TEST(TensorOps, SigmoidGradMatchesAnalytic) {
   ParameterStore ps;
   ps.clear_tape();
-  auto x = ps.tensor({3});
+  auto x = grad_tensor(ps, {3});
   fill_vec(x.data(), {-1.f, 0.0f, 2.f});
   auto y = sigmoid(x, ps);
   auto s = sum(y, ps);
@@ -178,7 +441,7 @@ TEST(TensorOps, SigmoidGradMatchesAnalytic) {
 TEST(TensorOps, LogGrad) {
   ParameterStore ps;
   ps.clear_tape();
-  auto x = ps.tensor({3});
+  auto x = grad_tensor(ps, {3});
   fill_vec(x.data(), {0.5f, 2.0f, 4.0f});
   auto y = vlog(x, ps);
   auto s = sum(y, ps);
@@ -192,7 +455,7 @@ TEST(TensorOps, LogGrad) {
 TEST(NN, BCEWithLogitsGradMatchesAnalytic) {
   ParameterStore ps;
   ps.clear_tape();
-  auto logits = ps.tensor({2, 1});
+  auto logits = grad_tensor(ps, {2, 1});
   fill_vec(logits.data(), {0.2f, -0.7f});
   auto targets = ps.tensor({2, 1});
   fill_vec(targets.data(), {1.0f, 0.0f});
@@ -209,9 +472,147 @@ TEST(NN, BCEWithLogitsGradMatchesAnalytic) {
   }
 }
 
+TEST(NN, BCEWithLogitsFusedForward) {
+  ParameterStore ps;
+  auto logits = grad_tensor(ps, {2, 2});
+  auto targets = ps.tensor({2, 2});
+  fill_vec(logits.data(), {0.5f, -2.0f, 100.0f, -100.0f});
+  fill_vec(targets.data(), {1.0f, 0.0f, 0.0f, 0.0f});
+  auto loss = nn::bce_with_logits_loss(logits, targets, ps);
+  // One tape entry, no intermediates.
+  ASSERT_EQ(ps.tape.size(), 1u);
+  EXPECT_EQ(ps.tape.back().type, OpType::BceWithLogits);
+  float ref = 0.0f;
+  for (int i = 0; i < 4; ++i) {
+    const float x = logits.data()[i];
+    const float y = targets.data()[i];
+    ref += std::max(x, 0.0f) - x * y + std::log1p(std::exp(-std::fabs(x)));
+  }
+  // Saturated logits stay finite: x = 100 with y = 0 costs exactly 100.
+  EXPECT_NEAR(loss.data()[0], ref / 2.0f, 1e-4f);
+  EXPECT_GT(loss.data()[0], 50.0f);
+}
+
+TEST(NN, CrossEntropyMatchesReference) {
+  ParameterStore ps;
+  const int N = 3, C = 5;
+  auto logits = grad_tensor(ps, {N, C});
+  fill_vec(logits.data(), {0.1f, 2.0f, -1.0f, 0.5f, 0.0f,    //
+                           90.0f, -90.0f, 3.0f, 89.0f, 0.0f,  //
+                           -5.0f, -5.0f, -5.0f, -5.0f, -5.0f});
+  const std::vector<int32_t> labels = {1, 3, 4};
+  auto loss = nn::cross_entropy_loss(logits, labels.data(), ps);
+  ASSERT_EQ(ps.tape.size(), 1u);
+  EXPECT_EQ(ps.tape.back().type, OpType::SoftmaxCrossEntropy);
+
+  std::vector<double> ref_grad(N * C);
+  double ref = 0.0;
+  for (int r = 0; r < N; ++r) {
+    const float* x = logits.data() + r * C;
+    const double mx = *std::max_element(x, x + C);
+    double total = 0.0;
+    for (int c = 0; c < C; ++c) total += std::exp(x[c] - mx);
+    ref += mx + std::log(total) - x[labels[r]];
+    for (int c = 0; c < C; ++c) {
+      ref_grad[r * C + c] =
+          (std::exp(x[c] - mx) / total - (c == labels[r] ? 1.0 : 0.0)) / N;
+    }
+  }
+  EXPECT_NEAR(loss.data()[0], ref / N, 1e-4f);
+
+  ps.backward(loss);
+  for (int i = 0; i < N * C; ++i) {
+    EXPECT_NEAR(logits.grad()[i], ref_grad[i], 1e-6) << i;
+  }
+
+  const std::vector<int32_t> bad = {0, 5, 1};
+  EXPECT_THROW(nn::cross_entropy_loss(logits, bad.data(), ps),
+               std::out_of_range);
+}
+
+TEST(NN, CrossEntropyLargeVocabThreadInvariant) {
+  const int N = 48, C = 5000;
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> dist(-4.0f, 4.0f);
+  std::vector<float> x(static_cast<size_t>(N) * C);
+  for (auto& v : x) v = dist(rng);
+  std::vector<int32_t> labels(N);
+  for (int r = 0; r < N; ++r) labels[r] = (r * 977) % C;
+
+  const auto run = [&](size_t threads, std::vector<float>& grad) {
+    parallel::set_num_threads(threads);
+    ParameterStore ps;
+    auto logits = grad_tensor(ps, {N, C});
+    std::copy(x.begin(), x.end(), logits.data());
+    auto loss = softmax_cross_entropy(logits, labels.data(), ps);
+    ps.backward(loss);
+    grad.assign(logits.grad(), logits.grad() + x.size());
+    parallel::set_num_threads(0);
+    return loss.data()[0];
+  };
+  std::vector<float> serial_grad, threaded_grad;
+  const float serial = run(1, serial_grad);
+  const float threaded = run(4, threaded_grad);
+  EXPECT_EQ(serial, threaded);
+  EXPECT_EQ(serial_grad, threaded_grad);
+  // Each gradient row sums to zero: softmax and one-hot both sum to 1.
+  double row = 0.0;
+  for (int c = 0; c < C; ++c) row += serial_grad[c];
+  EXPECT_NEAR(row, 0.0, 1e-6);
+}
+
+TEST(NN, EmbeddingGatherAndScatterAdd) {
+  ParameterStore ps;
+  nn::Embedding embed(4, 3, ps);
+  fill_vec(embed.W.data(), {0.f, 1.f, 2.f,  //
+                            3.f, 4.f, 5.f,  //
+                            6.f, 7.f, 8.f,  //
+                            9.f, 10.f, 11.f});
+  // Index 2 appears twice, index 0 never.
+  const std::vector<int32_t> idx = {2, 1, 3, 2};
+  auto out = embed(idx.data(), {2, 2}, ps);
+  ASSERT_EQ(out.shape, (std::vector<int>{2, 2, 3}));
+  for (int i = 0; i < 4; ++i) {
+    for (int d = 0; d < 3; ++d) {
+      EXPECT_FLOAT_EQ(out.data()[i * 3 + d], embed.W.data()[idx[i] * 3 + d]);
+    }
+  }
+
+  auto weights = ps.tensor({2, 2, 3});
+  for (int i = 0; i < 12; ++i) weights.data()[i] = static_cast<float>(i + 1);
+  auto loss = sum(mul(out, weights, ps), ps);
+  ps.backward(loss);
+  const float* g = embed.W.grad();
+  for (int d = 0; d < 3; ++d) {
+    EXPECT_FLOAT_EQ(g[0 * 3 + d], 0.0f);
+    EXPECT_FLOAT_EQ(g[1 * 3 + d], weights.data()[1 * 3 + d]);
+    EXPECT_FLOAT_EQ(g[2 * 3 + d],
+                    weights.data()[0 * 3 + d] + weights.data()[3 * 3 + d]);
+    EXPECT_FLOAT_EQ(g[3 * 3 + d], weights.data()[2 * 3 + d]);
+  }
+
+  const std::vector<int32_t> bad = {4};
+  EXPECT_THROW(embed(bad.data(), {1}, ps), std::out_of_range);
+}
+
+TEST(NN, EmbeddingMatchesOneHotMatmul) {
+  ParameterStore ps;
+  const int V = 7, D = 5, N = 6;
+  nn::Embedding embed(V, D, ps, 0.5f, 3);
+  const std::vector<int32_t> idx = {6, 0, 3, 3, 1, 6};
+  auto onehot = ps.tensor({N, V}, TensorInit::ZeroData);
+  for (int i = 0; i < N; ++i) fill_one_hot(onehot, i, idx[i]);
+  auto ref = matmul(onehot, embed.W, ps);
+  auto out = embed(idx.data(), {N}, ps);
+  ASSERT_EQ(out.shape, ref.shape);
+  for (int i = 0; i < N * D; ++i) {
+    EXPECT_FLOAT_EQ(out.data()[i], ref.data()[i]);
+  }
+}
+
 TEST(Optimizer, SGDBasicStep) {
   ParameterStore ps;
-  auto param = ps.tensor({2}, TensorInit::ZeroData);
+  auto param = grad_tensor(ps, {2}, TensorInit::ZeroData);
   float* data = param.data();
   data[0] = 1.0f;
   data[1] = -1.0f;
@@ -227,9 +628,128 @@ TEST(Optimizer, SGDBasicStep) {
   EXPECT_FLOAT_EQ(data[1], -0.975f);
 }
 
+namespace {
+
+// Runs embedding lookups of the given batches through an optimizer built by
+// make_opt and returns the final table.
+template <typename MakeOpt>
+std::vector<float> train_embedding(
+    bool sparse, const std::vector<std::vector<int32_t>>& steps,
+    MakeOpt make_opt) {
+  ParameterStore ps;
+  nn::Embedding embed(6, 3, ps, 0.5f, 11, sparse);
+  auto weights = ps.tensor({6, 3});
+  for (int i = 0; i < 18; ++i) weights.data()[i] = 0.1f * (i % 5) - 0.2f;
+  ConstantLRScheduler scheduler(0.1f);
+  auto opt = make_opt(embed.params(), scheduler);
+  for (const auto& idx : steps) {
+    opt.zero_grad();
+    ps.clear_tape();
+    auto e = embed(idx.data(), {static_cast<int>(idx.size())}, ps);
+    auto loss = sum(mul(e, narrow(weights, 0, 0, e.shape[0]), ps), ps);
+    ps.backward(loss);
+    opt.step();
+  }
+  return std::vector<float>(embed.W.data(), embed.W.data() + 18);
+}
+
+}  // namespace
+
+TEST(Optimizer, SparseSGDMomentumCatchUpMatchesDense) {
+  // Rows skip varying numbers of steps; the last step touches every row so
+  // the lazy catch-up has been applied everywhere.
+  const std::vector<std::vector<int32_t>> steps = {
+      {0, 1, 2}, {2, 3}, {0, 0, 1}, {4, 5, 0, 1}, {2, 3}, {0, 1, 2, 3, 4, 5}};
+  const auto sgd = [](std::vector<Tensor> p, ConstantLRScheduler& s) {
+    return optim::SGD<ConstantLRScheduler>(std::move(p), s, 0.9f);
+  };
+  const auto dense = train_embedding(false, steps, sgd);
+  const auto sparse = train_embedding(true, steps, sgd);
+  for (int i = 0; i < 18; ++i) EXPECT_NEAR(sparse[i], dense[i], 1e-5f) << i;
+}
+
+TEST(Optimizer, SparseAdamWSkipsUntouchedRows) {
+  const auto adamw = [](std::vector<Tensor> p, ConstantLRScheduler& s) {
+    return optim::AdamW<ConstantLRScheduler>(std::move(p), s, 0.9f, 0.999f,
+                                             0.01f, true);
+  };
+  // Rows 0-1 are touched every step and must match the dense optimizer.
+  const std::vector<std::vector<int32_t>> steps = {{0, 1, 5}, {0, 1}, {1, 0}};
+  const auto dense = train_embedding(false, steps, adamw);
+  const auto sparse = train_embedding(true, steps, adamw);
+  for (int i = 0; i < 6; ++i) EXPECT_FLOAT_EQ(sparse[i], dense[i]) << i;
+
+  // Never-touched rows keep their initial values under the lazy update,
+  // while the dense optimizer decays them every step.
+  const auto init = train_embedding(true, {}, adamw);
+  for (int i = 6; i < 15; ++i) {
+    EXPECT_FLOAT_EQ(sparse[i], init[i]) << i;
+    EXPECT_NE(dense[i], init[i]) << i;
+  }
+  // Row 5 stopped after step 1: lazy rows do not drift on momentum.
+  EXPECT_NE(sparse[15], dense[15]);
+}
+
+TEST(ParameterStore, RowSparseZeroGradClearsTouchedRows) {
+  ParameterStore ps;
+  ps.enable_stats(true);
+  nn::Embedding embed(100, 4, ps, 0.5f, 0, true);
+  auto bias = ps.parameter({4});
+  const std::vector<int32_t> idx = {7, 42, 7};
+  auto loss = sum(add(embed(idx.data(), {3}, ps), bias, ps), ps);
+  ps.backward(loss);
+  RowSparseGrad* sparse = ps.row_sparse_grad(embed.W);
+  ASSERT_NE(sparse, nullptr);
+  EXPECT_EQ(sparse->touched, (std::vector<int32_t>{7, 42}));
+  EXPECT_FLOAT_EQ(embed.W.grad()[7 * 4], 2.0f);
+  EXPECT_FLOAT_EQ(bias.grad()[0], 3.0f);
+
+  ps.reset_stats();
+  ps.zero_grad();
+  EXPECT_TRUE(sparse->touched.empty());
+  for (size_t i = 0; i < embed.W.numel; ++i) {
+    ASSERT_EQ(embed.W.grad()[i], 0.0f) << i;
+  }
+  EXPECT_EQ(bias.grad()[0], 0.0f);
+  // Two table rows plus the dense bias, not the whole 400-element table.
+  EXPECT_EQ(ps.get_stats().zero_grad_elems, 2u * 4 + 4);
+}
+
+TEST(ParameterStore, RowSparseTiedWeightsFallBackToDense) {
+  ParameterStore ps;
+  nn::Embedding embed(10, 4, ps, 0.5f, 0, true);
+  const std::vector<int32_t> idx = {3, 5};
+  // Output projection tied to the table writes gradient into every row.
+  auto h = embed(idx.data(), {2}, ps);
+  auto loss = sum(matmul(h, transpose(embed.W), ps), ps);
+  ps.backward(loss);
+  RowSparseGrad* sparse = ps.row_sparse_grad(embed.W);
+  ASSERT_NE(sparse, nullptr);
+  EXPECT_TRUE(sparse->dense);
+
+  const std::vector<float> before(embed.W.data(),
+                                  embed.W.data() + embed.W.numel);
+  const std::vector<float> grad(embed.W.grad(),
+                                embed.W.grad() + embed.W.numel);
+  EXPECT_NE(grad[0], 0.0f);  // Row 0 is untouched by embedding()
+  ConstantLRScheduler scheduler(0.1f);
+  optim::SGD optimizer({embed.W}, scheduler);
+  optimizer.step();
+  for (size_t i = 0; i < embed.W.numel; ++i) {
+    ASSERT_FLOAT_EQ(embed.W.data()[i], before[i] - 0.1f * grad[i]) << i;
+  }
+
+  ps.zero_grad();
+  EXPECT_FALSE(sparse->dense);
+  EXPECT_TRUE(sparse->touched.empty());
+  for (size_t i = 0; i < embed.W.numel; ++i) {
+    ASSERT_EQ(embed.W.grad()[i], 0.0f) << i;
+  }
+}
+
 TEST(Optimizer, AdamWDecoupledWeightDecay) {
   ParameterStore ps;
-  auto param = ps.tensor({1}, TensorInit::ZeroData);
+  auto param = grad_tensor(ps, {1}, TensorInit::ZeroData);
   param.data()[0] = 2.0f;
   param.grad()[0] = 0.5f;
 
@@ -245,7 +765,7 @@ TEST(Optimizer, AdamWDecoupledWeightDecay) {
 
 TEST(TensorOps, TensorFillAndZeroGrad) {
   ParameterStore ps;
-  auto t = ps.tensor({2, 3});
+  auto t = grad_tensor(ps, {2, 3});
   t.fill(5.0f);
   for (size_t i = 0; i < t.numel; ++i) {
     EXPECT_FLOAT_EQ(t.data()[i], 5.0f);
@@ -336,6 +856,361 @@ TEST(TensorOps, MatmulNon2D) {
   EXPECT_THROW(matmul(a, b, ps), std::invalid_argument);
 }
 
+TEST(Broadcast, RowVectorAddBackward) {
+  ParameterStore ps;
+  auto X = grad_tensor(ps, {2, 3});
+  auto b = grad_tensor(ps, {3});
+  fill_vec(X.data(), {1, 2, 3, 4, 5, 6});
+  fill_vec(b.data(), {10, 20, 30});
+  auto Y = add(X, b, ps);
+  ASSERT_EQ(Y.shape, (std::vector<int>{2, 3}));
+  EXPECT_FLOAT_EQ(Y.data()[4], 25.f);
+  auto W = ps.tensor({2, 3});
+  fill_vec(W.data(), {1, 2, 3, 4, 5, 6});
+  auto s = sum(mul(Y, W, ps), ps);
+  ps.zero_grad();
+  ps.backward(s);
+  for (int i = 0; i < 6; ++i) EXPECT_FLOAT_EQ(X.grad()[i], W.data()[i]);
+  // Column sums of the upstream gradient.
+  EXPECT_FLOAT_EQ(b.grad()[0], 5.f);
+  EXPECT_FLOAT_EQ(b.grad()[1], 7.f);
+  EXPECT_FLOAT_EQ(b.grad()[2], 9.f);
+}
+
+TEST(Broadcast, OuterProductMulBackward) {
+  ParameterStore ps;
+  auto a = grad_tensor(ps, {3, 1});
+  auto b = grad_tensor(ps, {1, 4});
+  fill_vec(a.data(), {1, 2, 3});
+  fill_vec(b.data(), {1, -1, 2, 0.5f});
+  auto y = mul(a, b, ps);
+  ASSERT_EQ(y.shape, (std::vector<int>{3, 4}));
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 4; ++j)
+      EXPECT_FLOAT_EQ(y.data()[i * 4 + j], a.data()[i] * b.data()[j]);
+  auto W = ps.tensor({3, 4});
+  for (int i = 0; i < 12; ++i) W.data()[i] = static_cast<float>(i);
+  auto s = sum(mul(y, W, ps), ps);
+  ps.zero_grad();
+  ps.backward(s);
+  // ga[i] = sum_j W[i,j] b[j]; gb[j] = sum_i W[i,j] a[i]
+  for (int i = 0; i < 3; ++i) {
+    float ref = 0.f;
+    for (int j = 0; j < 4; ++j) ref += W.data()[i * 4 + j] * b.data()[j];
+    EXPECT_FLOAT_EQ(a.grad()[i], ref);
+  }
+  for (int j = 0; j < 4; ++j) {
+    float ref = 0.f;
+    for (int i = 0; i < 3; ++i) ref += W.data()[i * 4 + j] * a.data()[i];
+    EXPECT_FLOAT_EQ(b.grad()[j], ref);
+  }
+}
+
+TEST(Broadcast, ScalarSubBothSides) {
+  ParameterStore ps;
+  auto x = grad_tensor(ps, {2, 2});
+  auto c = grad_tensor(ps, {1});
+  fill_vec(x.data(), {1, 2, 3, 4});
+  c.data()[0] = 10.f;
+  auto left = sub(c, x, ps);
+  auto right = sub(x, c, ps);
+  EXPECT_FLOAT_EQ(left.data()[3], 6.f);
+  EXPECT_FLOAT_EQ(right.data()[0], -9.f);
+  auto s = add(sum(left, ps), sum(mul(right, right, ps), ps), ps);
+  ps.zero_grad();
+  ps.backward(s);
+  // d/dx: -1 + 2 * (x - c); d/dc: 4 - 2 * sum(x - c)
+  for (int i = 0; i < 4; ++i)
+    EXPECT_FLOAT_EQ(x.grad()[i], -1.f + 2.f * (x.data()[i] - 10.f));
+  EXPECT_FLOAT_EQ(c.grad()[0], 4.f - 2.f * (1 + 2 + 3 + 4 - 40.f));
+}
+
+TEST(Broadcast, IncompatibleShapesThrow) {
+  ParameterStore ps;
+  auto a = ps.tensor({2, 3});
+  auto b = ps.tensor({2});
+  EXPECT_THROW(add(a, b, ps), std::invalid_argument);
+}
+
+TEST(TensorViews, TransposeAliasesStorage) {
+  ParameterStore ps;
+  auto t = ps.tensor({2, 3});
+  fill_vec(t.data(), {1, 2, 3, 4, 5, 6});
+  auto tt = transpose(t);
+  EXPECT_EQ(tt.shape, (std::vector<int>{3, 2}));
+  EXPECT_EQ(tt.strides, (std::vector<size_t>{1, 3}));
+  EXPECT_FALSE(tt.is_contiguous());
+  EXPECT_EQ(tt.data(), t.data());
+  // tt[2][1] == t[1][2]
+  EXPECT_FLOAT_EQ(tt.data()[2 * tt.strides[0] + 1 * tt.strides[1]], 6.f);
+  EXPECT_TRUE(ps.tape.empty());
+}
+
+TEST(TensorViews, MatmulTransposedViewsMatchDense) {
+  const int M = 3, K = 4, N = 5;
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  std::vector<float> a_vals(M * K), b_vals(K * N), w_vals(M * N);
+  for (auto& v : a_vals) v = dist(rng);
+  for (auto& v : b_vals) v = dist(rng);
+  for (auto& v : w_vals) v = dist(rng);
+
+  for (int ta = 0; ta < 2; ++ta) {
+    for (int tb = 0; tb < 2; ++tb) {
+      ParameterStore ps;
+      // Dense reference operands and the stored (possibly transposed) ones.
+      auto A = grad_tensor(ps, {M, K});
+      auto B = grad_tensor(ps, {K, N});
+      auto A_st = ta ? grad_tensor(ps, {K, M}) : grad_tensor(ps, {M, K});
+      auto B_st = tb ? grad_tensor(ps, {N, K}) : grad_tensor(ps, {K, N});
+      auto W = ps.tensor({M, N});
+      fill_vec(A.data(), a_vals);
+      fill_vec(B.data(), b_vals);
+      fill_vec(W.data(), w_vals);
+      for (int m = 0; m < M; ++m)
+        for (int k = 0; k < K; ++k)
+          A_st.data()[ta ? k * M + m : m * K + k] = a_vals[m * K + k];
+      for (int k = 0; k < K; ++k)
+        for (int n = 0; n < N; ++n)
+          B_st.data()[tb ? n * K + k : k * N + n] = b_vals[k * N + n];
+
+      auto a_view = ta ? transpose(A_st) : A_st;
+      auto b_view = tb ? transpose(B_st) : B_st;
+      auto C_ref = matmul(A, B, ps);
+      auto C = matmul(a_view, b_view, ps);
+      // Transposed operands go straight to GEMM: no copies on the tape.
+      for (size_t i = 0; i < ps.tape.size(); ++i)
+        EXPECT_NE(ps.tape[i].type, OpType::Contiguous);
+      auto loss = add(sum(mul(C_ref, W, ps), ps), sum(mul(C, W, ps), ps), ps);
+      ps.zero_grad();
+      ps.backward(loss);
+
+      for (int i = 0; i < M * N; ++i)
+        EXPECT_NEAR(C.data()[i], C_ref.data()[i], 1e-5f);
+      for (int m = 0; m < M; ++m)
+        for (int k = 0; k < K; ++k)
+          EXPECT_NEAR(A_st.grad()[ta ? k * M + m : m * K + k],
+                      A.grad()[m * K + k], 1e-5f)
+              << "ta=" << ta << " tb=" << tb;
+      for (int k = 0; k < K; ++k)
+        for (int n = 0; n < N; ++n)
+          EXPECT_NEAR(B_st.grad()[tb ? n * K + k : k * N + n],
+                      B.grad()[k * N + n], 1e-5f)
+              << "ta=" << ta << " tb=" << tb;
+    }
+  }
+}
+
+TEST(TensorViews, NarrowRowsFeedMatmul) {
+  ParameterStore ps;
+  auto X = grad_tensor(ps, {4, 2});
+  auto W = ps.tensor({2, 1});
+  fill_vec(X.data(), {1, 2, 3, 4, 5, 6, 7, 8});
+  fill_vec(W.data(), {1, 10});
+  auto rows = narrow(X, 0, 1, 2);
+  EXPECT_TRUE(rows.is_contiguous());
+  EXPECT_EQ(rows.offset, X.offset + 2);
+  auto y = matmul(rows, W, ps);
+  EXPECT_FLOAT_EQ(y.data()[0], 43.f);
+  EXPECT_FLOAT_EQ(y.data()[1], 65.f);
+  auto s = sum(y, ps);
+  ps.zero_grad();
+  ps.backward(s);
+  // Only the narrowed rows of the base receive gradient.
+  const std::vector<float> expected = {0, 0, 1, 10, 1, 10, 0, 0};
+  for (int i = 0; i < 8; ++i) EXPECT_FLOAT_EQ(X.grad()[i], expected[i]);
+}
+
+// Batched products against a loop of 2-D matmuls on views of each slice,
+// for every mix of batched, broadcast and transposed operands.
+TEST(BatchMatmul, MatchesPerSliceMatmul) {
+  const int B = 3, M = 4, K = 5, N = 6;
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  std::vector<float> a_vals(B * M * K), b_vals(B * K * N), w_vals(B * M * N);
+  for (auto& v : a_vals) v = dist(rng);
+  for (auto& v : b_vals) v = dist(rng);
+  for (auto& v : w_vals) v = dist(rng);
+
+  for (int batched = 1; batched < 4; ++batched) {
+    const bool a3 = batched & 1, b3 = batched & 2;
+    const int ba = a3 ? B : 1, bb = b3 ? B : 1;
+    for (int ta = 0; ta < 2; ++ta) {
+      for (int tb = 0; tb < 2; ++tb) {
+        ParameterStore ps;
+        // Stored operands hold each matrix transposed when ta / tb is set.
+        auto A_st = grad_tensor(ps, ta ? Shape{ba, K, M} : Shape{ba, M, K});
+        auto B_st = grad_tensor(ps, tb ? Shape{bb, N, K} : Shape{bb, K, N});
+        auto A_ref = grad_tensor(ps, {ba, M, K});
+        auto B_ref = grad_tensor(ps, {bb, K, N});
+        auto W = ps.tensor({B, M, N});
+        fill_vec(W.data(), w_vals);
+        for (int i = 0; i < ba; ++i)
+          for (int m = 0; m < M; ++m)
+            for (int k = 0; k < K; ++k) {
+              const float v = a_vals[(i * M + m) * K + k];
+              A_ref.data()[(i * M + m) * K + k] = v;
+              A_st.data()[ta ? (i * K + k) * M + m : (i * M + m) * K + k] = v;
+            }
+        for (int i = 0; i < bb; ++i)
+          for (int k = 0; k < K; ++k)
+            for (int n = 0; n < N; ++n) {
+              const float v = b_vals[(i * K + k) * N + n];
+              B_ref.data()[(i * K + k) * N + n] = v;
+              B_st.data()[tb ? (i * N + n) * K + k : (i * K + k) * N + n] = v;
+            }
+        // A 2-D operand is the single stored matrix, transposed as a 2-D view.
+        auto a_view = a3   ? (ta ? transpose(A_st, 1, 2) : A_st)
+                      : ta ? transpose(view(A_st, {K, M}))
+                           : view(A_st, {M, K});
+        auto b_view = b3   ? (tb ? transpose(B_st, 1, 2) : B_st)
+                      : tb ? transpose(view(B_st, {N, K}))
+                           : view(B_st, {K, N});
+        const size_t before = ps.tape.size();
+        auto C = matmul(a_view, b_view, ps);
+        ASSERT_EQ(C.shape, (Shape{B, M, N}));
+        ASSERT_EQ(ps.tape.size(), before + 1);
+        EXPECT_EQ(ps.tape[before].type, OpType::BatchMatmul);
+        Tensor loss = sum(mul(C, W, ps), ps);
+
+        for (int i = 0; i < B; ++i) {
+          auto Ai = view(narrow(A_ref, 0, a3 ? i : 0, 1), {M, K});
+          auto Bi = view(narrow(B_ref, 0, b3 ? i : 0, 1), {K, N});
+          auto Wi = view(narrow(W, 0, i, 1), {M, N});
+          auto Ci = matmul(Ai, Bi, ps);
+          for (int j = 0; j < M * N; ++j)
+            ASSERT_NEAR(C.data()[i * M * N + j], Ci.data()[j], 1e-5f)
+                << "a3=" << a3 << " b3=" << b3 << " ta=" << ta
+                << " tb=" << tb;
+          loss = add(loss, sum(mul(Ci, Wi, ps), ps), ps);
+        }
+        ps.zero_grad();
+        ps.backward(loss);
+
+        for (int i = 0; i < ba; ++i)
+          for (int m = 0; m < M; ++m)
+            for (int k = 0; k < K; ++k)
+              EXPECT_NEAR(
+                  A_st.grad()[ta ? (i * K + k) * M + m : (i * M + m) * K + k],
+                  A_ref.grad()[(i * M + m) * K + k], 1e-4f)
+                  << "a3=" << a3 << " b3=" << b3 << " ta=" << ta
+                  << " tb=" << tb;
+        for (int i = 0; i < bb; ++i)
+          for (int k = 0; k < K; ++k)
+            for (int n = 0; n < N; ++n)
+              EXPECT_NEAR(
+                  B_st.grad()[tb ? (i * N + n) * K + k : (i * K + k) * N + n],
+                  B_ref.grad()[(i * K + k) * N + n], 1e-4f)
+                  << "a3=" << a3 << " b3=" << b3 << " ta=" << ta
+                  << " tb=" << tb;
+      }
+    }
+  }
+}
+
+TEST(BatchMatmul, RejectsMismatchedShapes) {
+  ParameterStore ps;
+  EXPECT_THROW(matmul(ps.tensor({2, 3, 4}), ps.tensor({3, 4, 5}), ps),
+               std::invalid_argument);
+  EXPECT_THROW(matmul(ps.tensor({2, 3, 4}), ps.tensor({2, 5, 6}), ps),
+               std::invalid_argument);
+  EXPECT_THROW(matmul(ps.tensor({1, 2, 3, 4}), ps.tensor({4, 5}), ps),
+               std::invalid_argument);
+}
+
+// Attention-style scores q k^T / sqrt(d) with k read through a transposed
+// view, captured once and replayed on new inputs.
+TEST(BatchMatmul, ReplaysInCapturedGraph) {
+  const int B = 4, T = 8, D = 6;
+  const auto fill = [&](Tensor& q, Tensor& k, int step) {
+    for (size_t i = 0; i < q.numel; ++i)
+      q.data()[i] = 0.05f * static_cast<float>((i * 5 + step) % 17) - 0.4f;
+    for (size_t i = 0; i < k.numel; ++i)
+      k.data()[i] = 0.07f * static_cast<float>((i * 3 + step) % 11) - 0.3f;
+  };
+  const auto step_fn = [&](ParameterStore& ps, const Tensor& q,
+                           const Tensor& k, const Tensor& v) {
+    auto scores = matmul(q, transpose(k, 1, 2), ps);
+    auto ctx = matmul(sigmoid(scores, ps), v, ps);
+    return sum(mul(ctx, ctx, ps), ps);
+  };
+
+  ParameterStore eager_ps, graph_ps;
+  Tensor eager_q = grad_tensor(eager_ps, {B, T, D});
+  Tensor eager_k = grad_tensor(eager_ps, {B, T, D});
+  Tensor eager_v = eager_ps.parameter({T, D}, 0.5f, 5);
+  Tensor graph_q = grad_tensor(graph_ps, {B, T, D});
+  Tensor graph_k = grad_tensor(graph_ps, {B, T, D});
+  Tensor graph_v = graph_ps.parameter({T, D}, 0.5f, 5);
+  const StoreMark mark = eager_ps.mark();
+  Graph graph(graph_ps);
+  Tensor graph_loss;
+  for (int step = 0; step < 3; ++step) {
+    eager_ps.reset(mark);
+    eager_ps.clear_tape();
+    eager_ps.zero_grad();
+    fill(eager_q, eager_k, step);
+    Tensor eager_loss = step_fn(eager_ps, eager_q, eager_k, eager_v);
+    eager_ps.backward(eager_loss);
+
+    graph_ps.zero_grad();
+    fill(graph_q, graph_k, step);
+    if (!graph.captured()) {
+      graph_loss =
+          graph.capture([&] { return step_fn(graph_ps, graph_q, graph_k,
+                                             graph_v); });
+    } else {
+      graph.replay();
+    }
+    EXPECT_FLOAT_EQ(graph_loss.data()[0], eager_loss.data()[0]);
+    for (size_t i = 0; i < graph_q.numel; ++i) {
+      EXPECT_FLOAT_EQ(graph_q.grad()[i], eager_q.grad()[i]);
+      EXPECT_FLOAT_EQ(graph_k.grad()[i], eager_k.grad()[i]);
+    }
+    for (size_t i = 0; i < graph_v.numel; ++i)
+      EXPECT_FLOAT_EQ(graph_v.grad()[i], eager_v.grad()[i]);
+  }
+}
+
+TEST(TensorViews, StridedSliceBackward) {
+  ParameterStore ps;
+  auto x = grad_tensor(ps, {2, 5});
+  fill_vec(x.data(), {-1, 2, -3, 4, 5, 6, -7, 8, 9, -10});
+  // Columns 0, 2, 4 of each row.
+  auto cols = slice(x, 1, 0, 5, 2);
+  EXPECT_EQ(cols.shape, (std::vector<int>{2, 3}));
+  EXPECT_FALSE(cols.is_contiguous());
+  auto y = relu(cols, ps);
+  EXPECT_FLOAT_EQ(y.data()[0], 0.f);
+  EXPECT_FLOAT_EQ(y.data()[2], 5.f);
+  EXPECT_FLOAT_EQ(y.data()[3], 6.f);
+  EXPECT_FLOAT_EQ(y.data()[4], 8.f);
+  auto s = sum(y, ps);
+  ps.zero_grad();
+  ps.backward(s);
+  const std::vector<float> expected = {0, 0, 0, 0, 1, 1, 0, 1, 0, 0};
+  for (int i = 0; i < 10; ++i) EXPECT_FLOAT_EQ(x.grad()[i], expected[i]);
+}
+
+TEST(TensorViews, ViewAndReshape) {
+  ParameterStore ps;
+  auto x = grad_tensor(ps, {2, 3});
+  fill_vec(x.data(), {1, 2, 3, 4, 5, 6});
+  auto v = view(x, {3, -1});
+  EXPECT_EQ(v.shape, (std::vector<int>{3, 2}));
+  EXPECT_EQ(v.data(), x.data());
+  EXPECT_THROW(view(x, {4, -1}), std::invalid_argument);
+
+  auto t = transpose(x);
+  EXPECT_THROW(view(t, {6}), std::invalid_argument);
+  const size_t tape_before = ps.tape.size();
+  auto flat = reshape(t, {6}, ps);
+  EXPECT_EQ(ps.tape.size(), tape_before + 1);
+  const std::vector<float> expected = {1, 4, 2, 5, 3, 6};
+  for (int i = 0; i < 6; ++i) EXPECT_FLOAT_EQ(flat.data()[i], expected[i]);
+  EXPECT_THROW(narrow(x, 1, 2, 2), std::out_of_range);
+}
+
 TEST(Scheduler, ConstantLRScheduler) {
   ConstantLRScheduler sched(0.01f);
   EXPECT_FLOAT_EQ(sched.get(), 0.01f);
@@ -365,7 +1240,7 @@ TEST(Scheduler, StepLRSchedulerRejectsInvalidParameters) {
 
 TEST(Optimizer, AdamBasicStep) {
   ParameterStore ps;
-  auto param = ps.tensor({1}, TensorInit::ZeroData);
+  auto param = grad_tensor(ps, {1}, TensorInit::ZeroData);
   param.data()[0] = 1.0f;
   param.grad()[0] = 0.1f;
 
@@ -411,6 +1286,649 @@ TEST(NN, SequentialModel) {
   EXPECT_TRUE(output.data()[2] >= 0.0f);
 }
 
+TEST(NN, FusedLinearMatchesUnfusedOps) {
+  using kernels::Activation;
+  // 40x48x36 crosses the packed GEMM threshold so the tile epilogue runs.
+  const int N = 40, in = 48, out = 36;
+  for (Activation act : {Activation::None, Activation::Relu, Activation::Tanh,
+                         Activation::Sigmoid}) {
+    ParameterStore ps;
+    auto x = ps.parameter({N, in}, 1.0f, 1);
+    auto W = ps.parameter({in, out}, 0.3f, 2);
+    auto b = ps.parameter({out}, 0.5f, 3);
+    auto up = ps.parameter({N, out}, 1.0f, 4);
+
+    auto fused = linear(x, W, b, act, ps);
+    ASSERT_EQ(ps.tape.size(), 1u);
+    ps.backward(sum(mul(fused, up, ps), ps));
+    const std::vector<float> y(fused.data(), fused.data() + fused.numel);
+    const std::vector<float> gx(x.grad(), x.grad() + x.numel);
+    const std::vector<float> gW(W.grad(), W.grad() + W.numel);
+    const std::vector<float> gb(b.grad(), b.grad() + b.numel);
+
+    ps.zero_grad();
+    ps.clear_tape();
+    auto ref = add(matmul(x, W, ps), b, ps);
+    if (act == Activation::Relu) ref = relu(ref, ps);
+    if (act == Activation::Tanh) ref = vtanh(ref, ps);
+    if (act == Activation::Sigmoid) ref = sigmoid(ref, ps);
+    ps.backward(sum(mul(ref, up, ps), ps));
+
+    for (size_t i = 0; i < y.size(); ++i) {
+      ASSERT_NEAR(y[i], ref.data()[i], 1e-4f) << static_cast<int>(act);
+    }
+    for (size_t i = 0; i < gx.size(); ++i) {
+      ASSERT_NEAR(gx[i], x.grad()[i], 1e-4f) << static_cast<int>(act);
+    }
+    for (size_t i = 0; i < gW.size(); ++i) {
+      ASSERT_NEAR(gW[i], W.grad()[i], 1e-4f) << static_cast<int>(act);
+    }
+    for (size_t i = 0; i < gb.size(); ++i) {
+      ASSERT_NEAR(gb[i], b.grad()[i], 1e-4f) << static_cast<int>(act);
+    }
+  }
+}
+
+TEST(MixedPrecision, Bf16TensorsTakeHalfTheArena) {
+  ParameterStore ps;
+  auto a = ps.tensor({3, 5}, TensorInit::ZeroData, true, DType::BFloat16);
+  EXPECT_EQ(a.dtype, DType::BFloat16);
+  EXPECT_EQ(ps.size(), 8u);
+  EXPECT_EQ(ps.grad_size(), 15u);
+  auto b = ps.tensor({2});
+  EXPECT_EQ(b.offset, 8u);
+  a.fill(1.5f);
+  auto row = narrow(a, 0, 1, 1);
+  EXPECT_EQ(row.data_as<uint16_t>()[4], kernels::float_to_bf16(1.5f));
+  EXPECT_EQ(reinterpret_cast<const char*>(b.data()) -
+                reinterpret_cast<const char*>(a.raw_data()),
+            32);
+  ps.release(b);
+  ps.release(a);
+  EXPECT_EQ(ps.size(), 0u);
+}
+
+TEST(MixedPrecision, CastRoundTripsAndPassesGradient) {
+  ParameterStore ps;
+  auto x = ps.parameter({4, 3}, 1.0f, 7);
+  auto h = cast(transpose(x), DType::BFloat16, ps);
+  ASSERT_EQ(h.dtype, DType::BFloat16);
+  EXPECT_TRUE(h.is_contiguous());
+  auto y = cast(h, DType::Float32, ps);
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      const float v = x.data()[j * 3 + i];
+      EXPECT_NEAR(y.data()[i * 4 + j], v, std::fabs(v) / 256.0f);
+    }
+  }
+  EXPECT_EQ(cast(y, DType::Float32, ps).offset, y.offset);
+  // Element-wise ops widen bfloat16 inputs on their own.
+  auto up = ps.parameter({3, 4}, 1.0f, 8);
+  ps.backward(sum(mul(h, up, ps), ps));
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 4; ++j)
+      EXPECT_FLOAT_EQ(x.grad()[j * 3 + i], up.data()[i * 4 + j]);
+  }
+}
+
+TEST(MixedPrecision, AutocastLinearMatchesFloat32) {
+  using kernels::Activation;
+  // Large enough for the packed GEMM to widen bfloat16 while packing.
+  const int N = 40, in = 48, out = 36;
+  ParameterStore ps;
+  auto x = ps.parameter({N, in}, 1.0f, 1);
+  auto W = ps.parameter({in, out}, 0.3f, 2);
+  auto b = ps.parameter({out}, 0.5f, 3);
+  auto up = ps.parameter({N, out}, 1.0f, 4);
+
+  auto ref = linear(x, W, b, Activation::Tanh, ps);
+  ps.backward(sum(mul(ref, up, ps), ps));
+  const std::vector<float> y(ref.data(), ref.data() + ref.numel);
+  const std::vector<float> gx(x.grad(), x.grad() + x.numel);
+  const std::vector<float> gW(W.grad(), W.grad() + W.numel);
+
+  ps.zero_grad();
+  ps.clear_tape();
+  Tensor mixed;
+  {
+    AutocastGuard autocast(ps, DType::BFloat16);
+    mixed = linear(x, W, b, Activation::Tanh, ps);
+  }
+  EXPECT_EQ(ps.autocast, DType::Float32);
+  ASSERT_EQ(mixed.dtype, DType::BFloat16);
+  EXPECT_EQ(W.dtype, DType::Float32);
+  ps.backward(sum(mul(mixed, up, ps), ps));
+  const Tensor widened = cast(mixed, DType::Float32, ps);
+  for (size_t i = 0; i < y.size(); ++i)
+    ASSERT_NEAR(widened.data()[i], y[i], 2e-2f) << i;
+  for (size_t i = 0; i < gx.size(); ++i)
+    ASSERT_NEAR(x.grad()[i], gx[i], 5e-2f) << i;
+  for (size_t i = 0; i < gW.size(); ++i)
+    ASSERT_NEAR(W.grad()[i], gW[i], 5e-2f * (1.0f + std::fabs(gW[i]))) << i;
+}
+
+TEST(MixedPrecision, AutocastTrainingTracksFloat32) {
+  constexpr int kBatch = 64, kIn = 16, kHidden = 48, kClasses = 4;
+  // Linearly separable classes: the label is the block with the largest sum.
+  std::vector<float> inputs(kBatch * kIn);
+  std::vector<int32_t> labels(kBatch);
+  std::mt19937 rng(3);
+  std::normal_distribution<float> noise(0.0f, 1.0f);
+  for (int r = 0; r < kBatch; ++r) {
+    labels[r] = r % kClasses;
+    for (int c = 0; c < kIn; ++c) {
+      inputs[r * kIn + c] =
+          noise(rng) + (c / (kIn / kClasses) == labels[r] ? 1.5f : 0.0f);
+    }
+  }
+
+  const auto train = [&](DType dtype, float& loss_out) {
+    ParameterStore ps;
+    nn::Sequential model;
+    model.emplace_back<nn::Linear>(kIn, kHidden, ps, true, 0.3f, 1);
+    model.emplace_back<nn::Relu>();
+    model.emplace_back<nn::Linear>(kHidden, kClasses, ps, true, 0.3f, 2);
+    ConstantLRScheduler lr(0.01f);
+    optim::AdamW optimizer(model.params(), lr, 0.9f, 0.999f, 0.0f);
+    Tensor x = ps.tensor({kBatch, kIn});
+    std::copy(inputs.begin(), inputs.end(), x.data());
+    AutocastGuard autocast(ps, dtype);
+    Graph step(ps);
+    Tensor loss;
+    for (int i = 0; i < 60; ++i) {
+      optimizer.zero_grad();
+      if (step.captured()) {
+        step.replay();
+      } else {
+        loss = step.capture([&] {
+          return nn::cross_entropy_loss(model(x, ps), labels.data(), ps);
+        });
+      }
+      optimizer.step();
+    }
+    loss_out = loss.data()[0];
+    NoGradGuard no_grad(ps);
+    const Tensor logits = cast(model(x, ps), DType::Float32, ps);
+    int correct = 0;
+    for (int r = 0; r < kBatch; ++r) {
+      const float* row = logits.data() + r * kClasses;
+      correct += std::max_element(row, row + kClasses) - row == labels[r];
+    }
+    return correct;
+  };
+
+  float loss32 = 0.0f, loss16 = 0.0f;
+  const int correct32 = train(DType::Float32, loss32);
+  const int correct16 = train(DType::BFloat16, loss16);
+  EXPECT_GE(correct32, kBatch * 9 / 10);
+  EXPECT_LE(std::abs(correct16 - correct32), 2);
+  EXPECT_NEAR(loss16, loss32, 0.05f);
+}
+
+TEST(TypedTensors, IntegerTensorsAreSizedByElement) {
+  ParameterStore ps;
+  auto px = ps.tensor({3, 5}, TensorInit::ZeroData, false, DType::UInt8);
+  EXPECT_EQ(ps.size(), 4u);  // 15 bytes round up to 4 floats
+  auto ids = ps.tensor({3}, TensorInit::ZeroData, false, DType::Int32);
+  EXPECT_EQ(ps.size(), 7u);
+  EXPECT_EQ(ps.grad_size(), 0u);
+  EXPECT_THROW(ps.tensor({2}, TensorInit::ZeroData, true, DType::Int32),
+               std::invalid_argument);
+  px.fill(200.0f);
+  narrow(px, 0, 1, 1).fill(7.0f);
+  EXPECT_EQ(px.data_as<uint8_t>()[4], 200);
+  EXPECT_EQ(px.data_as<uint8_t>()[5], 7);
+  ids.fill(-3.0f);
+  EXPECT_EQ(ids.data_as<int32_t>()[2], -3);
+
+  // Integer <-> float casts, strided input, and bf16 via float32.
+  const Tensor f = cast(transpose(px), DType::Float32, ps);
+  EXPECT_EQ(f.shape, (Shape{5, 3}));
+  EXPECT_FLOAT_EQ(f.data()[0], 200.0f);
+  EXPECT_FLOAT_EQ(f.data()[1], 7.0f);
+  Tensor x = ps.tensor({2});
+  x.data()[0] = 2.9f;
+  x.data()[1] = -1.5f;
+  const Tensor i = cast(x, DType::Int32, ps);
+  EXPECT_EQ(i.data_as<int32_t>()[0], 2);
+  EXPECT_EQ(i.data_as<int32_t>()[1], -1);
+  const Tensor h = cast(ids, DType::BFloat16, ps);
+  EXPECT_EQ(h.data_as<uint16_t>()[0], kernels::float_to_bf16(-3.0f));
+  // Element-wise ops read integer inputs as float32.
+  EXPECT_FLOAT_EQ(add(f, f, ps).data()[0], 400.0f);
+}
+
+TEST(TypedTensors, Uint8LinearMatchesScaledFloat) {
+  ParameterStore ps;
+  std::mt19937 rng(11);
+  std::uniform_int_distribution<int> byte(0, 255);
+  // Below and above the packed GEMM threshold.
+  for (const auto& [M, K, N] : {std::array<int, 3>{3, 5, 4},
+                                std::array<int, 3>{40, 70, 33}}) {
+    auto W = ps.parameter({K, N}, 0.5f, 5);
+    auto b = ps.parameter({N}, 0.5f, 6);
+    auto px = ps.tensor({M, K}, TensorInit::UninitializedData, false,
+                        DType::UInt8);
+    auto x = ps.tensor({M, K});
+    for (int i = 0; i < M * K; ++i) {
+      px.data_as<uint8_t>()[i] = static_cast<uint8_t>(byte(rng));
+      x.data()[i] = px.data_as<uint8_t>()[i] / 255.0f;
+    }
+    const size_t tape = ps.tape.size();
+    const Tensor y8 = linear(px, W, b, kernels::Activation::Relu, ps,
+                             1.0f / 255.0f);
+    EXPECT_EQ(ps.tape.size(), tape + 1);  // no separate cast op
+    ps.backward(sum(y8, ps));
+    const std::vector<float> gW(W.grad(), W.grad() + W.numel);
+    const std::vector<float> gb(b.grad(), b.grad() + b.numel);
+    ps.zero_grad();
+    const Tensor y = linear(x, W, b, kernels::Activation::Relu, ps);
+    ps.backward(sum(y, ps));
+    for (size_t i = 0; i < y.numel; ++i)
+      ASSERT_NEAR(y8.data()[i], y.data()[i], 1e-4f) << i;
+    for (size_t i = 0; i < gW.size(); ++i)
+      ASSERT_NEAR(gW[i], W.grad()[i], 1e-4f) << i;
+    for (size_t i = 0; i < gb.size(); ++i)
+      ASSERT_NEAR(gb[i], b.grad()[i], 1e-4f) << i;
+    ps.zero_grad();
+    ps.clear_tape();
+  }
+}
+
+TEST(TypedTensors, IndexTensorsFeedEmbeddingAndLoss) {
+  ParameterStore ps;
+  nn::Embedding embed(6, 3, ps, 0.5f, 4);
+  auto tokens = ps.tensor({2, 3}, TensorInit::UninitializedData, false,
+                          DType::Int32);
+  const std::vector<int32_t> ids = {5, 0, 2, 2, 1, 4};
+  std::copy(ids.begin(), ids.end(), tokens.data_as<int32_t>());
+  const Tensor e = embed(tokens, ps);
+  const Tensor ref = embed(ids.data(), {2, 3}, ps);
+  ASSERT_EQ(e.shape, (Shape{2, 3, 3}));
+  for (size_t i = 0; i < e.numel; ++i)
+    EXPECT_FLOAT_EQ(e.data()[i], ref.data()[i]);
+  // Strided index views are made dense first.
+  const Tensor et = embed(transpose(tokens), ps);
+  EXPECT_FLOAT_EQ(et.data()[3], embed.W.data()[2 * 3]);  // ids[0][1] = 0
+  EXPECT_THROW(embed(ps.tensor({2}), ps), std::invalid_argument);
+
+  // Labels in the arena: a replayed graph reads the new contents.
+  auto logits = ps.parameter({4, 3}, 1.0f, 9);
+  auto labels = ps.tensor({4}, TensorInit::UninitializedData, false,
+                          DType::Int32);
+  std::vector<int32_t> y = {0, 2, 1, 1};
+  std::copy(y.begin(), y.end(), labels.data_as<int32_t>());
+  ps.clear_tape();
+  Graph step(ps);
+  const Tensor loss = step.capture(
+      [&] { return nn::cross_entropy_loss(logits, labels, ps); });
+  const float expected =
+      nn::cross_entropy_loss(logits, y.data(), ps).data()[0];
+  EXPECT_FLOAT_EQ(loss.data()[0], expected);
+  y = {2, 2, 0, 1};
+  std::copy(y.begin(), y.end(), labels.data_as<int32_t>());
+  step.replay();
+  {
+    NoGradGuard no_grad(ps);
+    EXPECT_FLOAT_EQ(loss.data()[0],
+                    softmax_cross_entropy(logits, y.data(), ps).data()[0]);
+  }
+  EXPECT_THROW(nn::cross_entropy_loss(logits, ps.tensor({4}), ps),
+               std::invalid_argument);
+
+  // Sampler fills the same windows into int32 tensors.
+  std::vector<int> text(40);
+  for (int i = 0; i < 40; ++i) text[i] = i;
+  Sampler sampler(2, 3, text, text);
+  Batch batch;
+  sampler.sample(batch);
+  auto xs = ps.tensor({2, 3}, TensorInit::UninitializedData, false,
+                      DType::Int32);
+  auto ys = ps.tensor({2, 3}, TensorInit::UninitializedData, false,
+                      DType::Int32);
+  sampler.sample(xs, ys);
+  for (int r = 0; r < 2; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      EXPECT_EQ(xs.data_as<int32_t>()[r * 3 + c], batch.first[r][c]);
+      EXPECT_EQ(ys.data_as<int32_t>()[r * 3 + c], batch.second[r][c]);
+    }
+  }
+}
+
+TEST(NN, SequentialFusesLinearActivationPairs) {
+  ParameterStore ps;
+  nn::Sequential model;
+  model.emplace_back<nn::Linear>(3, 5, ps);
+  model.emplace_back<nn::Tanh>();
+  model.emplace_back<nn::Linear>(5, 4, ps);
+  model.emplace_back<nn::Relu>();
+  model.emplace_back<nn::Linear>(4, 2, ps);
+  auto input = ps.tensor({2, 3}, TensorInit::ZeroData);
+  model(input, ps);
+  ASSERT_EQ(ps.tape.size(), 3u);
+  EXPECT_EQ(ps.tape[0].act, kernels::Activation::Tanh);
+  EXPECT_EQ(ps.tape[1].act, kernels::Activation::Relu);
+  EXPECT_EQ(ps.tape[2].act, kernels::Activation::None);
+  for (size_t i = 0; i < ps.tape.size(); ++i)
+    EXPECT_EQ(ps.tape[i].type, OpType::Linear);
+}
+
+TEST(NN, SequentialInferenceReusesActivations) {
+  constexpr int kBatch = 8, kWidth = 16, kDepth = 6;
+  ParameterStore ps;
+  nn::Sequential model;
+  for (int i = 0; i < kDepth; ++i) {
+    model.emplace_back<nn::Linear>(kWidth, kWidth, ps, true, 0.3f, i + 1);
+    model.emplace_back<nn::Tanh>();
+  }
+  auto input = ps.tensor({kBatch, kWidth});
+  for (size_t i = 0; i < input.numel; ++i)
+    input.data()[i] = 0.1f * static_cast<float>(i % 7);
+  const size_t act = static_cast<size_t>(kBatch) * kWidth;
+
+  const StoreMark mark = ps.mark();
+  Tensor trained = model(input, ps);
+  // Every layer input is saved for backward.
+  EXPECT_EQ(ps.size() - mark.data, kDepth * act);
+  const std::vector<float> expected(trained.data(),
+                                    trained.data() + trained.numel);
+  ps.clear_tape();
+  ps.reset(mark);
+
+  NoGradGuard no_grad(ps);
+  Tensor out = model(input, ps);
+  EXPECT_LE(ps.size() - mark.data, 2 * act);
+  for (size_t i = 0; i < expected.size(); ++i)
+    EXPECT_FLOAT_EQ(out.data()[i], expected[i]);
+}
+
+TEST(NN, QuantizeDynamicTracksFloat32Model) {
+  constexpr int kBatch = 24, kIn = 70, kHidden = 33, kOut = 10;
+  ParameterStore ps;
+  nn::Sequential model;
+  model.emplace_back<nn::Linear>(kIn, kHidden, ps, true, 0.3f, 1);
+  model.emplace_back<nn::Relu>();
+  model.emplace_back<nn::Linear>(kHidden, kOut, ps, true, 0.3f, 2);
+  auto input = ps.tensor({kBatch, kIn});
+  for (size_t i = 0; i < input.numel; ++i)
+    input.data()[i] = 0.05f * static_cast<float>(static_cast<int>(i % 13) - 6);
+
+  NoGradGuard no_grad(ps);
+  const Tensor ref = model(input, ps);
+  const std::vector<float> expected(ref.data(), ref.data() + ref.numel);
+  float range = 0.0f;
+  for (float v : expected) range = std::max(range, std::fabs(v));
+
+  EXPECT_EQ(nn::quantize_dynamic(model), 2u);
+  EXPECT_TRUE(model.params().empty());
+  const size_t ops = ps.tape.size();
+  const Tensor out = model(input, ps);
+  EXPECT_EQ(ps.tape.size(), ops);
+  EXPECT_FALSE(out.requires_grad());
+  ASSERT_EQ(out.shape, ref.shape);
+  for (size_t i = 0; i < expected.size(); ++i)
+    EXPECT_NEAR(out.data()[i], expected[i], 0.02f * range) << i;
+}
+
+TEST(NN, LinearS8RejectsGradInputs) {
+  ParameterStore ps;
+  auto x = ps.parameter({2, 4}, 1.0f, 1);
+  auto W = ps.parameter({4, 3}, 1.0f, 2);
+  const QuantizedMatrix q = quantize_per_channel(W);
+  EXPECT_EQ(q.rows, 3);
+  EXPECT_EQ(q.cols, 4);
+  EXPECT_THROW(linear_s8(x, q, Tensor{}, kernels::Activation::None, ps),
+               std::logic_error);
+  NoGradGuard no_grad(ps);
+  EXPECT_NO_THROW(linear_s8(x, q, Tensor{}, kernels::Activation::None, ps));
+}
+
+TEST(NN, CheckpointedSequentialMatchesPlainGradients) {
+  constexpr int kBatch = 8, kWidth = 16, kDepth = 6, kClasses = 4;
+  const auto build = [&](ParameterStore& ps, nn::Sequential& model) {
+    for (int i = 0; i < kDepth; ++i) {
+      model.emplace_back<nn::Linear>(kWidth, kWidth, ps, true, 0.3f, i + 1);
+      model.emplace_back<nn::Tanh>();
+    }
+    model.emplace_back<nn::Linear>(kWidth, kClasses, ps, true, 0.3f, 99);
+  };
+  const std::vector<int32_t> labels = {0, 1, 2, 3, 3, 2, 1, 0};
+  const auto step = [&](ParameterStore& ps, nn::Sequential& model) {
+    auto x = ps.tensor({kBatch, kWidth});
+    for (size_t i = 0; i < x.numel; ++i)
+      x.data()[i] = 0.05f * static_cast<float>(i % 11);
+    const StoreMark mark = ps.mark();
+    Tensor logits = model(x, ps);
+    const size_t kept = ps.size() - mark.data;
+    ps.backward(nn::cross_entropy_loss(logits, labels.data(), ps));
+    return kept;
+  };
+
+  ParameterStore plain_ps;
+  nn::Sequential plain;
+  build(plain_ps, plain);
+  const size_t plain_kept = step(plain_ps, plain);
+
+  // Two Linear + Tanh pairs per segment, or about two activations' worth.
+  const size_t budget = 2 * kBatch * kWidth;
+  for (const nn::CheckpointPolicy policy :
+       {nn::CheckpointPolicy{4, 0}, nn::CheckpointPolicy{0, budget}}) {
+    ParameterStore ps;
+    nn::Sequential model;
+    build(ps, model);
+    model.checkpoint = policy;
+    EXPECT_LT(step(ps, model), plain_kept);
+    EXPECT_LT(ps.tape.size(), plain_ps.tape.size());
+    auto expected = plain.params();
+    auto actual = model.params();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t p = 0; p < actual.size(); ++p) {
+      for (size_t i = 0; i < actual[p].numel; ++i)
+        EXPECT_FLOAT_EQ(actual[p].grad()[i], expected[p].grad()[i]);
+    }
+  }
+}
+
+TEST(Graph, ReplayMatchesEagerSteps) {
+  constexpr int kBatch = 6, kIn = 5, kHidden = 12, kClasses = 3;
+  const auto build = [&](ParameterStore& ps, nn::Sequential& model) {
+    model.emplace_back<nn::Linear>(kIn, kHidden, ps, true, 0.4f, 1);
+    model.emplace_back<nn::Tanh>();
+    model.emplace_back<nn::Linear>(kHidden, kHidden, ps, true, 0.4f, 2);
+    model.emplace_back<nn::Relu>();
+    model.emplace_back<nn::Linear>(kHidden, kClasses, ps, true, 0.4f, 3);
+  };
+  const auto fill_batch = [&](Tensor& x, std::vector<int32_t>& labels,
+                              int step) {
+    for (size_t i = 0; i < x.numel; ++i)
+      x.data()[i] = 0.1f * static_cast<float>((i * 7 + step * 3) % 13) - 0.6f;
+    for (int r = 0; r < kBatch; ++r) labels[r] = (r + step) % kClasses;
+  };
+
+  for (const size_t every : {size_t{0}, size_t{2}}) {
+    ParameterStore eager_ps, graph_ps;
+    nn::Sequential eager, replayed;
+    build(eager_ps, eager);
+    build(graph_ps, replayed);
+    replayed.checkpoint.every = every;
+    Tensor eager_x = eager_ps.tensor({kBatch, kIn});
+    Tensor graph_x = graph_ps.tensor({kBatch, kIn});
+    std::vector<int32_t> eager_labels(kBatch), graph_labels(kBatch);
+    const StoreMark mark = eager_ps.mark();
+
+    Graph graph(graph_ps);
+    Tensor graph_loss;
+    for (int step = 0; step < 3; ++step) {
+      eager_ps.reset(mark);
+      eager_ps.clear_tape();
+      eager_ps.zero_grad();
+      fill_batch(eager_x, eager_labels, step);
+      Tensor eager_loss = nn::cross_entropy_loss(eager(eager_x, eager_ps),
+                                                 eager_labels.data(), eager_ps);
+      eager_ps.backward(eager_loss);
+
+      graph_ps.zero_grad();
+      fill_batch(graph_x, graph_labels, step);
+      if (!graph.captured()) {
+        graph_loss = graph.capture([&] {
+          return nn::cross_entropy_loss(replayed(graph_x, graph_ps),
+                                        graph_labels.data(), graph_ps);
+        });
+        EXPECT_TRUE(graph_ps.tape.empty());
+      } else {
+        const size_t used = graph_ps.size();
+        graph.replay();
+        EXPECT_EQ(graph_ps.size(), used);
+      }
+
+      EXPECT_FLOAT_EQ(graph_loss.data()[0], eager_loss.data()[0]);
+      auto expected = eager.params();
+      auto actual = replayed.params();
+      for (size_t p = 0; p < actual.size(); ++p) {
+        for (size_t i = 0; i < actual[p].numel; ++i)
+          EXPECT_FLOAT_EQ(actual[p].grad()[i], expected[p].grad()[i]);
+      }
+    }
+    EXPECT_GT(graph.forward_ops(), 0u);
+    EXPECT_GT(graph.backward_ops(), 0u);
+  }
+}
+
+TEST(Graph, OptimizeFusesChainsAndDropsRepeats) {
+  // Three tiles' worth, so the fused loops run more than once.
+  constexpr int kN = 5000;
+  const auto step = [](ParameterStore& ps, const Tensor& p, const Tensor& x,
+                       const Tensor& ones) {
+    Tensor d1 = sub(ones, x, ps);
+    Tensor d2 = sub(ones, x, ps);  // repeat of d1
+    Tensor y = mul(d1, relu(p, ps), ps);
+    Tensor z = mul(d2, vlog(sigmoid(p, ps), ps), ps);
+    return sum(vtanh(add(y, z, ps), ps), ps);
+  };
+  const auto fill = [](Tensor& t, float scale, int round) {
+    for (size_t i = 0; i < t.numel; ++i)
+      t.data()[i] = scale * (static_cast<float>((i * 37 + round) % 101) - 50);
+  };
+
+  ParameterStore plain_ps, fused_ps;
+  Graph plain(plain_ps), fused(fused_ps);
+  Tensor losses[2];
+  Tensor params[2];
+  Tensor inputs[2];
+  ParameterStore* stores[2] = {&plain_ps, &fused_ps};
+  Graph* graphs[2] = {&plain, &fused};
+  for (int g = 0; g < 2; ++g) {
+    ParameterStore& ps = *stores[g];
+    params[g] = ps.parameter({kN});
+    inputs[g] = ps.tensor({kN});
+    Tensor ones = ps.tensor({kN});
+    ones.fill(1.0f);
+    fill(params[g], 0.02f, 0);
+    fill(inputs[g], 0.01f, 1);
+    losses[g] = graphs[g]->capture(
+        [&] { return step(ps, params[g], inputs[g], ones); });
+  }
+  const size_t ops = fused.forward_ops();
+  fused.optimize();
+  EXPECT_EQ(fused.forward_ops(), ops - 1);
+  EXPECT_LT(fused.forward_groups(), fused.forward_ops());
+  EXPECT_LT(fused.backward_groups(), fused.backward_ops());
+
+  for (int round = 2; round < 5; ++round) {
+    for (int g = 0; g < 2; ++g) {
+      fill(params[g], 0.02f, round);
+      fill(inputs[g], 0.01f, round + 1);
+      stores[g]->zero_grad();
+      graphs[g]->replay();
+    }
+    EXPECT_NEAR(losses[1].data()[0], losses[0].data()[0],
+                1e-4f * std::fabs(losses[0].data()[0]));
+    for (int i = 0; i < kN; ++i)
+      EXPECT_NEAR(params[1].grad()[i], params[0].grad()[i], 1e-5f);
+  }
+}
+
+TEST(Expr, FusedExpressionMatchesChainedOps) {
+  ParameterStore ps;
+  Tensor a = ps.parameter({4, 5}, 0.5f, 1);
+  Tensor b = ps.parameter({4, 5}, 0.5f, 2);
+  Tensor c = ps.parameter({4, 5}, 0.5f, 3);
+  Tensor ones = ps.tensor({4, 5});
+  ones.fill(1.0f);
+
+  std::vector<float> chained[3];
+  Tensor chained_loss = sum(
+      add(sub(mul(sigmoid(a, ps), b, ps), vtanh(a, ps), ps),
+          vlog(add(mul(c, c, ps), ones, ps), ps), ps),
+      ps);
+  ps.backward(chained_loss);
+  Tensor params[3] = {a, b, c};
+  for (int k = 0; k < 3; ++k) {
+    chained[k].assign(params[k].grad(), params[k].grad() + 20);
+    params[k].zero_grad();
+  }
+  ps.clear_tape();
+
+  const auto x = expr::ref(a), y = expr::ref(b), z = expr::ref(c);
+  Tensor out = expr::eval(sigmoid(x) * y - tanh(x) + log(z * z + 1.0f), ps);
+  EXPECT_EQ(out.shape, (std::vector<int>{4, 5}));
+  Tensor loss = sum(out, ps);
+  EXPECT_EQ(ps.tape.size(), 2u);
+  ps.backward(loss);
+  EXPECT_NEAR(loss.data()[0], chained_loss.data()[0], 1e-5f);
+  for (int k = 0; k < 3; ++k) {
+    for (int i = 0; i < 20; ++i)
+      EXPECT_NEAR(params[k].grad()[i], chained[k][i], 1e-5f);
+  }
+
+  // A tensor read twice accumulates both paths into its gradient.
+  a.zero_grad();
+  ps.clear_tape();
+  Tensor sq = expr::mean((x - 0.5f) * (x - 0.5f), ps);
+  ps.backward(sq);
+  float expected = 0.0f;
+  for (int i = 0; i < 20; ++i) {
+    const float d = a.data()[i] - 0.5f;
+    expected += d * d / 20.0f;
+    EXPECT_NEAR(a.grad()[i], 2.0f * d / 20.0f, 1e-6f);
+  }
+  EXPECT_NEAR(sq.data()[0], expected, 1e-5f);
+
+  Tensor wrong = ps.tensor({5, 4});
+  Tensor d = ps.tensor({4, 5});
+  EXPECT_THROW(expr::eval(x + expr::ref(wrong), ps), std::invalid_argument);
+  EXPECT_THROW(expr::eval(x + y + z + expr::ref(d), ps),
+               std::invalid_argument);
+}
+
+TEST(Expr, MeanSquaredErrorReplaysInCapturedGraph) {
+  ParameterStore ps;
+  Tensor p = ps.parameter({3, 4}, 0.5f, 4);
+  Tensor y = ps.tensor({4, 3});
+  for (int i = 0; i < 12; ++i) y.data()[i] = 0.1f * static_cast<float>(i);
+  const Tensor yt = transpose(y, 0, 1);  // strided: copied before the loop
+
+  Graph graph(ps);
+  Tensor loss = graph.capture([&] {
+    const auto pe = expr::ref(p), ye = expr::ref(yt);
+    return expr::mean((pe - ye) * (pe - ye), ps);
+  });
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < 12; ++i) y.data()[i] += 0.25f;
+    ps.zero_grad();
+    graph.replay();
+    float expected = 0.0f;
+    for (int r = 0; r < 3; ++r) {
+      for (int col = 0; col < 4; ++col) {
+        const float diff = p.data()[r * 4 + col] - y.data()[col * 3 + r];
+        expected += diff * diff / 12.0f;
+        EXPECT_NEAR(p.grad()[r * 4 + col], 2.0f * diff / 12.0f, 1e-6f);
+      }
+    }
+    EXPECT_NEAR(loss.data()[0], expected, 1e-5f);
+  }
+}
+
 TEST(NN, LinearDeterministicDefaultSeed) {
   ParameterStore ps1;
   ParameterStore ps2;